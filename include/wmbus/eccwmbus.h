@@ -28,6 +28,7 @@
 #define LOGTOVZ  1
 #define LOGTOXML 2
 #define LOGTODAT 3
+#define LOGTOHST 4
 
 
 //show Information
@@ -0,0 +1,69 @@
+#ifndef LIBECCWMBUS_H
+#define LIBECCWMBUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+
+// libeccwmbus: the wM-Bus stick driver for other programs
+//
+// Built as libeccwmbus.a and libeccwmbus.so, link with -lpthread -ldl, the
+// iM871A needs libwmbus.so of IMST in the working directory as for eccwmbus.
+// The stick is opened with wMBusLib_Open, meters are registered by slot and
+// every reading is handed to the callback from the receiving thread:
+//
+//   static void OnReading(void *ctx, const ecwMBUSLibReading *r) {
+//       printf("%08X %u %d\n", r->meter->ident, r->data->value, r->data->exp);
+//   }
+//
+//   pecwMBUSLib lib;
+//   if(APIOK == wMBusLib_Open(&lib, "/dev/ttyUSB0", 0, RADIOT2)) {
+//       wMBusLib_SetCallback(lib, OnReading, NULL, 0);
+//       wMBusLib_AddMeter(lib, 0, &meter);
+//       ...
+//       wMBusLib_Close(lib);
+//   }
+//
+// The reading points into the driver, nothing is copied for the callback: the
+// decoded values, the meter and the frame as received are valid until the
+// callback returns. Copy what is kept and return quickly, the next frame is
+// read after the callback. wMBusLib_SetCallback waits for a callback that is
+// running, so it must not be called from the callback. The driver state is
+// global, so there is one open stick per process.
+//
+// wMBusLib_RemoveMeter only stops the readings of the slot, the AES key of
+// the meter stays programmed in the stick until wMBusLib_AddMeter puts
+// another meter into the slot.
+
+#define WMBUSLIB_ALLFRAMES  0x01        // also frames of meters that are not registered
+
+typedef struct _WMBUS_LIB_READING {
+    int                 slot;           // -1 for a meter that is not registered
+    const ecwMBUSMeter *meter;          // registered meter or the sender of the frame, no key then
+    const ecMBUSData   *data;
+    const uint8_t      *frame;          // L-field and the frame bytes from the stick
+    int                 frameLength;
+} ecwMBUSLibReading, *pecwMBUSLibReading;
+
+typedef struct _WMBUS_LIB_COUNTERS {
+    uint64_t framesRead;
+    uint64_t framesDecoded;
+    uint64_t readings;                  // readings of registered meters
+} ecwMBUSLibCounters, *pecwMBUSLibCounters;
+
+typedef void (*wMBusLib_ReadingCallback)(void *ctx, const ecwMBUSLibReading *reading);
+
+typedef struct _WMBUS_LIB ecwMBUSLib, *pecwMBUSLib;
+
+int      wMBusLib_Open(pecwMBUSLib *lib, const char *device, uint16_t stick, int mode); //stick 0 tries iM871A and AMBER
+int      wMBusLib_SetCallback(pecwMBUSLib lib, wMBusLib_ReadingCallback callback, void *ctx, int flags);
+int      wMBusLib_AddMeter(pecwMBUSLib lib, int slot, const ecwMBUSMeter *meter);
+int      wMBusLib_RemoveMeter(pecwMBUSLib lib, int slot);
+int      wMBusLib_SetMode(pecwMBUSLib lib, int mode);
+uint16_t wMBusLib_GetStick(pecwMBUSLib lib);
+int      wMBusLib_GetStickCounters(pecwMBUSLib lib, pecwMBUSStickCounters counters);
+void     wMBusLib_GetCounters(pecwMBUSLib lib, pecwMBUSLibCounters counters);
+void     wMBusLib_Close(pecwMBUSLib lib);
+
+#endif
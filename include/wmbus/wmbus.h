@@ -17,6 +17,9 @@
 #define OFFSETCONFIGWORD    12
 #define OFFSETDECRYPTFILLER 14
 
+//header, L-field and the largest frame with timestamp and RSSI; the rest of a read buffer is never looked at
+#define FRAME_DECODEWINDOW  (OFFSETPAYLOAD+255+5+9)
+
 //wM-Bus data defines
 #define APL_VIF_UNITCODE                        0x78U
 #define APL_VIF_ENERGY_WH                       0x00U
@@ -75,30 +78,4 @@
 //Settings
 #define DATA_WITH_BLOCK1         0x20
 
-//Amber commands
-
-uint8_t CMD_SERIALNO_REQ_Arr[]              ={0xFF, 0x0B, 0x00, 0xF4}; //GetSerial
-uint8_t SET_BLOCK1_ADD_ENABLE_REQ[]         ={0xFF, 0x09, 0x03, 0x30, 0x01, 0x00};
-
-//CMD_SET_REQ
-uint8_t SET_RSSI_ENABLE_REQ_Arr[]           ={0xFF, 0x09, 0x03, 0x45, 0x01, 0x01, 0xB0};
-uint8_t SET_RSSI_DISABLE_REQ_Arr[]          ={0xFF, 0x09, 0x03, 0x45, 0x01, 0x00, 0xB1};
-uint8_t SET_AES_ENABLE_REQ_Arr[]            ={0xFF, 0x09, 0x03, 0x0B, 0x01, 0x01, 0xFE};
-uint8_t SET_AES_DISABLE_REQ_Arr[]           ={0xFF, 0x09, 0x03, 0x0B, 0x01, 0x00, 0xFF};
-
-//CMD_GET_REQ
-uint8_t CMD_GET_REQ_RSSI_ENABLED_Arr[]      ={0xFF, 0x0A, 0x02, 0x45, 0x01, 0xB3};
-uint8_t CMD_GET_REQ_MODE_Arr[]              ={0xFF, 0x0A, 0x02, 0x46, 0x01, 0xB0};
-
-
-uint8_t CMD_GET_AES_DEV_REQ_Arr0[]          ={0xFF, 0x52, 0x01, 0x00, 0xAC}; //Bank1...16 Devices
-uint8_t CMD_GET_AES_DEV_REQ_Arr1[]          ={0xFF, 0x52, 0x01, 0x01, 0xAD}; //Bank2
-uint8_t CMD_GET_AES_DEV_REQ_Arr2[]          ={0xFF, 0x52, 0x01, 0x02, 0xAE}; //Bank3
-uint8_t CMD_GET_AES_DEV_REQ_Arr3[]          ={0xFF, 0x52, 0x01, 0x03, 0xAF}; //Bank4
-uint8_t CMD_CLR_AES_KEY_REQ_Arr[]           ={0xFF, 0x51, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB};
-uint8_t CMD_SET_MODE_REQ_ArrT2S2[]          ={0xFF, 0x04, 0x01, 0x00, 0x00};
-uint8_t CMD_SET_MODE_REQ_ArrT2S2_PRESELECT[]={0xFF, 0x09, 0x03, 0x46, 0x01, 0x08, 0xBA};
-
-uint8_t CMD_SET_AES_KEY_REQ_Arr[]           ={0xFF, 0x50, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
 #endif
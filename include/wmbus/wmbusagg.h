@@ -0,0 +1,100 @@
+#ifndef WMBUSAGG_H
+#define WMBUSAGG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusfwd.h>
+
+// Aggregator: receives the readings of the forwarders (wmbusfwd) and of the
+// local stick and hands every telegram on once
+//
+// Gateways with overlapping coverage hear the same telegram. A telegram is
+// identified by meter, access number and status byte of the frame header,
+// which are the same whether a gateway could decrypt the payload or not,
+// and by its reception time within AGG_SKEW seconds. The first copy opens
+// a window of AGG_WINDOW ms in which the copies of the other gateways are
+// collected, the copy with the best RSSI is handed to the reading handler
+// when the window closes; a copy decoded by its gateway
+// beats a raw one (FWD_UNREGISTERED) whatever the RSSI. Copies arriving
+// later, e.g. resent by a forwarder after a reconnect, are counted as
+// duplicates and dropped as long as the telegram is remembered
+// (AGG_SEENSIZE telegrams, AGG_RETAIN ms).
+// The handler is called from the aggregator thread in the order the first
+// copies arrived, gateway is the id of the gateway with the best copy and
+// flags are the record flags of that copy.
+
+#define AGG_WINDOW          250         // ms
+#define AGG_RETAIN          600000      // ms
+#define AGG_SKEW            10          // s, reception times of two copies, clocks and resends after a reconnect
+#define AGG_SEENSIZE        65536       // telegrams remembered, power of 2
+#define AGG_BUCKETS         65536       // power of 2
+#define AGG_MAXPENDING      8192        // telegrams in their window, power of 2
+#define AGG_MAXGATEWAYS     32
+#define AGG_MAXCONN         32
+#define AGG_INSIZE          (64*1024)
+#define AGG_LOCAL           "local"     // gateway id of the local stick
+
+typedef void (*Agg_ReadingHandler)(void *ctx, const char *gateway, int flags, const ecwMBUSMeter *meter, const ecMBUSData *data);
+
+typedef struct _WMBUS_AGG_GATEWAY {
+    char          id[FWD_MAXID + 1];
+    int           connections;
+    unsigned long readings;
+    unsigned long duplicates;           // copies of a telegram already seen
+    unsigned long best;                 // copies handed on
+    unsigned long errors;               // connections closed on a protocol error
+} ecwMBUSAggGateway, *pecwMBUSAggGateway;
+
+typedef struct _WMBUS_AGG_CONN {
+    int      fd;
+    int      gateway;                   // -1 until the hello is read
+    uint8_t *in;
+    size_t   inLen;
+} ecwMBUSAggConn, *pecwMBUSAggConn;
+
+typedef struct _WMBUS_AGG_SEEN {
+    uint64_t key;
+    uint64_t firstUs;
+    uint32_t time;                      // reception time of the first copy
+    uint64_t next;                      // older telegram in the same bucket, 0 for none
+} ecwMBUSAggSeen;
+
+typedef struct _WMBUS_AGG_PENDING {
+    int          gateway;
+    int          flags;
+    ecwMBUSMeter meter;
+    ecMBUSData   data;
+} ecwMBUSAggPending;
+
+typedef struct _WMBUS_AGG {
+    int                listenFd;
+    int                wake[2];
+    Agg_ReadingHandler handler;
+    void              *ctx;
+    uint64_t           windowUs;
+    ecwMBUSAggConn     conns[AGG_MAXCONN];
+    int                connCount;
+    ecwMBUSAggGateway  gateways[AGG_MAXGATEWAYS];
+    int                gatewayCount;
+    ecwMBUSAggSeen    *seen;            // ring, indexed by seq
+    uint64_t          *buckets;         // newest seq per hash bucket
+    ecwMBUSAggPending *pending;         // seq emitSeq up to nextSeq
+    uint64_t           nextSeq;         // starts with 1
+    uint64_t           emitSeq;
+    unsigned long      unique;
+    unsigned long      early;           // handed on before the window closed, too many pending
+    unsigned long      rejected;        // no room for another gateway or connection
+    unsigned long      dropped;         // local readings, too many pending
+    bool               stop;
+    pthread_t          thread;
+    pthread_mutex_t    lock;
+} ecwMBUSAgg, *pecwMBUSAgg;
+
+int  Agg_Open(pecwMBUSAgg agg, const char *spec, int windowMs, Agg_ReadingHandler handler, void *ctx);
+void Agg_Submit(pecwMBUSAgg agg, const ecwMBUSMeter *meter, const ecMBUSData *data);
+void Agg_PrintStats(pecwMBUSAgg agg);
+void Agg_Close(pecwMBUSAgg agg);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef WMBUSCONF_H
+#define WMBUSCONF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <wmbus/eccwmbus.h>
+
+// Configuration file: the command line options and the meter list for an
+// unattended gateway (eccwmbus -c <file>)
+//
+// One setting per line as key = value, # starts a comment. Every key stands
+// for a command line option and is turned into it, so the file and the
+// command line mean the same; options given on the command line win.
+//
+//   port     = 0                      # -p, /dev/ttyUSB0 or a device path
+//   mode     = T                      # -m, S or T
+//   datapath = /home/pi/data/wmbus    # -f
+//   journal  = /home/pi/data/wmbus/journal
+//   daemon   = yes                    # -D
+//   meter    = 18c4 12345678 02 01 default
+//
+// A meter is manufacturer, ident, type and version in hex as eccwmbus-ctl
+// lists them and the key: 32 hex digits, default or zero (default if
+// omitted). The meters of the file replace meters.db, slot n is the n-th
+// meter line at the start. eccwmbus reads the meters again when the file
+// changes or on SIGHUP, the other settings need a restart.
+
+#define CONF_MAXLINE        512
+#define CONF_MAXOPTIONS     48
+
+typedef struct _WMBUS_CONF {
+    int          argc;
+    char        *argv[2*CONF_MAXOPTIONS + 2]; // program name and the options as on the command line, NULL terminated
+    ecwMBUSMeter meters[MAXMETER];
+    int          meterCount;
+} ecwMBUSConf, *pecwMBUSConf;
+
+int  Conf_Load(pecwMBUSConf conf, const char *path, const char *prog);
+void Conf_Free(pecwMBUSConf conf);
+
+//manid ident type version [key|default|zero]; APIERROR with the reason in err
+int  Conf_ParseMeter(int argc, char *argv[], pecwMBUSMeter meter, char *err, size_t errSize);
+
+#endif
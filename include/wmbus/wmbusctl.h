@@ -0,0 +1,62 @@
+#ifndef WMBUSCTL_H
+#define WMBUSCTL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <wmbus/eccwmbus.h>
+
+// Control socket: request/response protocol on a Unix socket
+//
+// request  : one line, command and arguments separated by blanks
+// response : "OK" or "ERR <message>", the result lines, an empty line
+//
+// Requests are served by Ctl_Poll from the thread that calls it, eccwmbus
+// calls it from its main loop so the handler may use the stick and the meter
+// list without locking. Ctl_GetFd is readable whenever Ctl_Poll has work, an
+// event loop waits on it and calls Ctl_Poll with timeout 0. eccwmbus-ctl is
+// the command line client.
+
+#define CTL_DEFAULTPATH     "/tmp/eccwmbus.ctl"
+#define CTL_MAXCLIENTS      16
+#define CTL_MAXREQUEST      512
+#define CTL_MAXARGS         16
+#define CTL_MAXREPLY        (64*1024)
+
+typedef struct _WMBUS_CTL_REPLY {
+    char   *buf;
+    size_t  len;
+    size_t  size;
+} ecwMBUSCtlReply, *pecwMBUSCtlReply;
+
+//returns APIOK, or APIERROR with the message in reply
+typedef int (*Ctl_Handler)(void *ctx, int argc, char *argv[], pecwMBUSCtlReply reply);
+
+typedef struct _WMBUS_CTL_CLIENT {
+    int     fd;
+    char    in[CTL_MAXREQUEST];
+    size_t  inLen;
+    char   *out;                    // response being sent
+    size_t  outLen;
+    size_t  outPos;
+} ecwMBUSCtlClient, *pecwMBUSCtlClient;
+
+typedef struct _WMBUS_CTL {
+    int              fd;
+    int              epfd;              // listener and clients, for Ctl_GetFd
+    char             path[_MAX_PATH];
+    Ctl_Handler      handler;
+    void            *ctx;
+    ecwMBUSCtlClient clients[CTL_MAXCLIENTS];
+    int              clientCount;
+    unsigned long    requests;
+} ecwMBUSCtl, *pecwMBUSCtl;
+
+void Ctl_Printf(pecwMBUSCtlReply reply, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+int  Ctl_Open(pecwMBUSCtl ctl, const char *path, Ctl_Handler handler, void *ctx);
+int  Ctl_Poll(pecwMBUSCtl ctl, int timeoutMs);
+int  Ctl_GetFd(pecwMBUSCtl ctl);
+void Ctl_Close(pecwMBUSCtl ctl);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef WMBUSDASH_H
+#define WMBUSDASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+
+// Terminal dashboard: one row per meter, redrawn in place
+//
+// A reading only updates the data of its row. Dash_Draw, called by the main
+// loop every DASH_INTERVALMS, renders the screen into a grid of cells and
+// writes the cells that differ from what the terminal shows in one write,
+// so the terminal output depends on what changed and not on the telegram
+// rate. Log messages for stdout are kept in the lines below the meters
+// while the dashboard is shown, the frame dump is off.
+//
+//  #  Manuf Ident               Value Unit      Age RSSI dBm AccNo  Decryption Rate/h
+//  1  18c4  12345678          1234.56 m3         4s      -60    17  OK            225
+
+#define DASH_INTERVALMS     250         // refresh period, the cap of the redraw rate
+#define DASH_LOGLINES       6           // latest log messages below the meters
+#define DASH_MAXROWS        (MAXMETER + DASH_LOGLINES + 5)
+#define DASH_MAXCOLS        160
+#define DASH_FRESHMS        5000        // a reading this young is shown in green
+
+typedef struct _WMBUS_DASH_ROW {
+    ecwMBUSMeter  meter;
+    ecMBUSData    data;
+    uint64_t      lastMs;               // monotonic, 0 before the first reading
+    uint32_t      avgMs;                // interval between readings, exponentially weighted
+    unsigned long readings;
+} ecwMBUSDashRow;
+
+typedef struct _WMBUS_DASH {
+    ecwMBUSDashRow  rows[MAXMETER];
+    char            title[80];
+    bool            shown;
+    int             width;
+    int             height;
+    uint8_t         frameLevel;         // log level of the frame dump while the dashboard is hidden
+    char            cells[DASH_MAXROWS][DASH_MAXCOLS];      // the screen being drawn
+    uint8_t         attrs[DASH_MAXROWS][DASH_MAXCOLS];      // SGR code per cell
+    char            shownCells[DASH_MAXROWS][DASH_MAXCOLS]; // what the terminal shows
+    uint8_t         shownAttrs[DASH_MAXROWS][DASH_MAXCOLS];
+    char            log[DASH_LOGLINES][DASH_MAXCOLS];
+    uint8_t         logLevels[DASH_LOGLINES];
+    int             logNext;
+    pthread_mutex_t lock;               // log lines, written by the log thread
+    unsigned long   draws;
+    unsigned long   bytes;              // written to the terminal
+} ecwMBUSDash, *pecwMBUSDash;
+
+int  Dash_Init(pecwMBUSDash dash, const char *title);
+void Dash_Free(pecwMBUSDash dash);
+
+//alternate screen of the terminal, APIERROR if stdout is no terminal
+int  Dash_Show(pecwMBUSDash dash, bool on);
+void Dash_Resize(pecwMBUSDash dash);
+
+void Dash_Update(pecwMBUSDash dash, int slot, const ecwMBUSMeter *meter, const ecMBUSData *data);
+void Dash_Draw(pecwMBUSDash dash, const ecwMBUSMeter *meters, int count);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef WMBUSDB_H
+#define WMBUSDB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <wmbus/eccwmbus.h>
+
+// Meter database: every known meter with its key and a label, and the stick
+// slot of the meters that are watched
+//
+// A 32 byte header followed by fixed size records sorted by manufacturer and
+// ident, all fields little endian so the file can be moved between hosts.
+// The file is mapped read only, a lookup is a binary search on the mapping.
+// A changed record is written in place; adding or removing meters writes a
+// new file and renames it over the old one, so readers see either version.
+// Another process that renamed a new file is picked up with Db_Open again.
+//
+// record: manid u16, ident u32, type u8, version u8, slot u8, flags u8,
+//         key[16], label[38] zero padded
+
+#define DB_MAGIC          0x4D424D57  // "WMBM"
+#define DB_VERSION        1
+#define DB_HEADERSIZE     32
+#define DB_RECORDSIZE     64
+#define DB_MAXLABEL       37
+#define DB_FILENAME       "meters.db"
+
+#define DB_NOSLOT         0xFF        // known, not watched
+#define DB_ANYSLOT        0xFE        // watched, eccwmbus picks the slot
+
+typedef struct _WMBUS_DBREC {
+    ecwMBUSMeter meter;
+    uint8_t      slot;                // 0..MAXMETER-1, DB_NOSLOT or DB_ANYSLOT
+    char         label[DB_MAXLABEL + 1];
+} ecwMBUSDbRec, *pecwMBUSDbRec;
+
+typedef struct _WMBUS_DB {
+    char           path[_MAX_PATH];
+    int            fd;
+    const uint8_t *map;               // read only mapping of the whole file, NULL while empty
+    size_t         mapSize;
+    uint32_t       count;
+} ecwMBUSDb, *pecwMBUSDb;
+
+//a missing file is an empty database, it is created with the first change
+int      Db_Open(pecwMBUSDb db, const char *path);
+void     Db_Close(pecwMBUSDb db);
+bool     Db_Exists(const char *path);
+
+void     Db_Get(const ecwMBUSDb *db, uint32_t index, pecwMBUSDbRec rec);
+int      Db_Find(const ecwMBUSDb *db, uint16_t manid, uint32_t ident, pecwMBUSDbRec rec);
+
+int      Db_Put(pecwMBUSDb db, const ecwMBUSDbRec *rec);
+int      Db_PutMany(pecwMBUSDb db, ecwMBUSDbRec *recs, uint32_t count, bool keepSlots);
+int      Db_Delete(pecwMBUSDb db, uint16_t manid, uint32_t ident);
+
+//the watched meters and their slots in file order, at most max are stored, all are counted
+int      Db_GetWatched(const ecwMBUSDb *db, pecwMBUSMeter meters, uint8_t *slots, int max);
+int      Db_SetSlot(pecwMBUSDb db, uint16_t manid, uint32_t ident, uint8_t slot);
+
+//manid,ident,type,version,key,label per line, hex as eccwmbus-ctl lists them; # starts a comment
+int      Db_ParseCSV(char *line, pecwMBUSDbRec rec, char *err, size_t errSize);
+int      Db_ImportCSV(pecwMBUSDb db, const char *path, uint32_t *imported);
+void     Db_FormatCSV(const ecwMBUSDbRec *rec, char *line, size_t size);
+
+//meter.dat of the older versions, the slot of a meter is its place in the file
+int      Db_ImportDat(pecwMBUSDb db, const char *path, uint32_t *imported);
+
+#endif
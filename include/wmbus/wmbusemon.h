@@ -0,0 +1,87 @@
+#ifndef WMBUSEMON_H
+#define WMBUSEMON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusspool.h>
+
+// emoncms uploader: readings are posted in batches to the bulk input API
+//
+// The endpoint is given as apikey@host[:port][/path], e.g.
+// 0123456789abcdef@emonpi.local/emoncms, plain HTTP only. Every reading is
+// one bulk item, node is the meter ident, the inputs are the value and RSSI:
+//
+// POST <path>/input/bulk   data=[[1420106400,"12345678",12.5,-60],...]&sentat=1420106405
+//
+// The item times are absolute, sentat is the gateway clock at sending so
+// emoncms corrects the clock difference. An uploader thread keeps one
+// keep-alive connection and sends a batch once EMON_MAXBATCH readings are
+// waiting or the oldest one waited EMON_INTERVAL. Readings stay queued until
+// emoncms answered "ok"; while the endpoint is unreachable they go to a disk
+// spool. The backlog is drained with full batches at most drainRate
+// readings per second so a returning uplink is not flooded.
+
+#define EMON_DEFAULTPORT    80
+#define EMON_MAXBATCH       250         // readings per request
+#define EMON_INTERVAL       5000        // ms, oldest reading waits at most this long
+#define EMON_DRAINRATE      1000        // readings/s while the backlog is sent
+#define EMON_QUEUESIZE      1024        // readings kept in memory
+#define EMON_MAXITEM        96
+#define EMON_BACKOFFMIN     1000        // ms
+#define EMON_BACKOFFMAX     60000       // ms
+#define EMON_TIMEOUT        10000       // ms, connect and response
+#define EMON_BUFFERSIZE     (EMON_MAXBATCH*EMON_MAXITEM + 1024)
+
+typedef struct _WMBUS_EMON_ITEM {
+    uint8_t  len;
+    char     data[EMON_MAXITEM];        // [time,"ident",value,rssi]
+} ecwMBUSEmonItem, *pecwMBUSEmonItem;
+
+typedef struct _WMBUS_EMON_STATS {
+    unsigned long published;            // readings handed to the uploader
+    unsigned long uploaded;             // accepted by emoncms
+    unsigned long spooled;              // readings written to the spool
+    unsigned long dropped;              // memory queue and spool full
+    unsigned long rejected;             // dropped, emoncms answered but not "ok"
+    unsigned long requests;
+    unsigned long failures;             // requests without answer or with HTTP error
+    unsigned long connects;
+} ecwMBUSEmonStats;
+
+typedef struct _WMBUS_EMON {
+    char            host[128];
+    char            port[8];
+    char            path[128];
+    char            apikey[64];
+    int             drainRate;
+    int             fd;
+    bool            connected;          // last request got through, new readings go to memory
+    ecwMBUSEmonItem *queue;             // ring, readings between head and tail
+    unsigned long   qHead;              // oldest reading not uploaded
+    unsigned long   qSend;              // next reading for a batch
+    unsigned long   qTail;
+    bool            useSpool;
+    ecwMBUSSpool    spool;              // readings newer than the memory queue
+    int             batchMem;           // readings of the request in memory and in the spool
+    int             batchSpool;
+    char           *out;
+    char           *in;
+    size_t          inLen;
+    int             wake[2];
+    bool            wakePending;
+    bool            stop;
+    bool            running;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    ecwMBUSEmonStats stats;
+} ecwMBUSEmon, *pecwMBUSEmon;
+
+int  Emon_Open(pecwMBUSEmon emon, const char *spec, const char *spoolPath, int drainRate);
+void Emon_Publish(pecwMBUSEmon emon, const ecwMBUSMeter *meter, const ecMBUSData *data);
+void Emon_GetQueue(pecwMBUSEmon emon, unsigned long *queued, unsigned long *spooled, unsigned long *dropped);
+void Emon_PrintStats(pecwMBUSEmon emon);
+void Emon_Close(pecwMBUSEmon emon);
+
+#endif
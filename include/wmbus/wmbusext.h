@@ -24,6 +24,25 @@
 #define PACKET_IS_ENCRYPTED        0x04
 #define PACKET_DECRYPTIONERROR     0x08
 
+//called for every reading of a registered meter, from the receiving thread
+typedef void (*wMBus_ReadingHandler)(int Index, const ecwMBUSMeter *meter, const ecMBUSData *data);
+
+//called for every received frame, Index is -1 for meters not on the stick;
+//meter, data and frame point into the driver and are valid during the call only
+typedef void (*wMBus_FrameHandler)(void *ctx, int Index, const ecwMBUSMeter *meter, const ecMBUSData *data,
+                                   const uint8_t *frame, int frameLength);
+
+//counters of the iM871A system status, they start at 0 when the stick starts
+typedef struct _WMBUS_STICK_COUNTERS {
+    uint32_t status;
+    uint32_t uptime;        // s
+    uint32_t txFrames;
+    uint32_t txErrors;
+    uint32_t rxFrames;
+    uint32_t crcErrors;
+    uint32_t decodeErrors;
+} ecwMBUSStickCounters, *pecwMBUSStickCounters;
+
 //wMBus handling
 unsigned long wMBus_OpenDevice(char* device, uint16_t stick);
 unsigned long wMBus_CloseDevice( unsigned long handle, uint16_t stick);
@@ -35,9 +54,21 @@ unsigned long wMBus_SwitchMode(  unsigned long handle, uint16_t stick, uint8_t M
 unsigned long wMBus_GetRadioMode(unsigned long handle, uint16_t stick, unsigned long* dwD, uint16_t infoflag);
 unsigned long wMBus_AddMeter(    unsigned long handle, uint16_t stick, int slot, pecwMBUSMeter NewMeter, uint16_t infoflag);
 int           wMBus_RemoveMeter(  int Index);
+int           wMBus_SyncMeters(unsigned long handle, uint16_t stick, const ecwMBUSMeter *meters, int count, uint16_t infoflag);
+unsigned long wMBus_GetSlotCommands(void);
 unsigned long wMBus_GetData4Meter(int Index, psecMBUSData data);
+void          wMBus_SetQueueDepth(int depth);
+int           wMBus_GetQueueStats(int Index, unsigned long *queued, unsigned long *overwritten);
+
+void          wMBus_RegisterReadingHandler(wMBus_ReadingHandler handler);
+void          wMBus_RegisterFrameHandler(wMBus_FrameHandler handler, void *ctx);
+void          wMBus_SetFrameDump(bool on);
+int           wMBus_GetStickCounters(unsigned long handle, uint16_t stick, pecwMBUSStickCounters counters);
 
 unsigned long wMBus_GetMeterList();
 unsigned long wMBus_GetMeterDataList();
+unsigned long wMBus_GetLastError(unsigned long handle, uint16_t stick);
+void          wMBus_GetDataByHand();
+void          wMBus_GetStickStatus(unsigned long handle, uint16_t stick, uint16_t infoflag);
 
 #endif
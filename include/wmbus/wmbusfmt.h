@@ -0,0 +1,44 @@
+#ifndef WMBUSFMT_H
+#define WMBUSFMT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <wmbus/eccwmbus.h>
+
+// Formatting of readings without printf, for the outputs that see every reading
+//
+// The Fmt_ functions write into the caller's buffer and return the length,
+// the buffer is not terminated. Callers size the buffer with the FMT_MAX
+// defines, the functions do not check for space. Values stay an integer
+// mantissa with a decimal exponent up to the text, Fmt_Value prints every
+// digit the meter sent.
+//
+// json : {"time":1420106400,"ts":"2015-01-01T10:00:00Z","manid":"18c4","ident":"12345678","type":2,
+//         "version":1,"value":125,"exp":-1,"scaled":12.5,"unit":"m3","rssi":-60,"accNo":17,"status":0,
+//         "pktInfo":2,"payload":"2c44..."}
+
+#define FMT_MAXVALUE    40                  // Fmt_Value, Fmt_Decimal
+#define FMT_MAXDATE     20                  // Fmt_Date
+#define FMT_MAXJSON     (320 + 2*256)       // Fmt_ReadingJSON with payload and newline
+
+#define FMT_PAYLOAD     0x01                // Fmt_ReadingJSON: add the payload as hex
+#define FMT_NEWLINE     0x02                // Fmt_ReadingJSON: end with '\n'
+
+#define FMT_DATE_ISO    0                   // Fmt_Date: 2015-01-01 10:00, the CSV log files
+#define FMT_DATE_DMY    1                   // Fmt_Date: 01.01.2015 10:00:00, the XML log files
+
+int         Fmt_U32(char *p, uint32_t v);
+int         Fmt_I32(char *p, int32_t v);
+int         Fmt_U64(char *p, uint64_t v);
+int         Fmt_Hex(char *p, uint32_t v, int digits);
+int         Fmt_HexBytes(char *p, const uint8_t *data, size_t len);
+int         Fmt_HexBytesUpper(char *p, const uint8_t *data, size_t len);
+int         Fmt_IsoTime(char *p, uint32_t t);
+int         Fmt_Date(char *p, const struct tm *tm, int style);
+int         Fmt_Decimal(char *p, int64_t value, int8_t exp);
+int         Fmt_Value(char *p, uint32_t value, int8_t exp);
+const char *Fmt_Unit(uint8_t type);
+int         Fmt_ReadingJSON(char *p, const ecwMBUSMeter *meter, const ecMBUSData *data, int flags);
+
+#endif
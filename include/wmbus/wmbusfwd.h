@@ -0,0 +1,71 @@
+#ifndef WMBUSFWD_H
+#define WMBUSFWD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+
+// Forwarder: ships the readings of this gateway to a central aggregator
+//
+// The aggregator is given as [raw:]host[:port][/id], the id names this
+// gateway and defaults to the host name. Without raw: the readings of the
+// registered meters are forwarded, with raw: every frame the stick hears,
+// the aggregator picks the meters of its own list. The forwarder is the write
+// and idle handler of a sink (wmbussink): readings are collected in a buffer
+// and sent when the sink queue ran empty or the buffer is full, so a busy
+// gateway sends large writes. While the aggregator is away the sink thread
+// retries with backoff, the sink queue fills and its policy (spill by
+// default) keeps the readings. After a reconnect the unsent buffer goes out
+// again, the aggregator drops what arrives twice.
+//
+// stream : hello | record | record | ...
+// hello  : magic u32, version u8, id length u8, id
+// record : length u16, flags u16, crc32 u32, reading body as in the journal (Jnl_EncodeReading)
+
+#define FWD_MAGIC           0x46424D57  // "WMBF"
+#define FWD_VERSION         1
+#define FWD_DEFAULTPORT     7100
+#define FWD_MAXID           32
+#define FWD_HELLOSIZE       6
+#define FWD_BUFFERSIZE      (64*1024)
+#define FWD_BACKOFFMIN      500         // ms
+#define FWD_BACKOFFMAX      30000       // ms
+#define FWD_TIMEOUT         5000        // ms, connect and send
+
+#define FWD_UNREGISTERED    0x0001      // record flag and sink tag: meter not registered on the gateway
+
+typedef struct _WMBUS_FWD_STATS {
+    unsigned long readings;             // readings handed to the forwarder
+    unsigned long sent;                 // readings written to the aggregator
+    unsigned long writes;
+    unsigned long bytes;
+    unsigned long connects;
+    unsigned long failures;             // connects and writes that failed
+    unsigned long lost;                 // unsent when stopped
+} ecwMBUSFwdStats;
+
+typedef struct _WMBUS_FWD {
+    char            host[128];
+    char            port[8];
+    char            id[FWD_MAXID + 1];
+    bool            raw;                // every frame, not only registered meters
+    int             fd;
+    uint8_t        *out;                // records not yet written
+    size_t          outLen;
+    unsigned long   outRecords;
+    uint64_t        seq;
+    int             backoff;            // ms
+    bool            stop;
+    pthread_mutex_t lock;               // stop and stats
+    ecwMBUSFwdStats stats;
+} ecwMBUSFwd, *pecwMBUSFwd;
+
+int  Fwd_Open(pecwMBUSFwd fwd, const char *spec);
+int  Fwd_Write(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag);
+void Fwd_Flush(void *ctx, uint64_t tag);
+void Fwd_Stop(pecwMBUSFwd fwd);
+void Fwd_PrintStats(pecwMBUSFwd fwd);
+void Fwd_Close(pecwMBUSFwd fwd);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef WMBUSHIST_H
+#define WMBUSHIST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <wmbus/eccwmbus.h>
+
+// History store: one file per meter, a 32 byte header followed by fixed size
+// records sorted by time. The file itself is the time index - a range lookup
+// is a binary search on the record number plus a sequential scan.
+// All fields are stored little endian so files can be moved between hosts.
+
+#define HIST_MAGIC        0x48424D57  // "WMBH"
+#define HIST_VERSION      1
+#define HIST_HEADERSIZE   32
+#define HIST_RECORDSIZE   16
+#define HIST_FILEPREFIX   "wmbus_"
+#define HIST_FILESUFFIX   ".hst"
+
+typedef struct _WMBUS_HISTREC {
+    uint32_t time;      // UNIX epoch time
+    uint32_t value;     // value in integer
+    int8_t   exp;       // value exponent
+    int8_t   rssiDBm;   // rssi in dbm
+    uint8_t  accNo;     // RF packet access number
+    uint8_t  status;    // wMbus Status
+    uint8_t  pktInfo;   // PACKET_xxx flags
+} ecwMBUSHistRec, *pecwMBUSHistRec;
+
+typedef struct _WMBUS_HIST {
+    int            fd;
+    const uint8_t *map;       // read only mapping of the whole file
+    size_t         mapSize;
+    uint32_t       count;     // number of complete records
+    ecwMBUSMeter   meter;     // identity from the header, key is always zero
+} ecwMBUSHist, *pecwMBUSHist;
+
+int      Hist_MakePath(char *path, size_t size, const char *dir, const ecwMBUSMeter *meter);
+void     Hist_FromRFData(pecwMBUSHistRec rec, uint32_t time, const ecMBUSData *rfData);
+
+int      Hist_AppendFd(int fd, const ecwMBUSMeter *meter, ecwMBUSHistRec *recs, uint32_t count);
+int      Hist_Append(const char *path, const ecwMBUSMeter *meter, ecwMBUSHistRec *recs, uint32_t count);
+
+int      Hist_Open(const char *path, pecwMBUSHist hist);
+void     Hist_Close(pecwMBUSHist hist);
+void     Hist_Get(const ecwMBUSHist *hist, uint32_t index, pecwMBUSHistRec rec);
+uint32_t Hist_GetTime(const ecwMBUSHist *hist, uint32_t index);
+uint32_t Hist_LowerBound(const ecwMBUSHist *hist, uint32_t time);
+uint32_t Hist_UpperBound(const ecwMBUSHist *hist, uint32_t time);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef WMBUSJOURNAL_H
+#define WMBUSJOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+
+// Write-ahead journal for readings
+//
+// Every accepted reading is appended to a binary journal before it reaches
+// the log files. Records are checksummed and committed in groups: a commit
+// thread collects the records of one time window and writes them with a
+// single write() and fdatasync(). On startup the records after the last
+// checkpoint are replayed, a torn record at the end is cut off.
+//
+// file   : header | record | record | ...
+// header : magic u32, version u16, size u16, checkpoint u64, crc32 u32, reserved u32
+// record : length u16, reserved u16, crc32 u32, body (see Jnl_EncodeReading)
+
+#define JNL_MAGIC          0x4A424D57  // "WMBJ"
+#define JNL_VERSION        1
+#define JNL_HEADERSIZE     24
+#define JNL_RECHEADERSIZE  8
+#define JNL_READINGSIZE    35          // body without payload
+#define JNL_MAXRECORD      (JNL_RECHEADERSIZE + JNL_READINGSIZE + 256)
+#define JNL_BUFFERSIZE     (64*1024)
+#define JNL_MAXSIZE        (1024*1024) // reset the journal beyond this size once everything is checkpointed
+#define JNL_DEFAULTWINDOW  200         // ms
+
+typedef void (*Jnl_ReplayHandler)(uint64_t seq, const ecwMBUSMeter *meter, ecMBUSData *data, void *ctx);
+
+typedef struct _WMBUS_JOURNAL_STATS {
+    unsigned long records;       // records committed
+    unsigned long bytes;         // bytes committed
+    unsigned long commits;       // number of fdatasync calls
+    unsigned long dropped;       // records dropped, buffer full
+    unsigned long replayed;      // records replayed on startup
+    unsigned long resets;        // journal truncations after checkpoint
+    double        syncMinMs;
+    double        syncMaxMs;
+    double        syncSumMs;
+    double        startTime;
+} ecwMBUSJournalStats;
+
+typedef struct _WMBUS_JOURNAL {
+    int             fd;
+    uint64_t        nextSeq;       // seq of the next appended record
+    uint64_t        writtenSeq;    // last seq in the file
+    uint64_t        checkpoint;    // last seq delivered to all sinks
+    bool            ckpPending;
+    int             windowMs;
+    uint8_t        *buf;           // records waiting for the next commit
+    uint8_t        *spare;
+    size_t          len;
+    unsigned long   pending;
+    uint64_t        pendingSeq;    // last seq in buf
+    off_t           size;
+    bool            stop;
+    bool            running;
+    pthread_t       thread;
+    pthread_mutex_t lock;          // buffers and stats
+    pthread_mutex_t lockIO;        // file
+    pthread_cond_t  cond;
+    ecwMBUSJournalStats stats;
+} ecwMBUSJournal, *pecwMBUSJournal;
+
+uint32_t Jnl_Crc32(const uint8_t *buf, size_t len, uint32_t crc);
+int      Jnl_EncodeReading(uint8_t *p, uint64_t seq, const ecwMBUSMeter *meter, const ecMBUSData *data);
+int      Jnl_DecodeReading(const uint8_t *p, size_t len, uint64_t *seq, pecwMBUSMeter meter, psecMBUSData data);
+
+int      Jnl_Open(pecwMBUSJournal jnl, const char *path, int windowMs, Jnl_ReplayHandler replay, void *ctx);
+int      Jnl_Append(pecwMBUSJournal jnl, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t *seq);
+uint64_t Jnl_LastSeq(pecwMBUSJournal jnl);
+void     Jnl_Checkpoint(pecwMBUSJournal jnl, uint64_t seq);
+void     Jnl_GetStats(pecwMBUSJournal jnl, ecwMBUSJournalStats *stats);
+void     Jnl_GetQueue(pecwMBUSJournal jnl, unsigned long *queued, unsigned long *dropped);
+void     Jnl_PrintStats(pecwMBUSJournal jnl);
+void     Jnl_Close(pecwMBUSJournal jnl);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef WMBUSLE_H
+#define WMBUSLE_H
+
+#include <stdint.h>
+
+// little endian helpers for the on-disk formats
+
+static inline void PutU16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t)(v>>8);
+}
+
+static inline void PutU32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t)(v>>8);
+    p[2] = (uint8_t)(v>>16);
+    p[3] = (uint8_t)(v>>24);
+}
+
+static inline void PutU64(uint8_t *p, uint64_t v) {
+    PutU32(p,   (uint32_t) v);
+    PutU32(p+4, (uint32_t)(v>>32));
+}
+
+static inline uint16_t GetU16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1]<<8));
+}
+
+static inline uint32_t GetU32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static inline uint64_t GetU64(const uint8_t *p) {
+    return (uint64_t)GetU32(p) | ((uint64_t)GetU32(p+4)<<32);
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef WMBUSLOG_H
+#define WMBUSLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Logging with levels per category
+//
+// Log_Printf checks the level of the category before the arguments are
+// evaluated, a disabled message costs one compare. An enabled message is
+// formatted into a slot of a lock free ring and written by a background
+// thread to stdout, a file or syslog, so a slow terminal or pipe never
+// stalls the thread that reads the stick. A full ring drops the message
+// and counts it. Before Log_Start and after Log_Stop messages are written
+// directly to stdout.
+//
+// levels    : -v debug or -v info,driver=debug,frame=warn
+// targets   : -V - (stdout), -V syslog, -V <file>
+
+#define LOGLVL_OFF          0
+#define LOGLVL_ERROR        1
+#define LOGLVL_WARN         2
+#define LOGLVL_INFO         3
+#define LOGLVL_DEBUG        4
+#define LOGLVL_TRACE        5
+
+#define LOGCAT_MAIN         0           // start, stop, configuration
+#define LOGCAT_DRIVER       1           // stick commands and status
+#define LOGCAT_FRAME        2           // the dump of every received frame
+#define LOGCAT_METER        3           // meter list and key slots
+#define LOGCAT_OUTPUT       4           // log files, queues and sinks
+#define LOGCAT_NET          5           // stream, MQTT, emoncms, forwarder, aggregator
+#define LOGCAT_COUNT        6
+
+#define LOG_RINGSIZE        256         // messages
+#define LOG_MSGSIZE         768         // bytes per message with terminating zero
+#define LOG_IDLEUS          20000       // drain interval of the writer thread while the ring is empty
+
+extern uint8_t Log_Levels[LOGCAT_COUNT];
+
+typedef void (*LogHandler)(void *ctx, int cat, int lvl, const char *text);
+
+#define Log_Enabled(cat, lvl)     ((lvl) <= Log_Levels[cat])
+#define Log_Printf(cat, lvl, ...) do { if(Log_Enabled(cat, lvl)) Log_Write(cat, lvl, __VA_ARGS__); } while(0)
+
+void        Log_Write(int cat, int lvl, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+const char *Log_LevelName(int lvl);
+const char *Log_CategoryName(int cat);
+void        Log_SetLevel(int cat, int lvl);
+int         Log_ParseLevels(const char *spec);
+void        Log_FormatLevels(char *p, size_t size);
+
+//NULL, "" or "-" for stdout, "syslog", otherwise a file that is appended to
+int         Log_Start(const char *target);
+void        Log_Stop(void);
+bool        Log_IsTerminal(void);
+//the messages for stdout go to the handler while one is registered, e.g. the dashboard; called from the writer thread
+void        Log_RegisterHandler(LogHandler handler, void *ctx);
+unsigned long Log_GetDropped(void);
+
+#endif
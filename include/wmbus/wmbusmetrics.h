@@ -0,0 +1,126 @@
+#ifndef WMBUSMETRICS_H
+#define WMBUSMETRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+
+// Metrics: Prometheus text format on http://[addr:]port/metrics
+//
+// Counters are kept in one block per thread. A thread only writes its own
+// block with relaxed stores, counting takes no lock and shares no cache line
+// with other threads. The blocks are summed when /metrics is scraped. A block
+// is allocated on the first count of a thread and never freed, the counts of
+// a finished thread stay in the sums.
+// The stick counters are sampled by the main loop with Met_SetStick, queue
+// depths and drops of the outputs are collected at scrape time.
+
+#define MET_MAXREQUEST      4096
+#define MET_TIMEOUT         2000        // ms, per request
+#define MET_SAMPLEINTERVAL  10          // s, stick counters
+
+//counters
+#define MET_FRAMESREAD      0           // frames read from the stick
+#define MET_FRAMESDECODED   1           // frames with a decrypted and decoded payload
+#define MET_READINGS        2           // readings of registered meters
+#define MET_COUNTERS        3
+
+//sinks with a write latency histogram
+#define MET_SINKFILE        0           // CSV or history file
+#define MET_SINKJOURNAL     1
+#define MET_SINKSEGLOG      2
+#define MET_SINKSTREAM      3
+#define MET_SINKMQTT        4
+#define MET_SINKNDJSON      5
+#define MET_SINKEMON        6
+#define MET_SINKFORWARD     7
+#define MET_SINKS           8
+
+#define MET_BUCKETS         12          // upper bounds in MetBucketsUs, +Inf above
+
+typedef struct _WMBUS_MET_BLOCK {
+    uint64_t counter[MET_COUNTERS];
+    uint64_t meterFrames[MAXMETER];
+    uint64_t meterDecryptErrors[MAXMETER];
+    uint64_t bucket[MET_SINKS][MET_BUCKETS+1];
+    uint64_t sumUs[MET_SINKS];
+    struct _WMBUS_MET_BLOCK *next;
+} __attribute__((aligned(64))) ecwMBUSMetBlock, *pecwMBUSMetBlock;
+
+typedef struct _WMBUS_MET_QUEUE {
+    const char   *name;
+    unsigned long queued;               // readings waiting
+    unsigned long dropped;              // readings lost since start
+    bool          hasLag;               // sink queues
+    uint64_t      lagUs;
+} ecwMBUSMetQueue;
+
+//fills up to max queues, called by the metrics thread for every scrape
+typedef int (*Met_QueueCollector)(void *ctx, ecwMBUSMetQueue *queues, int max);
+
+#define MET_MAXQUEUES       24
+
+typedef struct _WMBUS_METRICS {
+    int             fd;
+    int             wake[2];            // closes the server thread
+    bool            running;
+    pthread_t       thread;
+    pthread_mutex_t lock;               // stick sample
+    ecwMBUSStickCounters stick;
+    time_t          stickTime;          // 0 before the first sample
+    Met_QueueCollector collector;
+    void           *ctx;
+    char           *out;                // response being built
+    size_t          outLen;
+    size_t          outSize;
+    unsigned long   scrapes;
+} ecwMBUSMetrics, *pecwMBUSMetrics;
+
+extern __thread pecwMBUSMetBlock MetBlock;
+extern const uint32_t MetBucketsUs[MET_BUCKETS];
+
+pecwMBUSMetBlock Met_NewBlock(void);
+
+static inline pecwMBUSMetBlock Met_Block(void) {
+    return (NULL != MetBlock) ? MetBlock : Met_NewBlock();
+}
+
+//single writer per block, a relaxed store is enough for the scraper to see whole values
+static inline void Met_Add(uint64_t *c, uint64_t n) {
+    __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+static inline void Met_Count(int counter) {
+    pecwMBUSMetBlock b = Met_Block();
+    if(NULL != b) Met_Add(&b->counter[counter], 1);
+}
+
+static inline uint64_t Met_NowUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static inline void Met_Observe(int sink, uint64_t startUs) {
+    pecwMBUSMetBlock b = Met_Block();
+    uint64_t us = Met_NowUs() - startUs;
+    int      iX = 0;
+
+    if(NULL == b) return;
+    while((iX < MET_BUCKETS) && (us > MetBucketsUs[iX])) iX++;
+    Met_Add(&b->bucket[sink][iX], 1);
+    Met_Add(&b->sumUs[sink], us);
+}
+
+uint64_t Met_GetCounter(int counter);
+void Met_Reading(int index, const ecwMBUSMeter *meter, const ecMBUSData *data);
+void Met_ResetMeter(int index);
+
+int  Met_Open(pecwMBUSMetrics met, const char *spec, Met_QueueCollector collector, void *ctx);
+void Met_SetStick(pecwMBUSMetrics met, const ecwMBUSStickCounters *stick);
+void Met_Close(pecwMBUSMetrics met);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef WMBUSMQTT_H
+#define WMBUSMQTT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusspool.h>
+
+// MQTT 3.1.1 publisher, one topic per meter: <prefix>/<manid>/<ident>/value
+//
+// Readings are published with QoS 1 by a sender thread. Up to window
+// publishes are in flight, they are written back to back and the PUBACKs
+// are matched as they come in. A message is only removed once it was
+// acknowledged, after a reconnect the unacknowledged ones are sent again.
+// The broker is reconnected with exponential backoff, readings arriving
+// while it is away go to a disk spool and are sent first on reconnect.
+// The disk I/O of the spool is done under its own lock, so Mqtt_Publish
+// does not wait for the sender thread reading or committing the spool.
+
+#define MQTT_DEFAULTPORT    1883
+#define MQTT_TOPICPREFIX    "wmbus"
+#define MQTT_KEEPALIVE      60          // s
+#define MQTT_WINDOW         64          // QoS 1 publishes in flight
+#define MQTT_MAXWINDOW      256
+#define MQTT_QUEUESIZE      1024        // messages kept in memory
+#define MQTT_MAXTOPIC       64
+#define MQTT_MAXPAYLOAD     32
+#define MQTT_BACKOFFMIN     1000        // ms
+#define MQTT_BACKOFFMAX     60000       // ms
+#define MQTT_TIMEOUT        5000        // ms, connect and CONNACK
+#define MQTT_BUFFERSIZE     (64*1024)
+
+typedef struct _WMBUS_MQTT_MSG {
+    uint8_t  topicLen;
+    uint8_t  payloadLen;
+    char     data[MQTT_MAXTOPIC + MQTT_MAXPAYLOAD];
+} ecwMBUSMqttMsg, *pecwMBUSMqttMsg;
+
+typedef struct _WMBUS_MQTT_INFLIGHT {
+    uint16_t id;
+    uint8_t  spooled;                   // message came from the spool
+    uint8_t  acked;
+} ecwMBUSMqttInflight;
+
+typedef struct _WMBUS_MQTT_STATS {
+    unsigned long published;            // readings handed to the publisher
+    unsigned long acked;
+    unsigned long spooled;              // messages written to the spool
+    unsigned long dropped;              // memory queue and spool full
+    unsigned long resent;               // sent again after a reconnect
+    unsigned long connects;
+    unsigned long writes;               // send calls, acked/writes is the batching factor
+} ecwMBUSMqttStats;
+
+typedef struct _WMBUS_MQTT {
+    char            host[128];
+    char            port[8];
+    char            clientId[48];
+    char            prefix[32];
+    int             window;
+    int             fd;
+    bool            connected;
+    ecwMBUSMqttMsg *queue;              // ring, messages between head and tail
+    unsigned long   qHead;              // oldest message not acknowledged
+    unsigned long   qSend;              // next message to send
+    unsigned long   qTail;
+    bool            useSpool;
+    ecwMBUSSpool    spool;              // messages newer than the memory queue, under spoolLock
+    unsigned long   spoolCount;         // records in the spool or on their way in, under lock
+    ecwMBUSMqttInflight inflight[MQTT_MAXWINDOW];
+    int             ifHead;
+    int             ifCount;
+    uint16_t        nextId;
+    uint8_t        *out;
+    size_t          outLen;
+    uint8_t        *in;
+    size_t          inLen;
+    double          lastSend;
+    double          lastRecv;
+    int             wake[2];
+    bool            wakePending;
+    bool            stop;
+    bool            running;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_mutex_t spoolLock;          // the spool file only, taken after lock or alone
+    ecwMBUSMqttStats stats;
+} ecwMBUSMqtt, *pecwMBUSMqtt;
+
+int  Mqtt_Open(pecwMBUSMqtt mqtt, const char *broker, const char *spoolPath, int window);
+void Mqtt_Publish(pecwMBUSMqtt mqtt, const ecwMBUSMeter *meter, const ecMBUSData *data);
+void Mqtt_GetQueue(pecwMBUSMqtt mqtt, unsigned long *queued, unsigned long *spooled, unsigned long *dropped);
+void Mqtt_PrintStats(pecwMBUSMqtt mqtt);
+void Mqtt_Close(pecwMBUSMqtt mqtt);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef WMBUSNDJSON_H
+#define WMBUSNDJSON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+
+// NDJSON output: one JSON object per reading to stdout, a pipe or a file
+//
+// Ndj_Write and Ndj_Flush are the write and idle handler of the ndjson sink
+// and run in its writer thread. The readings are formatted with
+// Fmt_ReadingJSON into a preallocated buffer that is written with one
+// write() call once it is full or the sink queue ran empty, so a burst of
+// readings goes out in few writes. A slow reader of the pipe only fills the
+// sink queue, its policy decides what is dropped.
+
+#define NDJ_BUFFERSIZE      (64*1024)
+
+typedef struct _WMBUS_NDJSON {
+    int             fd;
+    int             flags;          // FMT_PAYLOAD
+    char           *buf;            // written by the sink thread only
+    size_t          len;
+    unsigned long   queued;         // readings in buf
+    unsigned long   written;        // readings
+    unsigned long   dropped;        // readings after a write error
+    unsigned long   writes;
+    unsigned long   bytes;
+    bool            failed;         // write error, e.g. the reader closed the pipe
+    bool            open;
+    pthread_mutex_t lock;           // the counters, read by the main thread
+} ecwMBUSNdjson, *pecwMBUSNdjson;
+
+int  Ndj_Open(pecwMBUSNdjson ndj, int fd, int flags);
+int  Ndj_Write(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag);
+void Ndj_Flush(void *ctx, uint64_t tag);
+void Ndj_GetQueue(pecwMBUSNdjson ndj, unsigned long *queued, unsigned long *dropped);
+void Ndj_PrintStats(pecwMBUSNdjson ndj);
+void Ndj_Close(pecwMBUSNdjson ndj);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef WMBUSOUT_H
+#define WMBUSOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <wmbus/eccwmbus.h>
+
+// Output routing: per meter path templates and a LRU cache of open files
+//
+// Template tokens:
+//   %d  data path (-f)            %m  manufacturer ID (4 hex digits)
+//   %i  ident (8 hex digits)      %t  meter type (2 hex digits)
+//   %v  version (2 hex digits)    %Y  year   %M  month   %D  day
+//   %%  a single %
+//
+// e.g. "%d/%m/%t/wmbus_%m_%i_%t_%v_%Y%M.csv" shards by manufacturer, type and month
+
+#define OUT_DEFAULTDATAPATH  "/home/pi/data/wmbus"
+#define OUT_DEFAULTTEMPLATE  "%d/wmbus_%m_%i_%t_%v.csv"
+#define OUT_DEFAULTMAXOPEN   64
+#define OUT_MAXOPEN          1024
+
+typedef struct _WMBUS_OUTFILE {
+    char     path[_MAX_PATH];
+    uint32_t hash;
+    int      fd;
+    int      flags;
+    uint32_t lastUse;
+} ecwMBUSOutFile, *pecwMBUSOutFile;
+
+typedef struct _WMBUS_FILECACHE {
+    ecwMBUSOutFile *files;
+    int             maxOpen;
+    int             count;
+    uint32_t        tick;
+    unsigned long   hits;
+    unsigned long   misses;
+    bool            syncOnClose;    // a journal checkpoint needs the rows of closed files on disk
+} ecwMBUSFileCache, *pecwMBUSFileCache;
+
+int  Out_ExpandPath(char *path, size_t size, const char *tmpl, const char *datapath, const ecwMBUSMeter *meter, const struct tm *tm);
+int  Out_MakeDirs(const char *path);
+
+int  Out_InitCache(pecwMBUSFileCache cache, int maxOpen);
+int  Out_GetFile(pecwMBUSFileCache cache, const char *path, int flags, bool *isNew);
+void Out_CloseFile(pecwMBUSFileCache cache, const char *path);
+void Out_SyncAll(pecwMBUSFileCache cache);
+void Out_CloseAll(pecwMBUSFileCache cache);
+void Out_FreeCache(pecwMBUSFileCache cache);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef WMBUSPOOL_H
+#define WMBUSPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <wmbus/eccwmbus.h>
+
+// Reading pool: reference counted readings shared by the queues of the outputs
+//
+// A reading handed to several sinks is copied once into a pooled buffer,
+// every queue holds a reference and the writer that drops the last one puts
+// the buffer back. Free buffers wait on a list; the pool grows by POOL_CHUNK
+// buffers when the list is empty and never shrinks, so once the queues have
+// seen their longest backlog a reading costs no heap allocation. The
+// allocations of the pool are counted in the stats.
+
+#define POOL_CHUNK          256         // readings per allocation
+#define POOL_MAXCHUNKS      1024
+
+typedef struct _WMBUS_READING {
+    ecwMBUSMeter           meter;
+    ecMBUSData             data;
+    int                    refs;
+    struct _WMBUS_READING *next;        // free list
+} ecwMBUSReading, *pecwMBUSReading;
+
+typedef struct _WMBUS_POOL_STATS {
+    unsigned long size;                 // readings allocated
+    unsigned long inUse;
+    unsigned long gets;
+    unsigned long allocations;          // chunks taken from the heap
+    unsigned long failed;               // no memory or POOL_MAXCHUNKS reached
+} ecwMBUSPoolStats;
+
+//one reference for the caller, NULL without memory
+pecwMBUSReading Pool_Get(const ecwMBUSMeter *meter, const ecMBUSData *data);
+void            Pool_Hold(pecwMBUSReading reading);
+void            Pool_Release(pecwMBUSReading reading);
+void            Pool_GetStats(ecwMBUSPoolStats *stats);
+
+//gives the memory back, every reading must have been released
+void            Pool_Free(void);
+
+#endif
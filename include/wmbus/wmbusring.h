@@ -0,0 +1,69 @@
+#ifndef WMBUSRING_H
+#define WMBUSRING_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wmbus/eccwmbus.h>
+
+// bounded queue of the readings of one meter, oldest first
+//
+// A full ring overwrites its oldest reading and counts it, so a slow consumer
+// loses the oldest readings, never the newest, and the loss shows. The caller
+// holds the lock of the ring. The items are allocated with the first push, a
+// ring of depth 0 keeps nothing.
+
+#define RING_DEFAULTDEPTH   16          // readings per meter
+#define RING_MAXDEPTH       4096
+
+typedef struct _WMBUS_RING {
+    ecMBUSData   *items;
+    unsigned int  depth;
+    unsigned int  head;                 // oldest reading
+    unsigned int  count;
+    unsigned long overwritten;          // readings lost since start
+} ecwMBUSRing, *pecwMBUSRing;
+
+static inline void Ring_Init(pecwMBUSRing ring, unsigned int depth) {
+    ring->items       = NULL;
+    ring->depth       = (depth > RING_MAXDEPTH) ? RING_MAXDEPTH : depth;
+    ring->head        = 0;
+    ring->count       = 0;
+    ring->overwritten = 0;
+}
+
+static inline void Ring_Free(pecwMBUSRing ring) {
+    free(ring->items);
+    ring->items = NULL;
+    ring->head  = 0;
+    ring->count = 0;
+}
+
+static inline void Ring_Clear(pecwMBUSRing ring) {
+    ring->head  = 0;
+    ring->count = 0;
+}
+
+//false if the reading was not kept: depth 0 or no memory
+static inline bool Ring_Push(pecwMBUSRing ring, const ecMBUSData *data) {
+    if(0 == ring->depth) return false;
+    if((NULL == ring->items) && (NULL == (ring->items = (ecMBUSData *) malloc(ring->depth*sizeof(ecMBUSData)))))
+        return false;
+    if(ring->count == ring->depth) {
+        ring->head = (ring->head + 1) % ring->depth;
+        ring->count--;
+        ring->overwritten++;
+    }
+    ring->items[(ring->head + ring->count) % ring->depth] = *data;
+    ring->count++;
+    return true;
+}
+
+static inline bool Ring_Pop(pecwMBUSRing ring, ecMBUSData *data) {
+    if(0 == ring->count) return false;
+    if(NULL != data) *data = ring->items[ring->head];
+    ring->head = (ring->head + 1) % ring->depth;
+    ring->count--;
+    return true;
+}
+
+#endif
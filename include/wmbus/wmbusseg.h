@@ -0,0 +1,76 @@
+#ifndef WMBUSSEG_H
+#define WMBUSSEG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <wmbus/eccwmbus.h>
+
+// Segment log: every reading is appended to a sequential log for downstream
+// consumers. Each consumer has a name and a committed offset, it resumes there
+// after a restart and may replay from any offset still on disk. Old segments
+// are removed once the slowest consumer has committed past them.
+//
+// dir/<base>.seg  : segment, <base> is the offset of its first record (20 digits)
+// dir/<name>.off  : committed offset of consumer <name>, the next record to read
+//
+// segment : header | record | record | ...
+// header  : magic u32, version u16, size u16, base offset u64, crc32 u32, reserved u32
+// record  : as in the journal (length u16, reserved u16, crc32 u32, Jnl_EncodeReading body),
+//           the seq field of the body holds the offset of the record
+// offset  : magic u32, offset u64, crc32 u32
+
+#define SEG_MAGIC          0x53424D57  // "WMBS"
+#define SEG_OFFMAGIC       0x4F424D57  // "WMBO"
+#define SEG_VERSION        1
+#define SEG_HEADERSIZE     24
+#define SEG_OFFSIZE        16
+#define SEG_DEFAULTSIZE    (1024*1024) // roll over to a new segment beyond this size
+#define SEG_DEFAULTDIR     "/home/pi/data/wmbus/log"
+#define SEG_MAXNAME        64
+#define SEG_FILESUFFIX     ".seg"
+#define SEG_OFFSUFFIX      ".off"
+
+#define SEG_NODATA         1           // Seg_Read: nothing new within the timeout
+
+typedef struct _WMBUS_SEGLOG {
+    char            dir[_MAX_PATH];
+    int             fd;            // active segment
+    uint64_t        base;          // offset of the first record in the active segment
+    uint64_t        nextOffset;    // offset of the next appended record
+    off_t           size;
+    off_t           segSize;
+    unsigned long   appended;
+    unsigned long   removed;       // segments deleted by retention
+    pthread_mutex_t lock;
+} ecwMBUSSegLog, *pecwMBUSSegLog;
+
+typedef struct _WMBUS_SEGREADER {
+    char      dir[_MAX_PATH];
+    char      name[SEG_MAXNAME+1]; // empty for an anonymous reader
+    int       fd;                  // segment being read
+    uint64_t  base;
+    off_t     pos;                 // file position of the next record
+    uint64_t  offset;              // offset of the next record
+    uint64_t  committed;
+    int       notify;              // inotify descriptor for blocking reads
+} ecwMBUSSegReader, *pecwMBUSSegReader;
+
+int      Seg_ValidName(const char *name);
+int      Seg_ListSegments(const char *dir, uint64_t **bases, int *count);
+int      Seg_GetOffset(const char *dir, const char *name, uint64_t *offset);
+int      Seg_SetOffset(const char *dir, const char *name, uint64_t offset);
+
+int      Seg_Open(pecwMBUSSegLog log, const char *dir, off_t segSize);
+int      Seg_Append(pecwMBUSSegLog log, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t *offset);
+int      Seg_Retain(pecwMBUSSegLog log);
+void     Seg_Close(pecwMBUSSegLog log);
+
+int      Seg_OpenReader(pecwMBUSSegReader reader, const char *dir, const char *name);
+int      Seg_Seek(pecwMBUSSegReader reader, uint64_t offset);
+int      Seg_Read(pecwMBUSSegReader reader, pecwMBUSMeter meter, psecMBUSData data, uint64_t *offset, int timeoutMs);
+int      Seg_Commit(pecwMBUSSegReader reader);
+void     Seg_CloseReader(pecwMBUSSegReader reader);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef WMBUSSHM_H
+#define WMBUSSHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+
+// Latest value table: the last reading of every meter slot in a shared memory
+// file, for local consumers (display, PLC bridge, alarm scripts)
+//
+// eccwmbus maps the file read/write and updates a slot for every reading of
+// the meter in that slot, the slot numbers are the ones of meters.db. Other
+// processes map it read only with Shm_Attach and take snapshots with
+// Shm_Read. Every slot is guarded by a sequence lock: the writer makes the
+// sequence odd, copies the reading and makes it even again, a reader copies
+// the slot and retries when the sequence was odd or changed meanwhile. The
+// writer never waits for readers and reading takes no syscall and no lock.
+// Shm_Update and Shm_Clear may be called from different threads of the
+// writing process, a mutex of the writer keeps one writer per slot. The
+// AES keys are not copied to the table.
+//
+// file : header | slot | slot | ... (MAXMETER slots, native byte order and layout)
+
+#define SHM_MAGIC           0x4C424D57  // "WMBL"
+#define SHM_VERSION         1
+#define SHM_DEFAULTPATH     "/dev/shm/eccwmbus"
+#define SHM_RETRIES         1000        // Shm_Read gives up after this many torn copies
+
+#define SHM_EMPTY           1           // Shm_Read: no reading in this slot
+#define SHM_BUSY            2           // Shm_Read: the slot changed on every try
+
+typedef struct _WMBUS_SHM_SLOT {
+    uint32_t     seq;                   // odd while the writer updates the slot
+    uint32_t     updates;               // readings written to this slot
+    ecwMBUSMeter meter;                 // manufacturerID 0 when empty, key zeroed
+    ecMBUSData   data;
+} __attribute__((aligned(64))) ecwMBUSShmSlot, *pecwMBUSShmSlot;
+
+typedef struct _WMBUS_SHM_HEADER {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slots;
+    uint32_t slotSize;                  // sizeof(ecwMBUSShmSlot) of the writer
+    uint32_t writerPid;
+    uint32_t startTime;                 // writer start, UNIX epoch
+    uint32_t reserved;
+    uint64_t updates;                   // readings written to all slots
+} __attribute__((aligned(64))) ecwMBUSShmHeader;
+
+typedef struct _WMBUS_SHM_TABLE {
+    ecwMBUSShmHeader header;
+    ecwMBUSShmSlot   slot[MAXMETER];
+} ecwMBUSShmTable;
+
+typedef struct _WMBUS_SHM {
+    ecwMBUSShmTable *table;
+    bool             writer;
+    pthread_mutex_t  lock;              // writer only, Shm_Update and Shm_Clear
+} ecwMBUSShm, *pecwMBUSShm;
+
+//writer, eccwmbus. An existing table is taken over with all slots empty
+int  Shm_Create(pecwMBUSShm shm, const char *path);
+void Shm_Update(pecwMBUSShm shm, int index, const ecwMBUSMeter *meter, const ecMBUSData *data);
+void Shm_Clear(pecwMBUSShm shm, int index);
+
+//readers, any process
+int  Shm_Attach(pecwMBUSShm shm, const char *path);
+int  Shm_Read(pecwMBUSShm shm, int index, pecwMBUSMeter meter, psecMBUSData data, uint32_t *updates);
+int  Shm_Find(pecwMBUSShm shm, uint16_t manufacturerID, uint32_t ident);
+
+void Shm_Close(pecwMBUSShm shm);
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef WMBUSSINK_H
+#define WMBUSSINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusspool.h>
+#include <wmbus/wmbuspool.h>
+
+// Output sinks: every output gets its own writer thread and a bounded queue
+//
+// Sink_Put copies the reading into a pooled buffer and queues it on one
+// sink, Sink_Dispatch queues one pooled buffer on all sinks of a fan-out;
+// each queue holds a reference until its writer is done. A caller that
+// queues the same reading on several sinks takes the pooled buffer itself
+// (Pool_Get) and hands it to Sink_PutReading and Sink_DispatchReading. The writer thread
+// calls the write handler of the output for each reading, so a slow or
+// stalled output only fills its own queue. What happens when the queue is
+// full is the policy of the sink:
+//
+//   block        the caller waits for room, nothing is lost
+//   drop-oldest  the oldest queued reading makes room
+//   drop-newest  the new reading is dropped
+//   spill        the reading goes to a disk spool, the spool is written
+//                after the queue and kept over a restart
+//
+// Policies are given per sink as name=policy[:depth],... e.g.
+// "mqtt=spill,file=block:1024". The idle handler runs in the writer thread
+// whenever the queue ran empty, with the tag of the last reading written.
+//
+// The stream, MQTT and emoncms outputs keep a second queue behind the sink.
+// It is not a buffer in front of a write: it holds what the other end has
+// not confirmed yet (MQTT messages in flight until PUBACK, the emoncms batch
+// until the HTTP answer, the bytes of each stream subscriber), and their
+// threads own the connection, reconnect and resend. Their write handlers
+// only queue and never wait for the network, the sink queue in front is
+// what the policy applies to.
+
+#define SINK_BLOCK          0
+#define SINK_DROPOLDEST     1
+#define SINK_DROPNEWEST     2
+#define SINK_SPILL          3
+
+#define SINK_DEFAULTDEPTH   256         // readings
+#define SINK_MAXDEPTH       65536
+#define SINK_MAXNAME        16
+#define SINK_MAXSINKS       8           // per fan-out
+#define SINK_SPOOLMAX       (64*1024*1024)
+
+typedef int  (*Sink_WriteHandler)(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag);
+typedef void (*Sink_IdleHandler)(void *ctx, uint64_t tag);
+
+typedef struct _WMBUS_SINK_POLICY {
+    int  policy;
+    int  depth;
+    char spoolPath[_MAX_PATH];          // spill only
+} ecwMBUSSinkPolicy, *pecwMBUSSinkPolicy;
+
+typedef struct _WMBUS_SINK_ITEM {
+    uint64_t        tag;
+    uint64_t        queuedUs;           // Met_NowUs when queued, for the lag
+    pecwMBUSReading reading;            // one reference held by the queue
+} ecwMBUSSinkItem, *pecwMBUSSinkItem;
+
+typedef struct _WMBUS_SINK_STATS {
+    unsigned long queued;               // readings handed to the sink
+    unsigned long written;
+    unsigned long failed;               // write handler returned an error
+    unsigned long dropped;              // queue full, or spool full
+    unsigned long spilled;              // readings written to the spool
+    unsigned long waits;                // callers blocked on a full queue
+    uint64_t      maxLagUs;             // longest time from queueing to written
+} ecwMBUSSinkStats;
+
+typedef struct _WMBUS_SINK {
+    char             name[SINK_MAXNAME];
+    char             queueName[SINK_MAXNAME + 8]; // <name>_sink, the output of its queue in the metrics
+    int              policy;
+    int              metSink;           // MET_SINKx for the write latency, -1 for none
+    Sink_WriteHandler write;
+    Sink_IdleHandler idle;
+    void            *ctx;
+    ecwMBUSSinkItem *items;             // ring, readings between head and tail
+    unsigned long    depth;
+    unsigned long    head;
+    unsigned long    tail;
+    bool             useSpool;
+    ecwMBUSSpool     spool;             // readings newer than the queue
+    bool             idlePending;       // written since the last idle call
+    uint64_t         lastTag;
+    bool             stop;
+    bool             running;
+    pthread_t        thread;
+    pthread_mutex_t  lock;
+    pthread_cond_t   notEmpty;
+    pthread_cond_t   notFull;
+    ecwMBUSSinkStats stats;
+} ecwMBUSSink, *pecwMBUSSink;
+
+typedef struct _WMBUS_FANOUT {
+    pecwMBUSSink sinks[SINK_MAXSINKS];
+    int          count;
+} ecwMBUSFanout, *pecwMBUSFanout;
+
+const char *Sink_PolicyName(int policy);
+int  Sink_ParsePolicy(const char *spec, const char *name, pecwMBUSSinkPolicy policy);
+
+int  Sink_Open(pecwMBUSSink sink, const char *name, int metSink, const ecwMBUSSinkPolicy *policy,
+               Sink_WriteHandler write, Sink_IdleHandler idle, void *ctx);
+int  Sink_Put(pecwMBUSSink sink, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag);
+int  Sink_PutReading(pecwMBUSSink sink, pecwMBUSReading reading, uint64_t tag);
+void Sink_GetQueue(pecwMBUSSink sink, unsigned long *queued, unsigned long *spooled, unsigned long *dropped, uint64_t *lagUs);
+void Sink_PrintStats(pecwMBUSSink sink);
+void Sink_Close(pecwMBUSSink sink);
+
+int  Sink_Add(pecwMBUSFanout fanout, pecwMBUSSink sink);
+void Sink_Dispatch(pecwMBUSFanout fanout, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag);
+void Sink_DispatchReading(pecwMBUSFanout fanout, pecwMBUSReading reading, uint64_t tag);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef WMBUSSPOOL_H
+#define WMBUSSPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Disk spool: a FIFO of records in one file for outputs that are offline
+//
+// Records are read ahead with Spool_Read and only removed with Spool_Commit
+// once the receiver has acknowledged them, Spool_Rewind goes back to the
+// first unacknowledged record after a reconnect. Spool_Prepend puts records
+// that are older than the spooled ones in front of them. The file is
+// truncated when it is empty and compacted once the committed part is large.
+// Not thread safe, the owner serializes the calls.
+//
+// file   : header | record | record | ...
+// header : magic u32, version u16, size u16, head offset u64, crc32 u32, reserved u32
+// record : length u16, reserved u16, crc32 u32, data
+
+#define SPOOL_MAGIC         0x51424D57  // "WMBQ"
+#define SPOOL_VERSION       1
+#define SPOOL_HEADERSIZE    24
+#define SPOOL_RECHEADERSIZE 8
+#define SPOOL_MAXRECORD     (16*1024)
+#define SPOOL_DEFAULTMAX    (16*1024*1024)
+#define SPOOL_COMPACTAT     (1024*1024) // move the records to the front once this much is committed
+
+#define SPOOL_EMPTY         1           // Spool_Read: no more records
+
+typedef struct _WMBUS_SPOOL {
+    int           fd;
+    off_t         head;      // first record not committed
+    off_t         cursor;    // next record for Spool_Read
+    off_t         size;      // end of the last record
+    off_t         maxSize;
+    unsigned long count;     // records after head
+    unsigned long unread;    // records after cursor
+    unsigned long dropped;   // records not spooled, file full
+} ecwMBUSSpool, *pecwMBUSSpool;
+
+int  Spool_Open(pecwMBUSSpool spool, const char *path, off_t maxSize);
+int  Spool_Push(pecwMBUSSpool spool, const void *data, size_t len);
+int  Spool_Read(pecwMBUSSpool spool, void *buf, size_t size, size_t *len);
+int  Spool_Prepend(pecwMBUSSpool spool, const void * const *data, const size_t *len, unsigned long n);
+int  Spool_Commit(pecwMBUSSpool spool, unsigned long n);
+void Spool_Rewind(pecwMBUSSpool spool);
+void Spool_Sync(pecwMBUSSpool spool);
+void Spool_Close(pecwMBUSSpool spool);
+
+#endif
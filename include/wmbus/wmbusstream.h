@@ -0,0 +1,82 @@
+#ifndef WMBUSSTREAM_H
+#define WMBUSSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusfmt.h>
+
+// Stream server: pushes every reading to the connected subscribers
+//
+// Listeners are given as "tcp:[addr:]port" or "unix:path", a "json:" prefix
+// selects newline delimited JSON instead of the binary encoding, e.g.
+// "tcp:7000", "json:tcp:127.0.0.1:7001", "unix:/tmp/eccwmbus.sock"
+//
+// binary : length u16 | reading body as in the journal (Jnl_EncodeReading), seq counts the readings
+// json   : {"seq":1, followed by the reading as Fmt_ReadingJSON writes it with the payload, see wmbusfmt.h
+//
+// Readings are queued per subscriber and sent by the server thread with
+// non-blocking writes, all readings queued since the last write go out in one
+// write. A subscriber whose queue is full loses readings, the others are not
+// delayed.
+
+#define STREAM_MAXLISTEN    8
+#define STREAM_MAXCLIENTS   64
+#define STREAM_QUEUESIZE    (256*1024)  // per subscriber
+#define STREAM_MAXJSON      (32 + FMT_MAXJSON)
+
+#define STREAM_BINARY       0
+#define STREAM_JSON         1
+
+typedef struct _WMBUS_STREAM_CLIENT {
+    int             fd;
+    int             format;
+    uint8_t        *queue;          // filled by Stream_Publish
+    size_t          queueLen;
+    uint8_t        *send;           // being written by the server thread
+    size_t          sendLen;
+    size_t          sendPos;
+    unsigned long   sent;           // readings
+    unsigned long   dropped;        // readings lost, queue full
+    unsigned long   queued;         // readings in queue
+    unsigned long   sending;        // readings in send
+} ecwMBUSStreamClient, *pecwMBUSStreamClient;
+
+typedef struct _WMBUS_STREAM_LISTENER {
+    int             fd;
+    int             format;
+    char            path[_MAX_PATH];  // unix socket, removed on close
+} ecwMBUSStreamListener;
+
+typedef struct _WMBUS_STREAM {
+    ecwMBUSStreamListener listen[STREAM_MAXLISTEN];
+    int             listenCount;
+    ecwMBUSStreamClient  clients[STREAM_MAXCLIENTS];
+    int             clientCount;
+    int             formats[2];     // clients per format
+    uint64_t        seq;
+    int             wake[2];        // pipe, wakes the server thread
+    bool            wakePending;
+    bool            stop;
+    bool            running;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    unsigned long   published;
+    unsigned long   dropped;        // sum over all clients, also disconnected ones
+    unsigned long   accepted;
+    unsigned long   sent;           // readings sent, sum over all clients
+    unsigned long   writes;         // completed writes, sent/writes is the batching factor
+} ecwMBUSStream, *pecwMBUSStream;
+
+int  Stream_EncodeJSON(char *p, size_t size, uint64_t seq, const ecwMBUSMeter *meter, const ecMBUSData *data);
+
+int  Stream_Init(pecwMBUSStream srv);
+int  Stream_Listen(pecwMBUSStream srv, const char *spec);
+int  Stream_Start(pecwMBUSStream srv);
+void Stream_Publish(pecwMBUSStream srv, const ecwMBUSMeter *meter, const ecMBUSData *data);
+void Stream_GetQueue(pecwMBUSStream srv, unsigned long *queued, unsigned long *dropped);
+void Stream_PrintStats(pecwMBUSStream srv);
+void Stream_Close(pecwMBUSStream srv);
+
+#endif
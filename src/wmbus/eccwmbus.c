@@ -13,77 +13,264 @@
 #include <time.h>
 #include <sys/time.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <wmbus/eccwmbus.h>
 #include <wmbus/wmbusext.h>
-
+#include <wmbus/wmbushist.h>
+#include <wmbus/wmbusout.h>
+#include <wmbus/wmbusjournal.h>
+#include <wmbus/wmbusseg.h>
+#include <wmbus/wmbusstream.h>
+#include <wmbus/wmbusmqtt.h>
+#include <wmbus/wmbusmetrics.h>
+#include <wmbus/wmbusshm.h>
+#include <wmbus/wmbusctl.h>
+#include <wmbus/wmbusfmt.h>
+#include <wmbus/wmbusndjson.h>
+#include <wmbus/wmbusemon.h>
+#include <wmbus/wmbussink.h>
+#include <wmbus/wmbuspool.h>
+#include <wmbus/wmbusfwd.h>
+#include <wmbus/wmbusagg.h>
+#include <wmbus/wmbusring.h>
+#include <wmbus/wmbusconf.h>
+#include <wmbus/wmbusdb.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusdash.h>
+
+
+//-D: no terminal, no colours, no prompts, the readings go to the outputs only
+static bool Daemon = false;
 
 void Colour(int8_t c, bool cr) {
+    if(Daemon) {
+        if(cr) printf("\n");
+        return;
+    }
     printf("%c[%dm",0x1B,(c>0) ? (30+c) : c);
     if(cr)
         printf("\n");
 }
 
-//Log Reading with date info to CSV File
-int Log2CSVFile(const char *path,  double Value,  ecMBUSData *rfData) {
-    FILE    *hFile;
-    uint32_t FileSize = 0;
-    int   iX;
+static ecwMBUSFileCache LogFiles;
+static ecwMBUSJournal   Journal;
+static ecwMBUSSegLog    SegLog;
+static ecwMBUSStream    Stream;
+static ecwMBUSMqtt      Mqtt;
+static ecwMBUSMetrics   Metrics;
+static ecwMBUSShm       Latest;
+static ecwMBUSCtl       Control;
+static ecwMBUSNdjson    Ndjson;
+static ecwMBUSEmon      Emon;
+static ecwMBUSFwd       Fwd;
+static ecwMBUSAgg       Agg;
+static ecwMBUSDb        MeterDb;        // meters.db, empty with the meters of a configuration file
+static ecwMBUSDash      Dash;           // -T or 'd', only with a terminal
+static bool             UseJournal = false;
+static bool             UseSegLog  = false;
+static bool             UseStream  = false;
+static bool             UseMqtt    = false;
+static bool             UseMetrics = false;
+static bool             UseLatest  = false;
+static bool             UseControl = false;
+static bool             UseNdjson  = false;
+static bool             UseEmon    = false;
+static bool             UseFwd     = false;
+static bool             UseAgg     = false;
+static unsigned long    AggUnknown = 0;  // aggregated readings of meters not in the list
+
+//every output but the journal and the latest table writes from its own sink thread
+static ecwMBUSSink      FileSink;
+static ecwMBUSSink      SegSink;
+static ecwMBUSSink      StreamSink;
+static ecwMBUSSink      MqttSink;
+static ecwMBUSSink      NdjsonSink;
+static ecwMBUSSink      EmonSink;
+static ecwMBUSSink      FwdSink;
+static ecwMBUSFanout    Outputs;        // fed by Deliver
+static ecwMBUSFanout    AllSinks;       // Outputs and the file sink, for the statistics
+static const char      *SinkNames[] = { "file", "seglog", "stream", "mqtt", "ndjson", "emoncms", "forward", NULL };
+
+//journal seq and file output queue in the same order
+static pthread_mutex_t  LogLock = PTHREAD_MUTEX_INITIALIZER;
+
+//readings per meter not yet shown by the main loop, -d deep
+static ecwMBUSRing      RoundQueue[MAXMETER];
+static unsigned long    RoundMask = 0;  // meters with queued readings
+static pthread_mutex_t  RoundLock = PTHREAD_MUTEX_INITIALIZER;
+static int              RoundEvent = -1; // eventfd, signalled when the table gets its first reading
+
+//what woke the main loop, epoll data
+#define LOOP_KEY        1
+#define LOOP_READING    2
+#define LOOP_SIGNAL     3
+#define LOOP_TIMER      4
+#define LOOP_CONTROL    5
+#define LOOP_RELOAD     6
+#define LOOP_DASH       7
+#define LOOP_MAXEVENTS  8
+
+typedef struct _LOG_TARGET {
+    char     *DataPath;
+    char     *PathTemplate;
+    uint16_t  LogMode;
+    uint16_t  InfoFlag;
+} LogTarget;
+
+//the options of the command line, the keys of a configuration file map to them in wmbusconf.c
+typedef struct _OPTIONS {
+    char     DataPath[_MAX_PATH];       // -f
+    char     PathTemplate[_MAX_PATH];   // -o
+    uint16_t MaxOpen;                   // -n
+    char     JournalPath[_MAX_PATH];    // -j
+    int      CommitWindow;              // -w
+    char     SegLogPath[_MAX_PATH];     // -s
+    char     StreamSpec[_MAX_PATH];     // -S
+    char     MqttBroker[_MAX_PATH];     // -M
+    char     EmonSpec[_MAX_PATH];       // -E
+    char     MetricsSpec[_MAX_PATH];    // -P
+    char     LatestPath[_MAX_PATH];     // -L
+    char     ControlPath[_MAX_PATH];    // -C
+    char     JsonPath[_MAX_PATH];       // -J
+    char     SinkSpec[_MAX_PATH];       // -Q
+    char     FwdSpec[_MAX_PATH];        // -F
+    char     AggSpec[_MAX_PATH];        // -A
+    int      Depth;                     // -d
+    char     ConfPath[_MAX_PATH];       // -c
+    char     LogLevels[_MAX_PATH];      // -v
+    char     LogTarget[_MAX_PATH];      // -V
+    bool     Daemon;                    // -D
+    bool     Dashboard;                 // -T
+    uint16_t InfoFlag;                  // -i
+    char     Device[_MAX_PATH];         // -p
+    uint16_t Mode;                      // -m
+    uint16_t LogMode;                   // -l
+} Options;
+
+//what the control socket may change, owned by main
+typedef struct _GATEWAY {
+    pecwMBUSMeter Meters;      // MAXMETER slots as in the meter database
+    int          *Count;       // slots in use up to the last one
+    int           hStick;
+    uint16_t      Stick;
+    uint16_t      InfoFlag;
+    bool          Persist;     // changes go to the meter database, not with the meters of a config file
+    const char   *Source;      // configuration file or meter database, read again on SIGHUP or when it changes
+} Gateway;
+
+//Log Reading with date info to CSV File, the value with every digit the meter sent
+int Log2CSVFile(const char *path, const ecMBUSData *rfData, const struct tm *tm) {
+    static const char Header[] = "Date, Value, Payload \n";
+    char  line[sizeof(Header) + FMT_MAXDATE + FMT_MAXVALUE + 8 + 2*sizeof(rfData->payload)];
+    int   len = 0;
+    int   fd;
+    bool  isNew;
     int   MessageLength = 10;
 
     MessageLength = rfData->payloadLength;
 
-    printf("\nMessage Length: %d\n",MessageLength);
+    Log_Printf(LOGCAT_OUTPUT, LOGLVL_DEBUG, "Message Length: %d", MessageLength);
 
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
+    if ((fd = Out_GetFile(&LogFiles, path, O_WRONLY | O_APPEND, &isNew)) < 0)
+        return APIERROR;
 
-    if ((hFile = fopen(path, "rb")) != NULL) {
-        fseek(hFile, 0L, SEEK_END);
-        FileSize = ftell(hFile);
-        fseek(hFile, 0L, SEEK_SET);
-        fclose(hFile);
+    if (isNew) { //start a new file with Header
+        memcpy(line, Header, sizeof(Header)-1);
+        len += sizeof(Header)-1;
     }
-
-    if ((hFile = fopen(path, "a")) != NULL) {
-        if (FileSize == 0)  //start a new file with Header
-            fprintf(hFile, "Date, Value, Payload \n");
-        fprintf(hFile,"%d-%02d-%02d %02d:%02d, %.1f, ", tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, Value);
-        for (iX=0;iX<MessageLength;iX++) 
-            fprintf(hFile,"%02X",rfData->payload[iX]);
-        fprintf(hFile,"\n");
-        fclose(hFile);
-    } else
+    len += Fmt_Date(line+len, tm, FMT_DATE_ISO);
+    line[len++] = ',';
+    line[len++] = ' ';
+    len += Fmt_Value(line+len, rfData->value, rfData->exp);
+    line[len++] = ',';
+    line[len++] = ' ';
+    len += Fmt_HexBytesUpper(line+len, rfData->payload, min(MessageLength, (int)sizeof(rfData->payload)));
+    line[len++] = '\n';
+
+    //one write per row, the file stays open in the cache
+    if (write(fd, line, len) != len) {
+        Out_CloseFile(&LogFiles, path);
         return APIERROR;
-
+    }
     return APIOK;
 }
 
 
-int getkey(void) {
-    int character;
-    struct termios orig_term_attr;
-    struct termios new_term_attr;
+//RSSI, access number and the value of a reading on the console
+void PrintValue(const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    const char *unit = Fmt_Unit(meter->type);
+    char        line[64 + FMT_MAXVALUE];
+    int         len = 0;
+
+    memcpy(line, " RSSI=", 6);       len += 6;
+    len += Fmt_I32(line+len, data->rssiDBm);
+    memcpy(line+len, " dbm, #", 7);  len += 7;
+    len += Fmt_U32(line+len, data->accNo);
+    line[len++] = ' ';
+    len += Fmt_Value(line+len, data->value, data->exp);
+    line[len++] = ' ';
+    memcpy(line+len, unit, strlen(unit)); len += strlen(unit);
+    line[len++] = ' ';
+    fwrite(line, 1, len, stdout);
+}
 
-    /* set the terminal to raw mode */
-    tcgetattr(fileno(stdin), &orig_term_attr);
-    memcpy(&new_term_attr, &orig_term_attr, sizeof(struct termios));
-    new_term_attr.c_lflag &= ~(ECHO|ICANON);
-    new_term_attr.c_cc[VTIME] = 0;
-    new_term_attr.c_cc[VMIN]  = 0;
-    tcsetattr(fileno(stdin), TCSANOW, &new_term_attr);
+//the terminal stays in raw mode while the main loop waits for keys, the prompts of 'a' and 'r' need line mode
+static struct termios KeyTerm;
+static bool           KeyRaw = false;
+
+void SetKeyMode(bool raw) {
+    struct termios t;
+
+    if(!isatty(STDIN_FILENO) || (raw == KeyRaw)) return;
+    if(raw) {
+        tcgetattr(STDIN_FILENO, &KeyTerm);
+        memcpy(&t, &KeyTerm, sizeof(struct termios));
+        t.c_lflag &= ~(ECHO|ICANON);
+        t.c_cc[VTIME] = 0;
+        t.c_cc[VMIN]  = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &t);
+    }
+    else
+        tcsetattr(STDIN_FILENO, TCSANOW, &KeyTerm);
+    KeyRaw = raw;
+}
 
-    /* read a character from the stdin stream without blocking */
-    /*   returns EOF (-1) if no character is available */
-    character = fgetc(stdin);
+void RestoreKeyMode(void) {
+    SetKeyMode(false);
+}
 
-    /* restore the original terminal attributes */
-    tcsetattr(fileno(stdin), TCSANOW, &orig_term_attr);
+//one key, called when stdin is readable; returns EOF (-1) if no character is available
+int getkey(void) {
+    unsigned char character;
 
-    return character;
+    return (read(STDIN_FILENO, &character, 1) == 1) ? character : EOF;
+}
+
+//the timer redraws the dashboard while it is shown and is stopped otherwise, false without a terminal
+bool ShowDashboard(int fd, bool on) {
+    struct itimerspec period = { { 0, 0 }, { 0, 0 } };
+
+    if(on && (APIOK == Dash_Show(&Dash, true))) {
+        period.it_interval.tv_sec  = DASH_INTERVALMS/1000;
+        period.it_interval.tv_nsec = (DASH_INTERVALMS%1000)*1000000L;
+        period.it_value.tv_nsec    = 1; //first draw right away
+    }
+    else
+        Dash_Show(&Dash, false);
+    timerfd_settime(fd, 0, &period, NULL);
+    return Dash.shown;
 }
 
 static int iTime;
-static int iMinute;
 
 int IsNewSecond(int iS) {
     int CurTime;
@@ -100,19 +287,6 @@ int IsNewSecond(int iS) {
     return 0;
 }
 
-int IsNewMinute(void) {
-    int CurTime;
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    CurTime = tm.tm_hour*60+tm.tm_min;
-
-    if (CurTime != iMinute) {
-        iMinute = CurTime;
-        return 1;
-    }
-    return 0;
-}
-
 void Intro(void) {
     printf("   \n");
     Colour(62, false);
@@ -127,6 +301,7 @@ void Intro(void) {
     printf("   r   : Remove meter\n");
     printf("   l   : List meters\n");
     printf("   u   : Update - check for data\n");
+    printf("   d   : Dashboard on/off\n");
     printf("   q   : Quit\n");
     printf("   \n");
 }
@@ -140,31 +315,80 @@ void IntroShowParam(void) {
     Colour(0,true);
     printf("   Commandline options:\n");
     printf("   ./eccwmbus -f /home/user/ecdata -p 0 -m S\n");
-    printf("   -p 0     : Portnumber 0 -> /dev/ttyUSB0\n");
+    printf("   -p 0     : Portnumber 0 -> /dev/ttyUSB0, or the device path, e.g. -p /dev/serial/by-id/...\n");
     printf("   -m S     : S2 mode \n");
+    printf("   -f <dir> : data path for the log files, default %s\n", OUT_DEFAULTDATAPATH);
+    printf("   -o <tmpl>: CSV path template, default %s\n", OUT_DEFAULTTEMPLATE);
+    printf("              %%d data path, %%m manufacturer, %%i ident, %%t type, %%v version, %%Y %%M %%D date\n");
+    printf("   -n <num> : max. number of log files kept open, default %d\n", OUT_DEFAULTMAXOPEN);
+    printf("   -j <file>: write-ahead journal, replayed into the log files after a crash\n");
+    printf("   -w <ms>  : journal group commit window, default %d ms\n", JNL_DEFAULTWINDOW);
+    printf("   -s <dir> : segment log with per consumer offsets (read with eccwmbus-consume)\n");
+    printf("   -S <lst> : stream readings to subscribers, comma separated listeners\n");
+    printf("              tcp:[addr:]port or unix:path, json: prefix for JSON lines, e.g. -S tcp:7000,json:unix:/tmp/wmbus.sock\n");
+    printf("   -M <host>: publish to the MQTT broker host[:port] as %s/<manid>/<ident>/value\n", MQTT_TOPICPREFIX);
+    printf("              readings are spooled to <data path>/mqtt.spool while the broker is away\n");
+    printf("   -E <url> : upload to emoncms in batches, apikey@host[:port][/path], e.g. <key>@emonpi.local/emoncms\n");
+    printf("              readings are spooled to <data path>/emoncms.spool while it is unreachable\n");
+    printf("   -L <file>: latest value table in shared memory, e.g. %s (read with eccwmbus-latest)\n", SHM_DEFAULTPATH);
+    printf("   -C <file>: control socket for eccwmbus-ctl, e.g. %s\n", CTL_DEFAULTPATH);
+    printf("   -J <file>: one JSON object per reading, - for stdout (console output goes to stderr)\n");
+    printf("              raw: prefix adds the payload as hex, e.g. -J raw:-\n");
+    printf("   -P <port>: Prometheus metrics on http://[addr:]port/metrics\n");
+    printf("   -Q <lst> : output queue policies, name=policy[:depth],... e.g. -Q mqtt=spill,file=block:1024\n");
+    printf("              outputs file seglog stream mqtt ndjson emoncms forward, policies block drop-oldest drop-newest spill\n");
+    printf("              default block for file and seglog, spill for forward, drop-oldest otherwise, %d readings deep\n", SINK_DEFAULTDEPTH);
+    printf("   -F <dst> : forward the readings to an aggregator, [raw:]host[:port][/id], default port %d, id the host name\n", FWD_DEFAULTPORT);
+    printf("              raw: forwards every frame the stick hears, not only the meters in the list\n");
+    printf("   -A <port>: aggregate the readings of forwarders on [addr:]port, copies heard by several gateways\n");
+    printf("              are handed on once with the best RSSI; the stick is optional\n");
+    printf("   -d <num> : readings kept per meter until they are shown, default %d, overwrites are counted\n", RING_DEFAULTDEPTH);
+    printf("   -l HST   : log to the history store instead of CSV (read with eccwmbus-query)\n");
+    printf("   -c <file>: read the options and the meter list from a configuration file, the command line wins\n");
+    printf("              the meters are read again when the file changes or on SIGHUP (meters.db without -c)\n");
+    printf("   -D       : daemon mode for systemd, no terminal input, readiness with sd_notify, SIGTERM ends it\n");
+    printf("   -v <lvl> : log levels, a level for all and/or category=level,... e.g. -v info,driver=debug,frame=warn\n");
+    printf("              levels off error warn info debug trace, categories main driver frame meter output net\n");
+    printf("              frame=info logs every frame as hex, the default except in daemon mode\n");
+    printf("   -V <dst> : log to - (stdout, default), syslog or a file that is appended to\n");
+    printf("   -T       : full screen dashboard, one row per meter, 'd' switches to the scrolling view and back\n");
     printf("   -i       : show detailed infos \n\n");
 }
 
 void ErrorAndExit(const char *info) {
+    Dash_Show(&Dash, false);
+    Log_Stop(); //what is logged comes before the error
     Colour(PRINTF_RED, false);
     printf("%s", info);
     Colour(0, true);
-    exit(0);
+    exit(1);
 }
 
+//sd_notify protocol, a datagram to $NOTIFY_SOCKET when started by systemd with Type=notify
+void Notify(const char *state) {
+    struct sockaddr_un addr;
+    const char        *path = getenv("NOTIFY_SOCKET");
+    size_t             len;
+    int                fd;
+
+    if((NULL == path) || ((path[0] != '/') && (path[0] != '@')) || ((len = strlen(path)) >= sizeof(addr.sun_path))) return;
+    if((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) return;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, len);
+    if(path[0] == '@') addr.sun_path[0] = 0; //abstract namespace
+    if(sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len) < 0) {}
+    close(fd);
+}
+
+//the decimal digits as hex digits, 12345678 -> 0x12345678 as printed on the meter
 unsigned int CalcUIntBCD(  unsigned int ident) {
-    int32_t identNumBCD=0;
-    #define MAXIDENTLEN 12
-    uint8_t  identchar[MAXIDENTLEN];
-    memset(identchar,0,MAXIDENTLEN*sizeof(uint8_t));
-    sprintf((char *)identchar, "%08d", ident);
-    uint32_t uiMul = 1;
-    uint8_t  uiX   = 0;
-    uint8_t  uiLen = strlen((char const*)identchar);
-
-    for(uiX=0; uiX < uiLen;uiX++) {
-        identNumBCD += (identchar[uiLen-1-uiX] - '0')*uiMul;
-        uiMul = uiMul*16;
+    unsigned int identNumBCD = 0;
+    int          shift;
+
+    for(shift = 0; (ident > 0) && (shift < 32); shift += 4) {
+        identNumBCD |= (ident % 10) << shift;
+        ident /= 10;
     }
     return identNumBCD;
 }
@@ -179,6 +403,7 @@ unsigned int CalcHEXStrBCD(  const char *string) {
 }
 
 void DisplayListofMeters(int iMax, pecwMBUSMeter ecpiwwMeter) {
+    ecwMBUSDbRec rec;
     int iX,iI;
 
     if(iMax == 0) printf("\nNo Meters defined.\n");
@@ -190,7 +415,7 @@ void DisplayListofMeters(int iMax, pecwMBUSMeter ecpiwwMeter) {
         }
         printf("\n\nList of active Meters (%d defined):\n\n", iI);
         if (iI>0) {
-            printf("No.   Manuf.  Ident       Type  Ver.  AES-Key\n");
+            printf("No.   Manuf.  Ident       Type  Ver.  AES-Key                             Label\n");
             printf("======================================");
             for(iI = 0; iI<AES_KEYLENGHT_IN_BYTES+1; iI++)
                 printf("==");
@@ -204,38 +429,38 @@ void DisplayListofMeters(int iMax, pecwMBUSMeter ecpiwwMeter) {
             printf("0x%08X  ", ecpiwwMeter[iX].ident);
             printf("0x%02X  ", ecpiwwMeter[iX].type);
             printf("0x%02X  ", ecpiwwMeter[iX].version);
-            printf("0x", iX+1);
+            printf("0x");
             for(iI = 0; iI<AES_KEYLENGHT_IN_BYTES; iI++)
                 printf("%02X",ecpiwwMeter[iX].key[iI]);
+            if((APIERROR != Db_Find(&MeterDb, ecpiwwMeter[iX].manufacturerID, ecpiwwMeter[iX].ident, &rec)) && (0 != rec.label[0]))
+                printf("  %s", rec.label);
             printf("\n");
         }
     }
     printf("\n");
 }
 
+//the driver sets or clears only the key slots that differ from the list
 void UpdateMetersonStick(unsigned long handle, uint16_t stick, int iMax, pecwMBUSMeter ecpiwwMeter, uint16_t infoflag) {
-    int iX;
+    if(0 == handle) return; //aggregator without a stick
 
-    for(iX=0; iX<MAXMETER; iX++)
-        wMBus_RemoveMeter(iX);
-
-    for(iX=0; iX<iMax; iX++) {
-        if( 0 != ecpiwwMeter[iX].manufacturerID)
-            wMBus_AddMeter(handle, stick, iX, &ecpiwwMeter[iX], infoflag);
-    }
+    if(APIERROR == wMBus_SyncMeters(handle, stick, ecpiwwMeter, iMax, infoflag))
+        Log_Printf(LOGCAT_METER, LOGLVL_ERROR, "Not all meters could be set on the stick");
 }
 
 #define XMLBUFFER (1*1024*1024)
-unsigned int Log2XMLFile(const char *path, double Reading, ecMBUSData *rfData) {
+#define PUTXML(s)         do { memcpy(szBuf+n, s, sizeof(s)-1); n += sizeof(s)-1; } while(0)
+#define XMLTAG(name, fmt) do { PUTXML("<" name ">"); n += fmt; PUTXML("</" name ">\n"); } while(0)
+
+unsigned int Log2XMLFile(const char *path, uint32_t value, int8_t exp, ecMBUSData *rfData) {
     char szBuf[250];
+    int  n = 0;
     FILE    *hFile;
     unsigned char*  pXMLIN = NULL;
     unsigned char*  pXMLTop,*pXMLMem = NULL;
     unsigned char*  pXML;
     unsigned int   dwSize   = 0;
     unsigned int   dwSizeIn = 0;
-    char  CurrentTime[250];
-
     time_t t = time(NULL);
     struct tm tm = *localtime(&t);
 
@@ -289,21 +514,19 @@ unsigned int Log2XMLFile(const char *path, double Reading, ecMBUSData *rfData) {
     }
 
     if(pXMLMem) {
-        sprintf(szBuf, "<OCR>\n");
-        memcpy(pXML, szBuf, strlen(szBuf)); dwSize+=strlen(szBuf); pXML+=strlen(szBuf);
-
-        sprintf(CurrentTime, "%02d.%02d.%d %02d:%02d:%02d", tm.tm_mday,tm.tm_mon+1, tm.tm_year+1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
-        sprintf(szBuf, "<Date>%s</Date>\n", CurrentTime); memcpy(pXML, szBuf,strlen(szBuf)); dwSize+=strlen(szBuf); pXML+=strlen(szBuf);
-
-        sprintf(szBuf, "<Reading>%.1f</Reading>\n", Reading); memcpy(pXML, szBuf, strlen(szBuf)); dwSize+=strlen(szBuf); pXML+=strlen(szBuf);
+        //one reading, the value with every digit the meter sent
+        PUTXML("<OCR>\n");
+        XMLTAG("Date",    Fmt_Date(szBuf+n, &tm, FMT_DATE_DMY));
+        XMLTAG("Reading", Fmt_Value(szBuf+n, value, exp));
         if(NULL != rfData) {
-            sprintf(szBuf, "<RSSI>%d</RSSI>\n",                 rfData->rssiDBm);    memcpy(pXML, szBuf, strlen(szBuf)); dwSize+=strlen(szBuf); pXML+=strlen(szBuf);
-            sprintf(szBuf, "<Pic>%d</Pic>\n",                   rfData->utcnt_pic);  memcpy(pXML, szBuf, strlen(szBuf)); dwSize+=strlen(szBuf); pXML+=strlen(szBuf);
-            sprintf(szBuf, "<Tx>%d</Tx>\n",                     rfData->utcnt_tx);   memcpy(pXML, szBuf, strlen(szBuf)); dwSize+=strlen(szBuf); pXML+=strlen(szBuf);
-            sprintf(szBuf, "<ConfigWord>%d</ConfigWord>\n",     rfData->configWord); memcpy(pXML, szBuf, strlen(szBuf)); dwSize+=strlen(szBuf); pXML+=strlen(szBuf);
-            sprintf(szBuf, "<wMBUSStatus>%d</wMBUSStatus>\n",   rfData->status);     memcpy(pXML, szBuf, strlen(szBuf)); dwSize+=strlen(szBuf); pXML+=strlen(szBuf);
+            XMLTAG("RSSI",        Fmt_I32(szBuf+n, rfData->rssiDBm));
+            XMLTAG("Pic",         Fmt_U32(szBuf+n, rfData->utcnt_pic));
+            XMLTAG("Tx",          Fmt_U32(szBuf+n, rfData->utcnt_tx));
+            XMLTAG("ConfigWord",  Fmt_U32(szBuf+n, rfData->configWord));
+            XMLTAG("wMBUSStatus", Fmt_U32(szBuf+n, rfData->status));
         }
-        sprintf(szBuf,"</OCR>\n");memcpy(pXML,szBuf,strlen(szBuf));dwSize+=strlen(szBuf);pXML+=strlen(szBuf);
+        PUTXML("</OCR>\n");
+        memcpy(pXML, szBuf, n); dwSize+=n; pXML+=n;
 
         if(dwSizeIn>0) {
             memcpy(pXML, pXMLTop, dwSizeIn);
@@ -318,7 +541,7 @@ unsigned int Log2XMLFile(const char *path, double Reading, ecMBUSData *rfData) {
             chmod(path, 0666);
         }
         else {
-            fprintf(stderr, "Cannot write to >%s<\n", path);
+            Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Cannot write to >%s<", path);
         }
     }
 
@@ -328,44 +551,839 @@ unsigned int Log2XMLFile(const char *path, double Reading, ecMBUSData *rfData) {
     return true;
 }
 
+//Log Reading to the per meter history store (see eccwmbus-query)
+int Log2HistFile(const char *path, const ecMBUSData *rfData, const ecwMBUSMeter *RFSource, time_t t) {
+    ecwMBUSHistRec rec;
+    int fd;
+
+    Hist_FromRFData(&rec, (uint32_t)t, rfData);
+    if (((fd = Out_GetFile(&LogFiles, path, O_RDWR, NULL)) < 0) || (Hist_AppendFd(fd, RFSource, &rec, 1) != APIOK)) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Cannot write to >%s<", path);
+        Out_CloseFile(&LogFiles, path);
+        return APIERROR;
+    }
+    return APIOK;
+}
+
 //Log Reading with date info to CSV File
-int Log2File(char *DataPath, uint16_t mode, uint16_t meterindex, uint16_t infoflag, float metervalue, ecMBUSData *rfData, pecwMBUSMeter RFSource) {
-    char  param[  _MAX_PATH];
+int Log2File(char *DataPath, char *PathTemplate, uint16_t mode, uint16_t meterindex, uint16_t infoflag, const ecMBUSData *rfData, const ecwMBUSMeter *RFSource) {
     char  datFile[_MAX_PATH];
-    FILE  *hDatFile;
-    time_t t;
+    time_t t = (0 != rfData->time) ? (time_t)rfData->time : time(NULL); //reception time
     struct tm curtime;
 
+    localtime_r(&t, &curtime);
+    if ((NULL == DataPath) || (0 == *DataPath))
+        DataPath = OUT_DEFAULTDATAPATH;
+
     switch(mode) {
+        case LOGTOHST : if(APIOK != Hist_MakePath(datFile, _MAX_PATH, DataPath, RFSource))
+                            return APIERROR;
+                        return Log2HistFile(datFile, rfData, RFSource, t);
+                        break;
+
         default:
-        case LOGTOCSV : sprintf(param, "/home/pi/data/wmbus/wmbus_%04x_%08x_%02x_%02x.csv", RFSource->manufacturerID, RFSource->ident, RFSource->type, RFSource->version);
-                        Log2CSVFile(param, metervalue, rfData); //log kWh
-                        return APIOK;
+        case LOGTOCSV : if(APIOK != Out_ExpandPath(datFile, _MAX_PATH, ((NULL == PathTemplate) || (0 == *PathTemplate)) ? OUT_DEFAULTTEMPLATE : PathTemplate, DataPath, RFSource, &curtime)) {
+                            Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Invalid path template >%s<", PathTemplate);
+                            return APIERROR;
+                        }
+                        return Log2CSVFile(datFile, rfData, &curtime);
                         break;
     }
     return APIERROR;
 }
 
+//journal every reading as soon as it arrives, log it under its journal seq, hand it to the output queues and wake the main loop
+void Deliver(int Index, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    pecwMBUSReading reading = Pool_Get(meter, data); //one copy for the file and all outputs
+    uint64_t        t, seq = 0, one = 1;
+    bool            wake;
+
+    if(UseLatest)  Shm_Update(&Latest, Index, meter, data);
+    //the file output gets the readings in seq order, so the last one written has every lower seq written
+    pthread_mutex_lock(&LogLock);
+    if(UseJournal) {
+        t = Met_NowUs();
+        Jnl_Append(&Journal, meter, data, &seq);
+        Met_Observe(MET_SINKJOURNAL, t);
+    }
+    Sink_PutReading(&FileSink, reading, seq);
+    pthread_mutex_unlock(&LogLock);
+    Sink_DispatchReading(&Outputs, reading, 0);
+    if(NULL != reading) Pool_Release(reading);
+
+    pthread_mutex_lock(&RoundLock);
+    wake = (0 == RoundMask);
+    if(Ring_Push(&RoundQueue[Index], data))
+        RoundMask |= (0x01<<Index);
+    pthread_mutex_unlock(&RoundLock);
+    if(wake && (RoundEvent >= 0) && (write(RoundEvent, &one, sizeof(one)) < 0)) {}
+}
+
+//readings of the local stick; with the aggregator they join the readings of the forwarders first
+void OnReading(int Index, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    if(UseAgg) Agg_Submit(&Agg, meter, data);
+    else       Deliver(Index, meter, data);
+}
+
+//every frame of the stick for the raw forwarder, decoded only for the meters on the stick
+void OnFrame(void *ctx, int Index, const ecwMBUSMeter *meter, const ecMBUSData *data, const uint8_t *frame, int frameLength) {
+    Sink_Put(&FwdSink, meter, data, (Index < 0) ? FWD_UNREGISTERED : 0);
+}
+
+//readings of all gateways once, called from the aggregator thread; the slot is taken from the meter list
+//a raw copy (FWD_UNREGISTERED) comes from a gateway without the meter, it was decoded there as far as the
+//stick could: unencrypted meters carry their value, encrypted ones come with PACKET_DECRYPTIONERROR
+void OnAggregated(void *ctx, const char *gateway, int flags, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    Gateway *gw = (Gateway *) ctx;
+    int      iX;
+
+    for(iX=0; iX<*gw->Count; iX++) {
+        if((gw->Meters[iX].manufacturerID == meter->manufacturerID) && (gw->Meters[iX].ident == meter->ident)) {
+            Deliver(iX, &gw->Meters[iX], data);
+            return;
+        }
+    }
+    AggUnknown++;
+}
+
+//the oldest reading of a meter the main loop has not seen, false if there is none
+bool TakeRoundData(int Index, ecMBUSData *data) {
+    bool has;
+
+    pthread_mutex_lock(&RoundLock);
+    has = Ring_Pop(&RoundQueue[Index], data);
+    if(0 == RoundQueue[Index].count)
+        RoundMask &= ~(0x01<<Index);
+    pthread_mutex_unlock(&RoundLock);
+    return has;
+}
+
+//a freed slot starts empty for the next meter: the readings and counts of the one before go
+void ResetSlot(int Index) {
+    pthread_mutex_lock(&RoundLock);
+    Ring_Clear(&RoundQueue[Index]);
+    RoundQueue[Index].overwritten = 0;
+    RoundMask &= ~(0x01<<Index);
+    pthread_mutex_unlock(&RoundLock);
+    Met_ResetMeter(Index);
+}
+
+//readings of a meter overwritten before the main loop showed them
+unsigned long GetRoundOverwritten(int Index, unsigned long *queued) {
+    unsigned long overwritten;
+
+    pthread_mutex_lock(&RoundLock);
+    overwritten = RoundQueue[Index].overwritten;
+    if(NULL != queued) *queued = RoundQueue[Index].count;
+    pthread_mutex_unlock(&RoundLock);
+    return overwritten;
+}
+
+unsigned long GetRoundMask(void) {
+    unsigned long mask;
+
+    pthread_mutex_lock(&RoundLock);
+    mask = RoundMask;
+    pthread_mutex_unlock(&RoundLock);
+    return mask;
+}
+
+//write handlers of the sinks, called from the sink threads
+int WriteFile(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    LogTarget *target = (LogTarget *) ctx;
+
+    return Log2File(target->DataPath, target->PathTemplate, target->LogMode, 0, target->InfoFlag, data, meter);
+}
+
+//the file queue ran empty, the tag is the journal seq of the last reading written
+void FileIdle(void *ctx, uint64_t tag) {
+    if(UseJournal) {
+        Out_SyncAll(&LogFiles);
+        Jnl_Checkpoint(&Journal, tag);
+    }
+}
+
+int WriteSegLog(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    return Seg_Append(&SegLog, meter, data, NULL);
+}
+
+int WriteStream(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    Stream_Publish(&Stream, meter, data);
+    return APIOK;
+}
+
+int WriteMqtt(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    Mqtt_Publish(&Mqtt, meter, data);
+    return APIOK;
+}
+
+int WriteEmon(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    Emon_Publish(&Emon, meter, data);
+    return APIOK;
+}
+
+//every name=policy entry of -Q has to name an output
+int CheckSinkSpec(const char *spec) {
+    const char *p = spec, *eq;
+    int         iX;
+
+    while((NULL != p) && (0 != *p)) {
+        if(NULL == (eq = strchr(p, '='))) return APIERROR;
+        for(iX=0; NULL != SinkNames[iX]; iX++)
+            if((strlen(SinkNames[iX]) == (size_t)(eq - p)) && (0 == strncmp(p, SinkNames[iX], eq - p))) break;
+        if(NULL == SinkNames[iX]) {
+            fprintf(stderr, "Unknown output >%.*s<\n", (int)(eq - p), p);
+            return APIERROR;
+        }
+        if(NULL != (p = strchr(eq, ','))) p++;
+    }
+    return APIOK;
+}
+
+void OpenSink(pecwMBUSSink sink, const char *name, int metSink, int policy, bool fixed, const char *spec, const char *datapath,
+              Sink_WriteHandler write, Sink_IdleHandler idle, void *ctx, bool dispatch) {
+    ecwMBUSSinkPolicy p;
+
+    memset(&p, 0, sizeof(p));
+    p.policy = policy;
+    p.depth  = SINK_DEFAULTDEPTH;
+    snprintf(p.spoolPath, _MAX_PATH, "%s/%s.sink.spool", (0 != datapath[0]) ? datapath : OUT_DEFAULTDATAPATH, name);
+    if(APIOK != Sink_ParsePolicy(spec, name, &p))
+        ErrorAndExit("Invalid -Q, name=policy[:depth],...\n");
+    if(fixed && (p.policy != policy)) {
+        fprintf(stderr, "The %s output keeps the %s policy\n", name, Sink_PolicyName(policy));
+        p.policy = policy;
+    }
+    if(SINK_SPILL == p.policy)
+        Out_MakeDirs(p.spoolPath);
+    if(APIOK != Sink_Open(sink, name, metSink, &p, write, idle, ctx)) {
+        fprintf(stderr, "Cannot start the %s output queue\n", name);
+        ErrorAndExit("Cannot start output\n");
+    }
+    Sink_Add(&AllSinks, sink);
+    if(dispatch)
+        Sink_Add(&Outputs, sink);
+}
+
+//queue depths of the outputs, called by the metrics thread for every scrape
+int CollectQueues(void *ctx, ecwMBUSMetQueue *queues, int max) {
+    unsigned long spooled;
+    int           n = 0;
+    int           iX;
+
+    if(UseJournal && (n < max)) {
+        queues[n].name = "journal";
+        Jnl_GetQueue(&Journal, &queues[n].queued, &queues[n].dropped);
+        n++;
+    }
+    if(UseStream && (n < max)) {
+        queues[n].name = "stream";
+        Stream_GetQueue(&Stream, &queues[n].queued, &queues[n].dropped);
+        n++;
+    }
+    if(UseMqtt && (n+1 < max)) {
+        queues[n].name = "mqtt";
+        Mqtt_GetQueue(&Mqtt, &queues[n].queued, &spooled, &queues[n].dropped);
+        n++;
+        queues[n].name    = "mqtt_spool";
+        queues[n].queued  = spooled;
+        queues[n].dropped = 0;
+        n++;
+    }
+    if(UseEmon && (n+1 < max)) {
+        queues[n].name = "emoncms";
+        Emon_GetQueue(&Emon, &queues[n].queued, &spooled, &queues[n].dropped);
+        n++;
+        queues[n].name    = "emoncms_spool";
+        queues[n].queued  = spooled;
+        queues[n].dropped = 0;
+        n++;
+    }
+    if(UseNdjson && (n < max)) {
+        queues[n].name = "ndjson";
+        Ndj_GetQueue(&Ndjson, &queues[n].queued, &queues[n].dropped);
+        n++;
+    }
+    if(n < max) {
+        unsigned long queued;
+        queues[n].name    = "meters";
+        queues[n].queued  = 0;
+        queues[n].dropped = 0;
+        for(iX=0; iX<MAXMETER; iX++) {
+            queues[n].dropped += GetRoundOverwritten(iX, &queued);
+            queues[n].queued  += queued;
+        }
+        n++;
+    }
+    for(iX=0; (iX<AllSinks.count) && (n < max); iX++) {
+        queues[n].name   = AllSinks.sinks[iX]->queueName;
+        queues[n].hasLag = true;
+        Sink_GetQueue(AllSinks.sinks[iX], &queues[n].queued, &spooled, &queues[n].dropped, &queues[n].lagUs);
+        n++;
+    }
+    return n;
+}
+
+//readings found in the journal after a crash go to the log files again
+void ReplayReading(uint64_t seq, const ecwMBUSMeter *meter, ecMBUSData *data, void *ctx) {
+    LogTarget *target = (LogTarget *) ctx;
+
+    Log2File(target->DataPath, target->PathTemplate, target->LogMode, 0, target->InfoFlag, data, meter);
+}
+
+//meters.db, in the data path if -f is given
+static char MeterDbPath[_MAX_PATH] = DB_FILENAME;
+
+//a meter set in a slot goes to the database at once, with the label it has there
+int StoreMeter(const ecwMBUSMeter *meter, int slot, const char *label) {
+    ecwMBUSDbRec rec;
+
+    if(APIERROR == Db_Find(&MeterDb, meter->manufacturerID, meter->ident, &rec))
+        memset(&rec, 0, sizeof(rec));
+    rec.meter = *meter;
+    rec.slot  = (uint8_t) slot;
+    if(NULL != label)
+        snprintf(rec.label, sizeof(rec.label), "%s", label);
+    Out_MakeDirs(MeterDbPath);
+    if(APIOK != Db_Put(&MeterDb, &rec)) {
+        Log_Printf(LOGCAT_METER, LOGLVL_ERROR, "Cannot write %s", MeterDbPath);
+        return APIERROR;
+    }
+    return APIOK;
+}
+
+//a meter taken out of its slot stays in the database with its key and label
+int UnwatchMeter(const ecwMBUSMeter *meter) {
+    return Db_SetSlot(&MeterDb, meter->manufacturerID, meter->ident, DB_NOSLOT);
+}
+
+static int LoopAdd(int loop, int fd, uint32_t what) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.u32 = what;
+    return (0 == epoll_ctl(loop, EPOLL_CTL_ADD, fd, &ev)) ? APIOK : APIERROR;
+}
+
+//the expirations or events counted since the last read
+static void LoopDrain(int fd, size_t size) {
+    uint8_t buf[sizeof(struct signalfd_siginfo)];
+
+    if(read(fd, buf, size) < 0) {}
+}
+
+//the meters of the configuration file or the watched meters of the database with the slots they
+//want, APIERROR keeps the list as it is
+static int ReadMeterSource(Gateway *gw, pecwMBUSMeter meters, uint8_t *slots, int *count) {
+    ecwMBUSConf conf;
+    int         iX;
+
+    memset(meters, 0, MAXMETER*sizeof(ecwMBUSMeter));
+    if(!gw->Persist) {
+        if(APIOK != Conf_Load(&conf, gw->Source, NULL))
+            return APIERROR;
+        memcpy(meters, conf.meters, conf.meterCount*sizeof(ecwMBUSMeter));
+        *count = conf.meterCount;
+        for(iX=0; iX<conf.meterCount; iX++)
+            slots[iX] = (uint8_t) iX; //the n-th meter line
+        Conf_Free(&conf);
+        return APIOK;
+    }
+    Db_Close(&MeterDb); //another program may have renamed a new file over it
+    if(APIOK != Db_Open(&MeterDb, gw->Source))
+        return APIERROR;
+    *count = Db_GetWatched(&MeterDb, meters, slots, MAXMETER);
+    if(*count > MAXMETER) {
+        Log_Printf(LOGCAT_METER, LOGLVL_WARN, "%d meters watched in %s, the stick has %d slots", *count, gw->Source, MAXMETER);
+        *count = MAXMETER;
+    }
+    return APIOK;
+}
+
+//one slot of the list, NULL empties it
+static void SetMeterSlot(Gateway *gw, int iX, const ecwMBUSMeter *meter) {
+    if(NULL == meter) {
+        memset(&gw->Meters[iX], 0, sizeof(ecwMBUSMeter));
+        Shm_Clear(&Latest, iX);
+        return;
+    }
+    gw->Meters[iX] = *meter;
+}
+
+//applies the difference to the new list: a meter that stays keeps its slot, new meters take the slot
+//they want or a free one; the stick gets only the slots that changed, the other slots keep receiving
+void ReloadMeters(Gateway *gw, bool report) {
+    ecwMBUSMeter meters[MAXMETER];
+    uint8_t      slots[MAXMETER];
+    uint8_t      stored[MAXMETER];  // slot the source has for the meter now in a slot
+    bool         placed[MAXMETER];
+    unsigned long reused = 0;       // slots freed by a meter that left
+    int          count = 0, added = 0, changed = 0, removed = 0;
+    int          iX, iN;
+
+    if(APIOK != ReadMeterSource(gw, meters, slots, &count)) {
+        Log_Printf(LOGCAT_METER, LOGLVL_ERROR, "Cannot read %s, the meters stay as they are", gw->Source);
+        return;
+    }
+    memset(placed, 0, sizeof(placed));
+    memset(stored, DB_NOSLOT, sizeof(stored));
+    for(iN=0; iN<count; iN++)
+        placed[iN] = (0 == meters[iN].manufacturerID);
+
+    for(iX=0; iX<*gw->Count; iX++) {
+        if(0 == gw->Meters[iX].manufacturerID) continue;
+        for(iN=0; iN<count; iN++) {
+            if(!placed[iN] && (meters[iN].manufacturerID == gw->Meters[iX].manufacturerID) && (meters[iN].ident == gw->Meters[iX].ident))
+                break;
+        }
+        if(iN == count) {
+            SetMeterSlot(gw, iX, NULL);
+            reused |= 0x01<<iX;
+            removed++;
+            continue;
+        }
+        placed[iN] = true;
+        stored[iX] = slots[iN];
+        if(0 != memcmp(&meters[iN], &gw->Meters[iX], sizeof(ecwMBUSMeter))) {
+            SetMeterSlot(gw, iX, &meters[iN]);
+            changed++;
+        }
+    }
+    for(iN=0; iN<count; iN++) {
+        if(placed[iN]) continue;
+        iX = slots[iN];
+        if((iX >= MAXMETER) || (0 != gw->Meters[iX].manufacturerID)) {
+            for(iX=0; (iX<MAXMETER) && (0 != gw->Meters[iX].manufacturerID); iX++)
+                ;
+        }
+        if(iX == MAXMETER) {
+            Log_Printf(LOGCAT_METER, LOGLVL_WARN, "All %d Meters defined, %04x %08x not added", MAXMETER, meters[iN].manufacturerID, meters[iN].ident);
+            continue;
+        }
+        SetMeterSlot(gw, iX, &meters[iN]);
+        stored[iX] = slots[iN];
+        *gw->Count = max(*gw->Count, iX+1);
+        added++;
+    }
+    while((*gw->Count > 0) && (0 == gw->Meters[*gw->Count-1].manufacturerID))
+        (*gw->Count)--;
+    if(added || changed || removed)
+        UpdateMetersonStick(gw->hStick, gw->Stick, *gw->Count, gw->Meters, gw->InfoFlag);
+
+    //once the stick no longer delivers the meters that left
+    for(iX=0; iX<MAXMETER; iX++) {
+        if(reused & (0x01<<iX))
+            ResetSlot(iX);
+    }
+
+    //the database learns the slots eccwmbus picked, one byte per meter that moved
+    for(iX=0; gw->Persist && (iX<*gw->Count); iX++) {
+        if((0 != gw->Meters[iX].manufacturerID) && (stored[iX] != iX))
+            Db_SetSlot(&MeterDb, gw->Meters[iX].manufacturerID, gw->Meters[iX].ident, (uint8_t) iX);
+    }
+    if(report && (added || changed || removed))
+        Log_Printf(LOGCAT_METER, LOGLVL_INFO, "Meters reloaded from %s: %d added, %d changed, %d removed", gw->Source, added, changed, removed);
+}
+
+//watches the directory, editors replace the file instead of writing it
+static int WatchSource(const char *path, char *name, size_t size) {
+    char        dir[_MAX_PATH];
+    const char *slash = strrchr(path, '/');
+    int         fd;
+
+    if(NULL == slash)
+        snprintf(dir, sizeof(dir), ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)((slash == path) ? 1 : slash-path), path);
+    snprintf(name, size, "%s", (NULL == slash) ? path : slash+1);
+    if((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+        return -1;
+    if(inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//true if one of the events is about the watched file
+static bool SourceChanged(int fd, const char *name) {
+    uint8_t buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    ssize_t len;
+    size_t  off;
+    bool    changed = false;
+
+    while((len = read(fd, buf, sizeof(buf))) > 0) {
+        for(off = 0; off < (size_t)len; off += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)(buf + off);
+            if((ev->len > 0) && (0 == strcmp(ev->name, name)))
+                changed = true;
+        }
+    }
+    return changed;
+}
+
+static void ControlMeter(pecwMBUSCtlReply reply, int iX, const ecwMBUSMeter *meter) {
+    ecwMBUSDbRec rec;
+
+    if((APIERROR == Db_Find(&MeterDb, meter->manufacturerID, meter->ident, &rec)) || (0 == rec.label[0]))
+        Ctl_Printf(reply, "%d %04x %08x %02x %02x\n", iX+1, meter->manufacturerID, meter->ident, meter->type, meter->version);
+    else
+        Ctl_Printf(reply, "%d %04x %08x %02x %02x %s\n", iX+1, meter->manufacturerID, meter->ident, meter->type, meter->version, rec.label);
+}
+
+//requests of the control socket, see ControlHelp; runs in the main loop
+int ControlRequest(void *ctx, int argc, char *argv[], pecwMBUSCtlReply reply) {
+    Gateway      *gw = (Gateway *) ctx;
+    ecwMBUSMeter  meter;
+    ecwMBUSDbRec  rec;
+    ecMBUSData    data;
+    ecwMBUSStickCounters counters;
+    unsigned long mode, queued, dropped, spooled;
+    uint32_t      updates;
+    char          err[80];
+    char          levels[LOGCAT_COUNT*16];
+    int           iX, ret;
+
+    if(0 == strcmp(argv[0], "meters")) {
+        for(iX=0; iX<*gw->Count; iX++)
+            if(0 != gw->Meters[iX].manufacturerID)
+                ControlMeter(reply, iX, &gw->Meters[iX]);
+        return APIOK;
+    }
+
+    //add <manid> <ident> <type> <version> [key|default|zero], numbers in hex as listed;
+    //add <manid> <ident> takes a meter of the database
+    if(0 == strcmp(argv[0], "add")) {
+        if((argc != 3) && ((argc < 5) || (argc > 6))) {
+            Ctl_Printf(reply, "usage: add <manid> <ident> [<type> <version> [key|default|zero]]");
+            return APIERROR;
+        }
+        if(argc == 3) {
+            char *ident[4] = { argv[1], argv[2], "0", "0" };
+
+            if((APIOK != Conf_ParseMeter(4, ident, &meter, err, sizeof(err))) ||
+               (APIERROR == Db_Find(&MeterDb, meter.manufacturerID, meter.ident, &rec))) {
+                Ctl_Printf(reply, "meter not in the database, add <manid> <ident> <type> <version> [key]");
+                return APIERROR;
+            }
+            meter = rec.meter;
+        }
+        else if(APIOK != Conf_ParseMeter(argc-1, argv+1, &meter, err, sizeof(err))) {
+            Ctl_Printf(reply, "%s", err);
+            return APIERROR;
+        }
+        for(iX=0; iX<MAXMETER; iX++) {
+            if((gw->Meters[iX].manufacturerID == meter.manufacturerID) && (gw->Meters[iX].ident == meter.ident)) {
+                Ctl_Printf(reply, "meter is in slot %d", iX+1);
+                return APIERROR;
+            }
+        }
+        for(iX=0; (iX<MAXMETER) && (0 != gw->Meters[iX].manufacturerID); iX++)
+            ;
+        if(iX == MAXMETER) {
+            Ctl_Printf(reply, "all %d meters defined", MAXMETER);
+            return APIERROR;
+        }
+        gw->Meters[iX] = meter;
+        *gw->Count = max(*gw->Count, iX+1);
+        UpdateMetersonStick(gw->hStick, gw->Stick, *gw->Count, gw->Meters, gw->InfoFlag);
+        if(gw->Persist)
+            StoreMeter(&meter, iX, NULL);
+        ControlMeter(reply, iX, &meter);
+        return APIOK;
+    }
+
+    if(0 == strcmp(argv[0], "remove")) {
+        iX = (argc == 2) ? atoi(argv[1]) - 1 : -1;
+        if((iX < 0) || (iX >= *gw->Count) || (0 == gw->Meters[iX].manufacturerID)) {
+            Ctl_Printf(reply, "usage: remove <slot>, slot as listed by meters");
+            return APIERROR;
+        }
+        if(gw->Persist)
+            UnwatchMeter(&gw->Meters[iX]);
+        memset(&gw->Meters[iX], 0, sizeof(ecwMBUSMeter));
+        Shm_Clear(&Latest, iX);
+        UpdateMetersonStick(gw->hStick, gw->Stick, *gw->Count, gw->Meters, gw->InfoFlag);
+        ResetSlot(iX);
+        return APIOK;
+    }
+
+    if(0 == strcmp(argv[0], "mode")) {
+        if(0 == gw->hStick) {
+            Ctl_Printf(reply, "no stick");
+            return APIERROR;
+        }
+        if(argc == 2) {
+            if(0 == strcmp(argv[1], "S"))      wMBus_SwitchMode(gw->hStick, gw->Stick, RADIOS2, gw->InfoFlag);
+            else if(0 == strcmp(argv[1], "T")) wMBus_SwitchMode(gw->hStick, gw->Stick, RADIOT2, gw->InfoFlag);
+            else {
+                Ctl_Printf(reply, "usage: mode [S|T]");
+                return APIERROR;
+            }
+        }
+        if(APIOK != wMBus_GetRadioMode(gw->hStick, gw->Stick, &mode, SILENTMODE)) {
+            Ctl_Printf(reply, "stick does not answer");
+            return APIERROR;
+        }
+        Ctl_Printf(reply, "mode %s\n", (mode == RADIOT2) ? "T2" : "S2");
+        return APIOK;
+    }
+
+    //latest [slot]: slot, meter, epoch, value, exp, rssi, accNo, status, pktInfo, readings
+    if(0 == strcmp(argv[0], "latest")) {
+        for(iX=0; iX<MAXMETER; iX++) {
+            if((argc > 1) && (iX != atoi(argv[1]) - 1)) continue;
+            ret = Shm_Read(&Latest, iX, &meter, &data, &updates);
+            if(ret != APIOK) continue;
+            Ctl_Printf(reply, "%d %04x %08x %u %u %d %d %u %u %u %u\n", iX+1, meter.manufacturerID, meter.ident,
+                       data.time, data.value, data.exp, data.rssiDBm, data.accNo, data.status, data.pktInfo, updates);
+        }
+        return APIOK;
+    }
+
+    if(0 == strcmp(argv[0], "status")) {
+        if((0 == gw->hStick) || (APIOK != wMBus_GetStickCounters(gw->hStick, gw->Stick, &counters))) {
+            Ctl_Printf(reply, "no status from this stick");
+            return APIERROR;
+        }
+        Ctl_Printf(reply, "status %u\nuptime %u\nframes_received %u\ncrc_errors %u\ndecoding_errors %u\nframes_transmitted %u\ntransmit_errors %u\n",
+                   counters.status, counters.uptime, counters.rxFrames, counters.crcErrors, counters.decodeErrors,
+                   counters.txFrames, counters.txErrors);
+        return APIOK;
+    }
+
+    //log [levels]: change the log levels while running
+    if(0 == strcmp(argv[0], "log")) {
+        if((argc == 2) && (APIOK != Log_ParseLevels(argv[1]))) {
+            Ctl_Printf(reply, "usage: log [level|category=level,...]");
+            return APIERROR;
+        }
+        Log_FormatLevels(levels, sizeof(levels));
+        Ctl_Printf(reply, "%s\n", levels);
+        return APIOK;
+    }
+
+    if(0 == strcmp(argv[0], "stats")) {
+        Ctl_Printf(reply, "frames_read %llu\nframes_decoded %llu\nreadings %llu\n",
+                   (unsigned long long)Met_GetCounter(MET_FRAMESREAD), (unsigned long long)Met_GetCounter(MET_FRAMESDECODED),
+                   (unsigned long long)Met_GetCounter(MET_READINGS));
+        if(UseJournal) {
+            ecwMBUSJournalStats stats;
+            Jnl_GetStats(&Journal, &stats);
+            Jnl_GetQueue(&Journal, &queued, &dropped);
+            Ctl_Printf(reply, "journal_records %lu\njournal_commits %lu\njournal_queued %lu\njournal_dropped %lu\n",
+                       stats.records, stats.commits, queued, dropped);
+        }
+        if(UseSegLog)
+            Ctl_Printf(reply, "seglog_next_offset %llu\nseglog_appended %lu\n", (unsigned long long)SegLog.nextOffset, SegLog.appended);
+        if(UseStream) {
+            Stream_GetQueue(&Stream, &queued, &dropped);
+            Ctl_Printf(reply, "stream_queued %lu\nstream_dropped %lu\n", queued, dropped);
+        }
+        if(UseMqtt) {
+            Mqtt_GetQueue(&Mqtt, &queued, &spooled, &dropped);
+            Ctl_Printf(reply, "mqtt_queued %lu\nmqtt_spooled %lu\nmqtt_dropped %lu\n", queued, spooled, dropped);
+        }
+        if(UseEmon) {
+            Emon_GetQueue(&Emon, &queued, &spooled, &dropped);
+            Ctl_Printf(reply, "emoncms_queued %lu\nemoncms_spooled %lu\nemoncms_dropped %lu\n", queued, spooled, dropped);
+        }
+        if(UseNdjson) {
+            Ndj_GetQueue(&Ndjson, &queued, &dropped);
+            Ctl_Printf(reply, "ndjson_queued %lu\nndjson_dropped %lu\n", queued, dropped);
+        }
+        if(UseFwd) {
+            pthread_mutex_lock(&Fwd.lock);
+            Ctl_Printf(reply, "forward_sent %lu\nforward_connects %lu\nforward_failures %lu\n",
+                       Fwd.stats.sent, Fwd.stats.connects, Fwd.stats.failures);
+            pthread_mutex_unlock(&Fwd.lock);
+        }
+        if(UseAgg) {
+            pthread_mutex_lock(&Agg.lock);
+            Ctl_Printf(reply, "aggregator_telegrams %lu\naggregator_early %lu\naggregator_dropped %lu\n",
+                       Agg.unique, Agg.early, Agg.dropped);
+            for(iX=0; iX<Agg.gatewayCount; iX++)
+                Ctl_Printf(reply, "gateway_%s_readings %lu\ngateway_%s_duplicates %lu\ngateway_%s_best %lu\ngateway_%s_connected %d\n",
+                           Agg.gateways[iX].id, Agg.gateways[iX].readings, Agg.gateways[iX].id, Agg.gateways[iX].duplicates,
+                           Agg.gateways[iX].id, Agg.gateways[iX].best, Agg.gateways[iX].id, Agg.gateways[iX].connections);
+            pthread_mutex_unlock(&Agg.lock);
+            Ctl_Printf(reply, "aggregator_unknown %lu\n", AggUnknown);
+        }
+        if(0 != gw->hStick)
+            Ctl_Printf(reply, "key_slot_commands %lu\n", wMBus_GetSlotCommands());
+        for(iX=0; iX<*gw->Count; iX++) {
+            dropped = GetRoundOverwritten(iX, &queued);
+            Ctl_Printf(reply, "meter_%d_queued %lu\nmeter_%d_overwritten %lu\n", iX, queued, iX, dropped);
+        }
+        for(iX=0; iX<AllSinks.count; iX++) {
+            uint64_t lagUs;
+            Sink_GetQueue(AllSinks.sinks[iX], &queued, &spooled, &dropped, &lagUs);
+            Ctl_Printf(reply, "sink_%s_queued %lu\nsink_%s_spooled %lu\nsink_%s_dropped %lu\nsink_%s_lag_ms %.1f\n",
+                       AllSinks.sinks[iX]->name, queued, AllSinks.sinks[iX]->name, spooled,
+                       AllSinks.sinks[iX]->name, dropped, AllSinks.sinks[iX]->name, lagUs/1000.0);
+        }
+        Log_FormatLevels(levels, sizeof(levels));
+        Ctl_Printf(reply, "log_levels %s\nlog_dropped %lu\n", levels, Log_GetDropped());
+        if(AllSinks.count > 0) {
+            ecwMBUSPoolStats pool;
+            Pool_GetStats(&pool);
+            Ctl_Printf(reply, "pool_readings %lu\npool_in_use %lu\npool_allocations %lu\npool_failed %lu\n",
+                       pool.size, pool.inUse, pool.allocations, pool.failed);
+        }
+        Ctl_Printf(reply, "control_requests %lu\n", Control.requests);
+        return APIOK;
+    }
+
+    if(0 == strcmp(argv[0], "help")) {
+        Ctl_Printf(reply, "meters\nadd <manid> <ident> <type> <version> [key|default|zero]\nremove <slot>\n"
+                          "mode [S|T]\nlatest [slot]\nstatus\nstats\nlog [levels]\n");
+        return APIOK;
+    }
+
+    Ctl_Printf(reply, "unknown command %s, try help", argv[0]);
+    return APIERROR;
+}
+
 //support commandline
-int parseparam(int argc, char *argv[], char *filepath, uint16_t *infoflag, uint16_t *Port, uint16_t *Mode, uint16_t *LogMode) {
+int parseparam(int argc, char *argv[], Options *opt) {
     int c;
 
-    if((NULL == LogMode) || (NULL == infoflag) || (NULL == Port)  || (NULL == Mode) ) return 0;
+    if(NULL == opt) return 0;
 
     opterr = 0;
-    while ((c = getopt (argc, argv, "f:hil:m:p:x")) != -1) {
+    while ((c = getopt (argc, argv, "A:c:C:d:DE:f:F:hij:J:l:L:m:M:n:o:p:P:Q:s:S:Tv:V:w:x")) != -1) {
         switch (c) {
             case 'i':
-                *infoflag = SHOWDETAILS;
+                opt->InfoFlag = SHOWDETAILS;
+                break;
+            case 'f':
+                if (NULL != optarg) {
+                    snprintf(opt->DataPath, _MAX_PATH, "%s", optarg);
+                    if((strlen(opt->DataPath) > 1) && (opt->DataPath[strlen(opt->DataPath)-1] == '/'))
+                        opt->DataPath[strlen(opt->DataPath)-1] = 0;
+                }
+                break;
+            case 'o':
+                if (NULL != optarg) {
+                    snprintf(opt->PathTemplate, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'n':
+                if (NULL != optarg) {
+                    opt->MaxOpen = atoi(optarg);
+                }
+                break;
+            case 'j':
+                if (NULL != optarg) {
+                    snprintf(opt->JournalPath, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'J':
+                if (NULL != optarg) {
+                    snprintf(opt->JsonPath, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'w':
+                if (NULL != optarg) {
+                    opt->CommitWindow = atoi(optarg);
+                }
+                break;
+            case 's':
+                if (NULL != optarg) {
+                    snprintf(opt->SegLogPath, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'S':
+                if (NULL != optarg) {
+                    snprintf(opt->StreamSpec, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'M':
+                if (NULL != optarg) {
+                    snprintf(opt->MqttBroker, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'E':
+                if (NULL != optarg) {
+                    snprintf(opt->EmonSpec, _MAX_PATH, "%s", optarg);
+                }
                 break;
             case 'p':
                 if (NULL != optarg) {
-                    *Port = atoi(optarg);
+                    if(isdigit((unsigned char)optarg[0]))
+                        snprintf(opt->Device, _MAX_PATH, "/dev/ttyUSB%d", atoi(optarg));
+                    else
+                        snprintf(opt->Device, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'c':
+                if (NULL != optarg) {
+                    snprintf(opt->ConfPath, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'D':
+                opt->Daemon = true;
+                break;
+            case 'T':
+                opt->Dashboard = true;
+                break;
+            case 'v':
+                if (NULL != optarg) {
+                    snprintf(opt->LogLevels, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'V':
+                if (NULL != optarg) {
+                    snprintf(opt->LogTarget, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'C':
+                if (NULL != optarg) {
+                    snprintf(opt->ControlPath, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'L':
+                if (NULL != optarg) {
+                    snprintf(opt->LatestPath, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'P':
+                if (NULL != optarg) {
+                    snprintf(opt->MetricsSpec, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'Q':
+                if (NULL != optarg) {
+                    snprintf(opt->SinkSpec, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'F':
+                if (NULL != optarg) {
+                    snprintf(opt->FwdSpec, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'A':
+                if (NULL != optarg) {
+                    snprintf(opt->AggSpec, _MAX_PATH, "%s", optarg);
+                }
+                break;
+            case 'd':
+                if (NULL != optarg) {
+                    opt->Depth = atoi(optarg);
                 }
                 break;
             case 'm':
                 if (NULL != optarg) {
-                    if(0 == strcmp("S", optarg)) *Mode=RADIOS2;
+                    if(0 == strcmp("S", optarg)) opt->Mode=RADIOS2;
+                    if(0 == strcmp("T", optarg)) opt->Mode=RADIOT2;
+                }
+                break;
+            case 'l':
+                if (NULL != optarg) {
+                    if(0 == strcmp("CSV", optarg)) opt->LogMode=LOGTOCSV;
+                    if(0 == strcmp("HST", optarg)) opt->LogMode=LOGTOHST;
                 }
                 break;
             case 'h':
@@ -373,7 +1391,7 @@ int parseparam(int argc, char *argv[], char *filepath, uint16_t *infoflag, uint1
                 exit (0);
                 break;
             case '?':
-                if (optopt == 'f')
+                if ((optopt == 'f') || (optopt == 'l') || (optopt == 'm') || (optopt == 'n') || (optopt == 'o') || (optopt == 'p') || (optopt == 'j') || (optopt == 'w') || (optopt == 's') || (optopt == 'S') || (optopt == 'M') || (optopt == 'P') || (optopt == 'L') || (optopt == 'C') || (optopt == 'J') || (optopt == 'E') || (optopt == 'Q') || (optopt == 'F') || (optopt == 'A') || (optopt == 'd') || (optopt == 'c') || (optopt == 'v') || (optopt == 'V'))
                     fprintf (stderr, "Option -%c requires an argument.\n", optopt);
                 else if (isprint (optopt))
                     fprintf (stderr, "Unknown option `-%c'.\n", optopt);
@@ -387,6 +1405,45 @@ int parseparam(int argc, char *argv[], char *filepath, uint16_t *infoflag, uint1
     return 0;
 }
 
+//the iM871A or else the Amber stick on device, 0 if neither answers
+unsigned long OpenStick(char *device, uint16_t *stick, uint16_t infoflag) {
+    unsigned long hStick;
+    unsigned long ID;
+
+    *stick = iM871AIdentifier;
+    hStick = wMBus_OpenDevice(device, *stick);
+
+    if((long)hStick <= 0) { //try 2.Stick
+        *stick = iAMB8465Identifier;
+        usleep(500*1000);
+        hStick = wMBus_OpenDevice(device, *stick);
+    }
+
+    if((long)hStick <= 0)
+        return 0;
+
+    if((iM871AIdentifier == *stick) && (APIOK == wMBus_GetStickId(hStick, *stick, &ID, infoflag)) && (iM871AIdentifier == ID)) {
+        if(infoflag > SILENTMODE) {
+            printf("IMST iM871A Stick found\n");
+        }
+        return hStick;
+    }
+
+    wMBus_CloseDevice(hStick, *stick);
+    //try 2. Stick
+    *stick = iAMB8465Identifier;
+    hStick = wMBus_OpenDevice(device, *stick);
+    if(((long)hStick > 0) && (APIOK == wMBus_GetStickId(hStick, *stick, &ID, infoflag)) && (iAMB8465Identifier == ID)) {
+        if(infoflag > SILENTMODE) {
+            printf("Amber Stick found\n");
+        }
+        return hStick;
+    }
+    if((long)hStick > 0)
+        wMBus_CloseDevice(hStick, *stick);
+    return 0;
+}
+
 //////////////////////////////////////////////
 int main(int argc, char *argv[]) {
     int      key    = 0;
@@ -394,94 +1451,379 @@ int main(int argc, char *argv[]) {
     int      iX;
     int      iK;
     char     KeyInput[_MAX_PATH];
+    ecwMBUSDbRec DbRec;
+    bool     Known;
     char     Key[3];
-    char     CommandlineDatPath[_MAX_PATH];
-    double   csvValue;
+    Options  Opt;
+    ecwMBUSConf Conf;
+    int      JsonFd = -1;
+    Gateway  Gw;
+    ecwMBUSStickCounters StickCounters;
+    int      LoopFd;
+    int      SignalFd;
+    int      TimerFd = -1;
+    int      WatchFd = -1;
+    char     WatchName[_MAX_PATH];
+    bool     Reload;
+    struct signalfd_siginfo SigInfo;
+    int      iE;
+    int      Ready;
+    bool     KeysOn = false;
+    bool     NewReadings;
+    bool     Quit = false;
+    int      DashFd = -1;
+    sigset_t Signals;
+    struct epoll_event Events[LOOP_MAXEVENTS];
+    LogTarget Target;
     int      Meters = 0;
     unsigned long ReturnValue;
-    FILE    *hDatFile;
 
-    uint16_t InfoFlag = SILENTMODE;
-    uint16_t Port = 0;
-    uint16_t Mode = RADIOT2;
-    uint16_t LogMode = LOGTOCSV;
     uint16_t wMBUSStick = iM871AIdentifier;
 
-    char     comDeviceName[100];
     int      hStick;
 
+    //SIGINT and SIGTERM end the main loop through a signalfd, SIGHUP reloads the meters, SIGWINCH resizes the dashboard;
+    //blocked before any thread starts, the threads inherit the mask
+    sigemptyset(&Signals);
+    sigaddset(&Signals, SIGINT);
+    sigaddset(&Signals, SIGTERM);
+    sigaddset(&Signals, SIGHUP);
+    sigaddset(&Signals, SIGWINCH);
+    pthread_sigmask(SIG_BLOCK, &Signals, NULL);
+    if(((SignalFd = signalfd(-1, &Signals, SFD_CLOEXEC)) < 0) || ((RoundEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0))
+        ErrorAndExit("Cannot create event loop\n");
+
     ecwMBUSMeter ecpiwwMeter[MAXMETER];
     memset(ecpiwwMeter, 0, MAXMETER*sizeof(ecwMBUSMeter));
 
-    memset(CommandlineDatPath, 0, _MAX_PATH*sizeof(char));
+    memset(&Conf, 0, sizeof(Conf));
+    memset(&Gw, 0, sizeof(Gw));
+    memset(&Opt, 0, sizeof(Opt));
+    Opt.MaxOpen      = OUT_DEFAULTMAXOPEN;
+    Opt.CommitWindow = JNL_DEFAULTWINDOW;
+    Opt.Depth        = RING_DEFAULTDEPTH;
+    Opt.InfoFlag     = SILENTMODE;
+    Opt.Mode         = RADIOT2;
+    Opt.LogMode      = LOGTOCSV;
+    snprintf(Opt.Device, _MAX_PATH, "/dev/ttyUSB0");
 
     if(argc > 1)
-      parseparam(argc, argv, CommandlineDatPath, &InfoFlag, &Port, &Mode, &LogMode);
+      parseparam(argc, argv, &Opt);
+
+    //the configuration file first, then the command line once more so its options win
+    if(0 != Opt.ConfPath[0]) {
+        if(APIOK != Conf_Load(&Conf, Opt.ConfPath, argv[0]))
+            ErrorAndExit("Invalid configuration file\n");
+        optind = 0;
+        parseparam(Conf.argc, Conf.argv, &Opt);
+        optind = 0;
+        parseparam(argc, argv, &Opt);
+        Conf_Free(&Conf);
+    }
+    Daemon = Opt.Daemon;
+    if(Daemon) {
+        setvbuf(stdout, NULL, _IOLBF, 0); //whole lines for the journal
+        wMBus_SetFrameDump(false);
+    }
+    if((0 != Opt.LogLevels[0]) && (APIOK != Log_ParseLevels(Opt.LogLevels)))
+        ErrorAndExit("Invalid -v, level or category=level,...\n");
+    if(APIOK != Log_Start(Opt.LogTarget))
+        ErrorAndExit("Cannot open the log, -V -|syslog|<file>\n");
+    if(0 != Opt.DataPath[0])
+        if(snprintf(MeterDbPath, _MAX_PATH, "%s/" DB_FILENAME, Opt.DataPath) >= _MAX_PATH)
+            ErrorAndExit("Data path too long, -f <dir>\n");
+
+    if(APIOK != Out_InitCache(&LogFiles, Opt.MaxOpen))
+        ErrorAndExit("Cannot allocate file cache\n");
+    if(APIOK != CheckSinkSpec(Opt.SinkSpec))
+        ErrorAndExit("Invalid -Q, name=policy[:depth],...\n");
+    if((Opt.Depth < 1) || (Opt.Depth > RING_MAXDEPTH))
+        ErrorAndExit("Invalid -d, readings per meter\n");
+    for(iX=0; iX<MAXMETER; iX++)
+        Ring_Init(&RoundQueue[iX], Opt.Depth);
+
+    Target.DataPath     = Opt.DataPath;
+    Target.PathTemplate = Opt.PathTemplate;
+    Target.LogMode      = Opt.LogMode;
+    Target.InfoFlag     = Opt.InfoFlag;
+
+    //replay the journal tail before new readings arrive
+    if(0 != Opt.JournalPath[0]) {
+        LogFiles.syncOnClose = true;
+        if(APIOK != Jnl_Open(&Journal, Opt.JournalPath, Opt.CommitWindow, ReplayReading, &Target))
+            ErrorAndExit("Cannot open journal\n");
+        if(Journal.stats.replayed > 0) {
+            printf("Journal: %lu readings replayed\n", Journal.stats.replayed);
+            Out_SyncAll(&LogFiles);
+        }
+        Jnl_Checkpoint(&Journal, Jnl_LastSeq(&Journal));
+        UseJournal = true;
+    }
+
+    //the journal checkpoint needs every reading of a round in the files, the file output never drops
+    OpenSink(&FileSink, "file", MET_SINKFILE, SINK_BLOCK, UseJournal, Opt.SinkSpec, Opt.DataPath, WriteFile, FileIdle, &Target, false);
 
-    //read config back
-    if ((hDatFile = fopen("meter.dat", "rb")) != NULL) {
-        Meters = fread((void*)ecpiwwMeter, sizeof(ecwMBUSMeter), MAXMETER, hDatFile);
-        fclose(hDatFile);
+    if(0 != Opt.SegLogPath[0]) {
+        if(APIOK != Seg_Open(&SegLog, Opt.SegLogPath, SEG_DEFAULTSIZE))
+            ErrorAndExit("Cannot open segment log\n");
+        UseSegLog = true;
+        OpenSink(&SegSink, "seglog", MET_SINKSEGLOG, SINK_BLOCK, false, Opt.SinkSpec, Opt.DataPath, WriteSegLog, NULL, NULL, true);
     }
 
-    Intro();
+    if(0 != Opt.StreamSpec[0]) {
+        char *spec, *next;
+        if(APIOK != Stream_Init(&Stream))
+            ErrorAndExit("Cannot start stream server\n");
+        for(spec = Opt.StreamSpec; NULL != spec; spec = next) {
+            if(NULL != (next = strchr(spec, ','))) *next++ = 0;
+            if(APIOK != Stream_Listen(&Stream, spec)) {
+                fprintf(stderr, "Cannot listen on >%s<\n", spec);
+                ErrorAndExit("Cannot start stream server\n");
+            }
+        }
+        if(APIOK != Stream_Start(&Stream))
+            ErrorAndExit("Cannot start stream server\n");
+        UseStream = true;
+        OpenSink(&StreamSink, "stream", MET_SINKSTREAM, SINK_DROPOLDEST, false, Opt.SinkSpec, Opt.DataPath, WriteStream, NULL, NULL, true);
+    }
 
-    //open wM-Bus Stick #1
-    wMBUSStick = iM871AIdentifier;
-    sprintf(comDeviceName, "/dev/ttyUSB%d", Port);
-    hStick = wMBus_OpenDevice(comDeviceName, wMBUSStick);
+    if(0 != Opt.MqttBroker[0]) {
+        char SpoolPath[_MAX_PATH];
+        if(snprintf(SpoolPath, _MAX_PATH, "%s/mqtt.spool", (0 != Opt.DataPath[0]) ? Opt.DataPath : OUT_DEFAULTDATAPATH) >= _MAX_PATH)
+            ErrorAndExit("Data path too long, -f <dir>\n");
+        Out_MakeDirs(SpoolPath);
+        if(APIOK != Mqtt_Open(&Mqtt, Opt.MqttBroker, SpoolPath, MQTT_WINDOW))
+            ErrorAndExit("Cannot start MQTT publisher\n");
+        UseMqtt = true;
+        OpenSink(&MqttSink, "mqtt", MET_SINKMQTT, SINK_DROPOLDEST, false, Opt.SinkSpec, Opt.DataPath, WriteMqtt, NULL, NULL, true);
+    }
 
-    if(hStick <= 0) { //try 2.Stick
-        wMBUSStick = iAMB8465Identifier;
-        usleep(500*1000);
-        hStick = wMBus_OpenDevice(comDeviceName, wMBUSStick);
+    if(0 != Opt.EmonSpec[0]) {
+        char SpoolPath[_MAX_PATH];
+        if(snprintf(SpoolPath, _MAX_PATH, "%s/emoncms.spool", (0 != Opt.DataPath[0]) ? Opt.DataPath : OUT_DEFAULTDATAPATH) >= _MAX_PATH)
+            ErrorAndExit("Data path too long, -f <dir>\n");
+        Out_MakeDirs(SpoolPath);
+        if(APIOK != Emon_Open(&Emon, Opt.EmonSpec, SpoolPath, EMON_DRAINRATE))
+            ErrorAndExit("Cannot start emoncms uploader, -E apikey@host[:port][/path]\n");
+        UseEmon = true;
+        OpenSink(&EmonSink, "emoncms", MET_SINKEMON, SINK_DROPOLDEST, false, Opt.SinkSpec, Opt.DataPath, WriteEmon, NULL, NULL, true);
+    }
+
+    //"-" is stdout, the console output moves to stderr so stdout carries only JSON lines
+    if(0 != Opt.JsonPath[0]) {
+        char *path  = Opt.JsonPath;
+        int   flags = 0;
+        if(0 == strncmp(path, "raw:", 4)) {
+            flags = FMT_PAYLOAD;
+            path += 4;
+        }
+        if(0 == strcmp(path, "-")) {
+            JsonFd = dup(STDOUT_FILENO);
+            if((JsonFd < 0) || (dup2(STDERR_FILENO, STDOUT_FILENO) < 0))
+                ErrorAndExit("Cannot redirect stdout\n");
+        }
+        else if((JsonFd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+            fprintf(stderr, "Cannot open >%s<\n", path);
+            ErrorAndExit("Cannot open NDJSON output\n");
+        }
+        if(APIOK != Ndj_Open(&Ndjson, JsonFd, flags))
+            ErrorAndExit("Cannot start NDJSON output\n");
+        UseNdjson = true;
+        OpenSink(&NdjsonSink, "ndjson", MET_SINKNDJSON, SINK_DROPOLDEST, false, Opt.SinkSpec, Opt.DataPath, Ndj_Write, Ndj_Flush, &Ndjson, true);
     }
 
-    if(hStick <= 0) {
-         ErrorAndExit("no wM-Bus Stick not found\n");
+    //spill keeps the readings on disk while the aggregator is away, it drops what arrives twice
+    if(0 != Opt.FwdSpec[0]) {
+        if(APIOK != Fwd_Open(&Fwd, Opt.FwdSpec))
+            ErrorAndExit("Invalid -F, [raw:]host[:port][/id]\n");
+        UseFwd = true;
+        OpenSink(&FwdSink, "forward", MET_SINKFORWARD, SINK_SPILL, false, Opt.SinkSpec, Opt.DataPath, Fwd_Write, Fwd_Flush, &Fwd, !Fwd.raw);
+        if(Fwd.raw)
+            wMBus_RegisterFrameHandler(OnFrame, NULL);
     }
 
-    if((iM871AIdentifier == wMBUSStick) && (APIOK == wMBus_GetStickId(hStick, wMBUSStick, &ReturnValue, InfoFlag)) && (iM871AIdentifier == ReturnValue)) {
-        if(InfoFlag > SILENTMODE) {
-            printf("IMST iM871A Stick found\n");
+    //without -L the table is private, it still answers the latest request of the control socket
+    if(APIOK != Shm_Create(&Latest, (0 != Opt.LatestPath[0]) ? Opt.LatestPath : NULL))
+        ErrorAndExit("Cannot create latest value table\n");
+    UseLatest = true;
+
+    if(0 != Opt.MetricsSpec[0]) {
+        if(APIOK != Met_Open(&Metrics, Opt.MetricsSpec, CollectQueues, NULL))
+            ErrorAndExit("Cannot start metrics endpoint\n");
+        UseMetrics = true;
+    }
+
+    //read config back: the meters of the configuration file, else the watched meters of the database
+    if(Conf.meterCount > 0) {
+        memcpy(ecpiwwMeter, Conf.meters, Conf.meterCount*sizeof(ecwMBUSMeter));
+        Meters = Conf.meterCount;
+    }
+    else
+        Gw.Persist = true;
+    Gw.Source   = Gw.Persist ? MeterDbPath : Opt.ConfPath;
+    Gw.Meters   = ecpiwwMeter;
+    Gw.Count    = &Meters;
+    Gw.InfoFlag = Opt.InfoFlag;
+    if(Gw.Persist) {
+        //meter.dat of an older version, in the data path or the working directory, moves to the database once
+        if(!Db_Exists(MeterDbPath)) {
+            uint32_t Imported = 0;
+
+            Out_MakeDirs(MeterDbPath);
+            if((snprintf(KeyInput, _MAX_PATH, "%s/meter.dat", (0 != Opt.DataPath[0]) ? Opt.DataPath : ".") < _MAX_PATH) &&
+               (APIOK == Db_Open(&MeterDb, MeterDbPath)) &&
+               ((APIOK == Db_ImportDat(&MeterDb, KeyInput, &Imported)) || (APIOK == Db_ImportDat(&MeterDb, "meter.dat", &Imported))))
+                printf("%u meters of meter.dat moved to %s\n", Imported, MeterDbPath);
+            Db_Close(&MeterDb);
         }
+        ReloadMeters(&Gw, false);
+    }
+
+    //the aggregator maps the readings of all gateways to the meter list
+    if(0 != Opt.AggSpec[0]) {
+        if(APIOK != Agg_Open(&Agg, Opt.AggSpec, AGG_WINDOW, OnAggregated, &Gw))
+            ErrorAndExit("Cannot start aggregator, -A [addr:]port\n");
+        UseAgg = true;
+    }
+
+    //the main loop takes its readings from the round table, the handler is always needed;
+    //the driver keeps no queue of its own then
+    wMBus_RegisterReadingHandler(OnReading);
+    wMBus_SetQueueDepth(0);
+
+    if(!Daemon)
+        Intro();
+
+    //open wM-Bus Stick #1, an aggregator runs without one
+    hStick = OpenStick(Opt.Device, &wMBUSStick, Opt.InfoFlag);
+
+    if(0 == hStick) {
+        if(!UseAgg)
+            ErrorAndExit("no wM-Bus Stick not found\n");
+        printf("No wM-Bus Stick, aggregating the forwarders only\n");
     }
     else {
-        wMBus_CloseDevice(hStick, wMBUSStick);
-        //try 2. Stick
-        wMBUSStick = iAMB8465Identifier;
-        hStick = wMBus_OpenDevice(comDeviceName,wMBUSStick);
-        if((iAMB8465Identifier == wMBUSStick) && (APIOK == wMBus_GetStickId(hStick, wMBUSStick, &ReturnValue, InfoFlag)) && (iAMB8465Identifier == ReturnValue)) {
-            if(InfoFlag > SILENTMODE) {
-                printf("Amber Stick found\n");
+        if(APIOK == wMBus_GetRadioMode(hStick, wMBUSStick, &ReturnValue, Opt.InfoFlag)) {
+            if(Opt.InfoFlag > SILENTMODE) {
+                printf("wM-BUS %s Mode\n", (ReturnValue == RADIOT2) ? "T2" : "S2");
             }
+            if (ReturnValue != Opt.Mode)
+               wMBus_SwitchMode(hStick, wMBUSStick, (uint8_t) Opt.Mode, Opt.InfoFlag);
         }
-        else {
-            wMBus_CloseDevice(hStick, wMBUSStick);
-            ErrorAndExit("no wM-Bus Stick not found\n");
-        }
-    }
+        else
+            ErrorAndExit("wM-Bus Stick not found\n");
 
-    if(APIOK == wMBus_GetRadioMode(hStick, wMBUSStick, &ReturnValue, InfoFlag)) {
-        if(InfoFlag > SILENTMODE) {
-            printf("wM-BUS %s Mode\n", (ReturnValue == RADIOT2) ? "T2" : "S2");
-        }
-        if (ReturnValue != Mode)
-           wMBus_SwitchMode(hStick, wMBUSStick, (uint8_t) Mode, InfoFlag);
+        wMBus_InitDevice(hStick, wMBUSStick, Opt.InfoFlag);
     }
-    else
-        ErrorAndExit("wM-Bus Stick not found\n");
 
-    wMBus_InitDevice(hStick, wMBUSStick, InfoFlag);
+    UpdateMetersonStick(hStick, wMBUSStick, Meters, ecpiwwMeter, Opt.InfoFlag);
 
-    UpdateMetersonStick(hStick, wMBUSStick, Meters, ecpiwwMeter, InfoFlag);
+    Gw.hStick = hStick;
+    Gw.Stick  = wMBUSStick;
 
-    IsNewMinute();
+    if(0 != Opt.ControlPath[0]) {
+        if(APIOK != Ctl_Open(&Control, Opt.ControlPath, ControlRequest, &Gw))
+            ErrorAndExit("Cannot open control socket\n");
+        UseControl = true;
+    }
 
-    while (!((key == 0x1B) || (key == 'q'))) {
-        usleep(500*1000);   //sleep 500ms
+    //one loop waits for keys, readings, control requests, signals and the stick counter timer; nothing wakes it while idle
+    if((LoopFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        ErrorAndExit("Cannot create event loop\n");
+    LoopAdd(LoopFd, RoundEvent, LOOP_READING);
+    LoopAdd(LoopFd, SignalFd, LOOP_SIGNAL);
+    if(UseControl)
+        LoopAdd(LoopFd, Ctl_GetFd(&Control), LOOP_CONTROL);
+    if(((WatchFd = WatchSource(Gw.Source, WatchName, sizeof(WatchName))) < 0) || (APIOK != LoopAdd(LoopFd, WatchFd, LOOP_RELOAD)))
+        printf("Cannot watch %s, reload the meters with SIGHUP\n", Gw.Source);
+    if(!Daemon && (APIOK == LoopAdd(LoopFd, STDIN_FILENO, LOOP_KEY))) { //not for /dev/null or a file
+        KeysOn = true;
+        SetKeyMode(true);
+        atexit(RestoreKeyMode);
+        //readings only update the rows of the dashboard, the timer redraws it
+        snprintf(KeyInput, _MAX_PATH, "eccwmbus on %.60s", (0 == hStick) ? "no stick" : Opt.Device);
+        if((APIOK != Dash_Init(&Dash, KeyInput)) || ((DashFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) ||
+           (APIOK != LoopAdd(LoopFd, DashFd, LOOP_DASH)))
+            ErrorAndExit("Cannot start the dashboard\n");
+        if(Opt.Dashboard && !ShowDashboard(DashFd, true))
+            Log_Printf(LOGCAT_MAIN, LOGLVL_WARN, "No terminal for the dashboard");
+    }
+    if(UseMetrics && (hStick > 0)) {
+        struct itimerspec period = { { MET_SAMPLEINTERVAL, 0 }, { 0, 1 } }; //first sample right away
+        if(((TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) || (timerfd_settime(TimerFd, 0, &period, NULL) != 0) ||
+           (APIOK != LoopAdd(LoopFd, TimerFd, LOOP_TIMER)))
+            ErrorAndExit("Cannot start stick counter timer\n");
+    }
 
-        key = getkey();
+    //the stick is set up and the outputs are open
+    if(Daemon)
+        printf("eccwmbus running on %s, %d meters\n", (0 == hStick) ? "no stick" : Opt.Device, Meters);
+    Notify("READY=1");
+
+    while (!((key == 0x1B) || (key == 'q') || Quit)) {
+        key = 0;
+        NewReadings = false;
+        Reload = false;
+        if((Ready = epoll_wait(LoopFd, Events, LOOP_MAXEVENTS, -1)) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        for(iE=0; iE<Ready; iE++) {
+            switch(Events[iE].data.u32) {
+                case LOOP_KEY:
+                    key = getkey();
+                    //a closed pipe or terminal stays readable, stop watching it
+                    if((EOF == key) && ((Events[iE].events & (EPOLLHUP | EPOLLERR)) || !isatty(STDIN_FILENO))) {
+                        epoll_ctl(LoopFd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                        KeysOn = false;
+                    }
+                    break;
+                case LOOP_READING:
+                    LoopDrain(RoundEvent, sizeof(uint64_t));
+                    NewReadings = true;
+                    break;
+                case LOOP_SIGNAL:
+                    if(read(SignalFd, &SigInfo, sizeof(SigInfo)) != sizeof(SigInfo))
+                        Quit = true;
+                    else if(SIGHUP == SigInfo.ssi_signo)
+                        Reload = true;
+                    else if(SIGWINCH == SigInfo.ssi_signo) {
+                        if(Dash.shown) Dash_Resize(&Dash);
+                    }
+                    else
+                        Quit = true;
+                    break;
+                case LOOP_RELOAD:
+                    if(SourceChanged(WatchFd, WatchName))
+                        Reload = true;
+                    break;
+                case LOOP_TIMER:
+                    //the stick counters are read here, the stick is only accessed from this thread
+                    LoopDrain(TimerFd, sizeof(uint64_t));
+                    if(APIOK == wMBus_GetStickCounters(hStick, wMBUSStick, &StickCounters))
+                        Met_SetStick(&Metrics, &StickCounters);
+                    break;
+                case LOOP_CONTROL:
+                    Ctl_Poll(&Control, 0);
+                    break;
+                case LOOP_DASH:
+                    LoopDrain(DashFd, sizeof(uint64_t));
+                    Dash_Draw(&Dash, ecpiwwMeter, Meters);
+                    break;
+            }
+        }
+        //the prompts and lists need the scrolling view
+        if(Dash.shown && ((key == 'a') || (key == 'r') || (key == 'l') || (key == 'x') || (key == 'h')))
+            ShowDashboard(DashFd, false);
+        if((key == 'd') && (DashFd >= 0))
+            ShowDashboard(DashFd, !Dash.shown);
+        //only the meters that changed are set on the stick, reception goes on
+        if(Reload)
+            ReloadMeters(&Gw, true);
+
+        if((key == 'a') || (key == 'r'))
+            SetKeyMode(false);
 
         /*key =fgetc(stdin);
         while(key!='\n' && fgetc(stdin) != '\n');
@@ -510,58 +1852,74 @@ int main(int argc, char *argv[]) {
                 if(fgets(KeyInput, _MAX_PATH,stdin))
                     ecpiwwMeter[iX].ident=CalcUIntBCD(atoi(KeyInput));
 
-                ecpiwwMeter[iX].type = 0x00;
-                printf("Enter Meter Type (2 = Electricity ; 3 = Gas ; 4 = Heat Supplied ; 7 = Water) : ");
-                if(fgets(KeyInput, _MAX_PATH,stdin)) {
-                    switch(atoi(KeyInput)) {
-                        case METER_GAS  :        ecpiwwMeter[iX].type = METER_GAS;          break;
-                        case METER_WATER:        ecpiwwMeter[iX].type = METER_WATER;        break;
-                        case METER_HEAT :        ecpiwwMeter[iX].type = METER_HEAT;         break;
-                        default: printf(" - wrong Type ; default to Electricity");
-                        case METER_ELECTRICITY : ecpiwwMeter[iX].type = METER_ELECTRICITY;  break;
-                    }
+                //a meter of the database needs no more questions
+                Known = (APIERROR != Db_Find(&MeterDb, ecpiwwMeter[iX].manufacturerID, ecpiwwMeter[iX].ident, &DbRec));
+                if(Known) {
+                    ecpiwwMeter[iX] = DbRec.meter;
+                    printf("Meter of the database %s\n", DbRec.label);
                 }
+                else {
+                    ecpiwwMeter[iX].type = 0x00;
+                    printf("Enter Meter Type (2 = Electricity ; 3 = Gas ; 4 = Heat Supplied ; 7 = Water) : ");
+                    if(fgets(KeyInput, _MAX_PATH,stdin)) {
+                        switch(atoi(KeyInput)) {
+                            case METER_GAS  :        ecpiwwMeter[iX].type = METER_GAS;          break;
+                            case METER_WATER:        ecpiwwMeter[iX].type = METER_WATER;        break;
+                            case METER_HEAT :        ecpiwwMeter[iX].type = METER_HEAT;         break;
+                            default: printf(" - wrong Type ; default to Electricity");
+                            // fall through
+                            case METER_ELECTRICITY : ecpiwwMeter[iX].type = METER_ELECTRICITY;  break;
+                        }
+                    }
 
-                ecpiwwMeter[iX].version        = 0x01;
-                printf("Enter Meter Version (1234): ");
-                if(fgets(KeyInput, _MAX_PATH,stdin))
-                    ecpiwwMeter[iX].version=CalcUIntBCD(atoi(KeyInput));
-
-                printf("Enter Key (0 = Zero ; 1 = Default ; 2 = Enter the 16 Bytes) : ");
-                if(fgets(KeyInput, _MAX_PATH, stdin)) {
-                    switch(atoi(KeyInput)) {
-                        case 0  : for(iK = 0; iK<AES_KEYLENGHT_IN_BYTES; iK++)
-                                    ecpiwwMeter[iX].key[iK] = 0;
-                        break;
-
-                        default:
-                        case 1  : for(iK = 0; iK<AES_KEYLENGHT_IN_BYTES; iK++)
-                                    ecpiwwMeter[iX].key[iK] = (uint8_t)(0x1C + 3*iK);
-                        break;
+                    ecpiwwMeter[iX].version        = 0x01;
+                    printf("Enter Meter Version (1234): ");
+                    if(fgets(KeyInput, _MAX_PATH,stdin))
+                        ecpiwwMeter[iX].version=CalcUIntBCD(atoi(KeyInput));
 
-                        case 2  :
-                                printf("Key:");
-                                fgets(KeyInput, _MAX_PATH, stdin);
-                                    for(iK = 0; iK<AES_KEYLENGHT_IN_BYTES; iK++)
+                    printf("Enter Key (0 = Zero ; 1 = Default ; 2 = Enter the 16 Bytes) : ");
+                    if(fgets(KeyInput, _MAX_PATH, stdin)) {
+                        switch(atoi(KeyInput)) {
+                            case 0  : for(iK = 0; iK<AES_KEYLENGHT_IN_BYTES; iK++)
                                         ecpiwwMeter[iX].key[iK] = 0;
-                                if((strlen(KeyInput)-1) < AES_KEYLENGHT_IN_BYTES*2)
-                                    printf("Key is too short - default to Zero\n");
-                                else {
-                                    memset(Key,0,sizeof(Key));
-                                    for(iK = 0; iK<(int)(strlen(KeyInput)-1)/2; iK++) {
-                                        Key[0] =  KeyInput[2*iK];
-                                        Key[1] =  KeyInput[2*iK+1];
-                                        ecpiwwMeter[iX].key[iK] = (uint8_t) strtoul(Key, NULL, 16);
+                            break;
+
+                            default:
+                            case 1  : for(iK = 0; iK<AES_KEYLENGHT_IN_BYTES; iK++)
+                                        ecpiwwMeter[iX].key[iK] = (uint8_t)(0x1C + 3*iK);
+                            break;
+
+                            case 2  :
+                                    printf("Key:");
+                                    fgets(KeyInput, _MAX_PATH, stdin);
+                                        for(iK = 0; iK<AES_KEYLENGHT_IN_BYTES; iK++)
+                                            ecpiwwMeter[iX].key[iK] = 0;
+                                    if((strlen(KeyInput)-1) < AES_KEYLENGHT_IN_BYTES*2)
+                                        printf("Key is too short - default to Zero\n");
+                                    else {
+                                        memset(Key,0,sizeof(Key));
+                                        for(iK = 0; iK<(int)(strlen(KeyInput)-1)/2; iK++) {
+                                            Key[0] =  KeyInput[2*iK];
+                                            Key[1] =  KeyInput[2*iK+1];
+                                            ecpiwwMeter[iX].key[iK] = (uint8_t) strtoul(Key, NULL, 16);
+                                        }
                                     }
-                                }
-                        break;
+                            break;
+                        }
                     }
+
+                    KeyInput[0] = 0;
+                    printf("Enter Label: ");
+                    if(fgets(KeyInput, _MAX_PATH, stdin))
+                        KeyInput[strcspn(KeyInput, "\r\n")] = 0;
                 }
 
                 Meters++;
                 Meters = min(Meters, MAXMETER);
+                if(Gw.Persist)
+                    StoreMeter(&ecpiwwMeter[iX], iX, Known ? NULL : KeyInput);
                 DisplayListofMeters(Meters, ecpiwwMeter);
-                UpdateMetersonStick(hStick, wMBUSStick, Meters, ecpiwwMeter, InfoFlag);
+                UpdateMetersonStick(hStick, wMBUSStick, Meters, ecpiwwMeter, Opt.InfoFlag);
             } else
                 printf("All %d Meters defined\n", MAXMETER);
         }
@@ -575,11 +1933,15 @@ int main(int argc, char *argv[]) {
             printf("Enter Meterindex to remove: ");
             if(fgets(KeyInput, _MAX_PATH, stdin)) {
                 iX = atoi(KeyInput);
-                if(iX-1 <= Meters-1) {
+                if((iX >= 1) && (iX-1 <= Meters-1)) {
                     printf("Remove Meter #%d\n",iX);
+                    if(Gw.Persist && (0 != ecpiwwMeter[iX-1].manufacturerID))
+                        UnwatchMeter(&ecpiwwMeter[iX-1]);
                     memset(&ecpiwwMeter[iX-1], 0, sizeof(ecwMBUSMeter));
+                    Shm_Clear(&Latest, iX-1);
                     DisplayListofMeters(Meters, ecpiwwMeter);
-                    UpdateMetersonStick(hStick, wMBUSStick, Meters, ecpiwwMeter, InfoFlag);
+                    UpdateMetersonStick(hStick, wMBUSStick, Meters, ecpiwwMeter, Opt.InfoFlag);
+                    ResetSlot(iX-1);
                  }
                  else
                     printf("Index not defined\n");
@@ -587,26 +1949,22 @@ int main(int argc, char *argv[]) {
         }
 
         // switch to S2 mode
-        if(key == 's')
+        if((key == 's') && (hStick > 0))
         {
-            wMBus_SwitchMode( hStick,wMBUSStick, RADIOS2,InfoFlag);
-            wMBus_GetRadioMode(hStick, wMBUSStick, &ReturnValue, InfoFlag); 
-            if(InfoFlag > SILENTMODE) {
-                printf("wM-BUS %s Mode\n", (ReturnValue == RADIOT2) ? "T2" : "S2");
-            }
+            wMBus_SwitchMode( hStick,wMBUSStick, RADIOS2,Opt.InfoFlag);
+            wMBus_GetRadioMode(hStick, wMBUSStick, &ReturnValue, Opt.InfoFlag); 
+            Log_Printf(LOGCAT_DRIVER, LOGLVL_DEBUG, "wM-BUS %s Mode", (ReturnValue == RADIOT2) ? "T2" : "S2");
         }
 
         // switch to T2 mode
-        if(key == 't')
+        if((key == 't') && (hStick > 0))
         {
-            wMBus_SwitchMode( hStick,wMBUSStick, RADIOT2,InfoFlag);
-            wMBus_GetRadioMode(hStick, wMBUSStick, &ReturnValue, InfoFlag); 
-            if(InfoFlag > SILENTMODE) {
-                printf("wM-BUS %s Mode\n", (ReturnValue == RADIOT2) ? "T2" : "S2");
-            }
+            wMBus_SwitchMode( hStick,wMBUSStick, RADIOT2,Opt.InfoFlag);
+            wMBus_GetRadioMode(hStick, wMBUSStick, &ReturnValue, Opt.InfoFlag); 
+            Log_Printf(LOGCAT_DRIVER, LOGLVL_DEBUG, "wM-BUS %s Mode", (ReturnValue == RADIOT2) ? "T2" : "S2");
         }
 
-        if(key == 'h')
+        if((key == 'h') && (hStick > 0))
         {
             wMBus_GetLastError( hStick,wMBUSStick);
             wMBus_GetDataByHand();
@@ -614,29 +1972,59 @@ int main(int argc, char *argv[]) {
 
         if(key == 'x')
         {
-            printf("\n\nStatus from Stick\n");
-            wMBus_GetStickStatus( hStick, wMBUSStick, InfoFlag);
+            if(hStick > 0) {
+                printf("\n\nStatus from Stick\n");
+                wMBus_GetStickStatus( hStick, wMBUSStick, Opt.InfoFlag);
+            }
+            if(0 != Opt.JournalPath[0])
+                Jnl_PrintStats(&Journal);
+            if(UseSegLog)
+                printf("Segment log          : next offset %llu, %lu appended, %lu segments removed\n",
+                       (unsigned long long)SegLog.nextOffset, SegLog.appended, SegLog.removed);
+            if(UseStream)
+                Stream_PrintStats(&Stream);
+            if(UseMqtt)
+                Mqtt_PrintStats(&Mqtt);
+            if(UseEmon)
+                Emon_PrintStats(&Emon);
+            if(UseNdjson)
+                Ndj_PrintStats(&Ndjson);
+            for(iX=0; iX<AllSinks.count; iX++)
+                Sink_PrintStats(AllSinks.sinks[iX]);
+            if(AllSinks.count > 0) {
+                ecwMBUSPoolStats pool;
+                Pool_GetStats(&pool);
+                printf("Reading pool           : %lu readings, %lu in use, %lu allocations for %lu readings\n",
+                       pool.size, pool.inUse, pool.allocations, pool.gets);
+            }
+            if(UseFwd)
+                Fwd_PrintStats(&Fwd);
+            if(UseAgg) {
+                Agg_PrintStats(&Agg);
+                printf("  not in the meter list : %lu\n", AggUnknown);
+            }
+            if(0 != hStick)
+                printf("Key slot commands      : %lu\n", wMBus_GetSlotCommands());
+            for(iX=0; iX<Meters; iX++) {
+                unsigned long queued, overwritten = GetRoundOverwritten(iX, &queued);
+                printf("Meter #%d queue        : %lu of %d queued, %lu overwritten\n", iX+1, queued, Opt.Depth, overwritten);
+            }
         }
 
-        //check whether there are new data from the EnergyCams
-        if (IsNewMinute() || (key == 'u')) {
-            if(wMBus_GetMeterDataList() > 0) {
+        if(KeysOn)
+            SetKeyMode(true);
+
+        //new data from the EnergyCams, already logged by Deliver
+        if (NewReadings || (key == 'u')) {
+            if(GetRoundMask() > 0) {
                 iCheck = 0;
                 for(iX=0; iX<Meters; iX++) {
-                    if((0x01<<iX) & wMBus_GetMeterDataList()) {
-                        ecMBUSData RFData;
-                        int iMul=1;
-                        int iDiv=1;
-                        wMBus_GetData4Meter(iX, &RFData);
-
-                        if(RFData.exp < 0) {  //GAS
-                            for(iK=RFData.exp; iK<0; iK++)
-                               iDiv=iDiv*10;
-                            csvValue = ((double)RFData.value)/iDiv;
-                        } else {
-                            for(iK=0; iK<RFData.exp; iK++)
-                                iMul=iMul*10;
-                            csvValue = (double)RFData.value*iMul;
+                    ecMBUSData RFData;
+                    while(TakeRoundData(iX, &RFData)) {
+                        if(Daemon) continue;
+                        if(Dash.shown) {
+                            Dash_Update(&Dash, iX, &ecpiwwMeter[iX], &RFData);
+                            continue;
                         }
 
                         // Log Meter alive
@@ -648,16 +2036,13 @@ int main(int argc, char *argv[]) {
                         if((RFData.pktInfo & PACKET_WAS_NOT_ENCRYPTED)  ==  PACKET_WAS_NOT_ENCRYPTED) printf(" not encrypted    ");
                         if((RFData.pktInfo & PACKET_IS_ENCRYPTED)       ==  PACKET_IS_ENCRYPTED)      printf(" is encrypted     ");
 
-                        printf(" RSSI=%i dbm, #%d ", RFData.rssiDBm, RFData.accNo);
+                        PrintValue(&ecpiwwMeter[iX], &RFData);
                         Colour(0,false);
-
-                        // Log to File
-                        Log2File(CommandlineDatPath, LogMode, iX, InfoFlag, csvValue, &RFData, &ecpiwwMeter[iX]);
-
                     }
                 }
+                fflush(stdout);
             }
-            else {
+            else if(!Daemon && !Dash.shown) {
                 Colour(PRINTF_YELLOW, false);
                 if(iCheck == 0) printf("\n");
                 printf(".");
@@ -667,14 +2052,61 @@ int main(int argc, char *argv[]) {
         }
     } // end while
 
+    Notify("STOPPING=1");
+    if(DashFd >= 0) {
+        Dash_Free(&Dash);
+        close(DashFd);
+    }
+    SetKeyMode(false);
+    close(LoopFd);
+    if(TimerFd >= 0)
+        close(TimerFd);
+    if(WatchFd >= 0)
+        close(WatchFd);
+    if(UseControl)
+        Ctl_Close(&Control);
+    if(UseMetrics)
+        Met_Close(&Metrics);
     if(hStick >0) wMBus_CloseDevice(hStick, wMBUSStick);
 
-    //save Meter config to file
-    if(Meters > 0) {
-        if ((hDatFile = fopen("meter.dat", "wb")) != NULL) {
-            fwrite((void*)ecpiwwMeter, sizeof(ecwMBUSMeter), MAXMETER, hDatFile);
-            fclose(hDatFile);
-        }
+    wMBus_RegisterReadingHandler(NULL);
+    wMBus_RegisterFrameHandler(NULL, NULL);
+    if(UseAgg) { //the pending readings still go to the outputs
+        Agg_PrintStats(&Agg);
+        Agg_Close(&Agg);
+    }
+    if(UseFwd)
+        Fwd_Stop(&Fwd);
+    for(iX=0; iX<AllSinks.count; iX++)
+        Sink_Close(AllSinks.sinks[iX]);
+    Pool_Free();
+    if(UseFwd) {
+        Fwd_PrintStats(&Fwd);
+        Fwd_Close(&Fwd);
+    }
+    if(UseJournal) {
+        Jnl_PrintStats(&Journal);
+        Jnl_Close(&Journal);
     }
+    if(UseSegLog)
+        Seg_Close(&SegLog);
+    if(UseStream)
+        Stream_Close(&Stream);
+    if(UseMqtt)
+        Mqtt_Close(&Mqtt);
+    if(UseEmon)
+        Emon_Close(&Emon);
+    if(UseNdjson) {
+        Ndj_PrintStats(&Ndjson);
+        Ndj_Close(&Ndjson);
+        close(JsonFd);
+    }
+    if(UseLatest)
+        Shm_Close(&Latest);
+    Out_FreeCache(&LogFiles);
+
+    //every change is in the meter database already
+    Db_Close(&MeterDb);
+    Log_Stop();
     return 0;
 }
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusseg.h>
+#include <wmbus/wmbusfmt.h>
+
+// eccwmbus-consume - read the segment log written with "eccwmbus -s <dir>"
+//
+// A named consumer (-c) continues after the last committed reading, its offset
+// is committed after the rows are written to stdout. Without -c the log is
+// read from the start (or -o) and nothing is committed.
+
+#define COMMIT_EVERY 256
+#define OUTBUFFER    (64*1024)
+
+static volatile sig_atomic_t Stop = 0;
+
+static void OnSignal(int sig) {
+    Stop = 1;
+}
+
+void IntroShowParam(void) {
+    printf("   eccwmbus-consume - read the eccwmbus segment log\n\n");
+    printf("   ./eccwmbus-consume -d %s -c billing -f\n", SEG_DEFAULTDIR);
+    printf("   -d <dir>    : directory of the segment log\n");
+    printf("   -c <name>   : consumer name, resumes at its committed offset\n");
+    printf("   -o <offset> : start at offset, e.g. to replay older readings\n");
+    printf("   -n <num>    : stop after num readings\n");
+    printf("   -f          : follow, wait for new readings\n");
+    printf("   -j          : JSON lines instead of CSV, one object per reading with the payload as hex\n");
+    printf("   -l          : list segments and consumers\n\n");
+    printf("   output: offset, meter, date, epoch, value, exp, rssi, accNo, status, payload\n");
+}
+
+void ErrorAndExit(const char *info) {
+    fprintf(stderr, "%s", info);
+    exit(1);
+}
+
+static void PrintReading(uint64_t offset, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    char      line[160 + 2*sizeof(data->payload)];
+    time_t    t = (time_t)data->time;
+    struct tm tm;
+    int       len, iX;
+    static const char HexDigits[] = "0123456789ABCDEF";
+
+    localtime_r(&t, &tm);
+    len = sprintf(line, "%llu, %04x_%08x_%02x_%02x, %d-%02d-%02d %02d:%02d:%02d, %u, %u, %d, %d, %u, %u, ",
+                  (unsigned long long)offset, meter->manufacturerID, meter->ident, meter->type, meter->version,
+                  tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                  data->time, data->value, data->exp, data->rssiDBm, data->accNo, data->status);
+    for(iX=0; iX<data->payloadLength; iX++) {
+        line[len++] = HexDigits[data->payload[iX] >> 4];
+        line[len++] = HexDigits[data->payload[iX] & 0x0F];
+    }
+    line[len++] = '\n';
+    fwrite(line, 1, len, stdout);
+}
+
+static void PrintJSON(const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    char line[FMT_MAXJSON];
+
+    fwrite(line, 1, Fmt_ReadingJSON(line, meter, data, FMT_PAYLOAD | FMT_NEWLINE), stdout);
+}
+
+//offset after the last record on disk
+static uint64_t EndOffset(const char *dir) {
+    ecwMBUSSegReader reader;
+    ecwMBUSMeter     meter;
+    ecMBUSData       data;
+    uint64_t        *bases;
+    uint64_t         end = 0;
+    int              count;
+
+    if((Seg_ListSegments(dir, &bases, &count) != APIOK) || (count == 0)) {
+        free(bases);
+        return 0;
+    }
+    if(Seg_OpenReader(&reader, dir, NULL) == APIOK) {
+        Seg_Seek(&reader, bases[count-1]);
+        while(Seg_Read(&reader, &meter, &data, NULL, 0) == APIOK)
+            ;
+        end = reader.offset;
+        Seg_CloseReader(&reader);
+    }
+    free(bases);
+    return end;
+}
+
+static void ListLog(const char *dir) {
+    DIR           *d;
+    struct dirent *de;
+    struct stat    st;
+    char           path[_MAX_PATH];
+    char           name[SEG_MAXNAME+1];
+    uint64_t      *bases;
+    uint64_t       end, offset;
+    int            count, iX;
+    size_t         sfx = strlen(SEG_OFFSUFFIX);
+
+    if(Seg_ListSegments(dir, &bases, &count) != APIOK)
+        ErrorAndExit("eccwmbus-consume - cannot read the segment log\n");
+    end = EndOffset(dir);
+
+    printf("Segments: %d, offsets %llu - %llu\n", count, count ? (unsigned long long)bases[0] : 0ULL, (unsigned long long)end);
+    for(iX=0; iX<count; iX++) {
+        snprintf(path, sizeof(path), "%s/%020llu" SEG_FILESUFFIX, dir, (unsigned long long)bases[iX]);
+        printf("  %020llu  %10ld bytes\n", (unsigned long long)bases[iX], (stat(path, &st) == 0) ? (long)st.st_size : 0L);
+    }
+    free(bases);
+
+    printf("Consumers:\n");
+    if(NULL == (d = opendir(dir))) return;
+    while(NULL != (de = readdir(d))) {
+        size_t len = strlen(de->d_name);
+        if((len <= sfx) || (len-sfx > SEG_MAXNAME) || (0 != strcmp(de->d_name+len-sfx, SEG_OFFSUFFIX)))
+            continue;
+        memcpy(name, de->d_name, len-sfx);
+        name[len-sfx] = 0;
+        if(Seg_GetOffset(dir, name, &offset) == APIOK)
+            printf("  %-24s offset %llu, lag %llu\n", name, (unsigned long long)offset,
+                   (unsigned long long)((end > offset) ? end - offset : 0));
+    }
+    closedir(d);
+}
+
+int main(int argc, char *argv[]) {
+    char              Dir[_MAX_PATH] = SEG_DEFAULTDIR;
+    char             *Name   = NULL;
+    bool              Follow = false;
+    bool              List   = false;
+    bool              Seek   = false;
+    bool              Json   = false;
+    uint64_t          Start  = 0;
+    unsigned long     Max    = 0;
+    unsigned long     Count  = 0;
+    unsigned long     Uncommitted = 0;
+    ecwMBUSSegReader  Reader;
+    ecwMBUSMeter      Meter;
+    ecMBUSData        Data;
+    uint64_t          Offset;
+    int               c, ret;
+
+    while ((c = getopt (argc, argv, "c:d:fhjln:o:")) != -1) {
+        switch (c) {
+            case 'd':
+                snprintf(Dir, sizeof(Dir), "%s", optarg);
+                break;
+            case 'c':
+                if(Seg_ValidName(optarg) != APIOK) ErrorAndExit("invalid consumer name\n");
+                Name = optarg;
+                break;
+            case 'o':
+                Start = strtoull(optarg, NULL, 10);
+                Seek  = true;
+                break;
+            case 'n':
+                Max = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                Follow = true;
+                break;
+            case 'j':
+                Json = true;
+                break;
+            case 'l':
+                List = true;
+                break;
+            case 'h':
+                IntroShowParam();
+                exit (0);
+            default:
+                IntroShowParam();
+                exit (1);
+        }
+    }
+
+    if(List) {
+        ListLog(Dir);
+        return 0;
+    }
+
+    if(Seg_OpenReader(&Reader, Dir, Name) != APIOK)
+        ErrorAndExit("eccwmbus-consume - cannot open the segment log\n");
+    if(Seek) Seg_Seek(&Reader, Start);
+
+    signal(SIGINT,  OnSignal);
+    signal(SIGTERM, OnSignal);
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOFBF, OUTBUFFER); //rows go out in large writes, flushed at every commit
+
+    while(!Stop && ((Max == 0) || (Count < Max))) {
+        //commit whenever the reader has caught up, the timeout keeps the signals responsive
+        ret = Seg_Read(&Reader, &Meter, &Data, &Offset, (Uncommitted > 0) ? 0 : (Follow ? 500 : 0));
+        if(ret == APIOK) {
+            if(Json) PrintJSON(&Meter, &Data);
+            else     PrintReading(Offset, &Meter, &Data);
+            Count++;
+            Uncommitted++;
+        }
+        if((ret != APIOK) || (Uncommitted >= COMMIT_EVERY)) {
+            if(Uncommitted > 0) {
+                if(fflush(stdout) != 0) break;
+                if((NULL != Name) && (Seg_Commit(&Reader) != APIOK))
+                    fprintf(stderr, "eccwmbus-consume - cannot commit offset %llu\n", (unsigned long long)Reader.offset);
+                Uncommitted = 0;
+            }
+            if(ret == APIERROR) break;
+            if((ret == SEG_NODATA) && !Follow) break;
+        }
+    }
+
+    if((Uncommitted > 0) && (fflush(stdout) == 0) && (NULL != Name))
+        Seg_Commit(&Reader);
+    Seg_CloseReader(&Reader);
+    return 0;
+}
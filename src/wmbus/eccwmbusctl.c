@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusctl.h>
+
+// eccwmbus-ctl - send requests to the control socket of "eccwmbus -C <file>"
+//
+// The command is given on the command line, without one the requests are read
+// from stdin, one per line. The result lines go to stdout, errors to stderr,
+// the exit code is 1 when a request failed.
+
+void IntroShowParam(void) {
+    printf("   eccwmbus-ctl - control a running eccwmbus\n\n");
+    printf("   ./eccwmbus-ctl -c %s meters\n", CTL_DEFAULTPATH);
+    printf("   -c <file>   : control socket, default %s\n\n", CTL_DEFAULTPATH);
+    printf("   meters                                        : list the meters\n");
+    printf("   add <manid> <ident> <type> <version> [key]    : add a meter, hex as listed, key is 32 hex digits,\n");
+    printf("                                                   default or zero\n");
+    printf("   add <manid> <ident>                           : add a meter of the meter database\n");
+    printf("   remove <slot>                                 : remove a meter, it stays in the meter database\n");
+    printf("   mode [S|T]                                    : show or switch the radio mode\n");
+    printf("   latest [slot]                                 : latest readings: slot, manid, ident, epoch, value, exp,\n");
+    printf("                                                   rssi, accNo, status, pktInfo, readings\n");
+    printf("   status                                        : stick counters\n");
+    printf("   stats                                         : counters of the outputs\n");
+    printf("   log [levels]                                  : show or change the log levels, e.g. log info,frame=warn\n");
+}
+
+void ErrorAndExit(const char *info) {
+    fprintf(stderr, "%s", info);
+    exit(1);
+}
+
+//send one request and print the response, APIERROR when it failed
+static int Request(FILE *in, FILE *out, const char *line) {
+    char buf[1024];
+    bool first = true;
+    int  ret   = APIERROR;
+
+    if((fprintf(out, "%s\n", line) < 0) || (fflush(out) != 0))
+        ErrorAndExit("eccwmbus-ctl - connection lost\n");
+    while(NULL != fgets(buf, sizeof(buf), in)) {
+        if(first) {
+            first = false;
+            if(0 == strcmp(buf, "OK\n")) ret = APIOK;
+            else fprintf(stderr, "%s", (0 == strncmp(buf, "ERR ", 4)) ? buf+4 : buf);
+            continue;
+        }
+        if(0 == strcmp(buf, "\n")) return ret;
+        fputs(buf, stdout);
+    }
+    ErrorAndExit("eccwmbus-ctl - connection lost\n");
+    return APIERROR;
+}
+
+int main(int argc, char *argv[]) {
+    char               Path[_MAX_PATH] = CTL_DEFAULTPATH;
+    char               Line[CTL_MAXREQUEST];
+    struct sockaddr_un addr;
+    FILE              *in, *out;
+    size_t             len;
+    int                c, fd, iX;
+    int                Failed = 0;
+
+    while ((c = getopt (argc, argv, "+c:h")) != -1) {
+        switch (c) {
+            case 'c':
+                snprintf(Path, sizeof(Path), "%s", optarg);
+                break;
+            case 'h':
+                IntroShowParam();
+                exit (0);
+            default:
+                IntroShowParam();
+                exit (1);
+        }
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(Path) >= sizeof(addr.sun_path)) ErrorAndExit("eccwmbus-ctl - socket path too long\n");
+    strcpy(addr.sun_path, Path);
+    if(((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0))
+        ErrorAndExit("eccwmbus-ctl - cannot connect, is eccwmbus running with -C?\n");
+    if((NULL == (in = fdopen(fd, "r"))) || (NULL == (out = fdopen(dup(fd), "w"))))
+        ErrorAndExit("eccwmbus-ctl - cannot connect\n");
+    signal(SIGPIPE, SIG_IGN);
+
+    if(optind < argc) {
+        len = 0;
+        Line[0] = 0;
+        for(iX=optind; iX<argc; iX++) {
+            if(len + strlen(argv[iX]) + 2 > sizeof(Line)) ErrorAndExit("eccwmbus-ctl - request too long\n");
+            len += sprintf(Line+len, "%s%s", (iX > optind) ? " " : "", argv[iX]);
+        }
+        Failed = (Request(in, out, Line) != APIOK);
+    }
+    else {
+        while(NULL != fgets(Line, sizeof(Line), stdin)) {
+            Line[strcspn(Line, "\r\n")] = 0;
+            if(0 == Line[strspn(Line, " \t")]) continue;
+            if(Request(in, out, Line) != APIOK) Failed = 1;
+        }
+    }
+    fclose(out);
+    fclose(in);
+    return Failed;
+}
@@ -0,0 +1,573 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbushist.h>
+#include <wmbus/wmbusout.h>
+
+// eccwmbus-import - move existing CSV (Log2CSVFile) and XML (Log2XMLFile) logs into the history store
+//
+// The meter of a file comes from its name (wmbus_<manid>_<ident>_<type>_<version>.csv or .xml),
+// from the payload of the first CSV row or from -m. Files of the same meter are parsed by one worker,
+// sorted and appended to the history file in one batch; meters are spread over all cores.
+
+#define FORMAT_CSV   0
+#define FORMAT_XML   1
+
+#define MAXTHREADS   16
+#define SLEEP100MS   (100*1000)
+
+typedef struct _IMPORT_FILE {
+    char          path[_MAX_PATH];
+    int           format;
+    ecwMBUSMeter  meter;
+} ImportFile;
+
+typedef struct _IMPORT_GROUP {
+    int first;      // index into Files
+    int count;
+} ImportGroup;
+
+typedef struct _IMPORT_RECS {
+    ecwMBUSHistRec *recs;
+    uint32_t        count;
+    uint32_t        size;
+} ImportRecs;
+
+typedef struct _HOUR_CACHE {
+    int      year, mon, mday, hour;
+    uint32_t epoch;
+    bool     valid;
+} HourCache;
+
+static char          DataPath[_MAX_PATH] = "/home/pi/data/wmbus";
+static ImportFile   *Files;
+static int           FileCount;
+static int           FileSize;
+static ImportGroup  *Groups;
+static int           GroupCount;
+static int           GroupNext;
+static bool          MeterOverride;
+static ecwMBUSMeter  OverrideMeter;
+
+static pthread_mutex_t lockImport = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long FilesDone;
+static unsigned long RecordsDone;
+static unsigned long LinesSkipped;
+static unsigned long MetersFailed;
+static unsigned long BytesDone;
+
+void IntroShowParam(void) {
+    printf("   eccwmbus-import - import CSV and XML logs into the eccwmbus history store\n\n");
+    printf("   ./eccwmbus-import -d /home/pi/data/wmbus /backup/gw1 /backup/gw2/wmbus_18c4_12345678_02_01.csv\n");
+    printf("   -d <dir>     : directory of the history files\n");
+    printf("   -m <meter>   : manufacturer:ident:type:version for files without meter in the name\n");
+    printf("   -j <n>       : number of threads, default number of cores\n");
+    printf("   Directories are searched recursively for *.csv and *.xml files.\n\n");
+}
+
+void ErrorAndExit(const char *info) {
+    fprintf(stderr, "%s", info);
+    exit(1);
+}
+
+//hex digits to number, returns false on anything else
+static bool ParseHex(const char *p, int n, uint32_t *v) {
+    int iX;
+    *v = 0;
+    for(iX=0; iX<n; iX++) {
+        char c = p[iX];
+        if     (c >= '0' && c <= '9') *v = (*v<<4) | (uint32_t)(c-'0');
+        else if(c >= 'a' && c <= 'f') *v = (*v<<4) | (uint32_t)(c-'a'+10);
+        else if(c >= 'A' && c <= 'F') *v = (*v<<4) | (uint32_t)(c-'A'+10);
+        else return false;
+    }
+    return true;
+}
+
+static bool ParseDec(const char **pp, const char *end, int n, int *v) {
+    const char *p = *pp;
+    int iX;
+    if(end - p < n) return false;
+    *v = 0;
+    for(iX=0; iX<n; iX++) {
+        if(p[iX] < '0' || p[iX] > '9') return false;
+        *v = *v*10 + (p[iX]-'0');
+    }
+    *pp = p+n;
+    return true;
+}
+
+static const char *SkipBlanks(const char *p, const char *end) {
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+//decimal text to value*10^exp without rounding, "123.4" -> 1234, -1
+static bool ParseValue(const char **pp, const char *end, uint32_t *value, int8_t *exp) {
+    const char *p = *pp;
+    uint64_t v = 0;
+    int      frac = 0;
+    bool     digits = false, point = false;
+
+    while(p < end) {
+        if(*p >= '0' && *p <= '9') {
+            v = v*10 + (uint64_t)(*p-'0');
+            if(v > UINT32_MAX) return false;
+            if(point) frac++;
+            digits = true;
+        }
+        else if(*p == '.' && !point) point = true;
+        else break;
+        p++;
+    }
+    if(!digits) return false;
+    *value = (uint32_t)v;
+    *exp   = (int8_t)(-frac);
+    *pp = p;
+    return true;
+}
+
+//local time to epoch, mktime only once per hour of input
+static uint32_t LocalEpoch(HourCache *cache, int year, int mon, int mday, int hour, int min, int sec) {
+    if(!cache->valid || cache->year != year || cache->mon != mon || cache->mday != mday || cache->hour != hour) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year  = year-1900;
+        tm.tm_mon   = mon-1;
+        tm.tm_mday  = mday;
+        tm.tm_hour  = hour;
+        tm.tm_isdst = -1;
+        cache->epoch = (uint32_t)mktime(&tm);
+        cache->year  = year;
+        cache->mon   = mon;
+        cache->mday  = mday;
+        cache->hour  = hour;
+        cache->valid = true;
+    }
+    return cache->epoch + min*60 + sec;
+}
+
+static bool AddRec(ImportRecs *r, const ecwMBUSHistRec *rec) {
+    if(r->count == r->size) {
+        uint32_t size = max(4096, r->size*2);
+        ecwMBUSHistRec *recs = (ecwMBUSHistRec *) realloc(r->recs, (size_t)size*sizeof(ecwMBUSHistRec));
+        if(NULL == recs) return false;
+        r->recs = recs;
+        r->size = size;
+    }
+    r->recs[r->count++] = *rec;
+    return true;
+}
+
+//meter address from the wM-Bus header in the payload hex (L C M M A A A A V T)
+static bool MeterFromPayload(const char *p, const char *end, pecwMBUSMeter meter) {
+    uint32_t b[10];
+    int iX;
+    if(end - p < 20) return false;
+    for(iX=0; iX<10; iX++)
+        if(!ParseHex(p+2*iX, 2, &b[iX])) return false;
+    memset(meter, 0, sizeof(ecwMBUSMeter));
+    meter->manufacturerID = (uint16_t)(b[2] | (b[3]<<8));
+    meter->ident          = b[4] | (b[5]<<8) | (b[6]<<16) | (b[7]<<24);
+    meter->version        = (uint8_t)b[8];
+    meter->type           = (uint8_t)b[9];
+    return meter->manufacturerID != 0;
+}
+
+//"YYYY-MM-DD HH:MM[:SS], Value, Payload"
+static bool ParseCSVLine(const char *p, const char *end, HourCache *cache, ecwMBUSHistRec *rec, const char **payload) {
+    int year, mon, mday, hour, min, sec = 0;
+    uint32_t b;
+
+    memset(rec, 0, sizeof(ecwMBUSHistRec));
+    if(!ParseDec(&p, end, 4, &year) || p >= end || *p++ != '-') return false;
+    if(!ParseDec(&p, end, 2, &mon)  || p >= end || *p++ != '-') return false;
+    if(!ParseDec(&p, end, 2, &mday) || p >= end || *p++ != ' ') return false;
+    if(!ParseDec(&p, end, 2, &hour) || p >= end || *p++ != ':') return false;
+    if(!ParseDec(&p, end, 2, &min)) return false;
+    if(p < end && *p == ':') {
+        p++;
+        if(!ParseDec(&p, end, 2, &sec)) return false;
+    }
+    p = SkipBlanks(p, end);
+    if(p >= end || *p++ != ',') return false;
+    p = SkipBlanks(p, end);
+    if(!ParseValue(&p, end, &rec->value, &rec->exp)) return false;
+    p = SkipBlanks(p, end);
+    if(p < end && *p == ',') p = SkipBlanks(p+1, end);
+
+    rec->time = LocalEpoch(cache, year, mon, mday, hour, min, sec);
+    *payload  = p;
+    if((end - p >= 26) && ParseHex(p+22, 2, &b)) rec->accNo  = (uint8_t)b;
+    if((end - p >= 26) && ParseHex(p+24, 2, &b)) rec->status = (uint8_t)b;
+    return true;
+}
+
+static void ParseCSV(const char *p, const char *end, ImportRecs *r, unsigned long *skipped) {
+    HourCache      cache;
+    ecwMBUSHistRec rec;
+    const char    *payload;
+
+    memset(&cache, 0, sizeof(cache));
+    while(p < end) {
+        const char *eol = memchr(p, '\n', end-p);
+        if(NULL == eol) eol = end;
+        if((eol > p) && (*p >= '0') && (*p <= '9')) { //header and blank lines start otherwise
+            if(ParseCSVLine(p, eol, &cache, &rec, &payload)) {
+                if(!AddRec(r, &rec)) break;
+            }
+            else (*skipped)++;
+        }
+        p = eol+1;
+    }
+}
+
+static const char *FindTag(const char *p, const char *end, const char *tag) {
+    size_t len = strlen(tag);
+    while(p + len <= end) {
+        const char *lt = memchr(p, '<', end-p);
+        if((NULL == lt) || (lt + len > end)) return NULL;
+        if(0 == memcmp(lt, tag, len)) return lt + len;
+        p = lt+1;
+    }
+    return NULL;
+}
+
+static bool ParseXMLInt(const char *p, const char *end, const char *tag, int *v) {
+    const char *q = FindTag(p, end, tag);
+    bool neg = false;
+    if(NULL == q) return false;
+    if(q < end && *q == '-') {
+        neg = true;
+        q++;
+    }
+    *v = 0;
+    if(q >= end || *q < '0' || *q > '9') return false;
+    while(q < end && *q >= '0' && *q <= '9')
+        *v = *v*10 + (*q++ - '0');
+    if(neg) *v = -*v;
+    return true;
+}
+
+//<OCR><Date>dd.mm.yyyy HH:MM:SS</Date><Reading>1.0</Reading><RSSI>..</RSSI>...<wMBUSStatus>..</wMBUSStatus></OCR>
+static void ParseXML(const char *p, const char *end, ImportRecs *r, unsigned long *skipped) {
+    HourCache      cache;
+    ecwMBUSHistRec rec;
+
+    memset(&cache, 0, sizeof(cache));
+    while(NULL != (p = FindTag(p, end, "<OCR>"))) {
+        const char *blockEnd = FindTag(p, end, "</OCR>");
+        const char *q;
+        int  mday, mon, year, hour, min, sec, v;
+
+        if(NULL == blockEnd) break;
+        memset(&rec, 0, sizeof(rec));
+        q = FindTag(p, blockEnd, "<Date>");
+        if((NULL == q) ||
+           !ParseDec(&q, blockEnd, 2, &mday) || *q++ != '.' || !ParseDec(&q, blockEnd, 2, &mon)  || *q++ != '.' ||
+           !ParseDec(&q, blockEnd, 4, &year) || *q++ != ' ' || !ParseDec(&q, blockEnd, 2, &hour) || *q++ != ':' ||
+           !ParseDec(&q, blockEnd, 2, &min)  || *q++ != ':' || !ParseDec(&q, blockEnd, 2, &sec)) {
+            (*skipped)++;
+            p = blockEnd;
+            continue;
+        }
+        q = FindTag(p, blockEnd, "<Reading>");
+        if((NULL == q) || !ParseValue(&q, blockEnd, &rec.value, &rec.exp)) {
+            (*skipped)++;
+            p = blockEnd;
+            continue;
+        }
+        rec.time = LocalEpoch(&cache, year, mon, mday, hour, min, sec);
+        if(ParseXMLInt(p, blockEnd, "<RSSI>", &v))        rec.rssiDBm = (int8_t)v;
+        if(ParseXMLInt(p, blockEnd, "<wMBUSStatus>", &v)) rec.status  = (uint8_t)v;
+        if(!AddRec(r, &rec)) break;
+        p = blockEnd;
+    }
+}
+
+static int CompareMeter(const ecwMBUSMeter *a, const ecwMBUSMeter *b) {
+    if(a->manufacturerID != b->manufacturerID) return (a->manufacturerID < b->manufacturerID) ? -1 : 1;
+    if(a->ident   != b->ident)   return (a->ident   < b->ident)   ? -1 : 1;
+    if(a->type    != b->type)    return (a->type    < b->type)    ? -1 : 1;
+    if(a->version != b->version) return (a->version < b->version) ? -1 : 1;
+    return 0;
+}
+
+static int CompareFiles(const void *a, const void *b) {
+    return CompareMeter(&((const ImportFile *)a)->meter, &((const ImportFile *)b)->meter);
+}
+
+//parse all files of one meter, sort and append in one batch
+static void ImportGroupFiles(const ImportGroup *group) {
+    ImportRecs    r;
+    char          path[_MAX_PATH];
+    unsigned long skipped = 0;
+    unsigned long bytes = 0;
+    int           iX;
+
+    memset(&r, 0, sizeof(r));
+    for(iX=group->first; iX<group->first+group->count; iX++) {
+        struct stat st;
+        int   fd = open(Files[iX].path, O_RDONLY);
+        char *map;
+
+        if(fd < 0) {
+            fprintf(stderr, "Cannot read >%s<\n", Files[iX].path);
+            continue;
+        }
+        if((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+            map = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(MAP_FAILED != map) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                if(Files[iX].format == FORMAT_XML) ParseXML(map, map+st.st_size, &r, &skipped);
+                else                               ParseCSV(map, map+st.st_size, &r, &skipped);
+                munmap(map, st.st_size);
+                bytes += st.st_size;
+            }
+        }
+        close(fd);
+
+        pthread_mutex_lock(&lockImport);
+        FilesDone++;
+        pthread_mutex_unlock(&lockImport);
+    }
+
+    Hist_MakePath(path, _MAX_PATH, DataPath, &Files[group->first].meter);
+    if((r.count > 0) && (Hist_Append(path, &Files[group->first].meter, r.recs, r.count) != APIOK)) {
+        fprintf(stderr, "Cannot write to >%s<\n", path);
+        pthread_mutex_lock(&lockImport);
+        MetersFailed++;
+        pthread_mutex_unlock(&lockImport);
+    }
+
+    pthread_mutex_lock(&lockImport);
+    RecordsDone  += r.count;
+    LinesSkipped += skipped;
+    BytesDone    += bytes;
+    pthread_mutex_unlock(&lockImport);
+    free(r.recs);
+}
+
+void * ImportThreadProc(void *arg) {
+    int iGroup;
+    for(;;) {
+        pthread_mutex_lock(&lockImport);
+        iGroup = GroupNext++;
+        pthread_mutex_unlock(&lockImport);
+        if(iGroup >= GroupCount) break;
+        ImportGroupFiles(&Groups[iGroup]);
+    }
+    return 0;
+}
+
+//meter from the file name or from the first CSV row
+static bool DetectMeter(ImportFile *file) {
+    const char *name = strrchr(file->path, '/');
+    size_t      len;
+    uint32_t    m, i, t, v;
+
+    name = (NULL == name) ? file->path : name+1;
+    len  = strlen(name);
+
+    if(MeterOverride) {
+        file->meter = OverrideMeter;
+        return true;
+    }
+    //wmbus_18c4_12345678_02_01.csv
+    if((len == 29) && (0 == strncmp(name, "wmbus_", 6)) && (name[10] == '_') && (name[19] == '_') && (name[22] == '_') &&
+       ParseHex(name+6, 4, &m) && ParseHex(name+11, 8, &i) && ParseHex(name+20, 2, &t) && ParseHex(name+23, 2, &v)) {
+        memset(&file->meter, 0, sizeof(ecwMBUSMeter));
+        file->meter.manufacturerID = (uint16_t)m;
+        file->meter.ident          = i;
+        file->meter.type           = (uint8_t)t;
+        file->meter.version        = (uint8_t)v;
+        return true;
+    }
+    if(file->format == FORMAT_CSV) {
+        char    buf[4096];
+        ssize_t n;
+        int     fd = open(file->path, O_RDONLY);
+        if(fd < 0) return false;
+        n = read(fd, buf, sizeof(buf));
+        close(fd);
+        if(n > 0) {
+            const char *p = buf, *end = buf+n;
+            HourCache cache;
+            ecwMBUSHistRec rec;
+            const char *payload;
+            memset(&cache, 0, sizeof(cache));
+            while(p < end) {
+                const char *eol = memchr(p, '\n', end-p);
+                if(NULL == eol) break;
+                if(ParseCSVLine(p, eol, &cache, &rec, &payload) && MeterFromPayload(payload, eol, &file->meter))
+                    return true;
+                p = eol+1;
+            }
+        }
+    }
+    return false;
+}
+
+static void AddFile(const char *path) {
+    size_t len = strlen(path);
+    int    format;
+
+    if((len > 4) && (0 == strcmp(path+len-4, ".csv")))      format = FORMAT_CSV;
+    else if((len > 4) && (0 == strcmp(path+len-4, ".xml"))) format = FORMAT_XML;
+    else return;
+    if(len >= _MAX_PATH) return;
+
+    if(FileCount == FileSize) {
+        FileSize = max(256, FileSize*2);
+        Files = (ImportFile *) realloc(Files, FileSize*sizeof(ImportFile));
+        if(NULL == Files) ErrorAndExit("eccwmbus-import - out of memory\n");
+    }
+    strcpy(Files[FileCount].path, path);
+    Files[FileCount].format = format;
+    if(!DetectMeter(&Files[FileCount])) {
+        fprintf(stderr, "No meter for >%s< - use -m\n", path);
+        return;
+    }
+    FileCount++;
+}
+
+static void AddPath(const char *path) {
+    struct stat st;
+    DIR *dir;
+    struct dirent *entry;
+    char sub[_MAX_PATH];
+
+    if(stat(path, &st) != 0) {
+        fprintf(stderr, "Cannot read >%s<\n", path);
+        return;
+    }
+    if(!S_ISDIR(st.st_mode)) {
+        AddFile(path);
+        return;
+    }
+    if(NULL == (dir = opendir(path))) return;
+    while(NULL != (entry = readdir(dir))) {
+        if(entry->d_name[0] == '.') continue;
+        if(snprintf(sub, sizeof(sub), "%s/%s", path, entry->d_name) >= (int)sizeof(sub)) continue;
+        AddPath(sub);
+    }
+    closedir(dir);
+}
+
+static double NowSec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int       Threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t ThreadIDs[MAXTHREADS];
+    double    tStart, tNow, tPrint = 0;
+    int       c, iX;
+    unsigned long done;
+
+    opterr = 0;
+    while ((c = getopt (argc, argv, "d:hj:m:")) != -1) {
+        switch (c) {
+            case 'd':
+                snprintf(DataPath, sizeof(DataPath), "%s", optarg);
+                break;
+            case 'j':
+                Threads = atoi(optarg);
+                break;
+            case 'm': {
+                unsigned int m, i, t, v;
+                char *p = optarg;
+                m = strtoul(p, &p, 16); if(*p++ != ':') ErrorAndExit("invalid meter\n");
+                i = strtoul(p, &p, 16); if(*p++ != ':') ErrorAndExit("invalid meter\n");
+                t = strtoul(p, &p, 16); if(*p++ != ':') ErrorAndExit("invalid meter\n");
+                v = strtoul(p, &p, 16);
+                memset(&OverrideMeter, 0, sizeof(OverrideMeter));
+                OverrideMeter.manufacturerID = (uint16_t)m;
+                OverrideMeter.ident          = i;
+                OverrideMeter.type           = (uint8_t)t;
+                OverrideMeter.version        = (uint8_t)v;
+                MeterOverride = true;
+                break;
+            }
+            case 'h':
+                IntroShowParam();
+                exit (0);
+            default:
+                IntroShowParam();
+                exit (1);
+        }
+    }
+    if(optind >= argc) {
+        IntroShowParam();
+        exit (1);
+    }
+    Threads = max(1, min(Threads, MAXTHREADS));
+
+    tStart = NowSec();
+    for(iX=optind; iX<argc; iX++)
+        AddPath(argv[iX]);
+    if(FileCount == 0) ErrorAndExit("No files to import\n");
+    {
+        char dir[_MAX_PATH+1];
+        snprintf(dir, sizeof(dir), "%s/", DataPath);
+        if(Out_MakeDirs(dir) != APIOK) ErrorAndExit("Cannot create data path\n");
+    }
+
+    //one group per meter
+    qsort(Files, FileCount, sizeof(ImportFile), CompareFiles);
+    Groups = (ImportGroup *) malloc(FileCount*sizeof(ImportGroup));
+    if(NULL == Groups) ErrorAndExit("eccwmbus-import - out of memory\n");
+    for(iX=0; iX<FileCount; iX++) {
+        if((iX == 0) || (CompareMeter(&Files[iX].meter, &Files[iX-1].meter) != 0)) {
+            Groups[GroupCount].first = iX;
+            Groups[GroupCount].count = 0;
+            GroupCount++;
+        }
+        Groups[GroupCount-1].count++;
+    }
+    printf("Importing %d files of %d meters with %d threads\n", FileCount, GroupCount, min(Threads, GroupCount));
+
+    Threads = min(Threads, GroupCount);
+    for(iX=0; iX<Threads; iX++)
+        pthread_create(&ThreadIDs[iX], NULL, ImportThreadProc, NULL);
+
+    do {
+        usleep(SLEEP100MS);
+        pthread_mutex_lock(&lockImport);
+        done = FilesDone;
+        tNow = NowSec() - tStart;
+        if(tNow - tPrint >= 1.0) { //progress once a second
+            printf("\r%lu/%d files, %lu records, %.0f records/s, %.1f MB/s   ", done, FileCount, RecordsDone,
+                   RecordsDone/tNow, BytesDone/tNow/(1024*1024));
+            fflush(stdout);
+            tPrint = tNow;
+        }
+        pthread_mutex_unlock(&lockImport);
+    } while(done < (unsigned long)FileCount);
+
+    for(iX=0; iX<Threads; iX++)
+        pthread_join(ThreadIDs[iX], NULL);
+
+    tNow = NowSec() - tStart;
+    printf("\rImported %lu records from %d files (%lu MB) in %.1f s, %.0f records/s\n", RecordsDone, FileCount,
+           BytesDone/(1024*1024), tNow, RecordsDone/tNow);
+    if(LinesSkipped > 0) printf("%lu lines skipped\n", LinesSkipped);
+    if(MetersFailed > 0) printf("%lu meters failed\n", MetersFailed);
+
+    free(Groups);
+    free(Files);
+    return (MetersFailed > 0) ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusshm.h>
+
+// eccwmbus-latest - print the latest value table written with "eccwmbus -L <file>"
+//
+// Without -w every meter in the table is printed once, with -w the table is
+// polled and a row is printed whenever a meter has a new reading.
+
+static volatile sig_atomic_t Stop = 0;
+
+static void OnSignal(int sig) {
+    Stop = 1;
+}
+
+void IntroShowParam(void) {
+    printf("   eccwmbus-latest - print the latest reading of every meter\n\n");
+    printf("   ./eccwmbus-latest -t %s -w 500\n", SHM_DEFAULTPATH);
+    printf("   -t <file>   : latest value table, default %s\n", SHM_DEFAULTPATH);
+    printf("   -m <ident>  : only this meter (hex ident as printed)\n");
+    printf("   -w <ms>     : watch, print new readings, poll every ms\n\n");
+    printf("   output: slot, meter, date, epoch, value, exp, rssi, accNo, status, pktInfo, readings\n");
+}
+
+void ErrorAndExit(const char *info) {
+    fprintf(stderr, "%s", info);
+    exit(1);
+}
+
+static void PrintSlot(int index, const ecwMBUSMeter *meter, const ecMBUSData *data, uint32_t updates) {
+    time_t    t = (time_t)data->time;
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    printf("%d, %04x_%08x_%02x_%02x, %d-%02d-%02d %02d:%02d:%02d, %u, %u, %d, %d, %u, %u, %u, %u\n",
+           index+1, meter->manufacturerID, meter->ident, meter->type, meter->version,
+           tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+           data->time, data->value, data->exp, data->rssiDBm, data->accNo, data->status, data->pktInfo, updates);
+}
+
+int main(int argc, char *argv[]) {
+    char         Path[_MAX_PATH] = SHM_DEFAULTPATH;
+    bool         Filter = false;
+    uint32_t     Ident  = 0;
+    int          WatchMs = 0;
+    uint32_t     Seen[MAXMETER];
+    ecwMBUSShm   Table;
+    ecwMBUSMeter Meter;
+    ecMBUSData   Data;
+    uint32_t     Updates;
+    int          c, iX, ret;
+
+    while ((c = getopt (argc, argv, "hm:t:w:")) != -1) {
+        switch (c) {
+            case 't':
+                snprintf(Path, sizeof(Path), "%s", optarg);
+                break;
+            case 'm':
+                Ident  = (uint32_t) strtoul(optarg, NULL, 16);
+                Filter = true;
+                break;
+            case 'w':
+                WatchMs = atoi(optarg);
+                break;
+            case 'h':
+                IntroShowParam();
+                exit (0);
+            default:
+                IntroShowParam();
+                exit (1);
+        }
+    }
+
+    if(Shm_Attach(&Table, Path) != APIOK)
+        ErrorAndExit("eccwmbus-latest - cannot open the latest value table\n");
+
+    signal(SIGINT,  OnSignal);
+    signal(SIGTERM, OnSignal);
+
+    memset(Seen, 0, sizeof(Seen));
+    do {
+        for(iX=0; iX<MAXMETER; iX++) {
+            ret = Shm_Read(&Table, iX, &Meter, &Data, &Updates);
+            if(ret == SHM_BUSY)
+                fprintf(stderr, "eccwmbus-latest - slot %d is busy\n", iX+1);
+            if((ret != APIOK) || (Filter && (Meter.ident != Ident)) || (Updates == Seen[iX]))
+                continue;
+            Seen[iX] = Updates;
+            PrintSlot(iX, &Meter, &Data, Updates);
+        }
+        if(fflush(stdout) != 0) break;
+        if(WatchMs > 0) usleep(WatchMs*1000);
+    } while(!Stop && (WatchMs > 0));
+
+    Shm_Close(&Table);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusdb.h>
+#include <wmbus/wmbusout.h>
+
+// eccwmbus-meters - manage the meter database (meters.db) of eccwmbus
+//
+// The database holds every known meter with key and label; the watched ones
+// are set on the stick by eccwmbus, which reads the database again when it
+// changes. Meters are given as manufacturer and ident in hex.
+
+void IntroShowParam(void) {
+    printf("   eccwmbus-meters - manage the eccwmbus meter database\n\n");
+    printf("   ./eccwmbus-meters -d /home/pi/data/wmbus import meters.csv\n");
+    printf("   -d <path>   : data path of eccwmbus or the database file (*.db), default /home/pi/data/wmbus\n\n");
+    printf("   list                       : all meters as CSV, watched ones with their slot\n");
+    printf("   export                     : all meters as CSV for import\n");
+    printf("   import <file.csv> ...      : add or update meters, lines: manid,ident,type,version,key,label\n");
+    printf("                                key is 32 hex digits, default or zero; the slots are kept\n");
+    printf("   import-dat <meter.dat>     : meters of an older eccwmbus, watched in their slots\n");
+    printf("   watch <manid> <ident>      : set the meter on the stick, eccwmbus picks a free slot\n");
+    printf("   unwatch <manid> <ident>    : take the meter off the stick, it stays in the database\n");
+    printf("   remove <manid> <ident>     : delete the meter\n");
+}
+
+void ErrorAndExit(const char *info) {
+    fprintf(stderr, "%s", info);
+    exit(1);
+}
+
+static void FindOrExit(pecwMBUSDb db, int argc, char *argv[], pecwMBUSDbRec rec) {
+    char *end1, *end2;
+    unsigned long manid, ident;
+
+    if(argc != 3) ErrorAndExit("<manid> <ident> expected\n");
+    manid = strtoul(argv[1], &end1, 16);
+    ident = strtoul(argv[2], &end2, 16);
+    if((*end1 != 0) || (*end2 != 0) || (manid == 0) || (manid > 0xFFFF) || (ident > 0xFFFFFFFFUL))
+        ErrorAndExit("invalid manid or ident\n");
+    if(APIERROR == Db_Find(db, (uint16_t)manid, (uint32_t)ident, rec))
+        ErrorAndExit("meter not in the database\n");
+}
+
+int main(int argc, char *argv[]) {
+    char         Path[_MAX_PATH] = "/home/pi/data/wmbus";
+    char         Line[DB_MAXLABEL + 80];
+    ecwMBUSDb    Db;
+    ecwMBUSDbRec Rec;
+    struct stat  st;
+    uint32_t     iX, Imported;
+    int          c, iA;
+
+    while ((c = getopt (argc, argv, "+d:h")) != -1) {
+        switch (c) {
+            case 'd':
+                snprintf(Path, sizeof(Path), "%s", optarg);
+                break;
+            case 'h':
+                IntroShowParam();
+                exit (0);
+            default:
+                IntroShowParam();
+                exit (1);
+        }
+    }
+    if(optind >= argc) {
+        IntroShowParam();
+        exit (1);
+    }
+    //a directory, also one still to be created, gets meters.db; a path ending in .db is the file
+    if((0 == stat(Path, &st)) ? S_ISDIR(st.st_mode) : ((strlen(Path) < 3) || (0 != strcmp(Path + strlen(Path) - 3, ".db"))))
+        strncat(Path, "/" DB_FILENAME, sizeof(Path) - strlen(Path) - 1);
+    argc -= optind;
+    argv += optind;
+
+    Out_MakeDirs(Path);
+    if(APIOK != Db_Open(&Db, Path)) {
+        fprintf(stderr, "%s is not a meter database\n", Path);
+        exit(1);
+    }
+
+    if((0 == strcmp(argv[0], "list")) || (0 == strcmp(argv[0], "export"))) {
+        if(0 == strcmp(argv[0], "export"))
+            printf("manid,ident,type,version,key,label\n");
+        for(iX=0; iX<Db.count; iX++) {
+            Db_Get(&Db, iX, &Rec);
+            Db_FormatCSV(&Rec, Line, sizeof(Line));
+            if((0 == strcmp(argv[0], "export")) || (DB_NOSLOT == Rec.slot)) printf("%s\n", Line);
+            else if(DB_ANYSLOT == Rec.slot)                                  printf("%s,watched\n", Line);
+            else                                                             printf("%s,slot %d\n", Line, Rec.slot+1);
+        }
+    }
+    else if(0 == strcmp(argv[0], "import")) {
+        if(argc < 2) ErrorAndExit("import <file.csv> ...\n");
+        for(iA=1; iA<argc; iA++) {
+            if(APIOK != Db_ImportCSV(&Db, argv[iA], &Imported)) {
+                Db_Close(&Db);
+                exit(1);
+            }
+            printf("%s: %u meters, %u in the database\n", argv[iA], Imported, Db.count);
+        }
+    }
+    else if(0 == strcmp(argv[0], "import-dat")) {
+        if((argc != 2) || (APIOK != Db_ImportDat(&Db, argv[1], &Imported))) ErrorAndExit("Cannot import meter.dat\n");
+        printf("%s: %u meters, %u in the database\n", argv[1], Imported, Db.count);
+    }
+    else if((0 == strcmp(argv[0], "watch")) || (0 == strcmp(argv[0], "unwatch"))) {
+        FindOrExit(&Db, argc, argv, &Rec);
+        if(0 == strcmp(argv[0], "unwatch"))  Rec.slot = DB_NOSLOT;
+        else if(DB_NOSLOT == Rec.slot)       Rec.slot = DB_ANYSLOT;
+        if(APIOK != Db_SetSlot(&Db, Rec.meter.manufacturerID, Rec.meter.ident, Rec.slot)) ErrorAndExit("Cannot write the database\n");
+    }
+    else if(0 == strcmp(argv[0], "remove")) {
+        FindOrExit(&Db, argc, argv, &Rec);
+        if(APIOK != Db_Delete(&Db, Rec.meter.manufacturerID, Rec.meter.ident)) ErrorAndExit("Cannot write the database\n");
+    }
+    else {
+        IntroShowParam();
+        exit (1);
+    }
+    Db_Close(&Db);
+    return 0;
+}
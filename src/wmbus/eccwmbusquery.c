@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbushist.h>
+#include <wmbus/wmbusfmt.h>
+
+// eccwmbus-query - read side of the history store written with "-l HST"
+//
+//   point  : last reading at or before -t
+//   range  : all readings between -s and -e
+//   latest : newest reading of every meter
+//   agg    : count, first, last, min, max, avg and consumption between -s and -e
+
+#define QUERY_POINT  0
+#define QUERY_RANGE  1
+#define QUERY_LATEST 2
+#define QUERY_AGG    3
+
+#define OUTPUT_CSV   0
+#define OUTPUT_JSON  1
+
+#define MAXTHREADS   16
+
+typedef struct _QUERY_JOB {
+    char     path[_MAX_PATH];
+    char     name[32];
+    char    *out;
+    size_t   len;
+    size_t   size;
+    bool     first;     // no JSON object written yet
+} QueryJob;
+
+typedef struct _QUERY_DATE_CACHE {
+    uint32_t  hourStart;
+    struct tm tm;
+    bool      valid;
+} QueryDateCache;
+
+static int       QueryType  = QUERY_LATEST;
+static int       OutputType = OUTPUT_CSV;
+static uint32_t  StartTime  = 0;
+static uint32_t  EndTime    = UINT32_MAX;
+static uint32_t  PointTime  = UINT32_MAX;
+
+static QueryJob *Jobs;
+static int       JobCount;
+static int       JobNext;
+static pthread_mutex_t lockJobs = PTHREAD_MUTEX_INITIALIZER;
+
+void IntroShowParam(void) {
+    printf("   eccwmbus-query - query the eccwmbus history store\n\n");
+    printf("   ./eccwmbus-query -d /home/pi/data/wmbus -q range -m 12345678 -s 2015-01-01 -e 2015-12-31\n");
+    printf("   -d <dir>     : directory of the history files\n");
+    printf("   -q <query>   : point, range, latest (default) or agg\n");
+    printf("   -m <meter>   : ident (12345678) or manufacturer:ident (18c4:12345678), default all\n");
+    printf("   -s <time>    : start, YYYY-MM-DD[ HH:MM[:SS]] or UNIX time\n");
+    printf("   -e <time>    : end (inclusive), a date only means end of that day\n");
+    printf("   -t <time>    : time for point queries, default now\n");
+    printf("   -o csv|json  : output format\n");
+    printf("   -j <n>       : number of threads, default number of cores\n\n");
+}
+
+static bool ParseDigits(const char **pp, int n, int *v) {
+    const char *p = *pp;
+    int iX;
+    *v = 0;
+    for(iX=0; iX<n; iX++) {
+        if(!isdigit((unsigned char)p[iX])) return false;
+        *v = *v*10 + (p[iX]-'0');
+    }
+    *pp = p+n;
+    return true;
+}
+
+//YYYY-MM-DD[ HH:MM[:SS]] in local time or a plain UNIX time
+static bool ParseTime(const char *s, uint32_t *t, bool endOfDay) {
+    struct tm tm;
+    const char *p = s;
+    int  v;
+    bool dateOnly = true;
+    time_t tt;
+
+    if(strlen(s) > 0 && strspn(s, "0123456789") == strlen(s)) {
+        *t = (uint32_t)strtoul(s, NULL, 10);
+        return true;
+    }
+
+    memset(&tm, 0, sizeof(tm));
+    if(!ParseDigits(&p, 4, &v)) return false;
+    tm.tm_year = v-1900;
+    if(*p++ != '-' || !ParseDigits(&p, 2, &v)) return false;
+    tm.tm_mon = v-1;
+    if(*p++ != '-' || !ParseDigits(&p, 2, &v)) return false;
+    tm.tm_mday = v;
+    if(*p == ' ' || *p == 'T') {
+        p++;
+        dateOnly = false;
+        if(!ParseDigits(&p, 2, &v)) return false;
+        tm.tm_hour = v;
+        if(*p++ != ':' || !ParseDigits(&p, 2, &v)) return false;
+        tm.tm_min = v;
+        if(*p == ':') {
+            p++;
+            if(!ParseDigits(&p, 2, &v)) return false;
+            tm.tm_sec = v;
+        }
+    }
+    if(*p != 0) return false;
+
+    if(dateOnly && endOfDay) {
+        tm.tm_hour = 23;
+        tm.tm_min  = 59;
+        tm.tm_sec  = 59;
+    }
+    tm.tm_isdst = -1;
+    if((tt = mktime(&tm)) == (time_t)-1) return false;
+    *t = (uint32_t)tt;
+    return true;
+}
+
+static void JobReserve(QueryJob *job, size_t n) {
+    if(job->len + n <= job->size) return;
+    size_t size = max(job->size*2, job->len+n+4096);
+    char *out = (char *) realloc(job->out, size);
+    if(NULL == out) ErrorAndExit("eccwmbus-query - out of memory\n");
+    job->out  = out;
+    job->size = size;
+}
+
+static void JobAppend(QueryJob *job, const char *s, size_t n) {
+    JobReserve(job, n);
+    memcpy(job->out+job->len, s, n);
+    job->len += n;
+}
+
+//localtime_r once per local hour, the rest is arithmetic
+static void FormatDate(QueryDateCache *cache, uint32_t t, char *buf) {
+    struct tm tm;
+    uint32_t  delta;
+
+    if(!cache->valid || (t < cache->hourStart) || (t - cache->hourStart >= 3600)) {
+        time_t tt = (time_t)t;
+        localtime_r(&tt, &cache->tm);
+        cache->hourStart = t - cache->tm.tm_min*60 - cache->tm.tm_sec;
+        cache->valid = true;
+    }
+    delta = t - cache->hourStart;
+    tm = cache->tm;
+    sprintf(buf, "%d-%02d-%02d %02d:%02d:%02d", tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, delta/60, delta%60);
+}
+
+static void EmitRecord(QueryJob *job, QueryDateCache *cache, const ecwMBUSHistRec *rec) {
+    char date[32];
+    char value[FMT_MAXVALUE+1];
+    char line[256];
+    int  n;
+
+    FormatDate(cache, rec->time, date);
+    value[Fmt_Value(value, rec->value, rec->exp)] = 0;
+
+    if(OutputType == OUTPUT_JSON)
+        n = sprintf(line, "%s{\"meter\":\"%s\",\"date\":\"%s\",\"time\":%u,\"value\":%s,\"rssi\":%d,\"accNo\":%u,\"status\":%u}",
+                    job->first ? "" : ",\n", job->name, date, rec->time, value, rec->rssiDBm, rec->accNo, rec->status);
+    else
+        n = sprintf(line, "%s, %s, %u, %s, %d, %u, %u\n", job->name, date, rec->time, value, rec->rssiDBm, rec->accNo, rec->status);
+    job->first = false;
+    JobAppend(job, line, n);
+}
+
+//a mantissa of exponent exp as one of exponent to, to <= exp
+static int64_t Rescale(uint32_t value, int8_t exp, int8_t to) {
+    int64_t v = value;
+
+    for(; exp > to; exp--) v *= 10;
+    return v;
+}
+
+//the values of a meter stay integer mantissas brought to the smallest exponent of the range,
+//the average gets two more digits
+static void EmitAggregate(QueryJob *job, const ecwMBUSHist *hist, uint32_t from, uint32_t to) {
+    QueryDateCache cache;
+    ecwMBUSHistRec rec, recFirst, recLast;
+    int64_t  vMin = 0, vMax = 0, v, first, last, avg;
+    uint64_t vSum = 0, count = to - from;
+    int8_t   exp;
+    char     dFirst[32], dLast[32];
+    char     sFirst[FMT_MAXVALUE+1], sLast[FMT_MAXVALUE+1], sMin[FMT_MAXVALUE+1], sMax[FMT_MAXVALUE+1];
+    char     sAvg[FMT_MAXVALUE+1], sUsed[FMT_MAXVALUE+1];
+    char     line[512];
+    uint32_t iX;
+    int      n;
+
+    if(from >= to) return;
+    memset(&cache, 0, sizeof(cache));
+
+    Hist_Get(hist, from, &recFirst);
+    Hist_Get(hist, to-1, &recLast);
+    exp = recFirst.exp;
+    for(iX=from; iX<to; iX++) {
+        Hist_Get(hist, iX, &rec);
+        exp = min(exp, rec.exp);
+    }
+    for(iX=from; iX<to; iX++) {
+        Hist_Get(hist, iX, &rec);
+        v = Rescale(rec.value, rec.exp, exp);
+        if((iX == from) || (v < vMin)) vMin = v;
+        if((iX == from) || (v > vMax)) vMax = v;
+        vSum += (uint64_t) v;
+    }
+    first = Rescale(recFirst.value, recFirst.exp, exp);
+    last  = Rescale(recLast.value, recLast.exp, exp);
+    avg   = (int64_t)((vSum / count)*100 + ((vSum % count)*100 + count/2) / count);
+    FormatDate(&cache, recFirst.time, dFirst);
+    FormatDate(&cache, recLast.time, dLast);
+    sFirst[Fmt_Decimal(sFirst, first, exp)]       = 0;
+    sLast[Fmt_Decimal(sLast, last, exp)]          = 0;
+    sMin[Fmt_Decimal(sMin, vMin, exp)]            = 0;
+    sMax[Fmt_Decimal(sMax, vMax, exp)]            = 0;
+    sAvg[Fmt_Decimal(sAvg, avg, exp-2)]           = 0;
+    sUsed[Fmt_Decimal(sUsed, last - first, exp)]  = 0;
+
+    if(OutputType == OUTPUT_JSON)
+        n = sprintf(line, "%s{\"meter\":\"%s\",\"count\":%u,\"firstDate\":\"%s\",\"lastDate\":\"%s\","
+                          "\"first\":%s,\"last\":%s,\"min\":%s,\"max\":%s,\"avg\":%s,\"consumption\":%s}",
+                    job->first ? "" : ",\n", job->name, to-from, dFirst, dLast, sFirst, sLast, sMin, sMax, sAvg, sUsed);
+    else
+        n = sprintf(line, "%s, %u, %s, %s, %s, %s, %s, %s, %s, %s\n",
+                    job->name, to-from, dFirst, dLast, sFirst, sLast, sMin, sMax, sAvg, sUsed);
+    job->first = false;
+    JobAppend(job, line, n);
+}
+
+static void RunJob(QueryJob *job) {
+    ecwMBUSHist    hist;
+    ecwMBUSHistRec rec;
+    QueryDateCache cache;
+    uint32_t from, to, iX;
+
+    job->first = true;
+    if(Hist_Open(job->path, &hist) != APIOK) {
+        fprintf(stderr, "Cannot read >%s<\n", job->path);
+        return;
+    }
+    memset(&cache, 0, sizeof(cache));
+
+    switch(QueryType) {
+        case QUERY_POINT:
+            to = Hist_UpperBound(&hist, PointTime);
+            if(to > 0) {
+                Hist_Get(&hist, to-1, &rec);
+                EmitRecord(job, &cache, &rec);
+            }
+            break;
+
+        case QUERY_RANGE:
+            from = Hist_LowerBound(&hist, StartTime);
+            to   = Hist_UpperBound(&hist, EndTime);
+            JobReserve(job, (size_t)(to > from ? to-from : 0)*96);
+            for(iX=from; iX<to; iX++) {
+                Hist_Get(&hist, iX, &rec);
+                EmitRecord(job, &cache, &rec);
+            }
+            break;
+
+        case QUERY_AGG:
+            EmitAggregate(job, &hist, Hist_LowerBound(&hist, StartTime), Hist_UpperBound(&hist, EndTime));
+            break;
+
+        default:
+        case QUERY_LATEST:
+            if(hist.count > 0) {
+                Hist_Get(&hist, hist.count-1, &rec);
+                EmitRecord(job, &cache, &rec);
+            }
+            break;
+    }
+    Hist_Close(&hist);
+}
+
+void * QueryThreadProc(void *arg) {
+    int iJob;
+    for(;;) {
+        pthread_mutex_lock(&lockJobs);
+        iJob = JobNext++;
+        pthread_mutex_unlock(&lockJobs);
+        if(iJob >= JobCount) break;
+        RunJob(&Jobs[iJob]);
+    }
+    return 0;
+}
+
+static int CompareJobs(const void *a, const void *b) {
+    return strcmp(((const QueryJob *)a)->name, ((const QueryJob *)b)->name);
+}
+
+//wmbus_<manid>_<ident>_<type>_<version>.hst
+static bool MatchFile(const char *file, bool filterMan, uint32_t manID, bool filterIdent, uint32_t ident, char *name) {
+    size_t lp = strlen(HIST_FILEPREFIX), ls = strlen(HIST_FILESUFFIX), l = strlen(file);
+    char   buf[32];
+    unsigned int m, i, t, v;
+
+    if((l != lp+ls+19) || strncmp(file, HIST_FILEPREFIX, lp) || strcmp(file+l-ls, HIST_FILESUFFIX))
+        return false;
+    memcpy(buf, file+lp, 19);
+    buf[19] = 0;
+    if(buf[4] != '_' || buf[13] != '_' || buf[16] != '_') return false;
+    buf[4] = buf[13] = buf[16] = 0;
+    m = strtoul(buf,    NULL, 16);
+    i = strtoul(buf+5,  NULL, 16);
+    t = strtoul(buf+14, NULL, 16);
+    v = strtoul(buf+17, NULL, 16);
+    if(filterMan   && (m != manID)) return false;
+    if(filterIdent && (i != ident)) return false;
+    sprintf(name, "%04x_%08x_%02x_%02x", m, i, t, v);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    char      DataPath[_MAX_PATH] = "/home/pi/data/wmbus";
+    bool      filterMan = false, filterIdent = false;
+    uint32_t  manID = 0, ident = 0;
+    int       Threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t ThreadIDs[MAXTHREADS];
+    DIR      *dir;
+    struct dirent *entry;
+    int       c, iX, size = 0;
+    bool      first = true;
+
+    opterr = 0;
+    while ((c = getopt (argc, argv, "d:e:hj:m:o:q:s:t:")) != -1) {
+        switch (c) {
+            case 'd':
+                snprintf(DataPath, sizeof(DataPath), "%s", optarg);
+                break;
+            case 'q':
+                if     (0 == strcmp("point",  optarg)) QueryType = QUERY_POINT;
+                else if(0 == strcmp("range",  optarg)) QueryType = QUERY_RANGE;
+                else if(0 == strcmp("latest", optarg)) QueryType = QUERY_LATEST;
+                else if(0 == strcmp("agg",    optarg)) QueryType = QUERY_AGG;
+                else ErrorAndExit("unknown query type\n");
+                break;
+            case 'm': {
+                char *sep = strchr(optarg, ':');
+                if(NULL != sep) {
+                    manID = strtoul(optarg, NULL, 16);
+                    filterMan = true;
+                    optarg = sep+1;
+                }
+                ident = strtoul(optarg, NULL, 16);
+                filterIdent = true;
+                break;
+            }
+            case 's':
+                if(!ParseTime(optarg, &StartTime, false)) ErrorAndExit("invalid start time\n");
+                break;
+            case 'e':
+                if(!ParseTime(optarg, &EndTime, true)) ErrorAndExit("invalid end time\n");
+                break;
+            case 't':
+                if(!ParseTime(optarg, &PointTime, true)) ErrorAndExit("invalid time\n");
+                break;
+            case 'o':
+                OutputType = (0 == strcmp("json", optarg)) ? OUTPUT_JSON : OUTPUT_CSV;
+                break;
+            case 'j':
+                Threads = atoi(optarg);
+                break;
+            case 'h':
+                IntroShowParam();
+                exit (0);
+            default:
+                IntroShowParam();
+                exit (1);
+        }
+    }
+    if(PointTime == UINT32_MAX) PointTime = (uint32_t)time(NULL);
+    Threads = max(1, min(Threads, MAXTHREADS));
+
+    if(NULL == (dir = opendir(DataPath))) {
+        fprintf(stderr, "Cannot open >%s<\n", DataPath);
+        return 1;
+    }
+    while(NULL != (entry = readdir(dir))) {
+        char name[32];
+        if(!MatchFile(entry->d_name, filterMan, manID, filterIdent, ident, name)) continue;
+        if(JobCount == size) {
+            size = max(64, size*2);
+            Jobs = (QueryJob *) realloc(Jobs, size*sizeof(QueryJob));
+            if(NULL == Jobs) ErrorAndExit("eccwmbus-query - out of memory\n");
+        }
+        memset(&Jobs[JobCount], 0, sizeof(QueryJob));
+        if(snprintf(Jobs[JobCount].path, _MAX_PATH, "%s/%s", DataPath, entry->d_name) >= _MAX_PATH) {
+            fprintf(stderr, "Path too long, >%s/%s< skipped\n", DataPath, entry->d_name);
+            continue;
+        }
+        strcpy(Jobs[JobCount].name, name);
+        JobCount++;
+    }
+    closedir(dir);
+    if(JobCount > 1) qsort(Jobs, JobCount, sizeof(QueryJob), CompareJobs);
+
+    Threads = min(Threads, max(JobCount, 1));
+    for(iX=0; iX<Threads; iX++)
+        pthread_create(&ThreadIDs[iX], NULL, QueryThreadProc, NULL);
+    for(iX=0; iX<Threads; iX++)
+        pthread_join(ThreadIDs[iX], NULL);
+
+    if(OutputType == OUTPUT_JSON) {
+        fputs("[\n", stdout);
+    } else {
+        if(QueryType == QUERY_AGG) fputs("Meter, Count, First Date, Last Date, First, Last, Min, Max, Avg, Consumption\n", stdout);
+        else                       fputs("Meter, Date, Time, Value, RSSI, AccNo, Status\n", stdout);
+    }
+    for(iX=0; iX<JobCount; iX++) {
+        if(Jobs[iX].len == 0) continue;
+        if((OutputType == OUTPUT_JSON) && !first) fputs(",\n", stdout);
+        fwrite(Jobs[iX].out, 1, Jobs[iX].len, stdout);
+        first = false;
+        free(Jobs[iX].out);
+    }
+    if(OutputType == OUTPUT_JSON) fputs("\n]\n", stdout);
+
+    free(Jobs);
+    return 0;
+}
+
+void ErrorAndExit(const char *info) {
+    fprintf(stderr, "%s", info);
+    exit(1);
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusmetrics.h>
+#include <wmbus/libeccwmbus.h>
+
+struct _WMBUS_LIB {
+    unsigned long            hStick;
+    uint16_t                 stick;
+    wMBusLib_ReadingCallback callback;
+    void                    *ctx;
+    int                      flags;
+    pthread_mutex_t          lock;      // callback, ctx and flags against the receiving thread
+};
+
+static ecwMBUSLib Lib;
+static bool       LibOpen = false;
+
+//called by the driver for every frame, the reading is built on the stack
+static void OnFrame(void *ctx, int Index, const ecwMBUSMeter *meter, const ecMBUSData *data,
+                    const uint8_t *frame, int frameLength) {
+    pecwMBUSLib       lib = (pecwMBUSLib) ctx;
+    ecwMBUSLibReading reading;
+
+    pthread_mutex_lock(&lib->lock);
+    if((NULL != lib->callback) && ((Index >= 0) || (lib->flags & WMBUSLIB_ALLFRAMES))) {
+        reading.slot        = Index;
+        reading.meter       = meter;
+        reading.data        = data;
+        reading.frame       = frame;
+        reading.frameLength = frameLength;
+        lib->callback(lib->ctx, &reading);
+    }
+    pthread_mutex_unlock(&lib->lock);
+}
+
+static bool IsStick(unsigned long hStick, uint16_t stick) {
+    unsigned long ID = 0;
+
+    return (APIOK == wMBus_GetStickId(hStick, stick, &ID, SILENTMODE)) && (ID == stick);
+}
+
+static unsigned long OpenStick(char *device, uint16_t stick) {
+    unsigned long hStick = wMBus_OpenDevice(device, stick);
+
+    if((long)hStick <= 0) return 0;
+    if(IsStick(hStick, stick)) return hStick;
+    wMBus_CloseDevice(hStick, stick);
+    return 0;
+}
+
+int wMBusLib_Open(pecwMBUSLib *lib, const char *device, uint16_t stick, int mode) {
+    char          dev[_MAX_PATH];
+    unsigned long hStick = 0;
+    unsigned long radioMode;
+    int           iX;
+
+    if((NULL == lib) || (NULL == device) || LibOpen) return APIERROR;
+    if((mode != RADIOT2) && (mode != RADIOS2)) return APIERROR;
+    *lib = NULL;
+    snprintf(dev, sizeof(dev), "%s", device);
+
+    //same order as eccwmbus, the AMBER stick is tried when no iM871A answers
+    if((0 == stick) || (iM871AIdentifier == stick)) {
+        hStick = OpenStick(dev, iM871AIdentifier);
+        if(hStick > 0) stick = iM871AIdentifier;
+    }
+    if((0 == hStick) && ((0 == stick) || (iAMB8465Identifier == stick))) {
+        usleep(500*1000);
+        hStick = OpenStick(dev, iAMB8465Identifier);
+        if(hStick > 0) stick = iAMB8465Identifier;
+    }
+    if(0 == hStick) return APIERROR;
+
+    if(APIOK != wMBus_GetRadioMode(hStick, stick, &radioMode, SILENTMODE)) {
+        wMBus_CloseDevice(hStick, stick);
+        return APIERROR;
+    }
+    if(radioMode != (unsigned long)mode)
+        wMBus_SwitchMode(hStick, stick, (uint8_t) mode, SILENTMODE);
+
+    memset(&Lib, 0, sizeof(ecwMBUSLib));
+    Lib.hStick = hStick;
+    Lib.stick  = stick;
+    wMBus_SetFrameDump(false);
+    if(1 != wMBus_InitDevice(hStick, stick, SILENTMODE)) {
+        wMBus_CloseDevice(hStick, stick);
+        wMBus_SetFrameDump(true);
+        return APIERROR;
+    }
+    pthread_mutex_init(&Lib.lock, NULL);
+    for(iX=0; iX<MAXMETER; iX++)
+        wMBus_RemoveMeter(iX);
+    wMBus_RegisterFrameHandler(OnFrame, &Lib);
+
+    LibOpen = true;
+    *lib = &Lib;
+    return APIOK;
+}
+
+//waits for a callback that is running, the next frame goes to the new one
+int wMBusLib_SetCallback(pecwMBUSLib lib, wMBusLib_ReadingCallback callback, void *ctx, int flags) {
+    if((NULL == lib) || !LibOpen) return APIERROR;
+    pthread_mutex_lock(&lib->lock);
+    lib->callback = callback;
+    lib->ctx      = ctx;
+    lib->flags    = flags;
+    pthread_mutex_unlock(&lib->lock);
+    return APIOK;
+}
+
+int wMBusLib_AddMeter(pecwMBUSLib lib, int slot, const ecwMBUSMeter *meter) {
+    ecwMBUSMeter m;
+
+    if((NULL == lib) || !LibOpen || (NULL == meter) || (slot < 0) || (slot >= MAXMETER)) return APIERROR;
+    if(0 == meter->manufacturerID) return APIERROR;
+    memcpy(&m, meter, sizeof(ecwMBUSMeter));
+    return (1 == wMBus_AddMeter(lib->hStick, lib->stick, slot, &m, SILENTMODE)) ? APIOK : APIERROR;
+}
+
+int wMBusLib_RemoveMeter(pecwMBUSLib lib, int slot) {
+    if((NULL == lib) || !LibOpen || (slot < 0) || (slot >= MAXMETER)) return APIERROR;
+    return wMBus_RemoveMeter(slot);
+}
+
+int wMBusLib_SetMode(pecwMBUSLib lib, int mode) {
+    if((NULL == lib) || !LibOpen || ((mode != RADIOT2) && (mode != RADIOS2))) return APIERROR;
+    return (0 != wMBus_SwitchMode(lib->hStick, lib->stick, (uint8_t) mode, SILENTMODE)) ? APIOK : APIERROR;
+}
+
+uint16_t wMBusLib_GetStick(pecwMBUSLib lib) {
+    return ((NULL == lib) || !LibOpen) ? 0 : lib->stick;
+}
+
+int wMBusLib_GetStickCounters(pecwMBUSLib lib, pecwMBUSStickCounters counters) {
+    if((NULL == lib) || !LibOpen || (NULL == counters)) return APIERROR;
+    return wMBus_GetStickCounters(lib->hStick, lib->stick, counters);
+}
+
+void wMBusLib_GetCounters(pecwMBUSLib lib, pecwMBUSLibCounters counters) {
+    memset(counters, 0, sizeof(ecwMBUSLibCounters));
+    if((NULL == lib) || !LibOpen) return;
+    counters->framesRead    = Met_GetCounter(MET_FRAMESREAD);
+    counters->framesDecoded = Met_GetCounter(MET_FRAMESDECODED);
+    counters->readings      = Met_GetCounter(MET_READINGS);
+}
+
+void wMBusLib_Close(pecwMBUSLib lib) {
+    if((NULL == lib) || !LibOpen) return;
+    wMBus_RegisterFrameHandler(NULL, NULL);
+    wMBus_CloseDevice(lib->hStick, lib->stick);
+    wMBus_SetFrameDump(true);
+    pthread_mutex_destroy(&lib->lock);
+    memset(lib, 0, sizeof(ecwMBUSLib));
+    LibOpen = false;
+}
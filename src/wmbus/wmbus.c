@@ -3,6 +3,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <termios.h>
 #include <string.h>
 #include <errno.h>
@@ -15,18 +17,57 @@
 #include <extern/libwmbus.h>
 #include <wmbus/wmbus.h>
 #include <wmbus/wmbusext.h>
-
-unsigned long   dwFrameCounter;
-unsigned long   dwMeter=0;
-unsigned long   MeterPresent=0;
-unsigned long   MeterHasData=0;
-bool            bCallbackRegistered=false;
-unsigned long   myhandle=0;
-uint16_t        myInfoFlag=SILENTMODE;
-uint16_t        myStickID = 0;
-
-static ecwMBUSMeter MeterAddr[MAXSLOT];
-static ecMBUSData MeterData[MAXSLOT];
+#include <wmbus/wmbusmetrics.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusring.h>
+
+//Amber commands
+
+static uint8_t CMD_SERIALNO_REQ_Arr[]              ={0xFF, 0x0B, 0x00, 0xF4}; //GetSerial
+static uint8_t SET_BLOCK1_ADD_ENABLE_REQ[]         ={0xFF, 0x09, 0x03, 0x30, 0x01, 0x00};
+
+//CMD_SET_REQ
+static uint8_t SET_RSSI_ENABLE_REQ_Arr[]           ={0xFF, 0x09, 0x03, 0x45, 0x01, 0x01, 0xB0};
+static uint8_t SET_RSSI_DISABLE_REQ_Arr[]          ={0xFF, 0x09, 0x03, 0x45, 0x01, 0x00, 0xB1};
+static uint8_t SET_AES_ENABLE_REQ_Arr[]            ={0xFF, 0x09, 0x03, 0x0B, 0x01, 0x01, 0xFE};
+static uint8_t SET_AES_DISABLE_REQ_Arr[]           ={0xFF, 0x09, 0x03, 0x0B, 0x01, 0x00, 0xFF};
+
+//CMD_GET_REQ
+static uint8_t CMD_GET_REQ_RSSI_ENABLED_Arr[]      ={0xFF, 0x0A, 0x02, 0x45, 0x01, 0xB3};
+static uint8_t CMD_GET_REQ_MODE_Arr[]              ={0xFF, 0x0A, 0x02, 0x46, 0x01, 0xB0};
+
+
+static uint8_t CMD_GET_AES_DEV_REQ_Arr0[]          ={0xFF, 0x52, 0x01, 0x00, 0xAC}; //Bank1...16 Devices
+static uint8_t CMD_GET_AES_DEV_REQ_Arr1[]          ={0xFF, 0x52, 0x01, 0x01, 0xAD}; //Bank2
+static uint8_t CMD_GET_AES_DEV_REQ_Arr2[]          ={0xFF, 0x52, 0x01, 0x02, 0xAE}; //Bank3
+static uint8_t CMD_GET_AES_DEV_REQ_Arr3[]          ={0xFF, 0x52, 0x01, 0x03, 0xAF}; //Bank4
+static uint8_t CMD_CLR_AES_KEY_REQ_Arr[]           ={0xFF, 0x51, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB};
+static uint8_t CMD_SET_MODE_REQ_ArrT2S2[]          ={0xFF, 0x04, 0x01, 0x00, 0x00};
+static uint8_t CMD_SET_MODE_REQ_ArrT2S2_PRESELECT[]={0xFF, 0x09, 0x03, 0x46, 0x01, 0x08, 0xBA};
+
+static uint8_t CMD_SET_AES_KEY_REQ_Arr[]           ={0xFF, 0x50, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+static unsigned long   dwFrameCounter;
+static unsigned long   dwMeter=0;
+static unsigned long   MeterPresent=0;
+static unsigned long   MeterHasData=0;
+static bool            bCallbackRegistered=false;
+static unsigned long   myhandle=0;
+static uint16_t        myInfoFlag=SILENTMODE;
+static uint16_t        myStickID = 0;
+static wMBus_ReadingHandler myReadingHandler = NULL;
+static wMBus_FrameHandler   myFrameHandler = NULL;
+static void                *myFrameContext = NULL;
+
+static ecwMBUSMeter MeterAddr[MAXSLOT];      // written under lockQueue, the receive thread looks meters up there
+static ecwMBUSMeter StickSlot[MAXSLOT];    // what is programmed in the key slots of the stick
+static unsigned long SlotProgrammed = 0;
+static bool         SlotsVerified = false; // AMBER device list read back since the stick was initialised
+static unsigned long SlotCommands = 0;     // set and clear commands sent
+static ecwMBUSRing  MeterQueue[MAXSLOT];   // readings not yet taken with wMBus_GetData4Meter
+static uint8_t      LastPktInfo[MAXSLOT];  // of the last reading of a slot, kept when the queue runs empty
+static unsigned int QueueDepth = RING_DEFAULTDEPTH;
+static pthread_mutex_t lockQueue = PTHREAD_MUTEX_INITIALIZER;
 
 void nColour(int8_t c, bool cr) {
     printf("%c[%dm",0x1B,(c>0) ? (30+c) : c);
@@ -34,7 +75,7 @@ void nColour(int8_t c, bool cr) {
         printf("\n");
 }
 
-void *libHandle;
+static void *libHandle;
 
 void *loadLibWMBusHCI() {
     char* error;
@@ -44,7 +85,7 @@ void *loadLibWMBusHCI() {
     libHandle = dlopen(LIB_WMBUSHCI, RTLD_NOW);
 
     if(!libHandle) {
-        printf("Error while loading: %s\n", dlerror());
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "Error while loading: %s", dlerror());
         return NULL;
     }
 
@@ -62,7 +103,7 @@ void *loadLibWMBusHCI() {
     WMBus_RegisterMsgHandler        = (registermsghandler_t)        dlsym(libHandle, "WMBus_RegisterMsgHandler");
 
     if((error = dlerror()) != NULL) {
-        printf("Error linking with dlsym: %s\n", error);
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "Error linking with dlsym: %s", error);
         return NULL;
     }
     return libHandle;
@@ -77,9 +118,10 @@ void GetDataFromStick(unsigned long handle,uint16_t stick,uint16_t infoflag);
 //////////////////////////////////////////////////////////////////////////////////////
 
 #pragma region "AMBERStick"
-pthread_t   ThreadID;
-pthread_mutex_t lockAPI= PTHREAD_MUTEX_INITIALIZER;
-int AmberCom=-1;
+static pthread_t   ThreadID;
+static pthread_mutex_t lockAPI= PTHREAD_MUTEX_INITIALIZER;
+static int AmberCom=-1;
+static int AmberWake=-1;     //eventfd, ends the reading thread
 
 //connect to AMBER Stick
 int AMBER_OpenDevice(char * comport, uint32_t BaudRate) {
@@ -88,7 +130,7 @@ int AMBER_OpenDevice(char * comport, uint32_t BaudRate) {
     speed_t speed;
     int serial;
 
-    printf("open port (%s) with %d baud\n", comport, BaudRate);
+    Log_Printf(LOGCAT_DRIVER, LOGLVL_INFO, "open port (%s) with %d baud", comport, BaudRate);
 
     serial = open(comport, O_RDWR | O_NOCTTY | O_NDELAY | O_EXCL);
     if (serial == -1) {
@@ -97,7 +139,7 @@ int AMBER_OpenDevice(char * comport, uint32_t BaudRate) {
         serial = open(comport, O_RDWR | O_NOCTTY | O_NDELAY | O_EXCL);
         if (serial == -1) {
             //retry
-            printf("Error opening port (%s)\n", comport);
+            Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "Error opening port (%s)", comport);
             return -1;
         }
     }
@@ -149,9 +191,8 @@ bool AMBERCommand(int serial, uint8_t command[], uint8_t  *pData,bool bReq, shor
     bool bSuccess=false;
     int i;
 
-    uint8_t *pBuffer;
-    pBuffer = (uint8_t *) malloc(BUFFER_SIZE);
-    memset(pBuffer, 0, sizeof(uint8_t)*BUFFER_SIZE);
+    uint8_t pBuffer[BUFFER_SIZE];
+    memset(pBuffer, 0, sizeof(pBuffer));
 
     pthread_mutex_lock(&lockAPI);
 
@@ -168,28 +209,17 @@ bool AMBERCommand(int serial, uint8_t command[], uint8_t  *pData,bool bReq, shor
                 if((command[1]+CNF)==pBuffer[1]) {
                     switch (command[1]) {
                         case CMD_SERIALNO_REQ:
-                            if(infoflag>=SHOWALLDETAILS) {
-                                printf("CMD_SERIALNO_REQ \nSerial: ");
-                                for(i=3;(i>=3 && i<7);i++)
-                                    printf("%02X", pBuffer[i]);
-                                printf("\n");
-                            }
+                            Log_Printf(LOGCAT_DRIVER, LOGLVL_TRACE, "CMD_SERIALNO_REQ Serial: %02X%02X%02X%02X", pBuffer[3], pBuffer[4], pBuffer[5], pBuffer[6]);
                             bSuccess=true;
                         break;
 
                         case CMD_GET_AES_DEV_REQ:
-                            if(infoflag>=SHOWALLDETAILS) {
-                                printf("CMD_GET_AES_DEV_REQ \nRegistered devices:\n");
-                                printf("Bank %X \n", command[3]);
-
+                            if(Log_Enabled(LOGCAT_DRIVER, LOGLVL_TRACE)) {
+                                Log_Write(LOGCAT_DRIVER, LOGLVL_TRACE, "CMD_GET_AES_DEV_REQ registered devices, bank %X", command[3]);
                                 for(i=0; i<(bytes_read-4); i=i+8) { // bytes_read-4: 3 preceding bytes of command and CRC Checksum are not displayed
-                                    if((pBuffer[3+i] | ( pBuffer[4+i] << 8))!=0) {
-                                        printf("ManID %02X %02X \n",            pBuffer[4+i], pBuffer[3+i]);
-                                        printf("Ident %02X %02X %02X %02X \n",  pBuffer[8+i], pBuffer[7+i], pBuffer[6+i], pBuffer[5+i]);
-                                        printf("Version %02X \n",               pBuffer[9+i]);
-                                        printf("Type %02X \n ",                 pBuffer[10+i]);
-                                        printf("\n");
-                                    }
+                                    if((pBuffer[3+i] | ( pBuffer[4+i] << 8))!=0)
+                                        Log_Write(LOGCAT_DRIVER, LOGLVL_TRACE, "ManID %02X%02X Ident %02X%02X%02X%02X Version %02X Type %02X",
+                                                  pBuffer[4+i], pBuffer[3+i], pBuffer[8+i], pBuffer[7+i], pBuffer[6+i], pBuffer[5+i], pBuffer[9+i], pBuffer[10+i]);
                                 }
                             }
                             bSuccess=true;
@@ -198,43 +228,38 @@ bool AMBERCommand(int serial, uint8_t command[], uint8_t  *pData,bool bReq, shor
                         case CMD_SET_AES_KEY_REQ:
                             bSuccess=false;
                             if(pBuffer[3]==0x00){
-                                if(infoflag>=SHOWALLDETAILS)
-                                    printf("CMD_SET_AES_KEY_REQ...OK\n");
+                                Log_Printf(LOGCAT_DRIVER, LOGLVL_TRACE, "CMD_SET_AES_KEY_REQ...OK");
                                 bSuccess=true; //success
                                 break;
                             }
-                            else if(pBuffer[3]==0x01) printf("Error...Verification in memory failed\n");       //verification in memory failed
-                            else if(pBuffer[3]==0x02) printf("Error...No more memory available...Error\n");    //no more memory available
+                            else if(pBuffer[3]==0x01) Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "CMD_SET_AES_KEY_REQ...Verification in memory failed");
+                            else if(pBuffer[3]==0x02) Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "CMD_SET_AES_KEY_REQ...No more memory available");
                         break;
 
                         case CMD_CLR_AES_KEY_REQ:
                             bSuccess=false;
-                            if(infoflag>=SHOWALLDETAILS) printf("CMD_CLR_AES_KEY_REQ");
                             if(pBuffer[3]==0x00){
-                                if(infoflag>=SHOWALLDETAILS)
-                                    printf("...OK ");
+                                Log_Printf(LOGCAT_DRIVER, LOGLVL_TRACE, "CMD_CLR_AES_KEY_REQ...OK");
                                 bSuccess=true;
                                 break;
                             }
-                            else if(pBuffer[3]==0x01) printf("\nError...Verification in memory failed ");
-                            else if(pBuffer[3]==0x02) if(infoflag>0) printf("...OK\nMeter to remove not in list ");
+                            else if(pBuffer[3]==0x01) Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "CMD_CLR_AES_KEY_REQ...Verification in memory failed");
+                            else if(pBuffer[3]==0x02) Log_Printf(LOGCAT_DRIVER, LOGLVL_DEBUG, "CMD_CLR_AES_KEY_REQ...OK, meter to remove not in list");
                         break;
 
                         case CMD_SET_MODE_REQ:
-                            if(infoflag>=SHOWALLDETAILS) printf("CMD_SET_MODE_REQ");
                             if(pBuffer[3]==0){ //status 0x00 -> success
-                                 if(infoflag>=SHOWALLDETAILS)
-                                     printf("...OK");
+                                 Log_Printf(LOGCAT_DRIVER, LOGLVL_TRACE, "CMD_SET_MODE_REQ...OK");
                                   bSuccess=true;
                             }
                             else {
-                                 printf("Error...setting S2/T2 mode failed\n");
+                                 Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "CMD_SET_MODE_REQ...setting S2/T2 mode failed");
                                  bSuccess=false ;
                             }
                         break;
 
                         case CMD_GET_REQ:
-                            if(infoflag>=SHOWALLDETAILS) printf("CMD_GET_REQ\n");
+                            Log_Printf(LOGCAT_DRIVER, LOGLVL_TRACE, "CMD_GET_REQ");
                             bSuccess=true;
                         break;
 
@@ -242,16 +267,15 @@ bool AMBERCommand(int serial, uint8_t command[], uint8_t  *pData,bool bReq, shor
                             bSuccess=false;
                             if(pBuffer[3]==0x00){
                                 bSuccess=true;
-                                if(infoflag>=SHOWALLDETAILS)
-                                    printf("\nCMD_SET_REQ...OK ");
+                                Log_Printf(LOGCAT_DRIVER, LOGLVL_TRACE, "CMD_SET_REQ...OK");
                                 break;
                             }
-                            else if(pBuffer[3]==0x01) printf("Error...Verification failed failed:\n");
-                            else if(pBuffer[3]==0x02) printf("Error...invalid memory position or invalid number of bytes to be written (write access to unauthorised location)\n");
+                            else if(pBuffer[3]==0x01) Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "CMD_SET_REQ...Verification failed");
+                            else if(pBuffer[3]==0x02) Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "CMD_SET_REQ...invalid memory position or invalid number of bytes to be written (write access to unauthorised location)");
                         break;
 
                         default:
-                            if(infoflag>=SHOWDETAILS) printf("Error...undefined command\n");
+                            Log_Printf(LOGCAT_DRIVER, LOGLVL_DEBUG, "Error...undefined command %02X", command[1]);
                         break;
                     }  //case
                 }
@@ -267,19 +291,17 @@ bool AMBERCommand(int serial, uint8_t command[], uint8_t  *pData,bool bReq, shor
         memcpy(pData, pBuffer, min(Datasize, BUFFER_SIZE));
     }
     pthread_mutex_unlock(&lockAPI);
-    if(pBuffer) free(pBuffer);
     return bSuccess;
 }
 
 //disconnect AMBER device
 bool AMBER_CloseDevice(int serial) {
     // Close serial port
-    printf("Closing serial port ");
     if (close(serial) != 0) {
-        printf( "Error\n");
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "Closing serial port...Error");
         return false;
     }
-    printf("OK\n");
+    Log_Printf(LOGCAT_DRIVER, LOGLVL_INFO, "Closing serial port...OK");
     return true;
 }
 
@@ -306,7 +328,7 @@ bool AMBER_SwitchRFMode(int serial, uint8_t Mode, uint16_t infoflag) {
     if(AMBERCommand(serial, CMD_SET_MODE_REQ_ArrT2S2_PRESELECT, NULL, true, sWriteSize, BUFFER_SIZE, infoflag))
         bSuccess=true;
     else
-        printf( "Error...writing command to stick failed\n");
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "Error...writing command to stick failed");
 
     return bSuccess;
 }
@@ -347,10 +369,12 @@ bool AMBER_ReadFrameFromStick(int serial, uint8_t *pbuffer, int sSize, short* sS
             }
         }
 
-        if(infoflag>=SHOWALLDETAILS) {
-            for(i=0; i<frame_length; i++)
-                printf("%02X ", pbuffer[i]);         //show bytes recieved
-            printf("\n");
+        if(Log_Enabled(LOGCAT_DRIVER, LOGLVL_TRACE)) { //show bytes recieved
+            char line[3*256 + 1];
+            for(i=0; (i<frame_length) && (i<256); i++)
+                snprintf(line+3*i, 4, "%02X ", pbuffer[i]);
+            line[3*i] = 0;
+            Log_Write(LOGCAT_DRIVER, LOGLVL_TRACE, "%s", line);
         }
     }
     return bSuccess;
@@ -358,13 +382,22 @@ bool AMBER_ReadFrameFromStick(int serial, uint8_t *pbuffer, int sSize, short* sS
 
 #pragma endregion
 
+//sleeps until the stick sends or wMBus_CloseDevice wakes it
 void * ThreadProc(void *arg) {
-    do {
-        usleep(SLEEP100MS);
-        pthread_mutex_lock(&lockAPI);
-        if(AmberCom != -1) GetDataFromStick(myhandle, myStickID, myInfoFlag);
-        pthread_mutex_unlock(&lockAPI);
-    } while( AmberCom != -1 );
+    struct pollfd pfd[2];
+
+    pfd[0].fd = AmberCom;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = AmberWake;
+    pfd[1].events = POLLIN;
+    for(;;) {
+        if(poll(pfd, 2, -1) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        if((pfd[1].revents != 0) || (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL))) break;
+        GetDataFromStick(myhandle, myStickID, myInfoFlag);
+    }
     return 0;
 }
 
@@ -375,11 +408,11 @@ void * ThreadProc(void *arg) {
 unsigned long wMBus_OpenDevice(char * device, uint16_t stick) {
     if(stick == iM871AIdentifier){
         pthread_mutex_init(&lockAPI, NULL);
-        printf("Connect to IMST on port %s\n", device);
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_INFO, "Connect to IMST on port %s", device);
         //load external LIB
         libHandle = loadLibWMBusHCI();
         if(0 == libHandle) {
-            printf("Library not found\n");
+            Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "Library not found");
             return 0;
         }
         return WMBus_OpenDevice(device);
@@ -387,7 +420,7 @@ unsigned long wMBus_OpenDevice(char * device, uint16_t stick) {
 
     if(stick == iAMB8465Identifier) {
         pthread_mutex_init(&lockAPI, NULL);
-        printf("Connect to AMBER on port %s\n", device);
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_INFO, "Connect to AMBER on port %s", device);
         AmberCom = AMBER_OpenDevice(device, 9600);
         return (unsigned long) AmberCom;
     }
@@ -402,10 +435,15 @@ unsigned long wMBus_CloseDevice(unsigned long handle, uint16_t stick) {
     }
 
     if(stick == iAMB8465Identifier) {
+        if(AmberWake >= 0) { //get thread to terminate
+            uint64_t one = 1;
+            if(write(AmberWake, &one, sizeof(one)) < 0) {}
+            pthread_join(ThreadID, NULL);
+            close(AmberWake);
+            AmberWake = -1;
+        }
         AMBER_CloseDevice((int)handle);
-        AmberCom = -1; //get thread to terminate
-        usleep(2*SLEEP100MS);
-        pthread_join(ThreadID, NULL);
+        AmberCom = -1;
         pthread_mutex_destroy(&lockAPI);
         return 1;
     }
@@ -414,23 +452,20 @@ unsigned long wMBus_CloseDevice(unsigned long handle, uint16_t stick) {
 
 int wMBus_GetStickId(unsigned long handle, uint16_t stick, unsigned long *ID, uint16_t infoflag) {
     unsigned long dwReturn=(unsigned long)APIERROR;
-    unsigned char *pData;
+    unsigned char pData[BUFFER_SIZE];
     uint16_t Datasize=BUFFER_SIZE;
-    pData = (unsigned char *) malloc(Datasize);
 
-    memset(pData,0,sizeof(unsigned char)*Datasize);
     if(NULL == ID) return dwReturn;
+    memset(pData,0,sizeof(pData));
 
     if(stick == iM871AIdentifier) {
        if(WMBus_GetDeviceInfo(handle, pData, Datasize)) {
-          if (infoflag > SILENTMODE) {
-
-                printf("Modul Type              : %#2x \n", *(pData+1));
-                printf("Device Mode             : %#2x \n", *(pData+2));
-                printf("Firmeware               : %#2x \n", *(pData+3));
-                printf("HCI Protocol Version    : %#2x \n", *(pData+4));
-                printf("32bit Device-ID         : %#010x \n", (unsigned long)*(pData+5)+*(pData+6)<<8+*(pData+7)<<16+*(pData+8)<<24);
-
+          if (Log_Enabled(LOGCAT_DRIVER, LOGLVL_DEBUG)) {
+                Log_Write(LOGCAT_DRIVER, LOGLVL_DEBUG, "Modul Type              : %#2x", *(pData+1));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_DEBUG, "Device Mode             : %#2x", *(pData+2));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_DEBUG, "Firmeware               : %#2x", *(pData+3));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_DEBUG, "HCI Protocol Version    : %#2x", *(pData+4));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_DEBUG, "32bit Device-ID         : %#010x", (unsigned int)(*(pData+5)|*(pData+6)<<8|*(pData+7)<<16|*(pData+8)<<24));
           }
           *ID = *(pData + 1);
           dwReturn = APIOK;
@@ -443,8 +478,6 @@ int wMBus_GetStickId(unsigned long handle, uint16_t stick, unsigned long *ID, ui
         *ID = *(pData + 3);
          dwReturn = APIOK;
     }
-
-    if(pData) free(pData);
     return dwReturn;
 }
 
@@ -453,22 +486,18 @@ unsigned long wMBus_GetLastError(unsigned long handle, uint16_t stick) {
 
     if(stick == iM871AIdentifier) {
         dwReturn = WMBus_GetLastError(handle);
-        char *pData;
-        pData = (char*)malloc(128);
-        memset(pData, 0, sizeof(unsigned char)*128);
-        WMBus_GetErrorString(dwReturn, pData, 128);
-        printf("\nGetLastError %ld %s\n", dwReturn, pData);
-        free(pData);
+        char pData[128];
+        memset(pData, 0, sizeof(pData));
+        WMBus_GetErrorString(dwReturn, pData, sizeof(pData));
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_WARN, "GetLastError %ld %s", dwReturn, pData);
     }
     return dwReturn;
 }
 
 unsigned long  wMBus_SwitchMode(unsigned long handle, uint16_t stick, uint8_t Mode, uint16_t infoflag) {
     unsigned long dwReturn=0;
-    uint16_t Datasize=BUFFER_SIZE;
-    unsigned char *pData;
-    pData = (unsigned char *) malloc(Datasize);
-    memset(pData,0,sizeof(unsigned char)*Datasize);
+    unsigned char pData[BUFFER_SIZE];
+    memset(pData,0,sizeof(pData));
 
     if((Mode == RADIOT2) || (Mode == RADIOS2)) {
         if(stick == iM871AIdentifier){
@@ -482,56 +511,59 @@ unsigned long  wMBus_SwitchMode(unsigned long handle, uint16_t stick, uint8_t Mo
             *(pData +6) = 1;    //RTC Control
 
             if((dwReturn = WMBus_SetDeviceConfig(handle, pData, 7, false))>0) {
-                  if (infoflag > SILENTMODE) printf("IMST SwitchMode to  %s \n", ((Mode==RADIOT2) ?"T2" : "S2"));
+                  Log_Printf(LOGCAT_DRIVER, LOGLVL_DEBUG, "IMST SwitchMode to %s", ((Mode==RADIOT2) ?"T2" : "S2"));
               }
         }
         if(stick == iAMB8465Identifier) {
             if((dwReturn = AMBER_SwitchRFMode((int)handle, Mode, infoflag))>0) {
-                 if (infoflag > SILENTMODE) printf("AMBER SwitchMode to  %s \n", ((Mode==RADIOT2) ?"T2" : "S2"));
+                 Log_Printf(LOGCAT_DRIVER, LOGLVL_DEBUG, "AMBER SwitchMode to %s", ((Mode==RADIOT2) ?"T2" : "S2"));
             }
         }
     }
-    free(pData);
     return dwReturn;
 }
 
+static uint32_t GetStatusU32(const unsigned char *p) {
+    return (uint32_t)(*p | *(p+1)<<8 | *(p+2)<<16 | *(p+3)<<24);
+}
+
 unsigned long  wMBus_GetRadioMode(unsigned long handle, uint16_t stick, unsigned long *dwD, uint16_t infoflag) {
     unsigned long  dwReturn=(unsigned long)APIERROR;
-    unsigned char * pData = (unsigned char*)malloc(BUFFER_SIZE);
-    if(NULL == pData)     return 0;
+    unsigned char pData[BUFFER_SIZE];
     if(0 == handle)       return 0;
-    memset(pData, 0, sizeof(unsigned char)*BUFFER_SIZE);
+    memset(pData, 0, sizeof(pData));
 
     if(stick == iM871AIdentifier) {
         if(WMBus_GetDeviceConfig(handle,pData,BUFFER_SIZE)) {
             if (infoflag > SILENTMODE) {
 
-                if(*(pData+1) & 0b00000001) printf("Bit 0:Device Mode       : %d \n", *(pData+2));
-                if(*(pData+1) & 0b00000010) printf("Bit 1:Radio Mode        : %d \n", *(pData+3));
-                if(*(pData+1) & 0b00000100) printf("Bit 2:WMBus C-Field     : %d \n", *(pData+4));
-                if(*(pData+1) & 0b00001000) printf("Bit 3:WMBus Man-ID      : %#06x \n", (unsigned short)*(pData+5)|*(pData+6)<<8);
-                if(*(pData+1) & 0b00010000) printf("Bit 4:WMBus Device-ID   : %#010x \n", (unsigned long)*(pData+7)|*(pData+8)<<8|*(pData+9)<<16|*(pData+10)<<24);
-                if(*(pData+1) & 0b00100000) printf("Bit 5:WMBus Version     : %d \n", *(pData+11));
-                if(*(pData+1) & 0b01000000) printf("Bit 6:WMBus Device Type : %d \n", *(pData+12));
-                if(*(pData+1) & 0b10000000) printf("Bit 7:Radio Channel     : %d \n", *(pData+13));
-
-                if(*(pData+14) & 0b00000001) printf("Bit 0:Radio Power Level : %d \n", *(pData+15));
-                if(*(pData+14) & 0b00000010) printf("Bit 1:Radio Data Rate   : %d \n", *(pData+16));
-                if(*(pData+14) & 0b00000100) printf("Bit 2:Radio RX Window   : %d \n", *(pData+17));
-                if(*(pData+14) & 0b00001000) printf("Bit 3:Auto Power Saving : %d \n", *(pData+18));
-                if(*(pData+14) & 0b00010000) printf("Bit 4:Auto RSSI Attach  : %d \n", *(pData+19));
-                if(*(pData+14) & 0b00100000) printf("Bit 5:Auto RX-Timestamp : %d \n", *(pData+20));
-                if(*(pData+14) & 0b01000000) printf("Bit 6:LED Control       : %d \n", *(pData+21));
-                if(*(pData+14) & 0b10000000) printf("Bit 7:RTC Control       : %d \n", *(pData+22));
-
-                int i;
-                for (i=0;i<=*(pData);i++) 
-                    printf("%#2x ",(unsigned char)*(pData+i));
-                printf("\n");
+                if(*(pData+1) & 0b00000001) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 0:Device Mode       : %d", *(pData+2));
+                if(*(pData+1) & 0b00000010) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 1:Radio Mode        : %d", *(pData+3));
+                if(*(pData+1) & 0b00000100) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 2:WMBus C-Field     : %d", *(pData+4));
+                if(*(pData+1) & 0b00001000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 3:WMBus Man-ID      : %#06x", (unsigned short)*(pData+5)|*(pData+6)<<8);
+                if(*(pData+1) & 0b00010000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 4:WMBus Device-ID   : %#010x", GetStatusU32(pData+7));
+                if(*(pData+1) & 0b00100000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 5:WMBus Version     : %d", *(pData+11));
+                if(*(pData+1) & 0b01000000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 6:WMBus Device Type : %d", *(pData+12));
+                if(*(pData+1) & 0b10000000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 7:Radio Channel     : %d", *(pData+13));
+
+                if(*(pData+14) & 0b00000001) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 0:Radio Power Level : %d", *(pData+15));
+                if(*(pData+14) & 0b00000010) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 1:Radio Data Rate   : %d", *(pData+16));
+                if(*(pData+14) & 0b00000100) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 2:Radio RX Window   : %d", *(pData+17));
+                if(*(pData+14) & 0b00001000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 3:Auto Power Saving : %d", *(pData+18));
+                if(*(pData+14) & 0b00010000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 4:Auto RSSI Attach  : %d", *(pData+19));
+                if(*(pData+14) & 0b00100000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 5:Auto RX-Timestamp : %d", *(pData+20));
+                if(*(pData+14) & 0b01000000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 6:LED Control       : %d", *(pData+21));
+                if(*(pData+14) & 0b10000000) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Bit 7:RTC Control       : %d", *(pData+22));
+
+                char line[5*256 + 1];
+                int  i, len = 0;
+                for (i=0;i<=*(pData);i++)
+                    len += snprintf(line+len, sizeof(line)-len, "%#2x ",(unsigned char)*(pData+i));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "%s", line);
                 switch(*(pData +3)) {
-                case RADIOT2: printf("T2 Mode \n");   break;
-                case RADIOS2: printf("S2 Mode \n");   break;
-                default:      printf("undefined \n"); break;
+                case RADIOT2: Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "T2 Mode");   break;
+                case RADIOS2: Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "S2 Mode");   break;
+                default:      Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "undefined"); break;
                 }
             }
             dwReturn=APIOK;
@@ -549,16 +581,15 @@ unsigned long  wMBus_GetRadioMode(unsigned long handle, uint16_t stick, unsigned
             }
             if (infoflag > SILENTMODE) {
                 switch(*(pData + 5)) {
-                    case RADIOT2_AMB: printf("T2 Mode \n");   break;
-                    case RADIOS2_AMB: printf("S2 Mode \n");   break;
-                    default:          printf("undefined \n"); break;
+                    case RADIOT2_AMB: Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "T2 Mode");   break;
+                    case RADIOS2_AMB: Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "S2 Mode");   break;
+                    default:          Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "undefined"); break;
                 }
             }
             dwReturn=APIOK;
             *dwD = mode;
         }
     }
-    free (pData);
     return dwReturn;
 }
 
@@ -566,27 +597,26 @@ unsigned long  wMBus_IsNewData(unsigned long handle, uint16_t stick, uint16_t in
     unsigned long  dwReturn=0;
     unsigned long  dwNewData=0;
 
-    unsigned char *pData = (unsigned char *) malloc(BUFFER_SIZE);
-    if(NULL == pData) return 0;
+    unsigned char pData[BUFFER_SIZE];
     if(0 == handle) return 0;
-    memset(pData, 0, sizeof(unsigned char)*BUFFER_SIZE);
+    memset(pData, 0, sizeof(pData));
 
     if(stick == iM871AIdentifier){
         if(WMBus_GetSystemStatus(handle, pData, BUFFER_SIZE)) {
 
             if (infoflag > SILENTMODE) {
 
-                printf("\n\nStatus (Error)       : %#1x \n",   *(pData+1));
-                printf("Reserved             : %#1x \n",   *(pData+2));
-                printf("System Alive since   : %d sec \n", (unsigned long)(*(pData+3)|*(pData+4)<<8|*(pData+5)<<16|*(pData+6)<<24)/100);
-                printf("Reserved             : %d \n", *((unsigned long*)(pData+7)));
-                printf("Reserved             : %d \n", (unsigned long)(*(pData+11)|*(pData+12)<<8|*(pData+13)<<16|*(pData+14)<<24));
-                printf("Frames transmitted   : %d \n", (unsigned long)(*(pData+15)|*(pData+16)<<8|*(pData+17)<<16|*(pData+18)<<24));
-                printf("Frames Errors        : %d \n", (unsigned long)(*(pData+19)|*(pData+20)<<8|*(pData+21)<<16|*(pData+22)<<24));
-                printf("Frames received      : %d \n", (unsigned long)(*(pData+23)|*(pData+24)<<8|*(pData+25)<<16|*(pData+26)<<24));
-                printf("Frames CRC Error     : %d \n", (unsigned long)(*(pData+27)|*(pData+28)<<8|*(pData+29)<<16|*(pData+30)<<24));
-                printf("Frames Decoding Error: %d \n", (unsigned long)(*(pData+31)|*(pData+32)<<8|*(pData+33)<<16|*(pData+34)<<24));
-                printf("Reserved             : %d \n", (unsigned long)(*(pData+35)|*(pData+36)<<8|*(pData+37)<<16|*(pData+38)<<24));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Status (Error)       : %#1x",   *(pData+1));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Reserved             : %#1x",   *(pData+2));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "System Alive since   : %u sec", GetStatusU32(pData+3)/100);
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Reserved             : %u", GetStatusU32(pData+7));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Reserved             : %u", GetStatusU32(pData+11));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Frames transmitted   : %u", GetStatusU32(pData+15));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Frames Errors        : %u", GetStatusU32(pData+19));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Frames received      : %u", GetStatusU32(pData+23));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Frames CRC Error     : %u", GetStatusU32(pData+27));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Frames Decoding Error: %u", GetStatusU32(pData+31));
+                Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "Reserved             : %u", GetStatusU32(pData+35));
             }
 
             dwNewData = *((unsigned long*) (pData+23));
@@ -594,17 +624,37 @@ unsigned long  wMBus_IsNewData(unsigned long handle, uint16_t stick, uint16_t in
                 dwReturn = 0; //start condition
             else
                 dwReturn = dwNewData - dwFrameCounter;
-            if (infoflag > SILENTMODE) printf("wMBus_IsNewData %ld Bytes -> new %ld \n", dwNewData, dwReturn);
+            if (infoflag > SILENTMODE) Log_Write(LOGCAT_DRIVER, LOGLVL_INFO, "wMBus_IsNewData %lu frames -> new %lu", dwNewData, dwReturn);
             dwFrameCounter = dwNewData;
         }
         else {
-            if (infoflag > SILENTMODE) printf("WMBus_GetSystemStatus returns 0\n");
+            Log_Printf(LOGCAT_DRIVER, LOGLVL_WARN, "WMBus_GetSystemStatus returns 0");
         }
     }
-    free (pData);
     return dwReturn;
 }
 
+//system status counters without printing them, the frame counter of wMBus_IsNewData is not touched
+int wMBus_GetStickCounters(unsigned long handle, uint16_t stick, pecwMBUSStickCounters counters) {
+    unsigned char pData[BUFFER_SIZE];
+    int           iReturn = APIERROR;
+
+    if((0 == handle) || (NULL == counters) || (stick != iM871AIdentifier)) return APIERROR;
+    memset(pData, 0, sizeof(pData));
+
+    if(WMBus_GetSystemStatus(handle, pData, BUFFER_SIZE)) {
+        counters->status       = *(pData+1);
+        counters->uptime       = GetStatusU32(pData+3)/100;
+        counters->txFrames     = GetStatusU32(pData+15);
+        counters->txErrors     = GetStatusU32(pData+19);
+        counters->rxFrames     = GetStatusU32(pData+23);
+        counters->crcErrors    = GetStatusU32(pData+27);
+        counters->decodeErrors = GetStatusU32(pData+31);
+        iReturn = APIOK;
+    }
+    return iReturn;
+}
+
 void wMBus_Callback(UINT32 msg, UINT32 param) {
     if(msg == WMBUS_MSG_HCI_MESSAGE_IND) {
         GetDataFromStick(myhandle, myStickID, myInfoFlag);
@@ -620,18 +670,35 @@ void wMBus_GetStickStatus(unsigned long handle, uint16_t stick, uint16_t infofla
 }
 
 unsigned long  wMBus_InitDevice(unsigned long handle, uint16_t stick, uint16_t infoflag) {
+    int iX;
+
     myInfoFlag = infoflag;
     myStickID = stick;
+    //the details asked for go to the log
+    if((infoflag >= SHOWALLDETAILS) && !Log_Enabled(LOGCAT_DRIVER, LOGLVL_TRACE))
+        Log_SetLevel(LOGCAT_DRIVER, LOGLVL_TRACE);
+    else if((infoflag > SILENTMODE) && !Log_Enabled(LOGCAT_DRIVER, LOGLVL_DEBUG))
+        Log_SetLevel(LOGCAT_DRIVER, LOGLVL_DEBUG);
     //clear Array
+    pthread_mutex_lock(&lockQueue);
     memset(MeterAddr, 0, MAXSLOT*sizeof(ecwMBUSMeter));
-    memset(MeterData, 0, MAXSLOT*sizeof(ecMBUSData));
+    for(iX=0; iX<MAXSLOT; iX++) {
+        if(MeterQueue[iX].depth != QueueDepth) {
+            Ring_Free(&MeterQueue[iX]);
+            Ring_Init(&MeterQueue[iX], QueueDepth);
+        }
+        Ring_Clear(&MeterQueue[iX]);
+    }
+    memset(LastPktInfo, 0, sizeof(LastPktInfo));
+    MeterHasData = 0;
+    pthread_mutex_unlock(&lockQueue);
 
     if(stick == iM871AIdentifier) {
         if(!bCallbackRegistered) {
             bCallbackRegistered=true;
             myhandle=handle;
             WMBus_RegisterMsgHandler(&wMBus_Callback);
-            printf("Msg Handler registered.\n");
+            Log_Printf(LOGCAT_DRIVER, LOGLVL_DEBUG, "Msg Handler registered.");
         }
         unsigned char Filter[8];
         unsigned char Key[16];
@@ -654,86 +721,252 @@ unsigned long  wMBus_InitDevice(unsigned long handle, uint16_t stick, uint16_t i
             WMBus_ConfigureAESDecryptionKey(handle, iX, Filter, Key);
         }
     }
+    memset(StickSlot, 0, sizeof(StickSlot));
+    SlotProgrammed = 0;
+    SlotsVerified  = false;
     if(stick == iAMB8465Identifier){
         short sWriteSize=0;
 
        //Enable AES
        sWriteSize=(sizeof(SET_AES_ENABLE_REQ_Arr))/(sizeof(uint8_t));
        if(AMBERCommand((int)handle,SET_AES_ENABLE_REQ_Arr, NULL, true, sWriteSize, BUFFER_SIZE, infoflag))
-            if(infoflag>=SHOWALLDETAILS) printf("AES\n");
+            Log_Printf(LOGCAT_DRIVER, LOGLVL_TRACE, "AES");
 
        //Enable RSSI
        sWriteSize=(sizeof(SET_RSSI_ENABLE_REQ_Arr))/(sizeof(uint8_t));
        if(AMBERCommand((int)handle,SET_RSSI_ENABLE_REQ_Arr, NULL, true, sWriteSize, BUFFER_SIZE, infoflag))
-            if(infoflag>=SHOWALLDETAILS) printf("RSSI\n");
-
-       //Start thread
-        pthread_create(&ThreadID, NULL, ThreadProc, NULL);
+            Log_Printf(LOGCAT_DRIVER, LOGLVL_TRACE, "RSSI");
+
+       //Start thread, without it nothing is received
+        if(AmberWake < 0) {
+            if((AmberWake = eventfd(0, EFD_CLOEXEC)) < 0)
+                return 0;
+            if(0 != pthread_create(&ThreadID, NULL, ThreadProc, NULL)) {
+                close(AmberWake);
+                AmberWake = -1;
+                return 0;
+            }
+        }
     }
     return 1;
 }
 
-unsigned long  wMBus_AddMeter(unsigned long handle,uint16_t stick,int slot,pecwMBUSMeter NewMeter,uint16_t infoflag) {
-    int i;
-    bool exist=false;
-    if(slot<MAXSLOT) {
-        dwMeter = slot;
-        for( i=0; i<=MAXSLOT; i++) {
-            if(MeterAddr[i].manufacturerID == NewMeter->manufacturerID &&
-               MeterAddr[i].ident          == NewMeter->ident          &&
-               MeterAddr[i].version        == NewMeter->version        &&
-               MeterAddr[i].type           == NewMeter->type) {
-            exist=true;
-            }
+//manufacturer, ident, version and type as the sticks take them
+static void MeterAddress(const ecwMBUSMeter *meter, uint8_t *addr) {
+    addr[0] = (uint8_t) meter->manufacturerID;
+    addr[1] = (uint8_t)(meter->manufacturerID>>8);
+    addr[2] = (uint8_t) meter->ident;
+    addr[3] = (uint8_t)(meter->ident>>8);
+    addr[4] = (uint8_t)(meter->ident>>16);
+    addr[5] = (uint8_t)(meter->ident>>24);
+    addr[6] = meter->version;
+    addr[7] = meter->type;
+}
+
+static bool SameAddress(const ecwMBUSMeter *a, const ecwMBUSMeter *b) {
+    return (a->manufacturerID == b->manufacturerID) && (a->ident == b->ident) && (a->version == b->version) && (a->type == b->type);
+}
+
+//removes a device from the AMBER key table, it is keyed by address
+static bool AmberClearKey(unsigned long handle, const ecwMBUSMeter *meter, uint16_t infoflag) {
+    uint8_t Cmd[sizeof(CMD_CLR_AES_KEY_REQ_Arr)];
+
+    memcpy(Cmd, CMD_CLR_AES_KEY_REQ_Arr, 3);
+    MeterAddress(meter, &Cmd[3]);
+    Cmd[sizeof(Cmd)-1] = CRC_XOR(Cmd, sizeof(Cmd)-1);
+    SlotCommands++;
+    return AMBERCommand((int)handle, Cmd, NULL, true, sizeof(Cmd), BUFFER_SIZE, infoflag);
+}
+
+//one set command for the slot; an AMBER slot that held another meter is cleared first
+static bool ProgramSlot(unsigned long handle, uint16_t stick, int slot, const ecwMBUSMeter *meter, uint16_t infoflag) {
+    uint8_t Filter[sizeof(CMD_SET_AES_KEY_REQ_Arr)];
+    bool    ok = false;
+
+    memset(Filter, 0, sizeof(Filter));
+    MeterAddress(meter, &Filter[3]);
+    if(stick == iM871AIdentifier) {
+        SlotCommands++;
+        ok = (NULL != WMBus_ConfigureAESDecryptionKey) &&
+             WMBus_ConfigureAESDecryptionKey(handle, (unsigned char)slot, &Filter[3], (unsigned char*) meter->key);
+    }
+    if(stick == iAMB8465Identifier) {
+        if((SlotProgrammed & (0x01<<slot)) && !SameAddress(&StickSlot[slot], meter))
+            AmberClearKey(handle, &StickSlot[slot], infoflag);
+        memcpy(Filter, CMD_SET_AES_KEY_REQ_Arr, 3); //first 3 bytes used for set AES key message
+        memcpy(&Filter[11], meter->key, AES_KEYLENGHT_IN_BYTES);
+        Filter[sizeof(Filter)-1] = CRC_XOR(Filter, sizeof(Filter)-1); //CRC
+        SlotCommands++;
+        ok = AMBERCommand((int)handle, Filter, NULL, true, sizeof(Filter), BUFFER_SIZE, infoflag);
+        if(!ok) Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "Error...writing command failed");
+    }
+    if(ok) {
+        StickSlot[slot] = *meter;
+        SlotProgrammed |= 0x01<<slot;
+    }
+    else
+        SlotProgrammed &= ~(0x01<<slot);
+    return ok;
+}
+
+//the iM871A slot gets a key for an address nobody sends, the AMBER drops the device
+static bool ClearSlot(unsigned long handle, uint16_t stick, int slot, uint16_t infoflag) {
+    unsigned char Filter[8] = { 0x25, 0xB3, 0x12, 0x00, 0x00, 0x00, 0x01, 0x02 };
+    unsigned char Key[AES_KEYLENGHT_IN_BYTES];
+    bool          ok = false;
+    int           iX;
+
+    if(stick == iM871AIdentifier) {
+        for(iX=0; iX<AES_KEYLENGHT_IN_BYTES; iX++)
+            Key[iX] = (unsigned char) iX;
+        Filter[5] = (unsigned char)(0x70+slot);
+        SlotCommands++;
+        ok = (NULL != WMBus_ConfigureAESDecryptionKey) && WMBus_ConfigureAESDecryptionKey(handle, (unsigned char)slot, Filter, Key);
+    }
+    if(stick == iAMB8465Identifier)
+        ok = AmberClearKey(handle, &StickSlot[slot], infoflag);
+    if(ok) {
+        memset(&StickSlot[slot], 0, sizeof(ecwMBUSMeter));
+        SlotProgrammed &= ~(0x01<<slot);
+    }
+    return ok;
+}
+
+//the devices in the AMBER key table, bank by bank until a bank is not full;
+//with find set it stops after the bank in which the last of these slots turned up
+static int AmberReadDevices(unsigned long handle, ecwMBUSMeter *devices, int max, unsigned long find, uint16_t infoflag) {
+    uint8_t *Cmd[] = { CMD_GET_AES_DEV_REQ_Arr0, CMD_GET_AES_DEV_REQ_Arr1, CMD_GET_AES_DEV_REQ_Arr2, CMD_GET_AES_DEV_REQ_Arr3 };
+    uint8_t  Data[BUFFER_SIZE];
+    int      count = 0, bank, entries, iX, iS;
+
+    for(bank=0; bank<4; bank++) {
+        if(!AMBERCommand((int)handle, Cmd[bank], Data, true, sizeof(CMD_GET_AES_DEV_REQ_Arr0), sizeof(Data), infoflag))
+            return APIERROR;
+        entries = min(Data[2]/8, 16);
+        for(iX=0; iX<entries; iX++) {
+            const uint8_t *e = &Data[3 + 8*iX];
+            if((0 == (e[0] | (e[1]<<8))) || (count >= max)) continue;
+            memset(&devices[count], 0, sizeof(ecwMBUSMeter));
+            devices[count].manufacturerID = (uint16_t)(e[0] | (e[1]<<8));
+            devices[count].ident          = (uint32_t)e[2] | ((uint32_t)e[3]<<8) | ((uint32_t)e[4]<<16) | ((uint32_t)e[5]<<24);
+            devices[count].version        = e[6];
+            devices[count].type           = e[7];
+            for(iS=0; iS<MAXSLOT; iS++)
+                if((find & (0x01<<iS)) && SameAddress(&devices[count], &StickSlot[iS]))
+                    find &= ~(0x01<<iS);
+            count++;
         }
+        if((entries < 16) || (0 == find)) break;
+    }
+    return count;
+}
 
-        if(!exist) {//if Meter does not exist...Add new one
-            unsigned char Filter[sizeof(CMD_SET_AES_KEY_REQ_Arr)];
-            memset(Filter,0,sizeof(CMD_SET_AES_KEY_REQ_Arr));
-
-            MeterPresent |= 0x01 << slot;
-            MeterAddr[dwMeter].manufacturerID   = NewMeter->manufacturerID;
-            MeterAddr[dwMeter].ident            = NewMeter->ident;
-            MeterAddr[dwMeter].version          = NewMeter->version;
-            MeterAddr[dwMeter].type             = NewMeter->type;
-            memcpy(MeterAddr[dwMeter].key, NewMeter->key, AES_KEYLENGHT_IN_BYTES);
-
-            Filter[ 3] = (unsigned char) NewMeter->manufacturerID;
-            Filter[ 4] = (unsigned char)(NewMeter->manufacturerID>>8);
-            Filter[ 5] = (unsigned char) NewMeter->ident;
-            Filter[ 6] = (unsigned char)(NewMeter->ident>>8);
-            Filter[ 7] = (unsigned char)(NewMeter->ident>>16);
-            Filter[ 8] = (unsigned char)(NewMeter->ident>>24);
-            Filter[ 9] = NewMeter->version;
-            Filter[10] = NewMeter->type;
-
-            if(stick == iM871AIdentifier) WMBus_ConfigureAESDecryptionKey(handle, (unsigned char)slot, &Filter[3],(unsigned char*) MeterAddr[dwMeter].key);
-            if(stick == iAMB8465Identifier) {
-                Filter[0]=CMD_SET_AES_KEY_REQ_Arr[0]; //first 3 bytes used for set AES key message
-                Filter[1]=CMD_SET_AES_KEY_REQ_Arr[1];
-                Filter[2]=CMD_SET_AES_KEY_REQ_Arr[2];
-
-                for(i = 0;i<AES_KEYLENGHT_IN_BYTES;i++) //Key Registration
-                    Filter[11+i]=NewMeter->key[i];
-
-                Filter[sizeof(CMD_SET_AES_KEY_REQ_Arr)-1]=CRC_XOR(Filter, sizeof(CMD_SET_AES_KEY_REQ_Arr)-1); //CRC
-
-                if(AMBERCommand((int)handle, Filter, NULL, true, sizeof(CMD_SET_AES_KEY_REQ_Arr), BUFFER_SIZE, infoflag) == 0) {
-                    printf("Error...writing command failed\n");
-                    return 0;
-                }
-            }
+//reads the AMBER table back: slots the stick lost are set again, devices of no slot are cleared;
+//every bank takes 500 ms, so with changed set only the banks up to the last of these slots are read
+static int AmberVerify(unsigned long handle, unsigned long changed, uint16_t infoflag) {
+    ecwMBUSMeter devices[4*16];
+    unsigned long check = (0 != changed) ? (changed & SlotProgrammed) : SlotProgrammed;
+    int          count, iX, iD, fixed = 0;
 
-            dwMeter++;
-            exist=false;
-            return 1;
-        } else {
-            return 0;
+    if((0 != changed) && (0 == check))
+        return 0;
+    if((count = AmberReadDevices(handle, devices, 4*16, (0 != changed) ? check : 0, infoflag)) < 0) {
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_ERROR, "Error...reading the AES device list failed");
+        return APIERROR;
+    }
+    for(iX=0; iX<MAXSLOT; iX++) {
+        if(!(check & (0x01<<iX))) continue;
+        for(iD=0; (iD<count) && !SameAddress(&devices[iD], &StickSlot[iX]); iD++)
+            ;
+        if(iD == count) {
+            Log_Printf(LOGCAT_METER, LOGLVL_WARN, "Meter %04X %08X is missing on the stick, set again", StickSlot[iX].manufacturerID, StickSlot[iX].ident);
+            ProgramSlot(handle, iAMB8465Identifier, iX, &StickSlot[iX], infoflag);
+            fixed++;
+        }
+    }
+    //the clear commands were acknowledged, the rest of the table is read only after the stick was initialised
+    for(iD=0; (0 == changed) && (iD<count); iD++) {
+        for(iX=0; (iX<MAXSLOT) && !((SlotProgrammed & (0x01<<iX)) && SameAddress(&devices[iD], &StickSlot[iX])); iX++)
+            ;
+        if(iX == MAXSLOT) {
+            Log_Printf(LOGCAT_METER, LOGLVL_DEBUG, "Meter %04X %08X is on the stick but in no slot, cleared", devices[iD].manufacturerID, devices[iD].ident);
+            AmberClearKey(handle, &devices[iD], infoflag);
+            fixed++;
         }
-    } else
-        printf("All slots full \n");
+    }
+    SlotsVerified = true;
+    return fixed;
+}
 
-    return 0;
+//brings the key slots of the stick to the list, meters[slot] with manufacturerID 0 is a free slot;
+//only slots that differ from what was programmed are set or cleared, returns the commands sent or APIERROR
+int wMBus_SyncMeters(unsigned long handle, uint16_t stick, const ecwMBUSMeter *meters, int count, uint16_t infoflag) {
+    unsigned long before = SlotCommands, set = 0;
+    bool          failed = false;
+    int           iX;
+
+    if(0 == handle) return APIERROR;
+    for(iX=0; iX<MAXSLOT; iX++) {
+        const ecwMBUSMeter *want = ((iX < count) && (0 != meters[iX].manufacturerID)) ? &meters[iX] : NULL;
+
+        if(NULL == want) {
+            if(MeterPresent & (0x01<<iX))
+                wMBus_RemoveMeter(iX);
+            if((SlotProgrammed & (0x01<<iX)) && !ClearSlot(handle, stick, iX, infoflag))
+                failed = true;
+            continue;
+        }
+        if(!(MeterPresent & (0x01<<iX)) || (0 != memcmp(&MeterAddr[iX], want, sizeof(ecwMBUSMeter)))) {
+            if((MeterPresent & (0x01<<iX)) && !SameAddress(&MeterAddr[iX], want))
+                wMBus_RemoveMeter(iX); //another meter, its queued readings go
+            pthread_mutex_lock(&lockQueue);
+            MeterAddr[iX] = *want;
+            pthread_mutex_unlock(&lockQueue);
+            MeterPresent |= 0x01<<iX;
+        }
+        if(!(SlotProgrammed & (0x01<<iX)) || (0 != memcmp(&StickSlot[iX], want, sizeof(ecwMBUSMeter)))) {
+            if(!ProgramSlot(handle, stick, iX, want, infoflag))
+                failed = true;
+            set |= 0x01<<iX;
+        }
+    }
+    //the whole table once after the stick was initialised, then only the slots just set
+    if((stick == iAMB8465Identifier) && (!SlotsVerified || (0 != set)) && (AmberVerify(handle, SlotsVerified ? set : 0, infoflag) < 0))
+        failed = true;
+    Log_Printf(LOGCAT_METER, LOGLVL_DEBUG, "Key slots synchronised, %lu commands", SlotCommands - before);
+    return failed ? APIERROR : (int)(SlotCommands - before);
+}
+
+//set and clear commands sent to the key slots since the start
+unsigned long wMBus_GetSlotCommands(void) {
+    return SlotCommands;
+}
+
+//registers one meter in a slot, 0 if it is in another slot already; the key goes to the stick only if it changed
+unsigned long  wMBus_AddMeter(unsigned long handle,uint16_t stick,int slot,pecwMBUSMeter NewMeter,uint16_t infoflag) {
+    int i;
+
+    if((slot < 0) || (slot >= MAXSLOT)) {
+        Log_Printf(LOGCAT_METER, LOGLVL_WARN, "All slots full");
+        return 0;
+    }
+    for( i=0; i<MAXSLOT; i++) {
+        if((MeterPresent & (0x01<<i)) && SameAddress(&MeterAddr[i], NewMeter))
+            return 0;
+    }
+    dwMeter = slot;
+    pthread_mutex_lock(&lockQueue);
+    if(!(MeterPresent & (0x01<<slot)) || !SameAddress(&MeterAddr[slot], NewMeter))
+        LastPktInfo[slot] = 0;
+    MeterAddr[slot] = *NewMeter;
+    pthread_mutex_unlock(&lockQueue);
+    MeterPresent |= 0x01 << slot;
+    if(!(SlotProgrammed & (0x01<<slot)) || (0 != memcmp(&StickSlot[slot], NewMeter, sizeof(ecwMBUSMeter)))) {
+        if(!ProgramSlot(handle, stick, slot, NewMeter, infoflag))
+            return 0;
+    }
+    dwMeter++;
+    return 1;
 }
 
 bool wMBus_IsInArray(ecwMBUSMeter p, ecwMBUSMeter MeterData[],int *Index) {
@@ -749,18 +982,72 @@ bool wMBus_IsInArray(ecwMBUSMeter p, ecwMBUSMeter MeterData[],int *Index) {
     return true;
 }
 
+//the slot stops delivering readings, its key stays on the stick until wMBus_SyncMeters or wMBus_AddMeter reuse it
 int wMBus_RemoveMeter(int Index) {
+    if((Index < 0) || (Index >= MAXSLOT))
+        return APIERROR;
     MeterPresent &= ~(0x01<<Index);
+    pthread_mutex_lock(&lockQueue);
     memset(&MeterAddr[Index], 0, sizeof(ecwMBUSMeter));
+    Ring_Clear(&MeterQueue[Index]);
+    LastPktInfo[Index] = 0;
+    MeterHasData &= ~(0x01<<Index);
+    pthread_mutex_unlock(&lockQueue);
     return 0;
 }
 
+void wMBus_RegisterReadingHandler(wMBus_ReadingHandler handler) {
+    myReadingHandler = handler;
+}
+
+void wMBus_RegisterFrameHandler(wMBus_FrameHandler handler, void *ctx) {
+    myFrameContext = ctx;
+    myFrameHandler = handler;
+}
+
+//the colored dump of every frame is logged at info in the frame category, on by default
+void wMBus_SetFrameDump(bool on) {
+    Log_SetLevel(LOGCAT_FRAME, on ? LOGLVL_INFO : LOGLVL_WARN);
+}
+
 unsigned long wMBus_GetMeterList() {
     return MeterPresent;
 }
 
 unsigned long wMBus_GetMeterDataList() {
-    return MeterHasData;
+    unsigned long mask;
+
+    pthread_mutex_lock(&lockQueue);
+    mask = MeterHasData;
+    pthread_mutex_unlock(&lockQueue);
+    return mask;
+}
+
+//readings kept per meter until wMBus_GetData4Meter takes them, 0 keeps none (the reading handler gets them all);
+//queued readings are dropped, set it before the stick is opened
+void wMBus_SetQueueDepth(int depth) {
+    int iX;
+
+    pthread_mutex_lock(&lockQueue);
+    QueueDepth = (depth < 0) ? 0 : min(depth, RING_MAXDEPTH);
+    for(iX=0; iX<MAXSLOT; iX++) {
+        Ring_Free(&MeterQueue[iX]);
+        Ring_Init(&MeterQueue[iX], QueueDepth);
+    }
+    MeterHasData = 0;
+    pthread_mutex_unlock(&lockQueue);
+}
+
+//readings waiting in the queue of a slot and readings overwritten there since the start
+int wMBus_GetQueueStats(int Index, unsigned long *queued, unsigned long *overwritten) {
+    if((Index < 0) || (Index >= MAXSLOT))
+        return APIERROR;
+
+    pthread_mutex_lock(&lockQueue);
+    if(NULL != queued)      *queued      = MeterQueue[Index].count;
+    if(NULL != overwritten) *overwritten = MeterQueue[Index].overwritten;
+    pthread_mutex_unlock(&lockQueue);
+    return APIOK;
 }
 
 bool saBCD12ToUINT32(uint8_t* pBcd12, uint8_t size, uint32_t* pV) {
@@ -791,6 +1078,38 @@ bool saBCD12ToUINT32(uint8_t* pBcd12, uint8_t size, uint32_t* pV) {
     return true;
 }
 
+//the payload in hex split into L C M A(ident) version type CI access-number status, coloured on a terminal
+static void DumpFrame(const uint8_t *payload, int len) {
+    static const char Hex[]       = "0123456789ABCDEF";
+    static const char SplitAt[12] = { PRINTF_GREEN, PRINTF_GREEN, 0, PRINTF_GREEN, 0, 0, 0, PRINTF_GREEN, PRINTF_GREEN,
+                                      PRINTF_RED, PRINTF_BLUE, PRINTF_YELLOW };
+    char line[LOG_MSGSIZE];
+    bool colour = Log_IsTerminal();
+    int  n, iX;
+
+    memcpy(line, "msg: ", 5);
+    n = 5;
+    for(iX=0; (iX<len) && (n < LOG_MSGSIZE - 16); iX++) {
+        line[n++] = Hex[payload[iX] >> 4];
+        line[n++] = Hex[payload[iX] & 0x0F];
+        if((iX < (int)sizeof(SplitAt)) && (0 != SplitAt[iX])) {
+            if(colour) {
+                memcpy(line+n, "\033[3", 4);
+                line[n+4] = (char)('0' + SplitAt[iX]);
+                line[n+5] = 'm';
+                n += 6;
+            }
+            line[n++] = '|';
+        }
+    }
+    if(colour) {
+        memcpy(line+n, "\033[0m", 4);
+        n += 4;
+    }
+    line[n] = 0;
+    Log_Write(LOGCAT_FRAME, LOGLVL_INFO, "%s", line);
+}
+
 void GetDataFromStick(unsigned long handle, uint16_t stick, uint16_t infoflag) {
     unsigned long   dwReturn=0;
     int             PayLoadLength;
@@ -799,26 +1118,29 @@ void GetDataFromStick(unsigned long handle, uint16_t stick, uint16_t infoflag) {
     int8_t          RSSI=0;
     bool            bIsDecrypted=false;
     int             Offset=0;
-    short           sSize = 1024;
+    short           sSize = BUFFER_SIZE;
     short           sSize_frame = 0;
-    unsigned char   *pBuffer;
-    int             iX;
+    unsigned char   pBuffer[BUFFER_SIZE];
 
-    pBuffer = (unsigned char *) malloc(sSize);
-    memset(pBuffer, 0, sizeof(unsigned char)*sSize);
+    //the decoder looks at the header, the L-field bytes and the trailer only
+    memset(pBuffer, 0, FRAME_DECODEWINDOW);
     if(stick == iM871AIdentifier)   dwReturn = WMBus_GetHCIMessage(handle, pBuffer, sSize);
-    if(stick == iAMB8465Identifier) dwReturn = AMBER_ReadFrameFromStick(AmberCom, pBuffer+2, sSize, &sSize_frame, infoflag); //AMBER has bytes less in header than IMST: Length(8Bit)->>>Payload
+    if(stick == iAMB8465Identifier) {
+        //only the read shares the port with the commands, the handlers below run without lockAPI
+        pthread_mutex_lock(&lockAPI);
+        dwReturn = AMBER_ReadFrameFromStick(AmberCom, pBuffer+2, sSize, &sSize_frame, infoflag); //AMBER has bytes less in header than IMST: Length(8Bit)->>>Payload
+        pthread_mutex_unlock(&lockAPI);
+    }
 
     if(dwReturn) {
+        Met_Count(MET_FRAMESREAD);
         PayLoadLength = *(pBuffer+2);
         MessageLength = PayLoadLength - 3;
-        if (infoflag > SILENTMODE) printf(" PayloadLength %d ", PayLoadLength);
 
         if(stick == iM871AIdentifier) {
             if(*(pBuffer) & 0x20) { //If TimeStamp attached
                 TimeStamp = *( (unsigned long*) (pBuffer+3+PayLoadLength));
                 MessageLength -= 4;
-                if (infoflag > SILENTMODE) printf("Timestamp=0x%08X ", (unsigned int)TimeStamp);
             }
             if(*(pBuffer) & 0x40) { //If RSSI attached
                 uint8_t RSSIfromBuf = *(pBuffer+7+PayLoadLength);
@@ -826,7 +1148,6 @@ void GetDataFromStick(unsigned long handle, uint16_t stick, uint16_t infoflag) {
                 double m = 80.0 / 150.0;
                 RSSI=(int8_t)(m * (double)RSSIfromBuf + b);
                 MessageLength -= 1;
-                if (infoflag > SILENTMODE) printf("RSSI=%i", RSSI);
             }
         }
 
@@ -841,7 +1162,6 @@ void GetDataFromStick(unsigned long handle, uint16_t stick, uint16_t infoflag) {
                 RSSI=0;
             }
         }
-        if (infoflag > SILENTMODE) printf("\n");
 
         ecMBUSData   RFData;    //struct to store value + rssi + timestamp
         ecwMBUSMeter RFSource;  //struct to store Source Address
@@ -865,7 +1185,7 @@ void GetDataFromStick(unsigned long handle, uint16_t stick, uint16_t infoflag) {
         memset(&RFData,   0, sizeof(ecMBUSData));
         memset(&RFSource, 0, sizeof(ecwMBUSMeter));
 
-        RFData.time=TimeStamp;
+        RFData.time=(uint32_t)time(NULL); //reception time, the stick timestamp is not an epoch time
         RFData.rssiDBm= RSSI;
         RFData.accNo  = *(pBuffer+OFFSETPAYLOAD+OFFSETACCESSNUMBER); //Access number
         RFData.status = *(pBuffer+OFFSETPAYLOAD+OFFSETSTATUS); //Status
@@ -907,6 +1227,7 @@ void GetDataFromStick(unsigned long handle, uint16_t stick, uint16_t infoflag) {
                 RFData.pktInfo=PACKET_DECRYPTIONERROR;
             }
             else {
+                Met_Count(MET_FRAMESDECODED);
                 if(stick == iM871AIdentifier) {
                     if(PayLoadLength > WMBUS_PAYLOADLENGTH_DEFAULT)
                         RFData.pktInfo = PACKET_WAS_ENCRYPTED;
@@ -979,55 +1300,55 @@ void GetDataFromStick(unsigned long handle, uint16_t stick, uint16_t infoflag) {
         RFSource.version        =  *(pBuffer+OFFSETPAYLOAD+OFFSETVERSION);
         RFSource.type           =  *(pBuffer+OFFSETPAYLOAD+OFFSETTYPE);
 
-        if (infoflag > SILENTMODE) printf("Meter  %04X %08X %02X %02X %d (exp) %d ", RFSource.manufacturerID, RFSource.ident, RFSource.version, RFSource.type, RFData.value, RFData.exp);
-
-        int MeterIndex;
-        if(wMBus_IsInArray(RFSource,MeterAddr,&MeterIndex)) {
-            if(MeterIndex < MAXSLOT) {
-                if (infoflag > SILENTMODE) printf(" - Meter is in Array at Pos #%d ", MeterIndex);
-                //If decryption doesn't work 2 Messages are sent - keep Decryption Error Status
-                if(PACKET_DECRYPTIONERROR == MeterData[MeterIndex].pktInfo)
-                    RFData.pktInfo=PACKET_DECRYPTIONERROR;
-                memcpy(&MeterData[MeterIndex],&RFData,sizeof(ecMBUSData));
+        //the main thread may change the list meanwhile, the handlers get a copy of the entry
+        ecwMBUSMeter Meter = RFSource;
+        int MeterIndex = -1;
+        pthread_mutex_lock(&lockQueue);
+        if(wMBus_IsInArray(RFSource,MeterAddr,&MeterIndex) && (MeterIndex < MAXSLOT)) {
+            Meter = MeterAddr[MeterIndex];
+            //If decryption doesn't work 2 Messages are sent - keep Decryption Error Status
+            if(PACKET_DECRYPTIONERROR == LastPktInfo[MeterIndex])
+                RFData.pktInfo=PACKET_DECRYPTIONERROR;
+            LastPktInfo[MeterIndex] = RFData.pktInfo;
+            if(Ring_Push(&MeterQueue[MeterIndex], &RFData))
                 MeterHasData=MeterHasData | (0x01<<MeterIndex); //set bit which MeterData was recieved
-            }
         }
-//        if (infoflag > SILENTMODE) printf("\n");
-
-        printf("msg: ");
-        for (iX=0;iX<MessageLength;iX++) {
-        //    printf("%02X",*(pBuffer+3+iX));
-            printf("%02X",RFData.payload[iX]);
-            switch (iX) {
-               case 0:
-               case 1:
-               case 3:
-               case 7:
-               case 8:   nColour(PRINTF_GREEN,0); printf("|"); break;
-               case 9:   nColour(PRINTF_RED,0); printf("|"); break;
-               case 10:  nColour(PRINTF_BLUE,0); printf("|"); break;
-               case 11:  nColour(PRINTF_YELLOW,0); printf("|"); break;
-               case 256: printf("|"); break;
-               default:  printf(""); 
-            }
+        pthread_mutex_unlock(&lockQueue);
+        if((MeterIndex >= 0) && (MeterIndex < MAXSLOT)) {
+            Met_Reading(MeterIndex, &RFSource, &RFData);
+            if(NULL != myReadingHandler)
+                myReadingHandler(MeterIndex, &Meter, &RFData);
         }
-        printf("\n");
-
+        Log_Printf(LOGCAT_DRIVER, LOGLVL_DEBUG, "PayloadLength %d Timestamp=0x%08X RSSI=%i Meter %04X %08X %02X %02X %u (exp) %d slot %d",
+                   PayLoadLength, (unsigned int)TimeStamp, RSSI, RFSource.manufacturerID, RFSource.ident, RFSource.version, RFSource.type,
+                   RFData.value, RFData.exp, MeterIndex);
+        //every frame from the L-field on, the views are valid during the call only
+        if(NULL != myFrameHandler) {
+            if((MeterIndex >= 0) && (MeterIndex < MAXSLOT))
+                myFrameHandler(myFrameContext, MeterIndex, &Meter, &RFData, pBuffer+2, PayLoadLength+1);
+            else
+                myFrameHandler(myFrameContext, -1, &RFSource, &RFData, pBuffer+2, PayLoadLength+1);
+        }
+        if(Log_Enabled(LOGCAT_FRAME, LOGLVL_INFO))
+            DumpFrame(RFData.payload, MessageLength);
     }
-
-    if(pBuffer) free(pBuffer);
 }
 
+//takes the oldest queued reading of a meter, 0 if there is none; call until 0 to drain the queue
 unsigned long wMBus_GetData4Meter(int Index, psecMBUSData data) {
-    unsigned long dwReturn;
+    unsigned long dwReturn = 0;
 
-    if (Index > MAXSLOT)
+    if ((Index < 0) || (Index >= MAXSLOT))
         return 0;
 
-    dwReturn = MeterHasData & (0x01<<Index); //get Bit out of mask
-    if(NULL != data) memcpy(data, &MeterData[Index], sizeof(ecMBUSData));
-    memset(&MeterData[Index], 0, sizeof(ecMBUSData));
-    MeterHasData &= ~(0x01<<Index); //clear Bit
+    pthread_mutex_lock(&lockQueue);
+    if(Ring_Pop(&MeterQueue[Index], data))
+        dwReturn = 0x01<<Index;
+    else if(NULL != data)
+        memset(data, 0, sizeof(ecMBUSData));
+    if(0 == MeterQueue[Index].count)
+        MeterHasData &= ~(0x01<<Index); //clear Bit
+    pthread_mutex_unlock(&lockQueue);
     return dwReturn;
 }
 #pragma endregion
@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusle.h>
+#include <wmbus/wmbusjournal.h>
+#include <wmbus/wmbusmetrics.h>
+#include <wmbus/wmbusagg.h>
+
+static int SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) ? APIERROR : APIOK;
+}
+
+static void Wake(pecwMBUSAgg agg) {
+    if(write(agg->wake[1], "w", 1) < 0) {}
+}
+
+//FNV-1a over the frame header, the part that is not encrypted: a gateway with the key of the meter
+//forwards the decrypted payload, one without it the encrypted one, the reception time and RSSI differ
+static uint64_t TelegramKey(const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    uint8_t  head[10];
+    uint64_t h = 0xCBF29CE484222325ULL;
+    int      iX;
+
+    PutU16(head,   meter->manufacturerID);
+    PutU32(head+2, meter->ident);
+    head[6] = meter->version;
+    head[7] = meter->type;
+    head[8] = data->accNo;
+    head[9] = data->status;
+    for(iX=0; iX<(int)sizeof(head); iX++)
+        h = (h ^ head[iX]) * 0x100000001B3ULL;
+    return h;
+}
+
+//the access number repeats every 256 telegrams, a copy belongs to a telegram received about the same time
+static bool SameTime(uint32_t a, uint32_t b) {
+    return ((a > b) ? a - b : b - a) <= AGG_SKEW;
+}
+
+static bool IsBetter(int flags, const ecMBUSData *data, const ecwMBUSAggPending *p) {
+    if((flags & FWD_UNREGISTERED) != (p->flags & FWD_UNREGISTERED))
+        return !(flags & FWD_UNREGISTERED);
+    return data->rssiDBm > p->data.rssiDBm;
+}
+
+//called with the lock held and room for one more pending telegram
+static void Accept(pecwMBUSAgg agg, int gateway, int flags, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t nowUs) {
+    uint64_t           key = TelegramKey(meter, data);
+    uint64_t          *bucket = &agg->buckets[key & (AGG_BUCKETS-1)];
+    uint64_t           seq;
+    ecwMBUSAggSeen    *s;
+    ecwMBUSAggPending *p;
+
+    agg->gateways[gateway].readings++;
+    //newest first, a seq no longer in the ring or too old ends the chain
+    for(seq = *bucket; (0 != seq) && (seq + AGG_SEENSIZE >= agg->nextSeq); seq = s->next) {
+        s = &agg->seen[seq & (AGG_SEENSIZE-1)];
+        if(s->firstUs + (uint64_t)AGG_RETAIN*1000 < nowUs) break;
+        if((s->key != key) || !SameTime(s->time, data->time)) continue;
+
+        agg->gateways[gateway].duplicates++;
+        if(seq >= agg->emitSeq) {
+            p = &agg->pending[seq & (AGG_MAXPENDING-1)];
+            if(IsBetter(flags, data, p)) {
+                p->gateway = gateway;
+                p->flags   = flags;
+                p->meter   = *meter;
+                p->data    = *data;
+            }
+        }
+        return;
+    }
+
+    seq = agg->nextSeq++;
+    s = &agg->seen[seq & (AGG_SEENSIZE-1)];
+    s->key     = key;
+    s->firstUs = nowUs;
+    s->time    = data->time;
+    s->next    = *bucket;
+    *bucket    = seq;
+
+    p = &agg->pending[seq & (AGG_MAXPENDING-1)];
+    p->gateway = gateway;
+    p->flags   = flags;
+    p->meter   = *meter;
+    p->data    = *data;
+    agg->unique++;
+}
+
+//hands on the oldest pending telegram if its window closed or force, the handler runs without the lock
+static bool EmitOne(pecwMBUSAgg agg, bool force) {
+    ecwMBUSAggPending p;
+    char              id[FWD_MAXID + 1];
+    uint64_t          nowUs = Met_NowUs();
+
+    pthread_mutex_lock(&agg->lock);
+    if((agg->emitSeq == agg->nextSeq) ||
+       (!force && (agg->seen[agg->emitSeq & (AGG_SEENSIZE-1)].firstUs + agg->windowUs > nowUs))) {
+        pthread_mutex_unlock(&agg->lock);
+        return false;
+    }
+    p = agg->pending[agg->emitSeq & (AGG_MAXPENDING-1)];
+    memcpy(id, agg->gateways[p.gateway].id, sizeof(id));
+    agg->gateways[p.gateway].best++;
+    agg->emitSeq++;
+    pthread_mutex_unlock(&agg->lock);
+
+    agg->handler(agg->ctx, id, p.flags, &p.meter, &p.data);
+    return true;
+}
+
+//ms until the oldest window closes, -1 without pending telegrams
+static int NextTimeout(pecwMBUSAgg agg) {
+    uint64_t dueUs, nowUs = Met_NowUs();
+    int      timeout = -1;
+
+    pthread_mutex_lock(&agg->lock);
+    if(agg->emitSeq != agg->nextSeq) {
+        dueUs   = agg->seen[agg->emitSeq & (AGG_SEENSIZE-1)].firstUs + agg->windowUs;
+        timeout = (dueUs > nowUs) ? (int)((dueUs - nowUs + 999)/1000) : 0;
+    }
+    pthread_mutex_unlock(&agg->lock);
+    return timeout;
+}
+
+//called with the lock held
+static int FindGateway(pecwMBUSAgg agg, const char *id) {
+    int iX;
+
+    for(iX=0; iX<agg->gatewayCount; iX++)
+        if(0 == strcmp(agg->gateways[iX].id, id)) return iX;
+    if(agg->gatewayCount == AGG_MAXGATEWAYS) return -1;
+    memset(&agg->gateways[iX], 0, sizeof(ecwMBUSAggGateway));
+    snprintf(agg->gateways[iX].id, sizeof(agg->gateways[iX].id), "%s", id);
+    agg->gatewayCount++;
+    return iX;
+}
+
+static void CloseConn(pecwMBUSAgg agg, int index, bool error) {
+    pecwMBUSAggConn c = &agg->conns[index];
+
+    pthread_mutex_lock(&agg->lock);
+    if(c->gateway >= 0) {
+        agg->gateways[c->gateway].connections--;
+        if(error) agg->gateways[c->gateway].errors++;
+    }
+    pthread_mutex_unlock(&agg->lock);
+    close(c->fd);
+    free(c->in);
+    agg->connCount--;
+    if(index != agg->connCount)
+        agg->conns[index] = agg->conns[agg->connCount];
+}
+
+static void AcceptConns(pecwMBUSAgg agg) {
+    pecwMBUSAggConn c;
+    int             fd, one = 1;
+
+    while((fd = accept(agg->listenFd, NULL, NULL)) >= 0) {
+        if((agg->connCount == AGG_MAXCONN) || (SetNonBlocking(fd) != APIOK)) {
+            close(fd);
+            pthread_mutex_lock(&agg->lock);
+            agg->rejected++;
+            pthread_mutex_unlock(&agg->lock);
+            continue;
+        }
+        c = &agg->conns[agg->connCount];
+        if(NULL == (c->in = (uint8_t *) malloc(AGG_INSIZE))) {
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+        c->fd      = fd;
+        c->gateway = -1;
+        c->inLen   = 0;
+        agg->connCount++;
+    }
+}
+
+//the hello names the gateway, APIERROR closes the connection
+static int ParseHello(pecwMBUSAgg agg, pecwMBUSAggConn c, size_t *off) {
+    char id[FWD_MAXID + 1];
+    int  idLen;
+
+    if(c->inLen < FWD_HELLOSIZE) return APIOK;
+    idLen = c->in[5];
+    if((GetU32(c->in) != FWD_MAGIC) || (c->in[4] != FWD_VERSION) || (idLen == 0) || (idLen > FWD_MAXID))
+        return APIERROR;
+    if(c->inLen < (size_t)(FWD_HELLOSIZE + idLen)) return APIOK;
+    memcpy(id, c->in + FWD_HELLOSIZE, idLen);
+    id[idLen] = 0;
+
+    pthread_mutex_lock(&agg->lock);
+    c->gateway = FindGateway(agg, id);
+    if(c->gateway >= 0)
+        agg->gateways[c->gateway].connections++;
+    else
+        agg->rejected++;
+    pthread_mutex_unlock(&agg->lock);
+    *off = FWD_HELLOSIZE + idLen;
+    return (c->gateway >= 0) ? APIOK : APIERROR;
+}
+
+//complete records of the input buffer, a damaged record closes the connection
+static int ParseRecords(pecwMBUSAgg agg, pecwMBUSAggConn c, size_t off) {
+    ecwMBUSMeter meter;
+    ecMBUSData   data;
+    size_t       len;
+
+    while(c->inLen - off >= JNL_RECHEADERSIZE) {
+        const uint8_t *rec = c->in + off;
+
+        len = GetU16(rec);
+        if((len < JNL_READINGSIZE) || (JNL_RECHEADERSIZE + len > JNL_MAXRECORD)) return APIERROR;
+        if(c->inLen - off < JNL_RECHEADERSIZE + len) break;
+        if((Jnl_Crc32(rec + JNL_RECHEADERSIZE, len, 0) != GetU32(rec+4)) ||
+           (APIOK != Jnl_DecodeReading(rec + JNL_RECHEADERSIZE, len, NULL, &meter, &data)))
+            return APIERROR;
+
+        //a full pending ring hands on the oldest telegram before its window closed
+        pthread_mutex_lock(&agg->lock);
+        while(agg->nextSeq - agg->emitSeq >= AGG_MAXPENDING) {
+            agg->early++;
+            pthread_mutex_unlock(&agg->lock);
+            EmitOne(agg, true);
+            pthread_mutex_lock(&agg->lock);
+        }
+        Accept(agg, c->gateway, GetU16(rec+2) & FWD_UNREGISTERED, &meter, &data, Met_NowUs());
+        pthread_mutex_unlock(&agg->lock);
+        off += JNL_RECHEADERSIZE + len;
+    }
+    if(off > 0) {
+        memmove(c->in, c->in + off, c->inLen - off);
+        c->inLen -= off;
+    }
+    return APIOK;
+}
+
+//APIERROR when the connection is to be closed, error tells whether it broke the protocol
+static int ReadConn(pecwMBUSAgg agg, pecwMBUSAggConn c, bool *error) {
+    ssize_t n;
+    size_t  off = 0;
+
+    *error = false;
+    n = read(c->fd, c->in + c->inLen, AGG_INSIZE - c->inLen);
+    if(n == 0) return APIERROR;
+    if(n < 0) return ((errno == EAGAIN) || (errno == EINTR)) ? APIOK : APIERROR;
+    c->inLen += n;
+
+    if(c->gateway < 0) {
+        if(APIOK != ParseHello(agg, c, &off)) {
+            *error = true;
+            return APIERROR;
+        }
+        if(c->gateway < 0) return APIOK; //hello not complete yet
+    }
+    if(APIOK != ParseRecords(agg, c, off)) {
+        *error = true;
+        return APIERROR;
+    }
+    return APIOK;
+}
+
+static void *AggThread(void *arg) {
+    pecwMBUSAgg   agg = (pecwMBUSAgg) arg;
+    struct pollfd pfd[AGG_MAXCONN + 2];
+    char          drain[64];
+    bool          stop = false, error;
+    int           iX, n;
+
+    while(!stop) {
+        pfd[0].fd     = agg->wake[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd     = agg->listenFd;
+        pfd[1].events = POLLIN;
+        for(iX=0; iX<agg->connCount; iX++) {
+            pfd[iX+2].fd     = agg->conns[iX].fd;
+            pfd[iX+2].events = POLLIN;
+        }
+        n = agg->connCount;
+        if(poll(pfd, n + 2, NextTimeout(agg)) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        if(pfd[0].revents & POLLIN)
+            while(read(agg->wake[0], drain, sizeof(drain)) > 0)
+                ;
+        //backwards, closing moves the last connection into the gap
+        for(iX=n-1; iX>=0; iX--) {
+            if(0 == pfd[iX+2].revents) continue;
+            if(APIOK != ReadConn(agg, &agg->conns[iX], &error))
+                CloseConn(agg, iX, error);
+        }
+        if(pfd[1].revents & POLLIN)
+            AcceptConns(agg);
+
+        while(EmitOne(agg, false))
+            ;
+        pthread_mutex_lock(&agg->lock);
+        stop = agg->stop;
+        pthread_mutex_unlock(&agg->lock);
+    }
+
+    //what is still in its window goes on, nothing arrives any more
+    while(EmitOne(agg, true))
+        ;
+    return NULL;
+}
+
+//spec is [addr:]port
+int Agg_Open(pecwMBUSAgg agg, const char *spec, int windowMs, Agg_ReadingHandler handler, void *ctx) {
+    struct sockaddr_in addr;
+    const char        *port;
+    char               host[64];
+    int                one = 1;
+
+    if((NULL == agg) || (NULL == spec) || (NULL == handler) || (windowMs < 0)) return APIERROR;
+    memset(agg, 0, sizeof(ecwMBUSAgg));
+    agg->listenFd = -1;
+    agg->wake[0]  = agg->wake[1] = -1;
+    agg->handler  = handler;
+    agg->ctx      = ctx;
+    agg->windowUs = (uint64_t)windowMs*1000;
+    agg->nextSeq  = 1;
+    agg->emitSeq  = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(NULL == (port = strrchr(spec, ':'))) port = spec;
+    else {
+        size_t len = port - spec;
+        if(len >= sizeof(host)) return APIERROR;
+        memcpy(host, spec, len);
+        host[len] = 0;
+        if(inet_pton(AF_INET, host, &addr.sin_addr) != 1) return APIERROR;
+        port++;
+    }
+    if((atoi(port) <= 0) || (atoi(port) > 65535)) return APIERROR;
+    addr.sin_port = htons((uint16_t)atoi(port));
+
+    agg->seen    = (ecwMBUSAggSeen *) calloc(AGG_SEENSIZE, sizeof(ecwMBUSAggSeen));
+    agg->buckets = (uint64_t *) calloc(AGG_BUCKETS, sizeof(uint64_t));
+    agg->pending = (ecwMBUSAggPending *) calloc(AGG_MAXPENDING, sizeof(ecwMBUSAggPending));
+    if((NULL == agg->seen) || (NULL == agg->buckets) || (NULL == agg->pending))
+        goto fail;
+
+    if((agg->listenFd = socket(AF_INET, SOCK_STREAM, 0)) < 0) goto fail;
+    setsockopt(agg->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if((bind(agg->listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+       (listen(agg->listenFd, AGG_MAXCONN) != 0) || (SetNonBlocking(agg->listenFd) != APIOK))
+        goto fail;
+    if(pipe(agg->wake) != 0) goto fail;
+    SetNonBlocking(agg->wake[0]);
+    SetNonBlocking(agg->wake[1]);
+
+    FindGateway(agg, AGG_LOCAL);
+    pthread_mutex_init(&agg->lock, NULL);
+    if(0 != pthread_create(&agg->thread, NULL, AggThread, agg)) {
+        pthread_mutex_destroy(&agg->lock);
+        goto fail;
+    }
+    return APIOK;
+
+fail:
+    if(agg->listenFd >= 0) close(agg->listenFd);
+    if(agg->wake[0] >= 0) close(agg->wake[0]);
+    if(agg->wake[1] >= 0) close(agg->wake[1]);
+    free(agg->seen);
+    free(agg->buckets);
+    free(agg->pending);
+    memset(agg, 0, sizeof(ecwMBUSAgg));
+    return APIERROR;
+}
+
+//a reading of the local stick, called from the receiving thread
+void Agg_Submit(pecwMBUSAgg agg, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    bool first;
+
+    pthread_mutex_lock(&agg->lock);
+    if(agg->nextSeq - agg->emitSeq >= AGG_MAXPENDING) {
+        agg->dropped++;
+        pthread_mutex_unlock(&agg->lock);
+        return;
+    }
+    first = (agg->emitSeq == agg->nextSeq);
+    Accept(agg, 0, 0, meter, data, Met_NowUs());
+    pthread_mutex_unlock(&agg->lock);
+    if(first) Wake(agg); //the thread may wait without a timeout
+}
+
+void Agg_PrintStats(pecwMBUSAgg agg) {
+    int iX;
+
+    if((NULL == agg) || (NULL == agg->seen)) return;
+    pthread_mutex_lock(&agg->lock);
+    printf("Aggregator           : %lu telegrams, %lu pending, %lu handed on early, %lu dropped, %lu rejected\n",
+           agg->unique, (unsigned long)(agg->nextSeq - agg->emitSeq), agg->early, agg->dropped, agg->rejected);
+    for(iX=0; iX<agg->gatewayCount; iX++)
+        printf("  %-18s : %lu readings, %lu duplicates, %lu best, %lu errors, %d connected\n", agg->gateways[iX].id,
+               agg->gateways[iX].readings, agg->gateways[iX].duplicates, agg->gateways[iX].best,
+               agg->gateways[iX].errors, agg->gateways[iX].connections);
+    pthread_mutex_unlock(&agg->lock);
+}
+
+//hands on the pending telegrams before it returns
+void Agg_Close(pecwMBUSAgg agg) {
+    int iX;
+
+    if((NULL == agg) || (NULL == agg->seen)) return;
+    pthread_mutex_lock(&agg->lock);
+    agg->stop = true;
+    pthread_mutex_unlock(&agg->lock);
+    Wake(agg);
+    pthread_join(agg->thread, NULL);
+
+    for(iX=0; iX<agg->connCount; iX++) {
+        close(agg->conns[iX].fd);
+        free(agg->conns[iX].in);
+    }
+    close(agg->listenFd);
+    close(agg->wake[0]);
+    close(agg->wake[1]);
+    pthread_mutex_destroy(&agg->lock);
+    free(agg->seen);
+    free(agg->buckets);
+    free(agg->pending);
+    memset(agg, 0, sizeof(ecwMBUSAgg));
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusconf.h>
+
+typedef struct _CONF_KEY {
+    const char *key;
+    char        option;
+    bool        flag;                   // yes/no, the option has no argument
+} ConfKey;
+
+static const ConfKey ConfKeys[] = {
+    { "port",         'p', false },
+    { "mode",         'm', false },
+    { "datapath",     'f', false },
+    { "template",     'o', false },
+    { "maxopen",      'n', false },
+    { "logmode",      'l', false },
+    { "depth",        'd', false },
+    { "journal",      'j', false },
+    { "commitwindow", 'w', false },
+    { "seglog",       's', false },
+    { "stream",       'S', false },
+    { "mqtt",         'M', false },
+    { "emoncms",      'E', false },
+    { "json",         'J', false },
+    { "latest",       'L', false },
+    { "control",      'C', false },
+    { "metrics",      'P', false },
+    { "queues",       'Q', false },
+    { "forward",      'F', false },
+    { "aggregate",    'A', false },
+    { "daemon",       'D', true  },
+    { "details",      'i', true  },
+    { "dashboard",    'T', true  },
+    { "loglevel",     'v', false },
+    { "logtarget",    'V', false },
+    { NULL,           0,   false }
+};
+
+static bool ParseHex(const char *s, int digits, uint32_t *v) {
+    char *end;
+
+    if((NULL == s) || (strlen(s) == 0) || (strlen(s) > (size_t)digits)) return false;
+    *v = (uint32_t) strtoul(s, &end, 16);
+    return (*end == 0);
+}
+
+static char *Trim(char *s) {
+    char *end;
+
+    while(isspace((unsigned char)*s)) s++;
+    end = s + strlen(s);
+    while((end > s) && isspace((unsigned char)end[-1])) end--;
+    *end = 0;
+    return s;
+}
+
+int Conf_ParseMeter(int argc, char *argv[], pecwMBUSMeter meter, char *err, size_t errSize) {
+    char     byte[3] = { 0, 0, 0 };
+    uint32_t v;
+    int      iK;
+
+    memset(meter, 0, sizeof(ecwMBUSMeter));
+    if((argc < 4) || (argc > 5)) { snprintf(err, errSize, "manid ident type version [key|default|zero]"); return APIERROR; }
+    if(!ParseHex(argv[0], 4, &v) || (v == 0)) { snprintf(err, errSize, "invalid manid"); return APIERROR; }
+    meter->manufacturerID = (uint16_t) v;
+    if(!ParseHex(argv[1], 8, &v)) { snprintf(err, errSize, "invalid ident"); return APIERROR; }
+    meter->ident = v;
+    if(!ParseHex(argv[2], 2, &v)) { snprintf(err, errSize, "invalid type"); return APIERROR; }
+    meter->type = (uint8_t) v;
+    if(!ParseHex(argv[3], 2, &v)) { snprintf(err, errSize, "invalid version"); return APIERROR; }
+    meter->version = (uint8_t) v;
+
+    if((argc == 4) || (0 == strcmp(argv[4], "default"))) {
+        for(iK = 0; iK<AES_KEYLENGHT_IN_BYTES; iK++)
+            meter->key[iK] = (uint8_t)(0x1C + 3*iK);
+    }
+    else if(0 != strcmp(argv[4], "zero")) {
+        if(strlen(argv[4]) != 2*AES_KEYLENGHT_IN_BYTES) { snprintf(err, errSize, "the key has %d hex digits", 2*AES_KEYLENGHT_IN_BYTES); return APIERROR; }
+        for(iK = 0; iK<AES_KEYLENGHT_IN_BYTES; iK++) {
+            byte[0] = argv[4][2*iK];
+            byte[1] = argv[4][2*iK+1];
+            if(!ParseHex(byte, 2, &v)) { snprintf(err, errSize, "invalid key"); return APIERROR; }
+            meter->key[iK] = (uint8_t) v;
+        }
+    }
+    return APIOK;
+}
+
+static int AddMeter(pecwMBUSConf conf, char *value, char *err, size_t errSize) {
+    char *args[6], *save = NULL, *tok;
+    int   argc = 0, iX;
+
+    for(tok = strtok_r(value, " \t", &save); (NULL != tok) && (argc < 6); tok = strtok_r(NULL, " \t", &save))
+        args[argc++] = tok;
+    if(conf->meterCount >= MAXMETER) { snprintf(err, errSize, "more than %d meters", MAXMETER); return APIERROR; }
+    if(APIOK != Conf_ParseMeter(argc, args, &conf->meters[conf->meterCount], err, errSize)) return APIERROR;
+    for(iX=0; iX<conf->meterCount; iX++) {
+        if((conf->meters[iX].manufacturerID == conf->meters[conf->meterCount].manufacturerID) &&
+           (conf->meters[iX].ident == conf->meters[conf->meterCount].ident)) {
+            snprintf(err, errSize, "meter listed twice");
+            return APIERROR;
+        }
+    }
+    conf->meterCount++;
+    return APIOK;
+}
+
+static int AddOption(pecwMBUSConf conf, const ConfKey *key, const char *value, char *err, size_t errSize) {
+    char opt[3] = { '-', key->option, 0 };
+
+    if(conf->argc + 2 >= (int)(sizeof(conf->argv)/sizeof(conf->argv[0]))) { snprintf(err, errSize, "too many settings"); return APIERROR; }
+    if(key->flag) {
+        if((0 == strcmp(value, "no")) || (0 == strcmp(value, "0")) || (0 == strcmp(value, "false"))) return APIOK;
+        if((0 != strcmp(value, "yes")) && (0 != strcmp(value, "1")) && (0 != strcmp(value, "true"))) { snprintf(err, errSize, "yes or no"); return APIERROR; }
+        conf->argv[conf->argc++] = strdup(opt);
+        return APIOK;
+    }
+    if(0 == *value) { snprintf(err, errSize, "value missing"); return APIERROR; }
+    conf->argv[conf->argc++] = strdup(opt);
+    conf->argv[conf->argc++] = strdup(value);
+    return APIOK;
+}
+
+//reads the file into options and meters, APIERROR after printing file:line and the reason
+int Conf_Load(pecwMBUSConf conf, const char *path, const char *prog) {
+    FILE *hFile;
+    char  line[CONF_MAXLINE], err[128];
+    char *key, *value, *p;
+    int   lineNo = 0, iX;
+    int   ret = APIOK;
+
+    if((NULL == conf) || (NULL == path)) return APIERROR;
+    memset(conf, 0, sizeof(ecwMBUSConf));
+    conf->argv[conf->argc++] = strdup((NULL != prog) ? prog : "eccwmbus");
+
+    if(NULL == (hFile = fopen(path, "r"))) {
+        fprintf(stderr, "Cannot open >%s<\n", path);
+        return APIERROR;
+    }
+    while((APIOK == ret) && (NULL != fgets(line, sizeof(line), hFile))) {
+        lineNo++;
+        err[0] = 0;
+        if(NULL != (p = strchr(line, '#'))) *p = 0;
+        key = Trim(line);
+        if(0 == *key) continue;
+        if(NULL == (p = strchr(key, '='))) {
+            snprintf(err, sizeof(err), "key = value expected");
+            ret = APIERROR;
+            break;
+        }
+        *p    = 0;
+        key   = Trim(key);
+        value = Trim(p+1);
+
+        if(0 == strcmp(key, "meter")) {
+            ret = AddMeter(conf, value, err, sizeof(err));
+            continue;
+        }
+        for(iX=0; (NULL != ConfKeys[iX].key) && (0 != strcmp(ConfKeys[iX].key, key)); iX++)
+            ;
+        if(NULL == ConfKeys[iX].key) {
+            snprintf(err, sizeof(err), "unknown key %s", key);
+            ret = APIERROR;
+            break;
+        }
+        ret = AddOption(conf, &ConfKeys[iX], value, err, sizeof(err));
+    }
+    fclose(hFile);
+    conf->argv[conf->argc] = NULL;
+    if(APIOK != ret) {
+        fprintf(stderr, "%s:%d: %s\n", path, lineNo, err);
+        Conf_Free(conf);
+    }
+    return ret;
+}
+
+void Conf_Free(pecwMBUSConf conf) {
+    int iX;
+
+    if(NULL == conf) return;
+    for(iX=0; iX<conf->argc; iX++)
+        free(conf->argv[iX]);
+    conf->argc = 0;
+    conf->argv[0] = NULL;
+}
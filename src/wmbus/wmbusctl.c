@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusctl.h>
+
+static int SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) ? APIERROR : APIOK;
+}
+
+//the epoll set waits for what Ctl_Poll waits for, a request or room for the response
+static void Watch(pecwMBUSCtl ctl, int fd, bool out, int op) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = out ? EPOLLOUT : EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(ctl->epfd, op, fd, &ev);
+}
+
+//append to the reply, output beyond CTL_MAXREPLY is cut off
+void Ctl_Printf(pecwMBUSCtlReply reply, const char *fmt, ...) {
+    va_list ap;
+    int     n;
+
+    for(;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(reply->buf + reply->len, reply->size - reply->len, fmt, ap);
+        va_end(ap);
+        if(n < 0) return;
+        if(reply->len + n < reply->size) {
+            reply->len += n;
+            return;
+        }
+        if(reply->size >= CTL_MAXREPLY) {
+            reply->len = reply->size - 1;
+            return;
+        }
+        char *p = (char *) realloc(reply->buf, min(2*reply->size + n, (size_t)CTL_MAXREPLY));
+        if(NULL == p) return;
+        reply->buf  = p;
+        reply->size = min(2*reply->size + n, (size_t)CTL_MAXREPLY);
+    }
+}
+
+int Ctl_Open(pecwMBUSCtl ctl, const char *path, Ctl_Handler handler, void *ctx) {
+    struct sockaddr_un addr;
+
+    if((NULL == ctl) || (NULL == path) || (NULL == handler)) return APIERROR;
+    memset(ctl, 0, sizeof(ecwMBUSCtl));
+    ctl->fd      = -1;
+    ctl->epfd    = -1;
+    ctl->handler = handler;
+    ctl->ctx     = ctx;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if((strlen(path) == 0) || (strlen(path) >= sizeof(addr.sun_path))) return APIERROR;
+    strcpy(addr.sun_path, path);
+
+    if((ctl->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return APIERROR;
+    unlink(path); //left over from a crash
+    if((bind(ctl->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(ctl->fd, 8) != 0) ||
+       (SetNonBlocking(ctl->fd) != APIOK)) {
+        close(ctl->fd);
+        ctl->fd = -1;
+        return APIERROR;
+    }
+    if((ctl->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        close(ctl->fd);
+        ctl->fd = -1;
+        unlink(path);
+        return APIERROR;
+    }
+    Watch(ctl, ctl->fd, false, EPOLL_CTL_ADD);
+    chmod(path, 0660); //meters and keys can be changed, owner and group only
+    strcpy(ctl->path, path);
+    return APIOK;
+}
+
+static void CloseClient(pecwMBUSCtl ctl, int index) {
+    pecwMBUSCtlClient c = &ctl->clients[index];
+
+    close(c->fd);
+    free(c->out);
+    ctl->clientCount--;
+    if(index != ctl->clientCount)
+        ctl->clients[index] = ctl->clients[ctl->clientCount];
+}
+
+static int NewReply(pecwMBUSCtlReply reply) {
+    memset(reply, 0, sizeof(ecwMBUSCtlReply));
+    reply->size = 1024;
+    return (NULL == (reply->buf = (char *) malloc(reply->size))) ? APIERROR : APIOK;
+}
+
+//split the request line and build the response
+static void Dispatch(pecwMBUSCtl ctl, pecwMBUSCtlClient c, char *line) {
+    ecwMBUSCtlReply body, out;
+    char           *argv[CTL_MAXARGS];
+    char           *save = NULL;
+    char           *tok;
+    int             argc = 0;
+    int             ret  = APIERROR;
+
+    for(tok = strtok_r(line, " \t\r", &save); (NULL != tok) && (argc < CTL_MAXARGS); tok = strtok_r(NULL, " \t\r", &save))
+        argv[argc++] = tok;
+
+    if(NewReply(&body) != APIOK) return;
+    if(NewReply(&out) != APIOK) {
+        free(body.buf);
+        return;
+    }
+    body.buf[0] = 0;
+    if(argc == 0)
+        Ctl_Printf(&body, "empty request");
+    else
+        ret = ctl->handler(ctl->ctx, argc, argv, &body);
+
+    if(ret == APIOK) {
+        Ctl_Printf(&out, "OK\n%s", body.buf);
+        if((body.len > 0) && (body.buf[body.len-1] != '\n'))
+            Ctl_Printf(&out, "\n");
+    }
+    else {
+        body.buf[strcspn(body.buf, "\n")] = 0; //the message is one line
+        Ctl_Printf(&out, "ERR %s\n", body.buf);
+    }
+    Ctl_Printf(&out, "\n");
+    free(body.buf);
+    ctl->requests++;
+    c->out    = out.buf;
+    c->outLen = out.len;
+    c->outPos = 0;
+}
+
+//returns APIERROR when the client is gone
+static int Serve(pecwMBUSCtl ctl, pecwMBUSCtlClient c, short revents) {
+    ssize_t n;
+    char   *nl;
+
+    if((revents & (POLLHUP | POLLERR)) && (NULL != c->out)) return APIERROR;
+    if(revents & POLLOUT) {
+        while(c->outPos < c->outLen) {
+            if((n = send(c->fd, c->out + c->outPos, c->outLen - c->outPos, MSG_NOSIGNAL)) < 0) {
+                if((errno == EAGAIN) || (errno == EWOULDBLOCK)) return APIOK;
+                return APIERROR;
+            }
+            c->outPos += n;
+        }
+        free(c->out);
+        c->out = NULL;
+        c->outLen = c->outPos = 0;
+    }
+    if((revents & (POLLIN | POLLHUP | POLLERR)) && (NULL == c->out)) {
+        n = recv(c->fd, c->in + c->inLen, sizeof(c->in) - 1 - c->inLen, 0);
+        if(n == 0) return APIERROR;
+        if(n < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? APIOK : APIERROR;
+        c->inLen += n;
+        c->in[c->inLen] = 0;
+    }
+    //one request at a time, the next one is taken once the response is sent
+    if((NULL == c->out) && (NULL != (nl = strchr(c->in, '\n')))) {
+        *nl = 0;
+        Dispatch(ctl, c, c->in);
+        c->inLen -= (nl + 1) - c->in;
+        memmove(c->in, nl + 1, c->inLen + 1);
+        return Serve(ctl, c, POLLOUT);
+    }
+    if(c->inLen >= sizeof(c->in) - 1) return APIERROR; //request too long
+    return APIOK;
+}
+
+//wait up to timeoutMs for requests and answer them
+int Ctl_Poll(pecwMBUSCtl ctl, int timeoutMs) {
+    struct pollfd     pfd[1 + CTL_MAXCLIENTS];
+    pecwMBUSCtlClient c;
+    int               count, iX, fd;
+
+    if((NULL == ctl) || (ctl->fd < 0)) return APIERROR;
+    pfd[0].fd = ctl->fd;
+    pfd[0].events = POLLIN;
+    count = ctl->clientCount;
+    for(iX=0; iX<count; iX++) {
+        pfd[1+iX].fd = ctl->clients[iX].fd;
+        pfd[1+iX].events = (NULL != ctl->clients[iX].out) ? POLLOUT : POLLIN;
+    }
+    if(poll(pfd, 1 + count, timeoutMs) <= 0) return APIOK;
+
+    //backwards, CloseClient moves the last client into the freed place
+    for(iX=count-1; iX>=0; iX--) {
+        if(pfd[1+iX].revents == 0) continue;
+        if(Serve(ctl, &ctl->clients[iX], pfd[1+iX].revents) != APIOK)
+            CloseClient(ctl, iX);
+        else if((pfd[1+iX].events == POLLOUT) != (NULL != ctl->clients[iX].out))
+            Watch(ctl, ctl->clients[iX].fd, NULL != ctl->clients[iX].out, EPOLL_CTL_MOD);
+    }
+    if(pfd[0].revents & POLLIN) {
+        while((fd = accept(ctl->fd, NULL, NULL)) >= 0) {
+            if((ctl->clientCount >= CTL_MAXCLIENTS) || (SetNonBlocking(fd) != APIOK)) {
+                close(fd);
+                continue;
+            }
+            c = &ctl->clients[ctl->clientCount++];
+            memset(c, 0, sizeof(ecwMBUSCtlClient));
+            c->fd = fd;
+            Watch(ctl, fd, false, EPOLL_CTL_ADD);
+        }
+    }
+    return APIOK;
+}
+
+int Ctl_GetFd(pecwMBUSCtl ctl) {
+    return (NULL == ctl) ? -1 : ctl->epfd;
+}
+
+void Ctl_Close(pecwMBUSCtl ctl) {
+    if((NULL == ctl) || (ctl->fd < 0)) return;
+    while(ctl->clientCount > 0)
+        CloseClient(ctl, ctl->clientCount-1);
+    close(ctl->fd);
+    close(ctl->epfd);
+    ctl->fd   = -1;
+    ctl->epfd = -1;
+    unlink(ctl->path);
+}
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusfmt.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusdash.h>
+
+#define SGR_NORMAL      0
+#define SGR_BOLD        1
+#define SGR_REVERSE     7
+#define SGR_RED         31
+#define SGR_GREEN       32
+#define SGR_YELLOW      33
+
+#define RUN_GAP         6               // equal cells between two changes written over instead of a cursor move
+
+//columns of the meter rows
+#define COL_SLOT        0
+#define COL_MANID       4
+#define COL_IDENT       10
+#define COL_VALUE       19              // right aligned
+#define WID_VALUE       16
+#define COL_UNIT        36
+#define COL_AGE         42              // right aligned
+#define WID_AGE         7
+#define COL_RSSI        50              // right aligned
+#define WID_RSSI        8
+#define COL_ACCNO       59              // right aligned
+#define WID_ACCNO       5
+#define COL_DECRYPT     66
+#define COL_RATE        77              // right aligned
+#define WID_RATE        6
+
+static const char Header[] = " #  Manuf Ident               Value Unit      Age RSSI dBm AccNo  Decryption Rate/h";
+static const char Keys[]   = " q quit  d scrolling view  a r l x leave the dashboard";
+
+static uint64_t NowMs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static void WriteAll(const char *p, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        if((n = write(STDOUT_FILENO, p, len)) < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        p   += n;
+        len -= n;
+    }
+}
+
+//text into the cells, cut at the edge of the screen
+static void Put(pecwMBUSDash dash, int row, int col, const char *text, int len, uint8_t attr) {
+    if((row < 0) || (row >= dash->height) || (col >= dash->width)) return;
+    if(col + len > dash->width) len = dash->width - col;
+    memcpy(&dash->cells[row][col], text, len);
+    memset(&dash->attrs[row][col], attr, len);
+}
+
+static void PutRight(pecwMBUSDash dash, int row, int col, int width, const char *text, int len, uint8_t attr) {
+    Put(dash, row, (len < width) ? col + width - len : col, text, len, attr);
+}
+
+static void PutString(pecwMBUSDash dash, int row, int col, const char *text, uint8_t attr) {
+    Put(dash, row, col, text, strlen(text), attr);
+}
+
+static void Highlight(pecwMBUSDash dash, int row, uint8_t attr) {
+    if((row >= 0) && (row < dash->height)) memset(dash->attrs[row], attr, dash->width);
+}
+
+//4s, 12m05s, 3h20m, 2d
+static int FmtAge(char *p, uint64_t ms) {
+    uint32_t s = (uint32_t)(ms/1000);
+    int      len;
+
+    if(s < 60) {
+        len = Fmt_U32(p, s);
+        p[len++] = 's';
+    }
+    else if(s < 3600) {
+        len = Fmt_U32(p, s/60);
+        p[len++] = 'm';
+        p[len++] = '0' + (s%60)/10;
+        p[len++] = '0' + (s%60)%10;
+        p[len++] = 's';
+    }
+    else if(s < 100*3600) {
+        len = Fmt_U32(p, s/3600);
+        p[len++] = 'h';
+        p[len++] = '0' + ((s%3600)/60)/10;
+        p[len++] = '0' + ((s%3600)/60)%10;
+        p[len++] = 'm';
+    }
+    else {
+        len = Fmt_U32(p, s/86400);
+        p[len++] = 'd';
+    }
+    return len;
+}
+
+static bool SameMeter(const ecwMBUSMeter *a, const ecwMBUSMeter *b) {
+    return (a->manufacturerID == b->manufacturerID) && (a->ident == b->ident);
+}
+
+static void DrawMeter(pecwMBUSDash dash, int row, int slot, uint64_t now) {
+    ecwMBUSDashRow *r = &dash->rows[slot];
+    const char     *decrypt = "";
+    char            text[FMT_MAXVALUE];
+    uint8_t         attr = SGR_NORMAL;
+    int             len;
+
+    if(r->readings > 0) {
+        if((r->data.pktInfo & PACKET_DECRYPTIONERROR) == PACKET_DECRYPTIONERROR) {
+            decrypt = "ERROR";
+            attr    = SGR_RED;
+        }
+        else if((r->data.pktInfo & PACKET_WAS_ENCRYPTED) == PACKET_WAS_ENCRYPTED)         decrypt = "OK";
+        else if((r->data.pktInfo & PACKET_WAS_NOT_ENCRYPTED) == PACKET_WAS_NOT_ENCRYPTED) decrypt = "none";
+        else if((r->data.pktInfo & PACKET_IS_ENCRYPTED) == PACKET_IS_ENCRYPTED)           decrypt = "encrypted";
+        else                                                                              decrypt = "";
+        if((SGR_NORMAL == attr) && (now - r->lastMs < DASH_FRESHMS)) attr = SGR_GREEN;
+    }
+
+    len = Fmt_U32(text, slot+1);
+    PutRight(dash, row, COL_SLOT, 2, text, len, attr);
+    len = Fmt_Hex(text, r->meter.manufacturerID, 4);
+    Put(dash, row, COL_MANID, text, len, attr);
+    len = Fmt_Hex(text, r->meter.ident, 8);
+    Put(dash, row, COL_IDENT, text, len, attr);
+    PutString(dash, row, COL_UNIT, Fmt_Unit(r->meter.type), attr);
+    if(0 == r->readings) {
+        PutRight(dash, row, COL_VALUE, WID_VALUE, "-", 1, attr);
+        return;
+    }
+    len = Fmt_Value(text, r->data.value, r->data.exp);
+    PutRight(dash, row, COL_VALUE, WID_VALUE, text, len, attr);
+    len = FmtAge(text, now - r->lastMs);
+    PutRight(dash, row, COL_AGE, WID_AGE, text, len, attr);
+    len = Fmt_I32(text, r->data.rssiDBm);
+    PutRight(dash, row, COL_RSSI, WID_RSSI, text, len, attr);
+    len = Fmt_U32(text, r->data.accNo);
+    PutRight(dash, row, COL_ACCNO, WID_ACCNO, text, len, attr);
+    PutString(dash, row, COL_DECRYPT, decrypt, attr);
+    if((r->readings > 1) && (r->avgMs > 0)) {
+        len = Fmt_U32(text, (3600000 + r->avgMs/2)/r->avgMs);
+        PutRight(dash, row, COL_RATE, WID_RATE, text, len, attr);
+    }
+}
+
+//the whole screen into the cells
+static void Render(pecwMBUSDash dash, int count, uint64_t now) {
+    char          text[DASH_MAXCOLS];
+    time_t        t = time(NULL);
+    struct tm     tm;
+    unsigned long readings = 0;
+    int           row, iX, len;
+
+    for(row=0; row<dash->height; row++) {
+        memset(dash->cells[row], ' ', dash->width);
+        memset(dash->attrs[row], SGR_NORMAL, dash->width);
+    }
+
+    for(iX=0; iX<count; iX++)
+        readings += dash->rows[iX].readings;
+    localtime_r(&t, &tm);
+    len = strftime(text, sizeof(text), "%H:%M:%S  ", &tm);
+    len += Fmt_U32(text+len, (uint32_t)readings);
+    memcpy(text+len, " readings", 9); len += 9;
+    Highlight(dash, 0, SGR_REVERSE);
+    PutString(dash, 0, 1, dash->title, SGR_REVERSE);
+    PutRight(dash, 0, 0, dash->width - 1, text, len, SGR_REVERSE);
+    PutString(dash, 1, 0, Header, SGR_BOLD);
+
+    row = 2;
+    for(iX=0; iX<count; iX++) {
+        if(0 == dash->rows[iX].meter.manufacturerID) continue;
+        DrawMeter(dash, row++, iX, now);
+    }
+
+    row++;
+    pthread_mutex_lock(&dash->lock);
+    for(iX=0; iX<DASH_LOGLINES; iX++) {
+        int line = (dash->logNext + iX) % DASH_LOGLINES;
+        if(0 == dash->log[line][0]) continue;
+        PutString(dash, row++, 0, dash->log[line],
+                  (dash->logLevels[line] <= LOGLVL_ERROR) ? SGR_RED : (dash->logLevels[line] == LOGLVL_WARN) ? SGR_YELLOW : SGR_NORMAL);
+    }
+    pthread_mutex_unlock(&dash->lock);
+
+    PutString(dash, dash->height - 1, 0, Keys, SGR_NORMAL);
+}
+
+static int PutSGR(char *p, uint8_t attr) {
+    int len = 0;
+
+    memcpy(p, "\x1b[0;", 4); len += 4;
+    len += Fmt_U32(p+len, attr);
+    p[len++] = 'm';
+    return len;
+}
+
+//the cells that differ from the terminal, a run of changes gets one cursor move
+static size_t Diff(pecwMBUSDash dash, char *out) {
+    size_t  len = 0;
+    uint8_t attr = SGR_NORMAL;
+    int     row, col, end, iX;
+
+    for(row=0; row<dash->height; row++) {
+        for(col=0; col<dash->width; col++) {
+            if((dash->cells[row][col] == dash->shownCells[row][col]) && (dash->attrs[row][col] == dash->shownAttrs[row][col]))
+                continue;
+            end = col + 1;
+            for(iX=col+1; (iX<dash->width) && (iX-end < RUN_GAP); iX++)
+                if((dash->cells[row][iX] != dash->shownCells[row][iX]) || (dash->attrs[row][iX] != dash->shownAttrs[row][iX]))
+                    end = iX + 1;
+
+            out[len++] = 0x1B;
+            out[len++] = '[';
+            len += Fmt_U32(out+len, row+1);
+            out[len++] = ';';
+            len += Fmt_U32(out+len, col+1);
+            out[len++] = 'H';
+            for(; col<end; col++) {
+                if(dash->attrs[row][col] != attr) {
+                    attr = dash->attrs[row][col];
+                    len += PutSGR(out+len, attr);
+                }
+                out[len++] = dash->cells[row][col];
+                dash->shownCells[row][col] = dash->cells[row][col];
+                dash->shownAttrs[row][col] = attr;
+            }
+            col = end - 1;
+        }
+    }
+    if(SGR_NORMAL != attr)
+        len += PutSGR(out+len, SGR_NORMAL);
+    return len;
+}
+
+//log messages for stdout, from the log thread
+static void OnLog(void *ctx, int cat, int lvl, const char *text) {
+    pecwMBUSDash dash = (pecwMBUSDash) ctx;
+    char        *line;
+    int          len, iX;
+
+    pthread_mutex_lock(&dash->lock);
+    line = dash->log[dash->logNext];
+    len  = snprintf(line, DASH_MAXCOLS, " %-6s %s", Log_CategoryName(cat), text);
+    if(len >= DASH_MAXCOLS) len = DASH_MAXCOLS - 1;
+    for(iX=0; iX<len; iX++)
+        if((line[iX] < ' ') || (line[iX] > '~')) line[iX] = ' ';
+    dash->logLevels[dash->logNext] = (uint8_t)lvl;
+    dash->logNext = (dash->logNext + 1) % DASH_LOGLINES;
+    pthread_mutex_unlock(&dash->lock);
+}
+
+int Dash_Init(pecwMBUSDash dash, const char *title) {
+    memset(dash, 0, sizeof(ecwMBUSDash));
+    snprintf(dash->title, sizeof(dash->title), "%s", title);
+    if(0 != pthread_mutex_init(&dash->lock, NULL)) return APIERROR;
+    return APIOK;
+}
+
+void Dash_Free(pecwMBUSDash dash) {
+    Dash_Show(dash, false);
+    pthread_mutex_destroy(&dash->lock);
+}
+
+void Dash_Resize(pecwMBUSDash dash) {
+    struct winsize ws;
+
+    dash->width  = 80;
+    dash->height = 24;
+    if((0 == ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)) && (ws.ws_col > 0) && (ws.ws_row > 0)) {
+        dash->width  = min(ws.ws_col, DASH_MAXCOLS);
+        dash->height = min(ws.ws_row, DASH_MAXROWS);
+    }
+    //nothing on the screen is known any more, the next draw writes every cell
+    memset(dash->shownCells, 0, sizeof(dash->shownCells));
+    if(dash->shown) WriteAll("\x1b[2J", 4);
+}
+
+int Dash_Show(pecwMBUSDash dash, bool on) {
+    static const char Enter[] = "\x1b[?1049h\x1b[?25l\x1b[2J";
+    static const char Leave[] = "\x1b[0m\x1b[?25h\x1b[?1049l";
+
+    if(on == dash->shown) return APIOK;
+    if(on) {
+        if(!isatty(STDOUT_FILENO)) return APIERROR;
+        fflush(stdout);
+        WriteAll(Enter, sizeof(Enter)-1);
+        dash->shown = true;
+        Dash_Resize(dash);
+        //one line per frame would push the other messages out
+        dash->frameLevel = Log_Levels[LOGCAT_FRAME];
+        if(Log_Enabled(LOGCAT_FRAME, LOGLVL_INFO)) Log_SetLevel(LOGCAT_FRAME, LOGLVL_WARN);
+        Log_RegisterHandler(OnLog, dash);
+    }
+    else {
+        Log_RegisterHandler(NULL, NULL);
+        if((LOGLVL_WARN == Log_Levels[LOGCAT_FRAME]) && (dash->frameLevel > LOGLVL_WARN)) //unless changed meanwhile
+            Log_SetLevel(LOGCAT_FRAME, dash->frameLevel);
+        WriteAll(Leave, sizeof(Leave)-1);
+        dash->shown = false;
+    }
+    return APIOK;
+}
+
+//called for every reading, only the row data changes
+void Dash_Update(pecwMBUSDash dash, int slot, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    ecwMBUSDashRow *r;
+    uint32_t        interval;
+
+    if((slot < 0) || (slot >= MAXMETER)) return;
+    r = &dash->rows[slot];
+    if(!SameMeter(&r->meter, meter)) {
+        memset(r, 0, sizeof(ecwMBUSDashRow));
+        r->meter = *meter;
+    }
+    //the rate from the reception times, readings the main loop took late do not count as a burst
+    if((r->readings > 0) && (data->time > r->data.time)) {
+        interval = (data->time - r->data.time)*1000;
+        r->avgMs = (0 == r->avgMs) ? interval : (7*r->avgMs + interval)/8;
+    }
+    r->data   = *data;
+    r->lastMs = NowMs();
+    r->readings++;
+}
+
+//at most every DASH_INTERVALMS, writes nothing when no cell changed
+void Dash_Draw(pecwMBUSDash dash, const ecwMBUSMeter *meters, int count) {
+    char   out[DASH_MAXROWS*DASH_MAXCOLS*10];
+    size_t len;
+    int    iX;
+
+    if(!dash->shown) return;
+    if(count > MAXMETER) count = MAXMETER;
+    for(iX=0; iX<count; iX++) {
+        if(SameMeter(&dash->rows[iX].meter, &meters[iX])) {
+            dash->rows[iX].meter = meters[iX];
+            continue;
+        }
+        memset(&dash->rows[iX], 0, sizeof(ecwMBUSDashRow));
+        dash->rows[iX].meter = meters[iX];
+    }
+    for(; iX<MAXMETER; iX++)
+        memset(&dash->rows[iX], 0, sizeof(ecwMBUSDashRow));
+
+    Render(dash, count, NowMs());
+    if((len = Diff(dash, out)) > 0) {
+        WriteAll(out, len);
+        dash->bytes += len;
+    }
+    dash->draws++;
+}
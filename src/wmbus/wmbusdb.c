@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusdb.h>
+#include <wmbus/wmbusconf.h>
+#include <wmbus/wmbusle.h>
+
+#define DB_MAXCSVLINE 256
+
+static inline uint64_t Key(uint16_t manid, uint32_t ident) {
+    return ((uint64_t)manid<<32) | ident;
+}
+
+static inline size_t RecordOffset(uint32_t index) {
+    return DB_HEADERSIZE + (size_t)index*DB_RECORDSIZE;
+}
+
+static void EncodeRecord(uint8_t *p, const ecwMBUSDbRec *rec) {
+    memset(p, 0, DB_RECORDSIZE);
+    PutU16(p,   rec->meter.manufacturerID);
+    PutU32(p+2, rec->meter.ident);
+    p[6] = rec->meter.type;
+    p[7] = rec->meter.version;
+    p[8] = rec->slot;
+    memcpy(p+10, rec->meter.key, AES_KEYLENGHT_IN_BYTES);
+    memcpy(p+26, rec->label, strnlen(rec->label, DB_MAXLABEL));
+}
+
+static void DecodeRecord(const uint8_t *p, pecwMBUSDbRec rec) {
+    memset(rec, 0, sizeof(ecwMBUSDbRec));
+    rec->meter.manufacturerID = GetU16(p);
+    rec->meter.ident          = GetU32(p+2);
+    rec->meter.type           = p[6];
+    rec->meter.version        = p[7];
+    rec->slot                 = p[8];
+    memcpy(rec->meter.key, p+10, AES_KEYLENGHT_IN_BYTES);
+    memcpy(rec->label, p+26, DB_MAXLABEL);
+}
+
+static inline uint64_t RecordKey(const ecwMBUSDb *db, uint32_t index) {
+    const uint8_t *p = db->map + RecordOffset(index);
+    return Key(GetU16(p), GetU32(p+2));
+}
+
+//first record with a key not below key
+static uint32_t LowerBound(const ecwMBUSDb *db, uint64_t key) {
+    uint32_t lo = 0, hi = db->count, mid;
+
+    while(lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if(RecordKey(db, mid) < key) lo = mid + 1;
+        else                         hi = mid;
+    }
+    return lo;
+}
+
+static void Unmap(pecwMBUSDb db) {
+    if(NULL != db->map) munmap((void *)db->map, db->mapSize);
+    if(db->fd >= 0)     close(db->fd);
+    db->map     = NULL;
+    db->mapSize = 0;
+    db->fd      = -1;
+    db->count   = 0;
+}
+
+static int Map(pecwMBUSDb db) {
+    struct stat st;
+    uint32_t    count;
+
+    if((db->fd = open(db->path, O_RDONLY)) < 0)
+        return (ENOENT == errno) ? APIOK : APIERROR; //empty until the first change
+    if((fstat(db->fd, &st) != 0) || (st.st_size < DB_HEADERSIZE)) {
+        Unmap(db);
+        return APIERROR;
+    }
+    db->mapSize = (size_t)st.st_size;
+    db->map = (const uint8_t *) mmap(NULL, db->mapSize, PROT_READ, MAP_SHARED, db->fd, 0);
+    if(MAP_FAILED == (void *)db->map) {
+        db->map = NULL;
+        Unmap(db);
+        return APIERROR;
+    }
+    count = GetU32(db->map+8);
+    if((GetU32(db->map) != DB_MAGIC) || (GetU16(db->map+4) != DB_VERSION) || (GetU16(db->map+6) != DB_RECORDSIZE) ||
+       (RecordOffset(count) > db->mapSize)) {
+        Unmap(db);
+        return APIERROR;
+    }
+    db->count = count;
+    return APIOK;
+}
+
+//maps the file again if another process renamed a new one over it, before every change
+static int Refresh(pecwMBUSDb db) {
+    struct stat now, mapped;
+
+    if(stat(db->path, &now) != 0) return (db->fd < 0) ? APIOK : APIERROR;
+    if((db->fd >= 0) && (fstat(db->fd, &mapped) == 0) && (now.st_ino == mapped.st_ino) && (now.st_dev == mapped.st_dev))
+        return APIOK;
+    Unmap(db);
+    return Map(db);
+}
+
+//in place through the shared mapping; the file is opened for the write only, so a watcher sees one
+//close after write per change and none for the readers
+static int WriteAt(const ecwMBUSDb *db, const void *buf, size_t len, size_t offset) {
+    int fd, ret;
+
+    if((fd = open(db->path, O_WRONLY)) < 0) return APIERROR;
+    ret = (pwrite(fd, buf, len, offset) == (ssize_t)len) ? APIOK : APIERROR;
+    close(fd);
+    return ret;
+}
+
+//writes header and records to a temporary file, renames it over the database and maps it again
+static int Rewrite(pecwMBUSDb db, const uint8_t *records, uint32_t count) {
+    char    tmp[_MAX_PATH];
+    uint8_t header[DB_HEADERSIZE];
+    size_t  size = (size_t)count*DB_RECORDSIZE;
+    int     fd, ret = APIOK;
+
+    if(snprintf(tmp, sizeof(tmp), "%s.tmp", db->path) >= (int)sizeof(tmp)) return APIERROR;
+    memset(header, 0, sizeof(header));
+    PutU32(header,   DB_MAGIC);
+    PutU16(header+4, DB_VERSION);
+    PutU16(header+6, DB_RECORDSIZE);
+    PutU32(header+8, count);
+
+    if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) return APIERROR; //the keys are secret
+    if((write(fd, header, DB_HEADERSIZE) != DB_HEADERSIZE) ||
+       ((size > 0) && (write(fd, records, size) != (ssize_t)size)) || (fdatasync(fd) != 0))
+        ret = APIERROR;
+    close(fd);
+    if((APIOK != ret) || (rename(tmp, db->path) != 0)) {
+        unlink(tmp);
+        return APIERROR;
+    }
+    Unmap(db);
+    return Map(db);
+}
+
+int Db_Open(pecwMBUSDb db, const char *path) {
+    if((NULL == db) || (NULL == path)) return APIERROR;
+    memset(db, 0, sizeof(ecwMBUSDb));
+    db->fd = -1;
+    if(snprintf(db->path, sizeof(db->path), "%s", path) >= (int)sizeof(db->path)) return APIERROR;
+    return Map(db);
+}
+
+void Db_Close(pecwMBUSDb db) {
+    if(NULL == db) return;
+    Unmap(db);
+}
+
+bool Db_Exists(const char *path) {
+    return (0 == access(path, F_OK));
+}
+
+void Db_Get(const ecwMBUSDb *db, uint32_t index, pecwMBUSDbRec rec) {
+    DecodeRecord(db->map + RecordOffset(index), rec);
+}
+
+//index of the meter, APIERROR if it is not in the database; rec may be NULL
+int Db_Find(const ecwMBUSDb *db, uint16_t manid, uint32_t ident, pecwMBUSDbRec rec) {
+    uint32_t index;
+
+    if((NULL == db) || (0 == db->count)) return APIERROR;
+    index = LowerBound(db, Key(manid, ident));
+    if((index == db->count) || (RecordKey(db, index) != Key(manid, ident))) return APIERROR;
+    if(NULL != rec) Db_Get(db, index, rec);
+    return (int)index;
+}
+
+//a known meter is written in place, a new one rewrites the file
+int Db_Put(pecwMBUSDb db, const ecwMBUSDbRec *rec) {
+    uint8_t  buf[DB_RECORDSIZE];
+    uint8_t *records;
+    uint32_t index;
+    int      ret;
+
+    if((NULL == db) || (NULL == rec) || (APIOK != Refresh(db))) return APIERROR;
+    EncodeRecord(buf, rec);
+    index = (0 == db->count) ? 0 : LowerBound(db, Key(rec->meter.manufacturerID, rec->meter.ident));
+    if((index < db->count) && (RecordKey(db, index) == Key(rec->meter.manufacturerID, rec->meter.ident)))
+        return WriteAt(db, buf, DB_RECORDSIZE, RecordOffset(index));
+
+    if(NULL == (records = (uint8_t *) malloc((size_t)(db->count + 1)*DB_RECORDSIZE))) return APIERROR;
+    if(index > 0)
+        memcpy(records, db->map + DB_HEADERSIZE, (size_t)index*DB_RECORDSIZE);
+    memcpy(records + (size_t)index*DB_RECORDSIZE, buf, DB_RECORDSIZE);
+    if(index < db->count)
+        memcpy(records + (size_t)(index + 1)*DB_RECORDSIZE, db->map + RecordOffset(index), (size_t)(db->count - index)*DB_RECORDSIZE);
+    ret = Rewrite(db, records, db->count + 1);
+    free(records);
+    return ret;
+}
+
+static int CompareRec(const void *a, const void *b) {
+    uint64_t ka = Key(((const ecwMBUSDbRec *)a)->meter.manufacturerID, ((const ecwMBUSDbRec *)a)->meter.ident);
+    uint64_t kb = Key(((const ecwMBUSDbRec *)b)->meter.manufacturerID, ((const ecwMBUSDbRec *)b)->meter.ident);
+    return (ka < kb) ? -1 : (ka > kb) ? 1 : 0;
+}
+
+//merges many meters with one rewrite, recs are sorted in place; keepSlots leaves known meters in their slots
+int Db_PutMany(pecwMBUSDb db, ecwMBUSDbRec *recs, uint32_t count, bool keepSlots) {
+    uint8_t     *records;
+    ecwMBUSDbRec old;
+    uint32_t     iO = 0, iN = 0, out = 0;
+    uint64_t     kO, kN;
+    int          ret;
+
+    if((NULL == db) || ((NULL == recs) && (count > 0)) || (APIOK != Refresh(db))) return APIERROR;
+    if(count > 1)
+        qsort(recs, count, sizeof(ecwMBUSDbRec), CompareRec);
+    for(iN=1; iN<count; iN++) {
+        if(0 == CompareRec(&recs[iN-1], &recs[iN])) {
+            fprintf(stderr, "%04x %08x listed twice\n", recs[iN].meter.manufacturerID, recs[iN].meter.ident);
+            return APIERROR;
+        }
+    }
+    if(NULL == (records = (uint8_t *) malloc(((size_t)db->count + count + 1)*DB_RECORDSIZE))) return APIERROR;
+    iN = 0;
+    while((iO < db->count) || (iN < count)) {
+        kO = (iO < db->count) ? RecordKey(db, iO) : UINT64_MAX;
+        kN = (iN < count) ? Key(recs[iN].meter.manufacturerID, recs[iN].meter.ident) : UINT64_MAX;
+        if(kO < kN) {
+            memcpy(records + (size_t)out*DB_RECORDSIZE, db->map + RecordOffset(iO), DB_RECORDSIZE);
+            iO++;
+        }
+        else {
+            if(kO == kN) {
+                if(keepSlots) {
+                    Db_Get(db, iO, &old);
+                    recs[iN].slot = old.slot;
+                }
+                iO++;
+            }
+            EncodeRecord(records + (size_t)out*DB_RECORDSIZE, &recs[iN]);
+            iN++;
+        }
+        out++;
+    }
+    ret = Rewrite(db, records, out);
+    free(records);
+    return ret;
+}
+
+int Db_Delete(pecwMBUSDb db, uint16_t manid, uint32_t ident) {
+    uint8_t *records;
+    int      index, ret;
+
+    if((APIOK != Refresh(db)) || (APIERROR == (index = Db_Find(db, manid, ident, NULL)))) return APIERROR;
+    if(NULL == (records = (uint8_t *) malloc((size_t)db->count*DB_RECORDSIZE))) return APIERROR;
+    memcpy(records, db->map + DB_HEADERSIZE, (size_t)index*DB_RECORDSIZE);
+    memcpy(records + (size_t)index*DB_RECORDSIZE, db->map + RecordOffset(index + 1), (size_t)(db->count - index - 1)*DB_RECORDSIZE);
+    ret = Rewrite(db, records, db->count - 1);
+    free(records);
+    return ret;
+}
+
+int Db_GetWatched(const ecwMBUSDb *db, pecwMBUSMeter meters, uint8_t *slots, int max) {
+    ecwMBUSDbRec rec;
+    uint32_t     iX;
+    int          n = 0;
+
+    for(iX=0; iX<db->count; iX++) {
+        if(DB_NOSLOT == db->map[RecordOffset(iX) + 8]) continue;
+        if(n < max) {
+            Db_Get(db, iX, &rec);
+            meters[n] = rec.meter;
+            slots[n]  = rec.slot;
+        }
+        n++;
+    }
+    return n;
+}
+
+//the slot byte in place, nothing is written if it is the same
+int Db_SetSlot(pecwMBUSDb db, uint16_t manid, uint32_t ident, uint8_t slot) {
+    int index;
+
+    if((APIOK != Refresh(db)) || (APIERROR == (index = Db_Find(db, manid, ident, NULL)))) return APIERROR;
+    if(db->map[RecordOffset(index) + 8] == slot) return APIOK;
+    return WriteAt(db, &slot, 1, RecordOffset(index) + 8);
+}
+
+static char *Trim(char *s) {
+    char *end;
+
+    while(isspace((unsigned char)*s)) s++;
+    end = s + strlen(s);
+    while((end > s) && isspace((unsigned char)end[-1])) end--;
+    *end = 0;
+    return s;
+}
+
+//one line of the CSV, APIOK with manufacturerID 0 for an empty line or a comment
+int Db_ParseCSV(char *line, pecwMBUSDbRec rec, char *err, size_t errSize) {
+    char  *fields[6], *p;
+    size_t len;
+    int    n = 0, iX;
+
+    memset(rec, 0, sizeof(ecwMBUSDbRec));
+    rec->slot = DB_NOSLOT;
+    if(NULL != (p = strchr(line, '#'))) *p = 0;
+    if(0 == *Trim(line)) return APIOK;
+
+    fields[n++] = line;
+    for(p = line; (*p != 0) && (n < 6); p++) {
+        if(*p == ',') {
+            *p = 0;
+            fields[n++] = p + 1;
+        }
+    }
+    if(n < 4) { snprintf(err, errSize, "manid,ident,type,version[,key[,label]]"); return APIERROR; }
+    for(iX=0; iX<n; iX++)
+        fields[iX] = Trim(fields[iX]);
+    if((n >= 5) && (0 == *fields[4])) fields[4] = "default";
+    if(APIOK != Conf_ParseMeter((n >= 5) ? 5 : 4, fields, &rec->meter, err, errSize)) return APIERROR;
+    if(n == 6) {
+        p = fields[5];
+        len = strlen(p);
+        if((len >= 2) && (p[0] == '"') && (p[len-1] == '"')) {
+            p[len-1] = 0;
+            p++;
+        }
+        if(strlen(p) > DB_MAXLABEL) { snprintf(err, errSize, "label longer than %d", DB_MAXLABEL); return APIERROR; }
+        snprintf(rec->label, sizeof(rec->label), "%s", p);
+    }
+    return APIOK;
+}
+
+void Db_FormatCSV(const ecwMBUSDbRec *rec, char *line, size_t size) {
+    char key[2*AES_KEYLENGHT_IN_BYTES + 1];
+    int  iK;
+
+    for(iK=0; iK<AES_KEYLENGHT_IN_BYTES; iK++)
+        snprintf(key + 2*iK, 3, "%02x", rec->meter.key[iK]);
+    snprintf(line, size, "%04x,%08x,%02x,%02x,%s,%s", rec->meter.manufacturerID, rec->meter.ident,
+             rec->meter.type, rec->meter.version, key, rec->label);
+}
+
+//all lines or none: a bad line is printed as file:line and the database stays as it is
+int Db_ImportCSV(pecwMBUSDb db, const char *path, uint32_t *imported) {
+    FILE         *hFile;
+    ecwMBUSDbRec *recs = NULL, *grown;
+    char          line[DB_MAXCSVLINE], err[80];
+    uint32_t      count = 0, size = 0;
+    int           lineNo = 0, ret = APIOK;
+
+    if(NULL != imported) *imported = 0;
+    if(NULL == (hFile = fopen(path, "r"))) {
+        fprintf(stderr, "Cannot open >%s<\n", path);
+        return APIERROR;
+    }
+    while(NULL != fgets(line, sizeof(line), hFile)) {
+        lineNo++;
+        if((1 == lineNo) && (0 == strncmp(line, "manid", 5))) continue; //header
+        if(count == size) {
+            size = (0 == size) ? 1024 : 2*size;
+            if(NULL == (grown = (ecwMBUSDbRec *) realloc(recs, size*sizeof(ecwMBUSDbRec)))) {
+                snprintf(err, sizeof(err), "out of memory");
+                ret = APIERROR;
+                break;
+            }
+            recs = grown;
+        }
+        if(APIOK != (ret = Db_ParseCSV(line, &recs[count], err, sizeof(err)))) break;
+        if(0 != recs[count].meter.manufacturerID) count++;
+    }
+    fclose(hFile);
+    if(APIOK != ret)
+        fprintf(stderr, "%s:%d: %s\n", path, lineNo, err);
+    else if(APIOK == (ret = Db_PutMany(db, recs, count, true)) && (NULL != imported))
+        *imported = count;
+    free(recs);
+    return ret;
+}
+
+int Db_ImportDat(pecwMBUSDb db, const char *path, uint32_t *imported) {
+    FILE        *hDatFile;
+    ecwMBUSMeter meters[MAXMETER];
+    ecwMBUSDbRec recs[MAXMETER];
+    uint32_t     count = 0;
+    int          iX, n;
+
+    if(NULL != imported) *imported = 0;
+    if(NULL == (hDatFile = fopen(path, "rb"))) return APIERROR;
+    n = (int) fread((void*)meters, sizeof(ecwMBUSMeter), MAXMETER, hDatFile);
+    fclose(hDatFile);
+    for(iX=0; iX<n; iX++) {
+        if(0 == meters[iX].manufacturerID) continue;
+        memset(&recs[count], 0, sizeof(ecwMBUSDbRec));
+        recs[count].meter = meters[iX];
+        recs[count].slot  = (uint8_t) iX;
+        count++;
+    }
+    if(APIOK != Db_PutMany(db, recs, count, false)) return APIERROR;
+    if(NULL != imported) *imported = count;
+    return APIOK;
+}
@@ -0,0 +1,598 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusspool.h>
+#include <wmbus/wmbusfmt.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusemon.h>
+
+#define EMON_HEADROOM    512                 // request line and headers in front of the body
+#define EMON_INSIZE      4096
+#define EMON_EOF         1                   // RecvMore: connection closed
+
+static double NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static int SendAll(int fd, const char *buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return APIERROR;
+        }
+        buf += n;
+        len -= n;
+    }
+    return APIOK;
+}
+
+static void Wake(pecwMBUSEmon emon) {
+    if(!emon->wakePending) {
+        emon->wakePending = true;
+        if(write(emon->wake[1], "w", 1) < 0) {}
+    }
+}
+
+static void DrainWake(pecwMBUSEmon emon) {
+    char buf[64];
+    while(read(emon->wake[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+static bool Stopped(pecwMBUSEmon emon) {
+    bool stop;
+    pthread_mutex_lock(&emon->lock);
+    stop = emon->stop;
+    pthread_mutex_unlock(&emon->lock);
+    return stop;
+}
+
+//wait on the wake pipe, Emon_Close ends the wait
+static void WaitWake(pecwMBUSEmon emon, int ms) {
+    struct pollfd pfd;
+
+    pfd.fd     = emon->wake[0];
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, ms) > 0) DrainWake(emon);
+}
+
+static int Connect(pecwMBUSEmon emon) {
+    struct addrinfo  hints, *res, *ai;
+    struct timeval   tv = { EMON_TIMEOUT/1000, 0 };
+    int              fd = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(emon->host, emon->port, &hints, &res) != 0) return APIERROR;
+
+    for(ai = res; NULL != ai; ai = ai->ai_next) {
+        struct pollfd pfd;
+        int           err = 0;
+        socklen_t     errLen = sizeof(err);
+
+        if((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            pfd.fd     = fd;
+            pfd.events = POLLOUT;
+            if((errno != EINPROGRESS) || (poll(&pfd, 1, EMON_TIMEOUT) != 1) ||
+               (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) != 0) || (err != 0)) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+        }
+        break;
+    }
+    freeaddrinfo(res);
+    if(fd < 0) return APIERROR;
+
+    //blocking writes with a timeout, reads are polled
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    emon->fd = fd;
+    return APIOK;
+}
+
+static void CloseSocket(pecwMBUSEmon emon) {
+    if(emon->fd >= 0) close(emon->fd);
+    emon->fd = -1;
+}
+
+static int SpoolItem(pecwMBUSEmon emon, const ecwMBUSEmonItem *item) {
+    int ret = Spool_Push(&emon->spool, item->data, item->len);
+    if(APIOK == ret) emon->stats.spooled++;
+    return ret;
+}
+
+//called with the lock held: the batch is sent again, memory readings go to
+//the spool so they survive a restart while the endpoint is away
+static void Disconnected(pecwMBUSEmon emon) {
+    emon->connected  = false;
+    emon->qSend      = emon->qHead;
+    emon->batchMem   = 0;
+    emon->batchSpool = 0;
+    if(!emon->useSpool) return;
+
+    Spool_Rewind(&emon->spool);
+    if(emon->spool.count == 0) { //the memory queue is older than anything spooled
+        while((emon->qHead != emon->qTail) && (SpoolItem(emon, &emon->queue[emon->qHead % EMON_QUEUESIZE]) == APIOK))
+            emon->qHead++;
+        emon->qSend = emon->qHead;
+        Spool_Sync(&emon->spool);
+    }
+}
+
+//called with the lock held, memory readings first, then the spool. The body
+//starts at out + EMON_HEADROOM, returns its length
+static size_t FillBatch(pecwMBUSEmon emon) {
+    char           *body = emon->out + EMON_HEADROOM;
+    char            item[EMON_MAXITEM];
+    const char     *p;
+    size_t          n = 0, len;
+    int             count = 0;
+
+    memcpy(body, "data=[", 6);
+    n = 6;
+    while(emon->batchMem + emon->batchSpool < EMON_MAXBATCH) {
+        if(emon->qSend != emon->qTail) {
+            pecwMBUSEmonItem e = &emon->queue[emon->qSend % EMON_QUEUESIZE];
+            p   = e->data;
+            len = e->len;
+            emon->qSend++;
+            emon->batchMem++;
+        }
+        else if(emon->useSpool && (Spool_Read(&emon->spool, item, sizeof(item), &len) == APIOK)) {
+            emon->batchSpool++;
+            if((len < 2) || (item[0] != '[') || (item[len-1] != ']'))
+                continue; //not an item, committed with the batch
+            p = item;
+        }
+        else
+            break;
+        if(count++ > 0) body[n++] = ',';
+        memcpy(body + n, p, len);
+        n += len;
+    }
+    memcpy(body + n, "]&sentat=", 9);
+    n += 9;
+    n += Fmt_U32(body + n, (uint32_t)time(NULL));
+    memcpy(body + n, "&apikey=", 8);
+    n += 8;
+    memcpy(body + n, emon->apikey, strlen(emon->apikey));
+    return n + strlen(emon->apikey);
+}
+
+static int WaitReadable(pecwMBUSEmon emon, double deadline) {
+    struct pollfd pfd;
+    int           left, r;
+
+    pfd.fd     = emon->fd;
+    pfd.events = POLLIN;
+    for(;;) {
+        left = (int)(deadline - NowMs());
+        if(left <= 0) return APIERROR;
+        r = poll(&pfd, 1, left);
+        if(r == 1) return APIOK;
+        if((r < 0) && (errno == EINTR)) continue;
+        return APIERROR;
+    }
+}
+
+static int RecvMore(pecwMBUSEmon emon, double deadline) {
+    ssize_t r;
+
+    if(emon->inLen >= EMON_INSIZE - 1) return APIERROR;
+    if(WaitReadable(emon, deadline) != APIOK) return APIERROR;
+    r = recv(emon->fd, emon->in + emon->inLen, EMON_INSIZE - 1 - emon->inLen, 0);
+    if(r == 0) return EMON_EOF;
+    if(r < 0)  return APIERROR;
+    emon->inLen += r;
+    emon->in[emon->inLen] = 0;
+    return APIOK;
+}
+
+//read and drop the part of a long answer that does not fit into in
+static int Discard(pecwMBUSEmon emon, size_t len, double deadline) {
+    char    buf[512];
+    ssize_t r;
+
+    while(len > 0) {
+        if(WaitReadable(emon, deadline) != APIOK) return APIERROR;
+        r = recv(emon->fd, buf, min(len, sizeof(buf)), 0);
+        if(r <= 0) return APIERROR;
+        len -= r;
+    }
+    return APIOK;
+}
+
+//send the request in out and read the answer. status is the HTTP status, ok
+//is set when emoncms accepted the data, keepAlive when the connection stays
+static int Request(pecwMBUSEmon emon, size_t bodyLen, int *status, bool *ok, bool *keepAlive) {
+    char          header[EMON_HEADROOM];
+    char         *end, *body, *p;
+    size_t        hdrLen, contentLen = 0, hdrEnd;
+    bool          hasLength = false, chunked = false;
+    double        deadline;
+    int           n, ret;
+
+    n = snprintf(header, sizeof(header), "POST %s/input/bulk HTTP/1.1\r\nHost: %s\r\n"
+                 "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %u\r\n\r\n",
+                 emon->path, emon->host, (unsigned int)bodyLen);
+    if((n < 0) || (n >= (int)sizeof(header))) return APIERROR;
+    hdrLen = (size_t)n;
+    memcpy(emon->out + EMON_HEADROOM - hdrLen, header, hdrLen);
+    if(SendAll(emon->fd, emon->out + EMON_HEADROOM - hdrLen, hdrLen + bodyLen) != APIOK) return APIERROR;
+
+    *status    = 0;
+    *ok        = false;
+    *keepAlive = true;
+    emon->inLen = 0;
+    emon->in[0] = 0;
+    deadline   = NowMs() + EMON_TIMEOUT;
+    while(NULL == (end = strstr(emon->in, "\r\n\r\n")))
+        if(RecvMore(emon, deadline) != APIOK) return APIERROR;
+    hdrEnd = end + 4 - emon->in;
+
+    if((sscanf(emon->in, "HTTP/1.%*d %d", status) != 1) || (*status < 100)) return APIERROR;
+    if(0 == strncmp(emon->in, "HTTP/1.0", 8)) *keepAlive = false;
+    for(p = emon->in; p < end; p++) *p = (char)tolower((unsigned char)*p);
+    if(NULL != (p = strstr(emon->in, "\r\ncontent-length:"))) {
+        contentLen = strtoul(p + 17, NULL, 10);
+        hasLength  = true;
+    }
+    if((NULL != (p = strstr(emon->in, "\r\ntransfer-encoding:"))) && (NULL != strstr(p, "chunked")) && (strstr(p, "chunked") < end))
+        chunked = true;
+    if((NULL != (p = strstr(emon->in, "\r\nconnection:"))) && (NULL != strstr(p, "close")) && (strstr(p, "close") < end))
+        *keepAlive = false;
+    if(NULL != strstr(emon->in, "\r\nconnection: keep-alive")) *keepAlive = true;
+
+    //the answer is short, "ok" or an error text. Only the start of a longer
+    //one is kept, the status decides and the rest is dropped
+    if(chunked) {
+        while(NULL == strstr(emon->in + hdrEnd, "0\r\n\r\n")) {
+            if(emon->inLen >= EMON_INSIZE - 1) { //the rest goes with the connection
+                *keepAlive = false;
+                break;
+            }
+            if(RecvMore(emon, deadline) != APIOK) return APIERROR;
+        }
+        body = strstr(emon->in + hdrEnd, "\r\n");
+        body = (NULL != body) ? body + 2 : emon->in + hdrEnd;
+    }
+    else if(hasLength) {
+        size_t keep = min(contentLen, EMON_INSIZE - 1 - hdrEnd);
+        while(emon->inLen < hdrEnd + keep)
+            if(RecvMore(emon, deadline) != APIOK) return APIERROR;
+        if((emon->inLen < hdrEnd + contentLen) && (Discard(emon, hdrEnd + contentLen - emon->inLen, deadline) != APIOK))
+            return APIERROR;
+        emon->in[hdrEnd + keep] = 0;
+        body = emon->in + hdrEnd;
+    }
+    else {
+        while((emon->inLen < EMON_INSIZE - 1) && (EMON_EOF != (ret = RecvMore(emon, deadline))))
+            if(ret != APIOK) return APIERROR;
+        *keepAlive = false;
+        body = emon->in + hdrEnd;
+    }
+    while(isspace((unsigned char)*body)) body++;
+    *ok = (0 == strncmp(body, "ok", 2)) || (NULL != strstr(body, "\"success\":true"));
+    if(!*ok && (*status/100 == 2))
+        Log_Printf(LOGCAT_NET, LOGLVL_WARN, "emoncms: %.60s", body);
+    return APIOK;
+}
+
+void * Emon_ThreadProc(void *arg) {
+    pecwMBUSEmon  emon = (pecwMBUSEmon) arg;
+    int           backoff = EMON_BACKOFFMIN;
+    unsigned long synced = 0;
+    double        lastSync = NowMs();
+    double        lastRequest = 0, firstWaiting = 0;
+
+    while(!Stopped(emon)) {
+        unsigned long waiting, backlog;
+        struct pollfd pfd[2];
+        double        now, due;
+        size_t        len;
+        bool          ok, keepAlive, reused;
+        int           status, ret, batch;
+
+        if(!emon->connected && (emon->fd < 0)) {
+            if(Connect(emon) != APIOK) {
+                WaitWake(emon, backoff);
+                backoff = min(2*backoff, EMON_BACKOFFMAX);
+                continue;
+            }
+            pthread_mutex_lock(&emon->lock);
+            emon->connected = true;
+            emon->stats.connects++;
+            pthread_mutex_unlock(&emon->lock);
+        }
+
+        pthread_mutex_lock(&emon->lock);
+        emon->wakePending = false;
+        waiting = (emon->qTail - emon->qHead) + (emon->useSpool ? emon->spool.count : 0);
+        backlog = emon->useSpool ? emon->spool.count : 0;
+        if(emon->useSpool && (emon->stats.spooled != synced) && (NowMs() - lastSync > 1000)) {
+            Spool_Sync(&emon->spool);
+            synced   = emon->stats.spooled;
+            lastSync = NowMs();
+        }
+        pthread_mutex_unlock(&emon->lock);
+
+        //full batches at the drain rate, single readings after EMON_INTERVAL
+        now = NowMs();
+        if(waiting == 0)           firstWaiting = 0;
+        else if(firstWaiting == 0) firstWaiting = now;
+        if((waiting >= EMON_MAXBATCH) || (backlog > 0))
+            due = lastRequest + EMON_MAXBATCH*1000.0/emon->drainRate;
+        else
+            due = firstWaiting + EMON_INTERVAL;
+
+        if((waiting == 0) || (now < due)) {
+            pfd[0].fd     = emon->wake[0];
+            pfd[0].events = POLLIN;
+            pfd[1].fd     = emon->fd;
+            pfd[1].events = POLLIN;
+            if(poll(pfd, (emon->fd >= 0) ? 2 : 1, (waiting == 0) ? -1 : (int)(due - now) + 1) > 0) {
+                if(pfd[0].revents & POLLIN) DrainWake(emon);
+                if((emon->fd >= 0) && (pfd[1].revents & (POLLIN | POLLERR | POLLHUP)))
+                    CloseSocket(emon); //idle connection closed by the server, opened again for the next batch
+            }
+            continue;
+        }
+
+        reused = (emon->fd >= 0);
+        if(!reused && (Connect(emon) != APIOK)) {
+            pthread_mutex_lock(&emon->lock);
+            Disconnected(emon);
+            pthread_mutex_unlock(&emon->lock);
+            continue;
+        }
+        if(!reused) {
+            pthread_mutex_lock(&emon->lock);
+            emon->stats.connects++;
+            pthread_mutex_unlock(&emon->lock);
+        }
+
+        pthread_mutex_lock(&emon->lock);
+        len = FillBatch(emon);
+        pthread_mutex_unlock(&emon->lock);
+
+        lastRequest = NowMs();
+        ret = Request(emon, len, &status, &ok, &keepAlive);
+
+        pthread_mutex_lock(&emon->lock);
+        batch = emon->batchMem + emon->batchSpool;
+        emon->stats.requests++;
+        if((ret == APIOK) && (status/100 == 2)) {
+            //answered but refused, sending it again would block the queue
+            if(ok) emon->stats.uploaded += batch;
+            else   emon->stats.rejected += batch;
+            emon->qHead += emon->batchMem;
+            if(emon->batchSpool > 0) Spool_Commit(&emon->spool, emon->batchSpool);
+            emon->batchMem = emon->batchSpool = 0;
+            firstWaiting = 0;
+            backoff = EMON_BACKOFFMIN;
+        }
+        else {
+            emon->stats.failures++;
+            if((ret == APIOK) && (status != 0))
+                Log_Printf(LOGCAT_NET, LOGLVL_WARN, "emoncms: HTTP %d from %s", status, emon->host);
+            Disconnected(emon);
+            keepAlive = false;
+        }
+        pthread_mutex_unlock(&emon->lock);
+
+        if(!keepAlive) CloseSocket(emon);
+        if(!emon->connected && !reused) { //a fresh connection failed, a reused one may just have timed out
+            WaitWake(emon, backoff);
+            backoff = min(2*backoff, EMON_BACKOFFMAX);
+        }
+    }
+
+    CloseSocket(emon);
+    pthread_mutex_lock(&emon->lock);
+    Disconnected(emon);
+    pthread_mutex_unlock(&emon->lock);
+    return 0;
+}
+
+//spec is apikey@host[:port][/path], readings go to spoolPath while emoncms is away (NULL for memory only)
+int Emon_Open(pecwMBUSEmon emon, const char *spec, const char *spoolPath, int drainRate) {
+    const char *at, *host, *slash, *sep;
+    char        hostPort[160];
+
+    if((NULL == emon) || (NULL == spec) || (NULL == (at = strchr(spec, '@'))) || (at == spec)) return APIERROR;
+    memset(emon, 0, sizeof(ecwMBUSEmon));
+    emon->fd = -1;
+    emon->wake[0] = emon->wake[1] = -1;
+    emon->drainRate = (drainRate > 0) ? drainRate : EMON_DRAINRATE;
+
+    snprintf(emon->apikey, sizeof(emon->apikey), "%.*s", (int)(at-spec), spec);
+    host = at + 1;
+    if(NULL != (slash = strchr(host, '/'))) {
+        snprintf(emon->path, sizeof(emon->path), "%s", slash);
+        while((strlen(emon->path) > 0) && (emon->path[strlen(emon->path)-1] == '/'))
+            emon->path[strlen(emon->path)-1] = 0;
+    }
+    else
+        slash = host + strlen(host);
+    snprintf(hostPort, sizeof(hostPort), "%.*s", (int)(slash-host), host);
+    if(0 == hostPort[0]) return APIERROR;
+
+    if((NULL != (sep = strrchr(hostPort, ':'))) && (NULL == strchr(sep, ']'))) {
+        if(snprintf(emon->host, sizeof(emon->host), "%.*s", (int)(sep-hostPort), hostPort) >= (int)sizeof(emon->host)) return APIERROR;
+        snprintf(emon->port, sizeof(emon->port), "%s", sep+1);
+    }
+    else {
+        if(snprintf(emon->host, sizeof(emon->host), "%s", hostPort) >= (int)sizeof(emon->host)) return APIERROR;
+        snprintf(emon->port, sizeof(emon->port), "%d", EMON_DEFAULTPORT);
+    }
+    if((emon->host[0] == '[') && (emon->host[strlen(emon->host)-1] == ']')) { //[ipv6]
+        memmove(emon->host, emon->host+1, strlen(emon->host));
+        emon->host[strlen(emon->host)-1] = 0;
+    }
+
+    if((NULL != spoolPath) && (0 != *spoolPath)) {
+        if(Spool_Open(&emon->spool, spoolPath, SPOOL_DEFAULTMAX) != APIOK) return APIERROR;
+        emon->useSpool = true;
+        if(emon->spool.count > 0)
+            Log_Printf(LOGCAT_NET, LOGLVL_INFO, "emoncms: %lu readings in the spool", emon->spool.count);
+    }
+
+    emon->queue = (ecwMBUSEmonItem *) malloc(EMON_QUEUESIZE*sizeof(ecwMBUSEmonItem));
+    emon->out   = (char *) malloc(EMON_HEADROOM + EMON_BUFFERSIZE);
+    emon->in    = (char *) malloc(EMON_INSIZE);
+    if((NULL == emon->queue) || (NULL == emon->out) || (NULL == emon->in) || (pipe(emon->wake) != 0)) {
+        Emon_Close(emon);
+        return APIERROR;
+    }
+    fcntl(emon->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(emon->wake[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&emon->lock, NULL);
+    emon->running = (0 == pthread_create(&emon->thread, NULL, Emon_ThreadProc, emon));
+    if(!emon->running) {
+        pthread_mutex_destroy(&emon->lock);
+        Emon_Close(emon);
+        return APIERROR;
+    }
+    return APIOK;
+}
+
+//queue a reading, called from the receiving thread
+void Emon_Publish(pecwMBUSEmon emon, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    ecwMBUSEmonItem item;
+    char           *p = item.data;
+    int             n = 0;
+
+    if((NULL == emon) || !emon->running) return;
+
+    p[n++] = '[';
+    n += Fmt_U32(p+n, data->time);
+    p[n++] = ',';
+    p[n++] = '"';
+    n += Fmt_Hex(p+n, meter->ident, 8);
+    p[n++] = '"';
+    p[n++] = ',';
+    n += Fmt_Value(p+n, data->value, data->exp);
+    p[n++] = ',';
+    n += Fmt_I32(p+n, data->rssiDBm);
+    p[n++] = ']';
+    item.len = (uint8_t)n;
+
+    pthread_mutex_lock(&emon->lock);
+    emon->stats.published++;
+    if(emon->useSpool && (!emon->connected || (emon->spool.count > 0) || (emon->qTail - emon->qHead >= EMON_QUEUESIZE))) {
+        if(SpoolItem(emon, &item) != APIOK) emon->stats.dropped++;
+    }
+    else if(emon->qTail - emon->qHead < EMON_QUEUESIZE)
+        emon->queue[emon->qTail++ % EMON_QUEUESIZE] = item;
+    else
+        emon->stats.dropped++;
+    Wake(emon);
+    pthread_mutex_unlock(&emon->lock);
+}
+
+//readings in memory and in the spool, readings dropped so far
+void Emon_GetQueue(pecwMBUSEmon emon, unsigned long *queued, unsigned long *spooled, unsigned long *dropped) {
+    *queued = *spooled = *dropped = 0;
+    if((NULL == emon) || !emon->running) return;
+    pthread_mutex_lock(&emon->lock);
+    *queued  = emon->qTail - emon->qHead;
+    *spooled = emon->useSpool ? emon->spool.count : 0;
+    *dropped = emon->stats.dropped + emon->stats.rejected;
+    pthread_mutex_unlock(&emon->lock);
+}
+
+void Emon_PrintStats(pecwMBUSEmon emon) {
+    ecwMBUSEmonStats stats;
+    unsigned long    queued, spool;
+    bool             connected;
+
+    if((NULL == emon) || !emon->running) return;
+    pthread_mutex_lock(&emon->lock);
+    stats     = emon->stats;
+    queued    = emon->qTail - emon->qHead;
+    spool     = emon->useSpool ? emon->spool.count : 0;
+    connected = emon->connected;
+    pthread_mutex_unlock(&emon->lock);
+
+    printf("emoncms %-13s: %s, %lu connects, %lu requests, %lu failed\n", emon->host,
+           connected ? "reachable" : "unreachable", stats.connects, stats.requests, stats.failures);
+    printf("emoncms readings     : %lu published, %lu uploaded, %lu queued, %lu spooled (%lu in spool), %lu dropped, %lu rejected\n",
+           stats.published, stats.uploaded, queued, stats.spooled, spool, stats.dropped, stats.rejected);
+    printf("emoncms batches      : %.1f readings/request\n",
+           (stats.requests > stats.failures) ? (double)(stats.uploaded + stats.rejected)/(stats.requests - stats.failures) : 0.0);
+}
+
+//after the uploader thread stopped: the rest of the memory queue is older than the spooled
+//readings and goes in front of them, it is uploaded first on the next start
+static void PrependQueue(pecwMBUSEmon emon) {
+    unsigned long n = emon->qTail - emon->qHead, iX;
+    const void  **data;
+    size_t       *len;
+
+    if(n == 0) return;
+    data = (const void **) malloc(n*sizeof(const void *));
+    len  = (size_t *) malloc(n*sizeof(size_t));
+    if((NULL != data) && (NULL != len)) {
+        for(iX=0; iX<n; iX++) {
+            const ecwMBUSEmonItem *item = &emon->queue[(emon->qHead + iX) % EMON_QUEUESIZE];
+            data[iX] = item->data;
+            len[iX]  = item->len;
+        }
+        if(Spool_Prepend(&emon->spool, data, len, n) == APIOK) {
+            emon->stats.spooled += n;
+            emon->qHead = emon->qTail;
+        }
+    }
+    free(data);
+    free(len);
+}
+
+void Emon_Close(pecwMBUSEmon emon) {
+    if(NULL == emon) return;
+    if(emon->running) {
+        pthread_mutex_lock(&emon->lock);
+        emon->stop = true;
+        Wake(emon);
+        pthread_mutex_unlock(&emon->lock);
+        pthread_join(emon->thread, NULL);
+        emon->running = false;
+        pthread_mutex_destroy(&emon->lock);
+        if(emon->useSpool) PrependQueue(emon);
+        if(emon->qTail != emon->qHead)
+            Log_Printf(LOGCAT_NET, LOGLVL_WARN, "emoncms: %lu readings not sent", emon->qTail - emon->qHead);
+    }
+    if(emon->useSpool) Spool_Close(&emon->spool);
+    if(emon->wake[0] >= 0) close(emon->wake[0]);
+    if(emon->wake[1] >= 0) close(emon->wake[1]);
+    emon->wake[0] = emon->wake[1] = -1;
+    free(emon->queue);
+    free(emon->out);
+    free(emon->in);
+    emon->queue = NULL;
+    emon->out   = emon->in = NULL;
+    emon->useSpool = false;
+}
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusfmt.h>
+
+static const char HexDigits[] = "0123456789abcdef";
+
+//the two hex digits of every byte value
+static const char HexPairs[513] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static const char HexPairsUpper[513] =
+    "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+//two digits at a time
+static const char DigitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+int Fmt_U64(char *p, uint64_t v) {
+    char tmp[20];
+    int  n = 20, len;
+
+    while(v >= 100) {
+        int i = (int)(v % 100) * 2;
+        v /= 100;
+        tmp[--n] = DigitPairs[i+1];
+        tmp[--n] = DigitPairs[i];
+    }
+    if(v >= 10) {
+        tmp[--n] = DigitPairs[v*2+1];
+        tmp[--n] = DigitPairs[v*2];
+    }
+    else
+        tmp[--n] = (char)('0' + v);
+    len = 20 - n;
+    memcpy(p, tmp + n, len);
+    return len;
+}
+
+int Fmt_U32(char *p, uint32_t v) {
+    return Fmt_U64(p, v);
+}
+
+int Fmt_I32(char *p, int32_t v) {
+    if(v >= 0) return Fmt_U64(p, (uint64_t)v);
+    *p = '-';
+    return 1 + Fmt_U64(p+1, (uint64_t)(-(int64_t)v));
+}
+
+//lowercase, zero padded to digits
+int Fmt_Hex(char *p, uint32_t v, int digits) {
+    int iX = digits;
+
+    while(iX >= 2) {
+        iX -= 2;
+        memcpy(p+iX, HexPairs + 2*(v & 0xFF), 2);
+        v >>= 8;
+    }
+    if(iX > 0) p[0] = HexDigits[v & 0x0F];
+    return digits;
+}
+
+static int HexBytes(char *p, const uint8_t *data, size_t len, const char *pairs) {
+    size_t iX;
+
+    for(iX=0; iX<len; iX++)
+        memcpy(p+2*iX, pairs + 2*data[iX], 2);
+    return (int)(2*len);
+}
+
+int Fmt_HexBytes(char *p, const uint8_t *data, size_t len) {
+    return HexBytes(p, data, len, HexPairs);
+}
+
+int Fmt_HexBytesUpper(char *p, const uint8_t *data, size_t len) {
+    return HexBytes(p, data, len, HexPairsUpper);
+}
+
+static void TwoDigits(char *p, unsigned int v) {
+    p[0] = DigitPairs[2*v];
+    p[1] = DigitPairs[2*v+1];
+}
+
+//UTC as 2015-01-01T10:00:00Z, civil date from days since the epoch without gmtime
+int Fmt_IsoTime(char *p, uint32_t t) {
+    uint32_t days = t / 86400;
+    uint32_t secs = t % 86400;
+    uint32_t z    = days + 719468;
+    uint32_t era  = z / 146097;
+    uint32_t doe  = z - era*146097;
+    uint32_t yoe  = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    uint32_t doy  = doe - (365*yoe + yoe/4 - yoe/100);
+    uint32_t mp   = (5*doy + 2) / 153;
+    uint32_t d    = doy - (153*mp + 2)/5 + 1;
+    uint32_t m    = (mp < 10) ? mp + 3 : mp - 9;
+    uint32_t y    = yoe + era*400 + (m <= 2);
+
+    TwoDigits(p,    y / 100);
+    TwoDigits(p+2,  y % 100);
+    p[4] = '-';
+    TwoDigits(p+5,  m);
+    p[7] = '-';
+    TwoDigits(p+8,  d);
+    p[10] = 'T';
+    TwoDigits(p+11, secs / 3600);
+    p[13] = ':';
+    TwoDigits(p+14, (secs / 60) % 60);
+    p[16] = ':';
+    TwoDigits(p+17, secs % 60);
+    p[19] = 'Z';
+    return 20;
+}
+
+//local time of the log files, 2015-01-01 10:00 or 01.01.2015 10:00:00
+int Fmt_Date(char *p, const struct tm *tm, int style) {
+    int year = tm->tm_year + 1900;
+
+    if(FMT_DATE_DMY == style) {
+        TwoDigits(p,    tm->tm_mday);
+        p[2] = '.';
+        TwoDigits(p+3,  tm->tm_mon + 1);
+        p[5] = '.';
+        TwoDigits(p+6,  year / 100);
+        TwoDigits(p+8,  year % 100);
+        p[10] = ' ';
+        TwoDigits(p+11, tm->tm_hour);
+        p[13] = ':';
+        TwoDigits(p+14, tm->tm_min);
+        p[16] = ':';
+        TwoDigits(p+17, tm->tm_sec);
+        return 19;
+    }
+    TwoDigits(p,    year / 100);
+    TwoDigits(p+2,  year % 100);
+    p[4] = '-';
+    TwoDigits(p+5,  tm->tm_mon + 1);
+    p[7] = '-';
+    TwoDigits(p+8,  tm->tm_mday);
+    p[10] = ' ';
+    TwoDigits(p+11, tm->tm_hour);
+    p[13] = ':';
+    TwoDigits(p+14, tm->tm_min);
+    return 16;
+}
+
+//value * 10^exp without rounding, e.g. 125 and -1 give "12.5", -1234 and -3 "-1.234"
+int Fmt_Decimal(char *p, int64_t value, int8_t exp) {
+    char     digits[20];
+    uint64_t v = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+    int      sign = 0, n, frac, iX;
+
+    if((exp > 16) || (exp < -16)) {
+        double d = (double) value;
+        for(iX=exp; iX<0; iX++) d /= 10;
+        for(iX=0; iX<exp; iX++)  d *= 10;
+        return snprintf(p, FMT_MAXVALUE, "%g", d);
+    }
+    if(value < 0) p[sign++] = '-';
+    p += sign;
+    n = Fmt_U64(digits, v);
+    if(exp >= 0) {
+        memcpy(p, digits, n);
+        if(0 == v) return sign + n;
+        memset(p+n, '0', exp);
+        return sign + n + exp;
+    }
+    frac = -exp;
+    if(n <= frac) {
+        p[0] = '0';
+        p[1] = '.';
+        memset(p+2, '0', frac - n);
+        memcpy(p+2+frac-n, digits, n);
+        return sign + 2 + frac;
+    }
+    memcpy(p, digits, n - frac);
+    p[n-frac] = '.';
+    memcpy(p+n-frac+1, digits+n-frac, frac);
+    return sign + n + 1;
+}
+
+//the value of a reading, every digit the meter sent
+int Fmt_Value(char *p, uint32_t value, int8_t exp) {
+    return Fmt_Decimal(p, value, exp);
+}
+
+//the driver decodes energy for electricity and heat and volume for gas and water
+const char *Fmt_Unit(uint8_t type) {
+    switch(type) {
+        case METER_ELECTRICITY :
+        case METER_HEAT        : return "Wh";
+        case METER_GAS         :
+        case METER_WATER       : return "m3";
+        default                : return "";
+    }
+}
+
+#define PUT(s) do { memcpy(p+len, s, sizeof(s)-1); len += sizeof(s)-1; } while(0)
+
+int Fmt_ReadingJSON(char *p, const ecwMBUSMeter *meter, const ecMBUSData *data, int flags) {
+    const char *unit = Fmt_Unit(meter->type);
+    int         len  = 0;
+
+    PUT("{\"time\":");     len += Fmt_U32(p+len, data->time);
+    PUT(",\"ts\":\"");     len += Fmt_IsoTime(p+len, data->time);
+    PUT("\",\"manid\":\""); len += Fmt_Hex(p+len, meter->manufacturerID, 4);
+    PUT("\",\"ident\":\""); len += Fmt_Hex(p+len, meter->ident, 8);
+    PUT("\",\"type\":");   len += Fmt_U32(p+len, meter->type);
+    PUT(",\"version\":");  len += Fmt_U32(p+len, meter->version);
+    PUT(",\"value\":");    len += Fmt_U32(p+len, data->value);
+    PUT(",\"exp\":");      len += Fmt_I32(p+len, data->exp);
+    PUT(",\"scaled\":");   len += Fmt_Value(p+len, data->value, data->exp);
+    PUT(",\"unit\":\"");   memcpy(p+len, unit, strlen(unit)); len += strlen(unit);
+    PUT("\",\"rssi\":");   len += Fmt_I32(p+len, data->rssiDBm);
+    PUT(",\"accNo\":");    len += Fmt_U32(p+len, data->accNo);
+    PUT(",\"status\":");   len += Fmt_U32(p+len, data->status);
+    PUT(",\"pktInfo\":");  len += Fmt_U32(p+len, data->pktInfo);
+    if(flags & FMT_PAYLOAD) {
+        PUT(",\"payload\":\"");
+        len += Fmt_HexBytes(p+len, data->payload, data->payloadLength);
+        p[len++] = '"';
+    }
+    p[len++] = '}';
+    if(flags & FMT_NEWLINE) p[len++] = '\n';
+    return len;
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusle.h>
+#include <wmbus/wmbusjournal.h>
+#include <wmbus/wmbusfwd.h>
+
+static int SendAll(int fd, const uint8_t *buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return APIERROR;
+        }
+        buf += n;
+        len -= n;
+    }
+    return APIOK;
+}
+
+static bool Stopped(pecwMBUSFwd fwd) {
+    bool stop;
+    pthread_mutex_lock(&fwd->lock);
+    stop = fwd->stop;
+    pthread_mutex_unlock(&fwd->lock);
+    return stop;
+}
+
+//sleeps the backoff in short steps, Fwd_Stop ends it
+static void Backoff(pecwMBUSFwd fwd) {
+    int ms;
+
+    for(ms = 0; (ms < fwd->backoff) && !Stopped(fwd); ms += 100)
+        usleep(100*1000);
+    fwd->backoff = min(2*fwd->backoff, FWD_BACKOFFMAX);
+}
+
+static void CloseSocket(pecwMBUSFwd fwd) {
+    if(fwd->fd >= 0) close(fwd->fd);
+    fwd->fd = -1;
+}
+
+static int Connect(pecwMBUSFwd fwd) {
+    struct addrinfo  hints, *res, *ai;
+    struct timeval   tv = { FWD_TIMEOUT/1000, 0 };
+    uint8_t          hello[FWD_HELLOSIZE + FWD_MAXID];
+    size_t           idLen = strlen(fwd->id);
+    int              fd = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(fwd->host, fwd->port, &hints, &res) != 0) return APIERROR;
+
+    for(ai = res; NULL != ai; ai = ai->ai_next) {
+        struct pollfd pfd;
+        int           err = 0;
+        socklen_t     errLen = sizeof(err);
+
+        if((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            pfd.fd     = fd;
+            pfd.events = POLLOUT;
+            if((errno != EINPROGRESS) || (poll(&pfd, 1, FWD_TIMEOUT) != 1) ||
+               (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) != 0) || (err != 0)) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+        }
+        break;
+    }
+    freeaddrinfo(res);
+    if(fd < 0) return APIERROR;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); //the buffer is the batch
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+    PutU32(hello, FWD_MAGIC);
+    hello[4] = FWD_VERSION;
+    hello[5] = (uint8_t) idLen;
+    memcpy(hello + FWD_HELLOSIZE, fwd->id, idLen);
+    if(SendAll(fd, hello, FWD_HELLOSIZE + idLen) != APIOK) {
+        close(fd);
+        return APIERROR;
+    }
+    fwd->fd = fd;
+    return APIOK;
+}
+
+//the aggregator never sends, a readable socket is closed or reset
+static bool IsAlive(pecwMBUSFwd fwd) {
+    struct pollfd pfd;
+
+    pfd.fd     = fwd->fd;
+    pfd.events = POLLIN;
+    return (poll(&pfd, 1, 0) == 0);
+}
+
+int Fwd_Open(pecwMBUSFwd fwd, const char *spec) {
+    const char *slash, *sep;
+    char        hostPort[160];
+
+    if((NULL == fwd) || (NULL == spec)) return APIERROR;
+    memset(fwd, 0, sizeof(ecwMBUSFwd));
+    fwd->fd      = -1;
+    fwd->backoff = FWD_BACKOFFMIN;
+    if(0 == strncmp(spec, "raw:", 4)) {
+        fwd->raw = true;
+        spec += 4;
+    }
+
+    if(NULL != (slash = strchr(spec, '/'))) {
+        if((0 == slash[1]) || (strlen(slash+1) > FWD_MAXID)) return APIERROR;
+        snprintf(fwd->id, sizeof(fwd->id), "%s", slash+1);
+    }
+    else {
+        slash = spec + strlen(spec);
+        if(gethostname(fwd->id, sizeof(fwd->id)) != 0) snprintf(fwd->id, sizeof(fwd->id), "gateway");
+        fwd->id[FWD_MAXID] = 0;
+    }
+    snprintf(hostPort, sizeof(hostPort), "%.*s", (int)(slash-spec), spec);
+    if(0 == hostPort[0]) return APIERROR;
+
+    if((NULL != (sep = strrchr(hostPort, ':'))) && (NULL == strchr(sep, ']'))) {
+        if(snprintf(fwd->host, sizeof(fwd->host), "%.*s", (int)(sep-hostPort), hostPort) >= (int)sizeof(fwd->host)) return APIERROR;
+        snprintf(fwd->port, sizeof(fwd->port), "%s", sep+1);
+    }
+    else {
+        if(snprintf(fwd->host, sizeof(fwd->host), "%s", hostPort) >= (int)sizeof(fwd->host)) return APIERROR;
+        snprintf(fwd->port, sizeof(fwd->port), "%d", FWD_DEFAULTPORT);
+    }
+    if((fwd->host[0] == '[') && (fwd->host[strlen(fwd->host)-1] == ']')) { //[ipv6]
+        memmove(fwd->host, fwd->host+1, strlen(fwd->host));
+        fwd->host[strlen(fwd->host)-1] = 0;
+    }
+
+    if(NULL == (fwd->out = (uint8_t *) malloc(FWD_BUFFERSIZE))) return APIERROR;
+    pthread_mutex_init(&fwd->lock, NULL);
+    return APIOK;
+}
+
+//sink idle handler: writes the buffer, retries until it is out or the forwarder is stopped
+void Fwd_Flush(void *ctx, uint64_t tag) {
+    pecwMBUSFwd fwd = (pecwMBUSFwd) ctx;
+    int         ret;
+
+    while(fwd->outLen > 0) {
+        if((fwd->fd >= 0) && !IsAlive(fwd))
+            CloseSocket(fwd);
+        if(fwd->fd < 0) {
+            if(Stopped(fwd)) break;
+            ret = Connect(fwd);
+            pthread_mutex_lock(&fwd->lock);
+            if(ret == APIOK) fwd->stats.connects++;
+            else             fwd->stats.failures++;
+            pthread_mutex_unlock(&fwd->lock);
+            if(ret != APIOK) {
+                Backoff(fwd);
+                continue;
+            }
+        }
+        if(SendAll(fwd->fd, fwd->out, fwd->outLen) != APIOK) {
+            CloseSocket(fwd);
+            pthread_mutex_lock(&fwd->lock);
+            fwd->stats.failures++;
+            pthread_mutex_unlock(&fwd->lock);
+            Backoff(fwd);
+            continue;
+        }
+        pthread_mutex_lock(&fwd->lock);
+        fwd->stats.sent  += fwd->outRecords;
+        fwd->stats.bytes += fwd->outLen;
+        fwd->stats.writes++;
+        pthread_mutex_unlock(&fwd->lock);
+        fwd->outLen     = 0;
+        fwd->outRecords = 0;
+        fwd->backoff    = FWD_BACKOFFMIN;
+    }
+    if(fwd->outLen > 0) { //stopped while the aggregator was away
+        pthread_mutex_lock(&fwd->lock);
+        fwd->stats.lost += fwd->outRecords;
+        pthread_mutex_unlock(&fwd->lock);
+        fwd->outLen     = 0;
+        fwd->outRecords = 0;
+    }
+}
+
+//sink write handler, the tag carries FWD_UNREGISTERED
+int Fwd_Write(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    pecwMBUSFwd fwd = (pecwMBUSFwd) ctx;
+    uint8_t    *rec;
+    int         len;
+
+    if(fwd->outLen + JNL_MAXRECORD > FWD_BUFFERSIZE)
+        Fwd_Flush(fwd, tag);
+
+    rec = fwd->out + fwd->outLen;
+    len = Jnl_EncodeReading(rec + JNL_RECHEADERSIZE, ++fwd->seq, meter, data);
+    PutU16(rec,   (uint16_t) len);
+    PutU16(rec+2, (uint16_t)(tag & FWD_UNREGISTERED));
+    PutU32(rec+4, Jnl_Crc32(rec + JNL_RECHEADERSIZE, len, 0));
+    fwd->outLen += JNL_RECHEADERSIZE + len;
+    fwd->outRecords++;
+
+    pthread_mutex_lock(&fwd->lock);
+    fwd->stats.readings++;
+    pthread_mutex_unlock(&fwd->lock);
+    return APIOK;
+}
+
+//ends the retries, call before the sink is closed
+void Fwd_Stop(pecwMBUSFwd fwd) {
+    if((NULL == fwd) || (NULL == fwd->out)) return;
+    pthread_mutex_lock(&fwd->lock);
+    fwd->stop = true;
+    pthread_mutex_unlock(&fwd->lock);
+}
+
+void Fwd_PrintStats(pecwMBUSFwd fwd) {
+    if((NULL == fwd) || (NULL == fwd->out)) return;
+    pthread_mutex_lock(&fwd->lock);
+    printf("Forward to %s:%s as %s%s : %lu readings, %lu sent in %lu writes (%lu bytes), %lu connects, %lu failures, %lu lost\n",
+           fwd->host, fwd->port, fwd->id, fwd->raw ? " (raw)" : "", fwd->stats.readings, fwd->stats.sent,
+           fwd->stats.writes, fwd->stats.bytes, fwd->stats.connects, fwd->stats.failures, fwd->stats.lost);
+    pthread_mutex_unlock(&fwd->lock);
+}
+
+//after the sink is closed
+void Fwd_Close(pecwMBUSFwd fwd) {
+    if((NULL == fwd) || (NULL == fwd->out)) return;
+    CloseSocket(fwd);
+    pthread_mutex_destroy(&fwd->lock);
+    free(fwd->out);
+    fwd->out = NULL;
+}
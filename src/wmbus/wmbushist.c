@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbushist.h>
+#include <wmbus/wmbusle.h>
+
+#define HIST_CHUNK 256 //records encoded per write on the append path
+
+static void EncodeRecord(uint8_t *p, const ecwMBUSHistRec *rec) {
+    PutU32(p,   rec->time);
+    PutU32(p+4, rec->value);
+    p[ 8] = (uint8_t)rec->exp;
+    p[ 9] = (uint8_t)rec->rssiDBm;
+    p[10] = rec->accNo;
+    p[11] = rec->status;
+    p[12] = rec->pktInfo;
+    p[13] = p[14] = p[15] = 0;
+}
+
+static void DecodeRecord(const uint8_t *p, pecwMBUSHistRec rec) {
+    rec->time    = GetU32(p);
+    rec->value   = GetU32(p+4);
+    rec->exp     = (int8_t)p[8];
+    rec->rssiDBm = (int8_t)p[9];
+    rec->accNo   = p[10];
+    rec->status  = p[11];
+    rec->pktInfo = p[12];
+}
+
+static void EncodeHeader(uint8_t *p, const ecwMBUSMeter *meter) {
+    memset(p, 0, HIST_HEADERSIZE);
+    PutU32(p,    HIST_MAGIC);
+    PutU16(p+4,  HIST_VERSION);
+    PutU16(p+6,  HIST_RECORDSIZE);
+    PutU16(p+8,  meter->manufacturerID);
+    p[10] = meter->version;
+    p[11] = meter->type;
+    PutU32(p+12, meter->ident);
+}
+
+static int DecodeHeader(const uint8_t *p, pecwMBUSMeter meter) {
+    if((GetU32(p) != HIST_MAGIC) || (GetU16(p+4) != HIST_VERSION) || (GetU16(p+6) != HIST_RECORDSIZE))
+        return APIERROR;
+    if(NULL != meter) {
+        memset(meter, 0, sizeof(ecwMBUSMeter));
+        meter->manufacturerID = GetU16(p+8);
+        meter->version        = p[10];
+        meter->type           = p[11];
+        meter->ident          = GetU32(p+12);
+    }
+    return APIOK;
+}
+
+static int WriteAll(int fd, const uint8_t *buf, size_t len, off_t off) {
+    while(len > 0) {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return APIERROR;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return APIOK;
+}
+
+static int ReadAll(int fd, uint8_t *buf, size_t len, off_t off) {
+    while(len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return APIERROR;
+        }
+        if(n == 0) return APIERROR;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return APIOK;
+}
+
+static off_t RecordOffset(uint32_t index) {
+    return (off_t)HIST_HEADERSIZE + (off_t)index*HIST_RECORDSIZE;
+}
+
+static int CompareRecTime(const void *a, const void *b) {
+    const ecwMBUSHistRec *ra = (const ecwMBUSHistRec *)a;
+    const ecwMBUSHistRec *rb = (const ecwMBUSHistRec *)b;
+    if(ra->time < rb->time) return -1;
+    if(ra->time > rb->time) return 1;
+    return 0;
+}
+
+int Hist_MakePath(char *path, size_t size, const char *dir, const ecwMBUSMeter *meter) {
+    int n = snprintf(path, size, "%s/" HIST_FILEPREFIX "%04x_%08x_%02x_%02x" HIST_FILESUFFIX,
+                     dir, meter->manufacturerID, meter->ident, meter->type, meter->version);
+    return ((n < 0) || ((size_t)n >= size)) ? APIERROR : APIOK;
+}
+
+void Hist_FromRFData(pecwMBUSHistRec rec, uint32_t time, const ecMBUSData *rfData) {
+    memset(rec, 0, sizeof(ecwMBUSHistRec));
+    rec->time    = time;
+    rec->value   = rfData->value;
+    rec->exp     = rfData->exp;
+    rec->rssiDBm = rfData->rssiDBm;
+    rec->accNo   = rfData->accNo;
+    rec->status  = rfData->status;
+    rec->pktInfo = rfData->pktInfo;
+}
+
+//append records to an open history file, records may come in any order
+//the common case (newer than the last record) is a plain write at the end,
+//older records are merged into the tail of the file
+int Hist_AppendFd(int fd, const ecwMBUSMeter *meter, ecwMBUSHistRec *recs, uint32_t count) {
+    uint8_t     chunk[HIST_CHUNK*HIST_RECORDSIZE];
+    uint8_t     header[HIST_HEADERSIZE];
+    struct stat st;
+    uint32_t    nFile, iX;
+    uint32_t    lastTime = 0;
+
+    if((fd < 0) || (NULL == meter) || ((count > 0) && (NULL == recs))) return APIERROR;
+    if(fstat(fd, &st) != 0) return APIERROR;
+
+    if(st.st_size < HIST_HEADERSIZE) { //new file
+        EncodeHeader(header, meter);
+        if((ftruncate(fd, 0) != 0) || (WriteAll(fd, header, HIST_HEADERSIZE, 0) != APIOK))
+            return APIERROR;
+        st.st_size = HIST_HEADERSIZE;
+    }
+    else {
+        if((ReadAll(fd, header, HIST_HEADERSIZE, 0) != APIOK) || (DecodeHeader(header, NULL) != APIOK))
+            return APIERROR;
+    }
+
+    nFile = (uint32_t)((st.st_size - HIST_HEADERSIZE) / HIST_RECORDSIZE);
+    if(RecordOffset(nFile) != st.st_size) { //drop a half written record
+        if(ftruncate(fd, RecordOffset(nFile)) != 0) return APIERROR;
+    }
+    if(count == 0) return APIOK;
+
+    for(iX=1; iX<count; iX++) {
+        if(recs[iX].time < recs[iX-1].time) {
+            qsort(recs, count, sizeof(ecwMBUSHistRec), CompareRecTime);
+            break;
+        }
+    }
+
+    if(nFile > 0) {
+        if(ReadAll(fd, chunk, HIST_RECORDSIZE, RecordOffset(nFile-1)) != APIOK) return APIERROR;
+        lastTime = GetU32(chunk);
+    }
+
+    if((nFile == 0) || (recs[0].time >= lastTime)) {
+        off_t off = RecordOffset(nFile);
+        for(iX=0; iX<count; ) {
+            uint32_t n = min(count-iX, HIST_CHUNK);
+            uint32_t iR;
+            for(iR=0; iR<n; iR++)
+                EncodeRecord(chunk+iR*HIST_RECORDSIZE, &recs[iX+iR]);
+            if(WriteAll(fd, chunk, (size_t)n*HIST_RECORDSIZE, off) != APIOK) return APIERROR;
+            off += (off_t)n*HIST_RECORDSIZE;
+            iX  += n;
+        }
+        return APIOK;
+    }
+
+    //merge: find first file record newer than the oldest new record
+    {
+        uint32_t lo = 0, hi = nFile, pos, nTail;
+        uint8_t *tail, *out, *pOut;
+        uint32_t iT = 0, iN = 0;
+        int      ret;
+
+        while(lo < hi) {
+            uint32_t mid = lo + (hi-lo)/2;
+            if(ReadAll(fd, chunk, 4, RecordOffset(mid)) != APIOK) return APIERROR;
+            if(GetU32(chunk) <= recs[0].time) lo = mid+1;
+            else                              hi = mid;
+        }
+        pos   = lo;
+        nTail = nFile - pos;
+
+        tail = (uint8_t *) malloc((size_t)nTail*HIST_RECORDSIZE);
+        out  = (uint8_t *) malloc(((size_t)nTail+count)*HIST_RECORDSIZE);
+        if((NULL == tail) || (NULL == out)) {
+            free(tail);
+            free(out);
+            return APIERROR;
+        }
+        if(ReadAll(fd, tail, (size_t)nTail*HIST_RECORDSIZE, RecordOffset(pos)) != APIOK) {
+            free(tail);
+            free(out);
+            return APIERROR;
+        }
+
+        pOut = out;
+        while((iT < nTail) || (iN < count)) {
+            if((iN >= count) || ((iT < nTail) && (GetU32(tail+iT*HIST_RECORDSIZE) <= recs[iN].time))) {
+                memcpy(pOut, tail+iT*HIST_RECORDSIZE, HIST_RECORDSIZE);
+                iT++;
+            }
+            else {
+                EncodeRecord(pOut, &recs[iN]);
+                iN++;
+            }
+            pOut += HIST_RECORDSIZE;
+        }
+        ret = WriteAll(fd, out, (size_t)(pOut-out), RecordOffset(pos));
+        free(tail);
+        free(out);
+        return ret;
+    }
+}
+
+int Hist_Append(const char *path, const ecwMBUSMeter *meter, ecwMBUSHistRec *recs, uint32_t count) {
+    int fd, ret;
+
+    if((fd = open(path, O_RDWR | O_CREAT, 0666)) < 0)
+        return APIERROR;
+    ret = Hist_AppendFd(fd, meter, recs, count);
+    close(fd);
+    return ret;
+}
+
+int Hist_Open(const char *path, pecwMBUSHist hist) {
+    struct stat st;
+
+    if(NULL == hist) return APIERROR;
+    memset(hist, 0, sizeof(ecwMBUSHist));
+    hist->fd = -1;
+
+    if((hist->fd = open(path, O_RDONLY)) < 0)
+        return APIERROR;
+    if((fstat(hist->fd, &st) != 0) || (st.st_size < HIST_HEADERSIZE)) {
+        Hist_Close(hist);
+        return APIERROR;
+    }
+
+    hist->mapSize = (size_t)st.st_size;
+    hist->map = (const uint8_t *) mmap(NULL, hist->mapSize, PROT_READ, MAP_SHARED, hist->fd, 0);
+    if(MAP_FAILED == (void *)hist->map) {
+        hist->map = NULL;
+        Hist_Close(hist);
+        return APIERROR;
+    }
+    if(DecodeHeader(hist->map, &hist->meter) != APIOK) {
+        Hist_Close(hist);
+        return APIERROR;
+    }
+    hist->count = (uint32_t)((hist->mapSize - HIST_HEADERSIZE) / HIST_RECORDSIZE);
+    return APIOK;
+}
+
+void Hist_Close(pecwMBUSHist hist) {
+    if(NULL == hist) return;
+    if(NULL != hist->map) munmap((void *)hist->map, hist->mapSize);
+    if(hist->fd >= 0)     close(hist->fd);
+    hist->map   = NULL;
+    hist->fd    = -1;
+    hist->count = 0;
+}
+
+void Hist_Get(const ecwMBUSHist *hist, uint32_t index, pecwMBUSHistRec rec) {
+    DecodeRecord(hist->map + RecordOffset(index), rec);
+}
+
+uint32_t Hist_GetTime(const ecwMBUSHist *hist, uint32_t index) {
+    return GetU32(hist->map + RecordOffset(index));
+}
+
+//first record with time >= time
+uint32_t Hist_LowerBound(const ecwMBUSHist *hist, uint32_t time) {
+    uint32_t lo = 0, hi = hist->count;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi-lo)/2;
+        if(Hist_GetTime(hist, mid) < time) lo = mid+1;
+        else                               hi = mid;
+    }
+    return lo;
+}
+
+//first record with time > time
+uint32_t Hist_UpperBound(const ecwMBUSHist *hist, uint32_t time) {
+    uint32_t lo = 0, hi = hist->count;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi-lo)/2;
+        if(Hist_GetTime(hist, mid) <= time) lo = mid+1;
+        else                                hi = mid;
+    }
+    return lo;
+}
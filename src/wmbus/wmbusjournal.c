@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusjournal.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusle.h>
+
+static uint32_t CrcTable[256];
+static pthread_once_t CrcTableOnce = PTHREAD_ONCE_INIT;
+
+static void CrcTableInit(void) {
+    uint32_t c, n, k;
+    for(n=0; n<256; n++) {
+        c = n;
+        for(k=0; k<8; k++)
+            c = (c & 1) ? (0xEDB88320u ^ (c>>1)) : (c>>1);
+        CrcTable[n] = c;
+    }
+}
+
+//CRC-32 (IEEE), pass 0 to start
+uint32_t Jnl_Crc32(const uint8_t *buf, size_t len, uint32_t crc) {
+    pthread_once(&CrcTableOnce, CrcTableInit);
+    crc = ~crc;
+    while(len--)
+        crc = CrcTable[(crc ^ *buf++) & 0xFF] ^ (crc>>8);
+    return ~crc;
+}
+
+static double NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+//reading body: seq u64, time u32, manID u16, ident u32, version, type, value u32, exp, rssi,
+//accNo, status, pktInfo, utcnt_pic, utcnt_tx, configWord u16, valDuringErrState, payloadLength, payload
+int Jnl_EncodeReading(uint8_t *p, uint64_t seq, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    PutU64(p,    seq);
+    PutU32(p+8,  data->time);
+    PutU16(p+12, meter->manufacturerID);
+    PutU32(p+14, meter->ident);
+    p[18] = meter->version;
+    p[19] = meter->type;
+    PutU32(p+20, data->value);
+    p[24] = (uint8_t)data->exp;
+    p[25] = (uint8_t)data->rssiDBm;
+    p[26] = data->accNo;
+    p[27] = data->status;
+    p[28] = data->pktInfo;
+    p[29] = data->utcnt_pic;
+    p[30] = data->utcnt_tx;
+    PutU16(p+31, data->configWord);
+    p[33] = data->valDuringErrState ? 1 : 0;
+    p[34] = data->payloadLength;
+    memcpy(p+JNL_READINGSIZE, data->payload, data->payloadLength);
+    return JNL_READINGSIZE + data->payloadLength;
+}
+
+int Jnl_DecodeReading(const uint8_t *p, size_t len, uint64_t *seq, pecwMBUSMeter meter, psecMBUSData data) {
+    if((len < JNL_READINGSIZE) || (len != (size_t)JNL_READINGSIZE + p[34]))
+        return APIERROR;
+
+    memset(meter, 0, sizeof(ecwMBUSMeter));
+    memset(data,  0, sizeof(ecMBUSData));
+    if(NULL != seq) *seq = GetU64(p);
+    data->time              = GetU32(p+8);
+    meter->manufacturerID   = GetU16(p+12);
+    meter->ident            = GetU32(p+14);
+    meter->version          = p[18];
+    meter->type             = p[19];
+    data->mbusID            = meter->ident;
+    data->value             = GetU32(p+20);
+    data->exp               = (int8_t)p[24];
+    data->rssiDBm           = (int8_t)p[25];
+    data->accNo             = p[26];
+    data->status            = p[27];
+    data->pktInfo           = p[28];
+    data->utcnt_pic         = p[29];
+    data->utcnt_tx          = p[30];
+    data->configWord        = GetU16(p+31);
+    data->valDuringErrState = p[33] != 0;
+    data->payloadLength     = p[34];
+    memcpy(data->payload, p+JNL_READINGSIZE, data->payloadLength);
+    return APIOK;
+}
+
+static int WriteHeader(pecwMBUSJournal jnl, uint64_t checkpoint) {
+    uint8_t header[JNL_HEADERSIZE];
+
+    memset(header, 0, sizeof(header));
+    PutU32(header,    JNL_MAGIC);
+    PutU16(header+4,  JNL_VERSION);
+    PutU16(header+6,  JNL_HEADERSIZE);
+    PutU64(header+8,  checkpoint);
+    PutU32(header+16, Jnl_Crc32(header+8, 8, 0));
+    return (pwrite(jnl->fd, header, JNL_HEADERSIZE, 0) == JNL_HEADERSIZE) ? APIOK : APIERROR;
+}
+
+//read the journal, replay everything after the checkpoint and cut off a torn tail
+static int Recover(pecwMBUSJournal jnl, Jnl_ReplayHandler replay, void *ctx) {
+    struct stat   st;
+    uint8_t      *file;
+    size_t        off;
+    ecwMBUSMeter  meter;
+    ecMBUSData    data;
+    uint64_t      seq;
+
+    if(fstat(jnl->fd, &st) != 0) return APIERROR;
+    if(st.st_size < JNL_HEADERSIZE) { //new journal
+        if((ftruncate(jnl->fd, 0) != 0) || (WriteHeader(jnl, 0) != APIOK) || (fdatasync(jnl->fd) != 0))
+            return APIERROR;
+        jnl->size = JNL_HEADERSIZE;
+        jnl->nextSeq = 1;
+        return APIOK;
+    }
+
+    if(NULL == (file = (uint8_t *) malloc(st.st_size))) return APIERROR;
+    if(pread(jnl->fd, file, st.st_size, 0) != st.st_size) {
+        free(file);
+        return APIERROR;
+    }
+    if((GetU32(file) != JNL_MAGIC) || (GetU16(file+4) != JNL_VERSION) || (GetU16(file+6) != JNL_HEADERSIZE) ||
+       (Jnl_Crc32(file+8, 8, 0) != GetU32(file+16))) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_WARN, "Journal header is invalid");
+        free(file);
+        return APIERROR;
+    }
+    jnl->checkpoint = GetU64(file+8);
+    jnl->nextSeq    = jnl->checkpoint+1;
+
+    off = JNL_HEADERSIZE;
+    while(off + JNL_RECHEADERSIZE <= (size_t)st.st_size) {
+        size_t len = GetU16(file+off);
+        if((off + JNL_RECHEADERSIZE + len > (size_t)st.st_size) ||
+           (Jnl_Crc32(file+off+JNL_RECHEADERSIZE, len, 0) != GetU32(file+off+4)) ||
+           (Jnl_DecodeReading(file+off+JNL_RECHEADERSIZE, len, &seq, &meter, &data) != APIOK))
+            break;
+        if(seq > jnl->checkpoint) {
+            if(NULL != replay) replay(seq, &meter, &data, ctx);
+            jnl->stats.replayed++;
+        }
+        if(seq >= jnl->nextSeq) jnl->nextSeq = seq+1;
+        off += JNL_RECHEADERSIZE + len;
+    }
+    free(file);
+
+    if(off != (size_t)st.st_size) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_WARN, "Journal: cut off %ld bytes of a torn record", (long)(st.st_size - off));
+        if(ftruncate(jnl->fd, off) != 0) return APIERROR;
+    }
+    jnl->size       = off;
+    jnl->writtenSeq = jnl->nextSeq-1;
+    return APIOK;
+}
+
+void * Jnl_ThreadProc(void *arg) {
+    pecwMBUSJournal jnl = (pecwMBUSJournal) arg;
+    uint8_t        *data;
+    size_t          len;
+    unsigned long   records;
+    uint64_t        lastSeq, checkpoint;
+    bool            writeCheckpoint;
+    double          t0, t1;
+    int             ret;
+
+    for(;;) {
+        pthread_mutex_lock(&jnl->lock);
+        while(!jnl->stop && (jnl->len == 0) && !jnl->ckpPending)
+            pthread_cond_wait(&jnl->cond, &jnl->lock);
+        if(jnl->stop && (jnl->len == 0) && !jnl->ckpPending) {
+            pthread_mutex_unlock(&jnl->lock);
+            break;
+        }
+        if(!jnl->stop && (jnl->windowMs > 0)) { //group commit: collect the records of one window
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec  += jnl->windowMs/1000;
+            deadline.tv_nsec += (jnl->windowMs%1000)*1000000L;
+            if(deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            //commit early when the buffer is half full
+            while(!jnl->stop && (jnl->len < JNL_BUFFERSIZE/2)) {
+                if(pthread_cond_timedwait(&jnl->cond, &jnl->lock, &deadline) == ETIMEDOUT)
+                    break;
+            }
+        }
+        data            = jnl->buf;
+        len             = jnl->len;
+        records         = jnl->pending;
+        lastSeq         = jnl->pendingSeq;
+        writeCheckpoint = jnl->ckpPending;
+        checkpoint      = jnl->checkpoint;
+        jnl->buf        = jnl->spare;
+        jnl->spare      = data;
+        jnl->len        = 0;
+        jnl->pending    = 0;
+        jnl->ckpPending = false;
+        pthread_mutex_unlock(&jnl->lock);
+
+        pthread_mutex_lock(&jnl->lockIO);
+        ret = APIOK;
+        if(len > 0) {
+            if(pwrite(jnl->fd, data, len, jnl->size) != (ssize_t)len) ret = APIERROR;
+            else {
+                jnl->size += len;
+                jnl->writtenSeq = lastSeq;
+            }
+        }
+        if(writeCheckpoint && (WriteHeader(jnl, checkpoint) != APIOK)) ret = APIERROR;
+        t0 = NowMs();
+        if(fdatasync(jnl->fd) != 0) ret = APIERROR;
+        t1 = NowMs();
+        pthread_mutex_unlock(&jnl->lockIO);
+
+        if(APIOK != ret) Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Journal: write failed (%s)", strerror(errno));
+
+        pthread_mutex_lock(&jnl->lock);
+        if(len > 0) {
+            jnl->stats.records += records;
+            jnl->stats.bytes   += len;
+        }
+        if((jnl->stats.commits == 0) || (t1-t0 < jnl->stats.syncMinMs)) jnl->stats.syncMinMs = t1-t0;
+        if(t1-t0 > jnl->stats.syncMaxMs) jnl->stats.syncMaxMs = t1-t0;
+        jnl->stats.syncSumMs += t1-t0;
+        jnl->stats.commits++;
+        pthread_mutex_unlock(&jnl->lock);
+    }
+    return 0;
+}
+
+int Jnl_Open(pecwMBUSJournal jnl, const char *path, int windowMs, Jnl_ReplayHandler replay, void *ctx) {
+    if((NULL == jnl) || (NULL == path)) return APIERROR;
+
+    memset(jnl, 0, sizeof(ecwMBUSJournal));
+    jnl->windowMs = (windowMs < 0) ? JNL_DEFAULTWINDOW : windowMs;
+    if((jnl->fd = open(path, O_RDWR | O_CREAT, 0666)) < 0) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Cannot open journal >%s<", path);
+        return APIERROR;
+    }
+    if(Recover(jnl, replay, ctx) != APIOK) {
+        close(jnl->fd);
+        jnl->fd = -1;
+        return APIERROR;
+    }
+
+    jnl->buf   = (uint8_t *) malloc(JNL_BUFFERSIZE);
+    jnl->spare = (uint8_t *) malloc(JNL_BUFFERSIZE);
+    if((NULL == jnl->buf) || (NULL == jnl->spare)) {
+        free(jnl->buf);
+        free(jnl->spare);
+        close(jnl->fd);
+        jnl->fd = -1;
+        return APIERROR;
+    }
+    pthread_mutex_init(&jnl->lock, NULL);
+    pthread_mutex_init(&jnl->lockIO, NULL);
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&jnl->cond, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+    jnl->stats.startTime = NowMs();
+    jnl->running = (0 == pthread_create(&jnl->thread, NULL, Jnl_ThreadProc, jnl));
+    return jnl->running ? APIOK : APIERROR;
+}
+
+//called from the receiving thread, never waits for the disk; seq (may be NULL) gets the seq of the record
+int Jnl_Append(pecwMBUSJournal jnl, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t *seq) {
+    uint8_t *p;
+    int      len;
+
+    if((NULL == jnl) || !jnl->running) return APIERROR;
+
+    pthread_mutex_lock(&jnl->lock);
+    if(jnl->len + JNL_MAXRECORD > JNL_BUFFERSIZE) {
+        jnl->stats.dropped++;
+        pthread_mutex_unlock(&jnl->lock);
+        return APIERROR;
+    }
+    p = jnl->buf + jnl->len;
+    len = Jnl_EncodeReading(p+JNL_RECHEADERSIZE, jnl->nextSeq, meter, data);
+    PutU16(p,   (uint16_t)len);
+    PutU16(p+2, 0);
+    PutU32(p+4, Jnl_Crc32(p+JNL_RECHEADERSIZE, len, 0));
+    jnl->len += JNL_RECHEADERSIZE + len;
+    jnl->pending++;
+    jnl->pendingSeq = jnl->nextSeq++;
+    if(NULL != seq) *seq = jnl->pendingSeq;
+    if((jnl->pending == 1) || (jnl->len >= JNL_BUFFERSIZE/2))
+        pthread_cond_signal(&jnl->cond);
+    pthread_mutex_unlock(&jnl->lock);
+    return APIOK;
+}
+
+//seq of the last appended record
+uint64_t Jnl_LastSeq(pecwMBUSJournal jnl) {
+    uint64_t seq;
+    if((NULL == jnl) || !jnl->running) return 0;
+    pthread_mutex_lock(&jnl->lock);
+    seq = jnl->nextSeq-1;
+    pthread_mutex_unlock(&jnl->lock);
+    return seq;
+}
+
+//all records up to seq are in the sinks and synced, the journal is reset once it
+//is large enough and everything in it is covered by the checkpoint
+void Jnl_Checkpoint(pecwMBUSJournal jnl, uint64_t seq) {
+    bool reset = false;
+
+    if((NULL == jnl) || !jnl->running) return;
+
+    pthread_mutex_lock(&jnl->lock);
+    if(seq > jnl->checkpoint) {
+        jnl->checkpoint = seq;
+        jnl->ckpPending = true;
+        pthread_cond_signal(&jnl->cond);
+    }
+    pthread_mutex_unlock(&jnl->lock);
+
+    pthread_mutex_lock(&jnl->lockIO);
+    if((jnl->size > JNL_MAXSIZE) && (jnl->writtenSeq <= seq)) {
+        if((WriteHeader(jnl, seq) == APIOK) && (ftruncate(jnl->fd, JNL_HEADERSIZE) == 0) && (fdatasync(jnl->fd) == 0)) {
+            jnl->size = JNL_HEADERSIZE;
+            reset = true;
+        }
+    }
+    pthread_mutex_unlock(&jnl->lockIO);
+
+    if(reset) {
+        pthread_mutex_lock(&jnl->lock);
+        jnl->stats.resets++;
+        pthread_mutex_unlock(&jnl->lock);
+    }
+}
+
+void Jnl_GetStats(pecwMBUSJournal jnl, ecwMBUSJournalStats *stats) {
+    if((NULL == jnl) || (NULL == stats)) return;
+    if(!jnl->running) {
+        memset(stats, 0, sizeof(ecwMBUSJournalStats));
+        return;
+    }
+    pthread_mutex_lock(&jnl->lock);
+    *stats = jnl->stats;
+    pthread_mutex_unlock(&jnl->lock);
+}
+
+//records waiting for the next commit and records dropped so far
+void Jnl_GetQueue(pecwMBUSJournal jnl, unsigned long *queued, unsigned long *dropped) {
+    *queued = *dropped = 0;
+    if((NULL == jnl) || !jnl->running) return;
+    pthread_mutex_lock(&jnl->lock);
+    *queued  = jnl->pending;
+    *dropped = jnl->stats.dropped;
+    pthread_mutex_unlock(&jnl->lock);
+}
+
+void Jnl_PrintStats(pecwMBUSJournal jnl) {
+    ecwMBUSJournalStats stats;
+    double secs;
+
+    Jnl_GetStats(jnl, &stats);
+    secs = (NowMs() - stats.startTime)/1000.0;
+    printf("Journal records      : %lu (%.1f/s, %lu bytes, %.1f bytes/s)\n", stats.records,
+           (secs > 0) ? stats.records/secs : 0.0, stats.bytes, (secs > 0) ? stats.bytes/secs : 0.0);
+    printf("Journal commits      : %lu (%.1f records/commit)\n", stats.commits,
+           (stats.commits > 0) ? (double)stats.records/stats.commits : 0.0);
+    printf("Journal fsync        : min %.2f ms, avg %.2f ms, max %.2f ms\n", stats.syncMinMs,
+           (stats.commits > 0) ? stats.syncSumMs/stats.commits : 0.0, stats.syncMaxMs);
+    printf("Journal dropped      : %lu, replayed %lu, resets %lu\n", stats.dropped, stats.replayed, stats.resets);
+}
+
+void Jnl_Close(pecwMBUSJournal jnl) {
+    if((NULL == jnl) || !jnl->running) return;
+
+    pthread_mutex_lock(&jnl->lock);
+    jnl->stop = true;
+    pthread_cond_signal(&jnl->cond);
+    pthread_mutex_unlock(&jnl->lock);
+    pthread_join(jnl->thread, NULL);
+    jnl->running = false;
+
+    close(jnl->fd);
+    jnl->fd = -1;
+    free(jnl->buf);
+    free(jnl->spare);
+    jnl->buf = jnl->spare = NULL;
+    pthread_mutex_destroy(&jnl->lock);
+    pthread_mutex_destroy(&jnl->lockIO);
+    pthread_cond_destroy(&jnl->cond);
+}
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbuslog.h>
+
+#define TARGET_STDOUT   0
+#define TARGET_FILE     1
+#define TARGET_SYSLOG   2
+
+typedef struct _LOG_SLOT {
+    unsigned long seq;                  // ring position the slot is free for, +1 once written
+    time_t        time;
+    uint8_t       cat;
+    uint8_t       lvl;
+    char          text[LOG_MSGSIZE];
+} LogSlot;
+
+uint8_t Log_Levels[LOGCAT_COUNT] = { LOGLVL_INFO, LOGLVL_INFO, LOGLVL_INFO, LOGLVL_INFO, LOGLVL_INFO, LOGLVL_INFO };
+
+static const char *LevelNames[]    = { "off", "error", "warn", "info", "debug", "trace" };
+static const char *CategoryNames[] = { "main", "driver", "frame", "meter", "output", "net" };
+static const int   SyslogPrio[]    = { LOG_DEBUG, LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG, LOG_DEBUG };
+
+static LogSlot       Ring[LOG_RINGSIZE];
+static unsigned long Tail = 0;          // next position to claim, producers
+static unsigned long Head = 0;          // next position to write, writer thread
+static unsigned long Dropped = 0;       // not yet reported by the writer
+static unsigned long DroppedTotal = 0;
+static bool          Running = false;
+static bool          Stop = false;
+static pthread_t     Thread;
+static int           Target = TARGET_STDOUT;
+static FILE         *File = NULL;
+static LogHandler    Handler = NULL;
+static void         *HandlerCtx = NULL;
+static pthread_mutex_t lockHandler = PTHREAD_MUTEX_INITIALIZER;
+
+const char *Log_LevelName(int lvl) {
+    return ((lvl >= LOGLVL_OFF) && (lvl <= LOGLVL_TRACE)) ? LevelNames[lvl] : "?";
+}
+
+const char *Log_CategoryName(int cat) {
+    return ((cat >= 0) && (cat < LOGCAT_COUNT)) ? CategoryNames[cat] : "?";
+}
+
+void Log_SetLevel(int cat, int lvl) {
+    if((cat < 0) || (cat >= LOGCAT_COUNT) || (lvl < LOGLVL_OFF) || (lvl > LOGLVL_TRACE)) return;
+    __atomic_store_n(&Log_Levels[cat], (uint8_t)lvl, __ATOMIC_RELAXED);
+}
+
+static int FindName(const char **names, int count, const char *s, size_t len) {
+    int iX;
+
+    for(iX=0; iX<count; iX++)
+        if((strlen(names[iX]) == len) && (0 == strncmp(s, names[iX], len))) return iX;
+    return -1;
+}
+
+//level for all categories and/or cat=level,... ; nothing is changed when an entry is invalid
+int Log_ParseLevels(const char *spec) {
+    uint8_t     levels[LOGCAT_COUNT];
+    const char *p = spec, *end, *eq;
+    int         cat, lvl, iX;
+
+    if((NULL == spec) || (0 == *spec)) return APIERROR;
+    memcpy(levels, Log_Levels, sizeof(levels));
+    while(0 != *p) {
+        end = strchr(p, ',');
+        if(NULL == end) end = p + strlen(p);
+        eq = memchr(p, '=', end - p);
+        if(NULL == eq) {
+            if((lvl = FindName(LevelNames, LOGLVL_TRACE + 1, p, end - p)) < 0) return APIERROR;
+            for(iX=0; iX<LOGCAT_COUNT; iX++) levels[iX] = (uint8_t)lvl;
+        }
+        else {
+            if((cat = FindName(CategoryNames, LOGCAT_COUNT, p, eq - p)) < 0) return APIERROR;
+            if((lvl = FindName(LevelNames, LOGLVL_TRACE + 1, eq + 1, end - (eq + 1))) < 0) return APIERROR;
+            levels[cat] = (uint8_t)lvl;
+        }
+        p = ('\0' != *end) ? end + 1 : end;
+    }
+    for(iX=0; iX<LOGCAT_COUNT; iX++) Log_SetLevel(iX, levels[iX]);
+    return APIOK;
+}
+
+//main=info,driver=debug,...
+void Log_FormatLevels(char *p, size_t size) {
+    size_t len = 0;
+    int    iX;
+
+    if(size > 0) *p = 0;
+    for(iX=0; (iX<LOGCAT_COUNT) && (len < size); iX++)
+        len += snprintf(p+len, size-len, "%s%s=%s", (iX > 0) ? "," : "", CategoryNames[iX], LevelNames[Log_Levels[iX]]);
+}
+
+static void Output(const LogSlot *slot) {
+    char      stamp[32];
+    struct tm tm;
+
+    switch(Target) {
+        case TARGET_SYSLOG : syslog(SyslogPrio[slot->lvl], "%s: %s", CategoryNames[slot->cat], slot->text);
+                             break;
+        case TARGET_FILE   : localtime_r(&slot->time, &tm);
+                             strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+                             fprintf(File, "%s %-5s %-6s %s\n", stamp, LevelNames[slot->lvl], CategoryNames[slot->cat], slot->text);
+                             break;
+        default            : pthread_mutex_lock(&lockHandler);
+                             if(NULL != Handler)
+                                 Handler(HandlerCtx, slot->cat, slot->lvl, slot->text);
+                             else {
+                                 fputs(slot->text, stdout);
+                                 fputc('\n', stdout);
+                             }
+                             pthread_mutex_unlock(&lockHandler);
+                             break;
+    }
+}
+
+static void Flush(void) {
+    if(TARGET_FILE == Target)        fflush(File);
+    else if(TARGET_STDOUT == Target) fflush(stdout);
+}
+
+//single consumer, a slot is free again once its seq is a ring size ahead
+static int Drain(void) {
+    LogSlot      *slot;
+    unsigned long dropped;
+    int           count = 0;
+
+    for(;;) {
+        slot = &Ring[Head % LOG_RINGSIZE];
+        if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != Head + 1) break;
+        Output(slot);
+        __atomic_store_n(&slot->seq, Head + LOG_RINGSIZE, __ATOMIC_RELEASE);
+        Head++;
+        count++;
+    }
+    if(0 != (dropped = __atomic_exchange_n(&Dropped, 0, __ATOMIC_RELAXED))) {
+        LogSlot note;
+        note.time = time(NULL);
+        note.cat  = LOGCAT_MAIN;
+        note.lvl  = LOGLVL_WARN;
+        snprintf(note.text, sizeof(note.text), "%lu log messages dropped", dropped);
+        Output(&note);
+        count++;
+    }
+    if(count > 0) Flush();
+    return count;
+}
+
+static void * Log_ThreadProc(void *arg) {
+    while(!__atomic_load_n(&Stop, __ATOMIC_ACQUIRE))
+        if(0 == Drain()) usleep(LOG_IDLEUS);
+    Drain();
+    return NULL;
+}
+
+//one line per message, the writer adds the newline
+static void TrimNewlines(char *text) {
+    size_t len = strlen(text);
+
+    while((len > 0) && ('\n' == text[len-1])) text[--len] = 0;
+}
+
+void Log_Write(int cat, int lvl, const char *fmt, ...) {
+    LogSlot      *slot;
+    unsigned long pos, seq;
+    va_list       ap;
+
+    if(!__atomic_load_n(&Running, __ATOMIC_ACQUIRE)) {
+        char text[LOG_MSGSIZE];
+        va_start(ap, fmt);
+        vsnprintf(text, sizeof(text), fmt, ap);
+        va_end(ap);
+        TrimNewlines(text);
+        fprintf(stdout, "%s\n", text);
+        return;
+    }
+
+    //claim a position whose slot the writer has given back, drop the message when the ring is full
+    pos = __atomic_load_n(&Tail, __ATOMIC_RELAXED);
+    for(;;) {
+        slot = &Ring[pos % LOG_RINGSIZE];
+        seq  = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if(seq == pos) {
+            if(__atomic_compare_exchange_n(&Tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+        else if((long)(seq - pos) < 0) {
+            __atomic_add_fetch(&Dropped, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&DroppedTotal, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+            pos = __atomic_load_n(&Tail, __ATOMIC_RELAXED);
+    }
+    slot->time = time(NULL);
+    slot->cat  = (uint8_t)cat;
+    slot->lvl  = (uint8_t)lvl;
+    va_start(ap, fmt);
+    vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+    va_end(ap);
+    TrimNewlines(slot->text);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+int Log_Start(const char *target) {
+    unsigned long iX;
+
+    if(Running) return APIERROR;
+    if((NULL == target) || (0 == *target) || (0 == strcmp(target, "-")))
+        Target = TARGET_STDOUT;
+    else if(0 == strcmp(target, "syslog")) {
+        Target = TARGET_SYSLOG;
+        openlog("eccwmbus", LOG_PID, LOG_DAEMON);
+    }
+    else {
+        if(NULL == (File = fopen(target, "a"))) return APIERROR;
+        Target = TARGET_FILE;
+    }
+    for(iX=0; iX<LOG_RINGSIZE; iX++) Ring[iX].seq = iX;
+    Head = Tail = 0;
+    Stop = false;
+    if(0 != pthread_create(&Thread, NULL, Log_ThreadProc, NULL)) {
+        if(NULL != File) fclose(File);
+        File   = NULL;
+        Target = TARGET_STDOUT;
+        return APIERROR;
+    }
+    __atomic_store_n(&Running, true, __ATOMIC_RELEASE);
+    return APIOK;
+}
+
+//writes what is in the ring, later messages go to stdout directly
+void Log_Stop(void) {
+    if(!Running) return;
+    __atomic_store_n(&Stop, true, __ATOMIC_RELEASE);
+    pthread_join(Thread, NULL);
+    __atomic_store_n(&Running, false, __ATOMIC_RELEASE);
+    Drain(); //written by threads that saw Running before it was cleared
+    if(TARGET_SYSLOG == Target) closelog();
+    if(NULL != File) fclose(File);
+    File   = NULL;
+    Target = TARGET_STDOUT;
+}
+
+//colour escapes only make sense on a terminal
+bool Log_IsTerminal(void) {
+    return (TARGET_STDOUT == Target) && (NULL == Handler) && isatty(STDOUT_FILENO);
+}
+
+//once it returns the old handler is not called any more
+void Log_RegisterHandler(LogHandler handler, void *ctx) {
+    pthread_mutex_lock(&lockHandler);
+    Handler    = handler;
+    HandlerCtx = ctx;
+    pthread_mutex_unlock(&lockHandler);
+}
+
+unsigned long Log_GetDropped(void) {
+    return __atomic_load_n(&DroppedTotal, __ATOMIC_RELAXED);
+}
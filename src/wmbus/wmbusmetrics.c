@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusmetrics.h>
+
+__thread pecwMBUSMetBlock MetBlock = NULL;
+
+const uint32_t MetBucketsUs[MET_BUCKETS] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000 };
+
+static const char *SinkNames[MET_SINKS] = { "file", "journal", "seglog", "stream", "mqtt", "ndjson", "emoncms", "forward" };
+
+//all blocks ever allocated, the lock is only taken to add a block and to scrape
+static pecwMBUSMetBlock BlockList = NULL;
+static pthread_mutex_t  BlockLock = PTHREAD_MUTEX_INITIALIZER;
+
+//per meter gauges, written by the receiving thread only
+static uint64_t MeterKey[MAXMETER];    // manid << 32 | ident, 0 before the first reading
+static int32_t  MeterRssi[MAXMETER];
+static uint32_t MeterSeen[MAXMETER];
+//counts of the meters that had the slot before, taken off the sums; under BlockLock
+static uint64_t MeterFramesBase[MAXMETER];
+static uint64_t MeterErrorsBase[MAXMETER];
+
+pecwMBUSMetBlock Met_NewBlock(void) {
+    pecwMBUSMetBlock b;
+
+    if(0 != posix_memalign((void **)&b, 64, sizeof(ecwMBUSMetBlock))) return NULL;
+    memset(b, 0, sizeof(ecwMBUSMetBlock));
+    pthread_mutex_lock(&BlockLock);
+    b->next   = BlockList;
+    BlockList = b;
+    pthread_mutex_unlock(&BlockLock);
+    MetBlock = b;
+    return b;
+}
+
+//a frame of the registered meter in slot index was received
+void Met_Reading(int index, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    pecwMBUSMetBlock b = Met_Block();
+
+    if((NULL == b) || (index < 0) || (index >= MAXMETER)) return;
+    Met_Add(&b->counter[MET_READINGS], 1);
+    Met_Add(&b->meterFrames[index], 1);
+    if(PACKET_DECRYPTIONERROR == data->pktInfo)
+        Met_Add(&b->meterDecryptErrors[index], 1);
+    __atomic_store_n(&MeterRssi[index], data->rssiDBm, __ATOMIC_RELAXED);
+    __atomic_store_n(&MeterSeen[index], data->time, __ATOMIC_RELAXED);
+    __atomic_store_n(&MeterKey[index], ((uint64_t)meter->manufacturerID << 32) | meter->ident, __ATOMIC_RELAXED);
+}
+
+static uint64_t Load(const uint64_t *c) {
+    return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+//the slot gets another meter, its series start again at 0
+void Met_ResetMeter(int index) {
+    pecwMBUSMetBlock b;
+
+    if((index < 0) || (index >= MAXMETER)) return;
+    pthread_mutex_lock(&BlockLock);
+    MeterFramesBase[index] = 0;
+    MeterErrorsBase[index] = 0;
+    for(b = BlockList; NULL != b; b = b->next) {
+        MeterFramesBase[index] += Load(&b->meterFrames[index]);
+        MeterErrorsBase[index] += Load(&b->meterDecryptErrors[index]);
+    }
+    __atomic_store_n(&MeterKey[index], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&MeterRssi[index], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&MeterSeen[index], 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&BlockLock);
+}
+
+//sum of a counter over all threads
+uint64_t Met_GetCounter(int counter) {
+    pecwMBUSMetBlock b;
+    uint64_t         sum = 0;
+
+    if((counter < 0) || (counter >= MET_COUNTERS)) return 0;
+    pthread_mutex_lock(&BlockLock);
+    for(b = BlockList; NULL != b; b = b->next)
+        sum += Load(&b->counter[counter]);
+    pthread_mutex_unlock(&BlockLock);
+    return sum;
+}
+
+static void Printf(pecwMBUSMetrics met, const char *fmt, ...) {
+    va_list ap;
+    int     n;
+
+    for(;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(met->out + met->outLen, met->outSize - met->outLen, fmt, ap);
+        va_end(ap);
+        if(n < 0) return;
+        if(met->outLen + n < met->outSize) {
+            met->outLen += n;
+            return;
+        }
+        char *p = (char *) realloc(met->out, 2*met->outSize + n);
+        if(NULL == p) return;
+        met->out      = p;
+        met->outSize  = 2*met->outSize + n;
+    }
+}
+
+static void Family(pecwMBUSMetrics met, const char *name, const char *type, const char *help) {
+    Printf(met, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void Scrape(pecwMBUSMetrics met) {
+    ecwMBUSMetBlock      sum;
+    ecwMBUSMetQueue      queues[MET_MAXQUEUES];
+    ecwMBUSStickCounters stick;
+    time_t               stickTime;
+    pecwMBUSMetBlock     b;
+    uint64_t             key[MAXMETER];
+    uint64_t             cum;
+    int                  nQueues = 0;
+    int                  iX, iB;
+
+    memset(&sum, 0, sizeof(sum));
+    pthread_mutex_lock(&BlockLock);
+    for(b = BlockList; NULL != b; b = b->next) {
+        for(iX=0; iX<MET_COUNTERS; iX++)
+            sum.counter[iX] += Load(&b->counter[iX]);
+        for(iX=0; iX<MAXMETER; iX++) {
+            sum.meterFrames[iX]        += Load(&b->meterFrames[iX]);
+            sum.meterDecryptErrors[iX] += Load(&b->meterDecryptErrors[iX]);
+        }
+        for(iX=0; iX<MET_SINKS; iX++) {
+            for(iB=0; iB<=MET_BUCKETS; iB++)
+                sum.bucket[iX][iB] += Load(&b->bucket[iX][iB]);
+            sum.sumUs[iX] += Load(&b->sumUs[iX]);
+        }
+    }
+    for(iX=0; iX<MAXMETER; iX++) {
+        sum.meterFrames[iX]        -= MeterFramesBase[iX];
+        sum.meterDecryptErrors[iX] -= MeterErrorsBase[iX];
+    }
+    pthread_mutex_unlock(&BlockLock);
+
+    pthread_mutex_lock(&met->lock);
+    stick     = met->stick;
+    stickTime = met->stickTime;
+    met->scrapes++;
+    pthread_mutex_unlock(&met->lock);
+
+    memset(queues, 0, sizeof(queues));
+    if(NULL != met->collector)
+        nQueues = met->collector(met->ctx, queues, MET_MAXQUEUES);
+
+    met->outLen = 0;
+    Family(met, "eccwmbus_frames_read_total", "counter", "Frames read from the stick");
+    Printf(met, "eccwmbus_frames_read_total %llu\n", (unsigned long long)sum.counter[MET_FRAMESREAD]);
+    Family(met, "eccwmbus_frames_decoded_total", "counter", "Frames with a decrypted and decoded payload");
+    Printf(met, "eccwmbus_frames_decoded_total %llu\n", (unsigned long long)sum.counter[MET_FRAMESDECODED]);
+    Family(met, "eccwmbus_readings_total", "counter", "Frames of registered meters");
+    Printf(met, "eccwmbus_readings_total %llu\n", (unsigned long long)sum.counter[MET_READINGS]);
+
+    for(iX=0; iX<MAXMETER; iX++)
+        key[iX] = __atomic_load_n(&MeterKey[iX], __ATOMIC_RELAXED);
+#define METER_LABELS(i) (unsigned int)(key[i] >> 32), (unsigned int)(key[i] & 0xFFFFFFFF)
+    Family(met, "eccwmbus_meter_frames_total", "counter", "Frames per registered meter");
+    for(iX=0; iX<MAXMETER; iX++)
+        if(0 != key[iX])
+            Printf(met, "eccwmbus_meter_frames_total{manid=\"%04x\",ident=\"%08x\"} %llu\n", METER_LABELS(iX), (unsigned long long)sum.meterFrames[iX]);
+    Family(met, "eccwmbus_meter_decryption_errors_total", "counter", "Frames per registered meter that could not be decrypted");
+    for(iX=0; iX<MAXMETER; iX++)
+        if(0 != key[iX])
+            Printf(met, "eccwmbus_meter_decryption_errors_total{manid=\"%04x\",ident=\"%08x\"} %llu\n", METER_LABELS(iX), (unsigned long long)sum.meterDecryptErrors[iX]);
+    Family(met, "eccwmbus_meter_rssi_dbm", "gauge", "RSSI of the last frame per registered meter");
+    for(iX=0; iX<MAXMETER; iX++)
+        if(0 != key[iX])
+            Printf(met, "eccwmbus_meter_rssi_dbm{manid=\"%04x\",ident=\"%08x\"} %d\n", METER_LABELS(iX), (int)__atomic_load_n(&MeterRssi[iX], __ATOMIC_RELAXED));
+    Family(met, "eccwmbus_meter_last_seen_seconds", "gauge", "Reception time of the last frame per registered meter");
+    for(iX=0; iX<MAXMETER; iX++)
+        if(0 != key[iX])
+            Printf(met, "eccwmbus_meter_last_seen_seconds{manid=\"%04x\",ident=\"%08x\"} %u\n", METER_LABELS(iX), __atomic_load_n(&MeterSeen[iX], __ATOMIC_RELAXED));
+#undef METER_LABELS
+
+    if(0 != stickTime) {
+        Family(met, "eccwmbus_stick_status", "gauge", "Error status of the stick");
+        Printf(met, "eccwmbus_stick_status %u\n", stick.status);
+        Family(met, "eccwmbus_stick_uptime_seconds", "gauge", "Time since the stick started");
+        Printf(met, "eccwmbus_stick_uptime_seconds %u\n", stick.uptime);
+        Family(met, "eccwmbus_stick_frames_received_total", "counter", "Frames received by the stick");
+        Printf(met, "eccwmbus_stick_frames_received_total %u\n", stick.rxFrames);
+        Family(met, "eccwmbus_stick_crc_errors_total", "counter", "Frames with a CRC error on the stick");
+        Printf(met, "eccwmbus_stick_crc_errors_total %u\n", stick.crcErrors);
+        Family(met, "eccwmbus_stick_decoding_errors_total", "counter", "Frames the stick could not decode");
+        Printf(met, "eccwmbus_stick_decoding_errors_total %u\n", stick.decodeErrors);
+        Family(met, "eccwmbus_stick_frames_transmitted_total", "counter", "Frames transmitted by the stick");
+        Printf(met, "eccwmbus_stick_frames_transmitted_total %u\n", stick.txFrames);
+        Family(met, "eccwmbus_stick_transmit_errors_total", "counter", "Frames the stick could not transmit");
+        Printf(met, "eccwmbus_stick_transmit_errors_total %u\n", stick.txErrors);
+        Family(met, "eccwmbus_stick_sample_time_seconds", "gauge", "Time the stick counters were sampled");
+        Printf(met, "eccwmbus_stick_sample_time_seconds %ld\n", (long)stickTime);
+    }
+
+    if(nQueues > 0) {
+        Family(met, "eccwmbus_queue_depth", "gauge", "Readings waiting in an output queue");
+        for(iX=0; iX<nQueues; iX++)
+            Printf(met, "eccwmbus_queue_depth{output=\"%s\"} %lu\n", queues[iX].name, queues[iX].queued);
+        Family(met, "eccwmbus_readings_dropped_total", "counter", "Readings an output lost, queue or spool full");
+        for(iX=0; iX<nQueues; iX++)
+            Printf(met, "eccwmbus_readings_dropped_total{output=\"%s\"} %lu\n", queues[iX].name, queues[iX].dropped);
+        Family(met, "eccwmbus_queue_lag_seconds", "gauge", "Age of the oldest reading waiting in a sink queue");
+        for(iX=0; iX<nQueues; iX++)
+            if(queues[iX].hasLag)
+                Printf(met, "eccwmbus_queue_lag_seconds{output=\"%s\"} %.6f\n", queues[iX].name, queues[iX].lagUs/1e6);
+    }
+
+    Family(met, "eccwmbus_sink_write_seconds", "histogram", "Time to write a reading to a sink");
+    for(iX=0; iX<MET_SINKS; iX++) {
+        cum = 0;
+        for(iB=0; iB<MET_BUCKETS; iB++) {
+            cum += sum.bucket[iX][iB];
+            Printf(met, "eccwmbus_sink_write_seconds_bucket{sink=\"%s\",le=\"%g\"} %llu\n", SinkNames[iX], MetBucketsUs[iB]/1e6, (unsigned long long)cum);
+        }
+        cum += sum.bucket[iX][MET_BUCKETS];
+        Printf(met, "eccwmbus_sink_write_seconds_bucket{sink=\"%s\",le=\"+Inf\"} %llu\n", SinkNames[iX], (unsigned long long)cum);
+        Printf(met, "eccwmbus_sink_write_seconds_sum{sink=\"%s\"} %.6f\n", SinkNames[iX], sum.sumUs[iX]/1e6);
+        Printf(met, "eccwmbus_sink_write_seconds_count{sink=\"%s\"} %llu\n", SinkNames[iX], (unsigned long long)cum);
+    }
+}
+
+static int SendAll(int fd, const char *p, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        if((n = send(fd, p, len, MSG_NOSIGNAL)) <= 0) {
+            if((n < 0) && (errno == EINTR)) continue;
+            return APIERROR;
+        }
+        p   += n;
+        len -= n;
+    }
+    return APIOK;
+}
+
+static void Respond(int fd, const char *status, const char *type, const char *body, size_t len) {
+    char header[256];
+    int  n;
+
+    n = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+                 status, type, (unsigned long)len);
+    if(SendAll(fd, header, n) == APIOK)
+        SendAll(fd, body, len);
+}
+
+//one request per connection, scrapes are rare enough to serve them one after the other
+static void ServeClient(pecwMBUSMetrics met, int fd) {
+    char           req[MET_MAXREQUEST];
+    size_t         len = 0;
+    ssize_t        n;
+    struct timeval tv;
+
+    tv.tv_sec  = MET_TIMEOUT/1000;
+    tv.tv_usec = (MET_TIMEOUT%1000)*1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    while(len < sizeof(req)-1) {
+        if((n = recv(fd, req+len, sizeof(req)-1-len, 0)) <= 0) {
+            if((n < 0) && (errno == EINTR)) continue;
+            return;
+        }
+        len += n;
+        req[len] = 0;
+        if(NULL != strstr(req, "\r\n\r\n")) break;
+    }
+    req[len] = 0;
+
+    if((0 == strncmp(req, "GET /metrics ", 13)) || (0 == strncmp(req, "GET /metrics?", 13))) {
+        Scrape(met);
+        Respond(fd, "200 OK", "text/plain; version=0.0.4", met->out, met->outLen);
+    }
+    else if(0 == strncmp(req, "GET ", 4))
+        Respond(fd, "404 Not Found", "text/plain", "Not found, try /metrics\n", 24);
+    else
+        Respond(fd, "405 Method Not Allowed", "text/plain", "Only GET\n", 9);
+}
+
+void * Met_ThreadProc(void *arg) {
+    pecwMBUSMetrics met = (pecwMBUSMetrics) arg;
+    struct pollfd   pfd[2];
+    int             fd;
+
+    for(;;) {
+        pfd[0].fd = met->wake[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd = met->fd;
+        pfd[1].events = POLLIN;
+        if(poll(pfd, 2, -1) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        if(pfd[0].revents) break; //only written by Met_Close
+        if(pfd[1].revents & POLLIN) {
+            if((fd = accept(met->fd, NULL, NULL)) >= 0) {
+                ServeClient(met, fd);
+                close(fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+//spec is [addr:]port
+int Met_Open(pecwMBUSMetrics met, const char *spec, Met_QueueCollector collector, void *ctx) {
+    struct sockaddr_in addr;
+    const char        *port;
+    char               host[64];
+    int                one = 1;
+
+    if((NULL == met) || (NULL == spec)) return APIERROR;
+    memset(met, 0, sizeof(ecwMBUSMetrics));
+    met->fd = met->wake[0] = met->wake[1] = -1;
+    met->collector = collector;
+    met->ctx       = ctx;
+    pthread_mutex_init(&met->lock, NULL);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(NULL == (port = strrchr(spec, ':'))) port = spec;
+    else {
+        size_t len = port - spec;
+        if(len >= sizeof(host)) return APIERROR;
+        memcpy(host, spec, len);
+        host[len] = 0;
+        if(inet_pton(AF_INET, host, &addr.sin_addr) != 1) return APIERROR;
+        port++;
+    }
+    if((atoi(port) <= 0) || (atoi(port) > 65535)) return APIERROR;
+    addr.sin_port = htons((uint16_t)atoi(port));
+
+    met->outSize = 16*1024;
+    if(NULL == (met->out = (char *) malloc(met->outSize))) return APIERROR;
+    if((met->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        Met_Close(met);
+        return APIERROR;
+    }
+    setsockopt(met->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if((bind(met->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(met->fd, 8) != 0) ||
+       (pipe(met->wake) != 0) || (pthread_create(&met->thread, NULL, Met_ThreadProc, met) != 0)) {
+        Met_Close(met);
+        return APIERROR;
+    }
+    met->running = true;
+    return APIOK;
+}
+
+void Met_SetStick(pecwMBUSMetrics met, const ecwMBUSStickCounters *stick) {
+    if((NULL == met) || (NULL == stick)) return;
+    pthread_mutex_lock(&met->lock);
+    met->stick     = *stick;
+    met->stickTime = time(NULL);
+    pthread_mutex_unlock(&met->lock);
+}
+
+void Met_Close(pecwMBUSMetrics met) {
+    if(NULL == met) return;
+    if(met->running) {
+        if(write(met->wake[1], "q", 1) < 0) {}
+        pthread_join(met->thread, NULL);
+        met->running = false;
+    }
+    if(met->fd >= 0)      close(met->fd);
+    if(met->wake[0] >= 0) close(met->wake[0]);
+    if(met->wake[1] >= 0) close(met->wake[1]);
+    met->fd = met->wake[0] = met->wake[1] = -1;
+    free(met->out);
+    met->out = NULL;
+    pthread_mutex_destroy(&met->lock);
+}
@@ -0,0 +1,621 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusspool.h>
+#include <wmbus/wmbusmqtt.h>
+#include <wmbus/wmbusfmt.h>
+#include <wmbus/wmbuslog.h>
+
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISHQOS1 0x32
+#define MQTT_PUBACK      0x40
+#define MQTT_PINGREQ     0xC0
+#define MQTT_PINGRESP    0xD0
+#define MQTT_DISCONNECT  0xE0
+
+#define MQTT_MAXPACKET   (5 + 2 + MQTT_MAXTOPIC + 2 + MQTT_MAXPAYLOAD)
+
+static double NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static int EncodeLength(uint8_t *p, size_t len) {
+    int n = 0;
+    do {
+        uint8_t b = (uint8_t)(len % 128);
+        len /= 128;
+        if(len > 0) b |= 0x80;
+        p[n++] = b;
+    } while(len > 0);
+    return n;
+}
+
+static size_t EncodePublish(uint8_t *p, const ecwMBUSMqttMsg *msg, uint16_t id) {
+    size_t n = 0;
+
+    p[n++] = MQTT_PUBLISHQOS1;
+    n += EncodeLength(p+n, 2 + msg->topicLen + 2 + msg->payloadLen);
+    p[n++] = 0;
+    p[n++] = msg->topicLen;
+    memcpy(p+n, msg->data, msg->topicLen);
+    n += msg->topicLen;
+    p[n++] = (uint8_t)(id >> 8);
+    p[n++] = (uint8_t) id;
+    memcpy(p+n, msg->data + msg->topicLen, msg->payloadLen);
+    return n + msg->payloadLen;
+}
+
+static int SendAll(int fd, const uint8_t *buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return APIERROR;
+        }
+        buf += n;
+        len -= n;
+    }
+    return APIOK;
+}
+
+static void Wake(pecwMBUSMqtt mqtt) {
+    if(!mqtt->wakePending) {
+        mqtt->wakePending = true;
+        if(write(mqtt->wake[1], "w", 1) < 0) {}
+    }
+}
+
+static void DrainWake(pecwMBUSMqtt mqtt) {
+    char buf[64];
+    while(read(mqtt->wake[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+static bool Stopped(pecwMBUSMqtt mqtt) {
+    bool stop;
+    pthread_mutex_lock(&mqtt->lock);
+    stop = mqtt->stop;
+    pthread_mutex_unlock(&mqtt->lock);
+    return stop;
+}
+
+static int ConnectSocket(pecwMBUSMqtt mqtt) {
+    struct addrinfo  hints, *res, *ai;
+    struct timeval   tv = { 10, 0 };
+    int              fd = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(mqtt->host, mqtt->port, &hints, &res) != 0) return -1;
+
+    for(ai = res; NULL != ai; ai = ai->ai_next) {
+        struct pollfd pfd;
+        int           err = 0;
+        socklen_t     errLen = sizeof(err);
+
+        if((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            pfd.fd     = fd;
+            pfd.events = POLLOUT;
+            if((errno != EINPROGRESS) || (poll(&pfd, 1, MQTT_TIMEOUT) != 1) ||
+               (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) != 0) || (err != 0)) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+        }
+        break;
+    }
+    freeaddrinfo(res);
+    if(fd < 0) return -1;
+
+    //blocking writes with a timeout, reads are polled
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int Connect(pecwMBUSMqtt mqtt) {
+    uint8_t       p[128];
+    size_t        n = 0, idLen = strlen(mqtt->clientId);
+    struct pollfd pfd;
+    double        deadline;
+    size_t        got = 0;
+    int           fd;
+
+    if((fd = ConnectSocket(mqtt)) < 0) return APIERROR;
+
+    p[n++] = MQTT_CONNECT;
+    n += EncodeLength(p+n, 10 + 2 + idLen);
+    p[n++] = 0;    p[n++] = 4;
+    p[n++] = 'M';  p[n++] = 'Q';  p[n++] = 'T';  p[n++] = 'T';
+    p[n++] = 4;                             //protocol level 3.1.1
+    p[n++] = 0x02;                          //clean session
+    p[n++] = (uint8_t)(MQTT_KEEPALIVE >> 8);
+    p[n++] = (uint8_t) MQTT_KEEPALIVE;
+    p[n++] = (uint8_t)(idLen >> 8);
+    p[n++] = (uint8_t) idLen;
+    memcpy(p+n, mqtt->clientId, idLen);
+    n += idLen;
+    if(SendAll(fd, p, n) != APIOK) {
+        close(fd);
+        return APIERROR;
+    }
+
+    //CONNACK: 0x20 0x02 flags returncode
+    deadline = NowMs() + MQTT_TIMEOUT;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    while(got < 4) {
+        ssize_t r;
+        int     left = (int)(deadline - NowMs());
+        if((left <= 0) || (poll(&pfd, 1, left) != 1) || ((r = recv(fd, p+got, 4-got, 0)) <= 0)) {
+            close(fd);
+            return APIERROR;
+        }
+        got += r;
+    }
+    if((p[0] != MQTT_CONNACK) || (p[1] != 2) || (p[3] != 0)) {
+        Log_Printf(LOGCAT_NET, LOGLVL_ERROR, "MQTT: connection refused by %s (%d)", mqtt->host, p[3]);
+        close(fd);
+        return APIERROR;
+    }
+
+    mqtt->fd       = fd;
+    mqtt->outLen   = 0;
+    mqtt->inLen    = 0;
+    mqtt->lastSend = mqtt->lastRecv = NowMs();
+    return APIOK;
+}
+
+//spool record: topic length, payload length, topic, payload; called with the spool lock held
+static int SpoolMsg(pecwMBUSMqtt mqtt, const ecwMBUSMqttMsg *msg) {
+    return Spool_Push(&mqtt->spool, msg, 2 + msg->topicLen + msg->payloadLen);
+}
+
+//the messages in flight are sent again, memory messages go to the spool so they
+//survive a restart while the broker is away
+static void Disconnect(pecwMBUSMqtt mqtt) {
+    unsigned long first = 0, n = 0, failed = 0, iX;
+
+    if(mqtt->fd >= 0) close(mqtt->fd);
+    mqtt->fd = -1;
+    pthread_mutex_lock(&mqtt->lock);
+    mqtt->connected     = false;
+    mqtt->stats.resent += mqtt->ifCount;
+    mqtt->ifHead = mqtt->ifCount = 0;
+    mqtt->qSend  = mqtt->qHead;
+    if(!mqtt->useSpool) {
+        pthread_mutex_unlock(&mqtt->lock);
+        return;
+    }
+    //the memory queue is older than anything spooled; its slots stay as they are, while
+    //disconnected and spooling Mqtt_Publish does not queue in memory
+    if(mqtt->spoolCount == 0) {
+        first = mqtt->qHead;
+        n     = mqtt->qTail - mqtt->qHead;
+        mqtt->qHead = mqtt->qSend = mqtt->qTail;
+        mqtt->spoolCount = n;
+    }
+    pthread_mutex_lock(&mqtt->spoolLock);
+    pthread_mutex_unlock(&mqtt->lock);
+    Spool_Rewind(&mqtt->spool);
+    for(iX=0; iX<n; iX++)
+        if(SpoolMsg(mqtt, &mqtt->queue[(first + iX) % MQTT_QUEUESIZE]) != APIOK) failed++;
+    if(n > 0) Spool_Sync(&mqtt->spool);
+    pthread_mutex_unlock(&mqtt->spoolLock);
+
+    if(n > 0) {
+        pthread_mutex_lock(&mqtt->lock);
+        mqtt->stats.spooled += n - failed;
+        mqtt->stats.dropped += failed;
+        mqtt->spoolCount    -= failed;
+        pthread_mutex_unlock(&mqtt->lock);
+    }
+}
+
+//called with the lock held, acknowledged messages leave the memory queue or the spool in
+//order, returns the spooled ones the caller commits
+static unsigned long Ack(pecwMBUSMqtt mqtt, uint16_t id) {
+    unsigned long nSpool = 0;
+    int           iX;
+
+    for(iX=0; iX<mqtt->ifCount; iX++) {
+        ecwMBUSMqttInflight *e = &mqtt->inflight[(mqtt->ifHead + iX) % MQTT_MAXWINDOW];
+        if((e->id == id) && !e->acked) {
+            e->acked = 1;
+            break;
+        }
+    }
+    while((mqtt->ifCount > 0) && mqtt->inflight[mqtt->ifHead].acked) {
+        if(mqtt->inflight[mqtt->ifHead].spooled) nSpool++;
+        else                                     mqtt->qHead++;
+        mqtt->ifHead = (mqtt->ifHead + 1) % MQTT_MAXWINDOW;
+        mqtt->ifCount--;
+        mqtt->stats.acked++;
+    }
+    mqtt->spoolCount -= nSpool;
+    return nSpool;
+}
+
+//called with the lock held, msg NULL for a spool record that is not a message,
+//it is committed in order with the others
+static void AddInflight(pecwMBUSMqtt mqtt, const ecwMBUSMqttMsg *msg, uint8_t spooled) {
+    ecwMBUSMqttInflight *e = &mqtt->inflight[(mqtt->ifHead + mqtt->ifCount) % MQTT_MAXWINDOW];
+
+    mqtt->ifCount++;
+    e->spooled = spooled;
+    if(NULL == msg) {
+        e->id    = 0;
+        e->acked = 1;
+        return;
+    }
+    if(++mqtt->nextId == 0) mqtt->nextId = 1;
+    e->id    = mqtt->nextId;
+    e->acked = 0;
+    mqtt->outLen += EncodePublish(mqtt->out + mqtt->outLen, msg, mqtt->nextId);
+}
+
+//memory messages first, then the spool, which is read without the lock
+static void FillWindow(pecwMBUSMqtt mqtt) {
+    ecwMBUSMqttMsg msg[MQTT_MAXWINDOW];
+    bool           valid[MQTT_MAXWINDOW];
+    size_t         len;
+    int            room, n = 0, iX;
+    bool           spool;
+
+    pthread_mutex_lock(&mqtt->lock);
+    while((mqtt->ifCount < mqtt->window) && (mqtt->outLen + MQTT_MAXPACKET <= MQTT_BUFFERSIZE) && (mqtt->qSend != mqtt->qTail))
+        AddInflight(mqtt, &mqtt->queue[mqtt->qSend++ % MQTT_QUEUESIZE], 0);
+    room  = min(mqtt->window - mqtt->ifCount, (int)((MQTT_BUFFERSIZE - mqtt->outLen)/MQTT_MAXPACKET));
+    spool = mqtt->useSpool && (mqtt->qSend == mqtt->qTail) && (mqtt->spoolCount > 0);
+    pthread_mutex_unlock(&mqtt->lock);
+    if(!spool || (room <= 0)) return;
+
+    pthread_mutex_lock(&mqtt->spoolLock);
+    while((n < room) && (Spool_Read(&mqtt->spool, &msg[n], sizeof(msg[n]), &len) == APIOK)) {
+        valid[n] = (len >= 2) && (len == (size_t)(2 + msg[n].topicLen + msg[n].payloadLen));
+        n++;
+    }
+    pthread_mutex_unlock(&mqtt->spoolLock);
+
+    pthread_mutex_lock(&mqtt->lock);
+    for(iX=0; iX<n; iX++)
+        AddInflight(mqtt, valid[iX] ? &msg[iX] : NULL, 1);
+    pthread_mutex_unlock(&mqtt->lock);
+}
+
+//handle all complete packets in the input buffer
+static void Parse(pecwMBUSMqtt mqtt) {
+    unsigned long nSpool = 0;
+    size_t        off = 0;
+
+    pthread_mutex_lock(&mqtt->lock);
+    while(off + 2 <= mqtt->inLen) {
+        size_t rem = 0, mul = 1, hdr = 1;
+        while((off + hdr < mqtt->inLen) && (hdr < 5)) {
+            uint8_t b = mqtt->in[off + hdr++];
+            rem += (b & 0x7F)*mul;
+            mul *= 128;
+            if(!(b & 0x80)) break;
+        }
+        if((off + hdr > mqtt->inLen) || (mqtt->in[off + hdr - 1] & 0x80) || (off + hdr + rem > mqtt->inLen))
+            break; //incomplete
+        if(((mqtt->in[off] & 0xF0) == MQTT_PUBACK) && (rem >= 2))
+            nSpool += Ack(mqtt, (uint16_t)((mqtt->in[off+hdr] << 8) | mqtt->in[off+hdr+1]));
+        off += hdr + rem;
+    }
+    pthread_mutex_unlock(&mqtt->lock);
+    if(nSpool > 0) {
+        pthread_mutex_lock(&mqtt->spoolLock);
+        Spool_Commit(&mqtt->spool, nSpool);
+        pthread_mutex_unlock(&mqtt->spoolLock);
+    }
+    if(off > 0) {
+        memmove(mqtt->in, mqtt->in + off, mqtt->inLen - off);
+        mqtt->inLen -= off;
+    }
+}
+
+void * Mqtt_ThreadProc(void *arg) {
+    pecwMBUSMqtt  mqtt = (pecwMBUSMqtt) arg;
+    int           backoff = MQTT_BACKOFFMIN;
+    unsigned long synced = 0, spooled;
+    double        lastSync = NowMs();
+
+    while(!Stopped(mqtt)) {
+        struct pollfd pfd[2];
+        double        now;
+        int           timeout;
+
+        if(mqtt->fd < 0) {
+            if(Connect(mqtt) == APIOK) {
+                pthread_mutex_lock(&mqtt->lock);
+                mqtt->connected = true;
+                mqtt->stats.connects++;
+                pthread_mutex_unlock(&mqtt->lock);
+                backoff = MQTT_BACKOFFMIN;
+            }
+            else { //wait, Mqtt_Close wakes us up
+                pfd[0].fd     = mqtt->wake[0];
+                pfd[0].events = POLLIN;
+                if(poll(pfd, 1, backoff) > 0) DrainWake(mqtt);
+                backoff = min(2*backoff, MQTT_BACKOFFMAX);
+                continue;
+            }
+        }
+
+        //everything the window allows goes out with one send
+        pthread_mutex_lock(&mqtt->lock);
+        mqtt->wakePending = false;
+        spooled = mqtt->stats.spooled;
+        pthread_mutex_unlock(&mqtt->lock);
+        FillWindow(mqtt);
+        if(mqtt->useSpool && (spooled != synced) && (NowMs() - lastSync > 1000)) {
+            pthread_mutex_lock(&mqtt->spoolLock);
+            Spool_Sync(&mqtt->spool);
+            pthread_mutex_unlock(&mqtt->spoolLock);
+            synced   = spooled;
+            lastSync = NowMs();
+        }
+
+        if(mqtt->outLen > 0) {
+            if(SendAll(mqtt->fd, mqtt->out, mqtt->outLen) != APIOK) {
+                Disconnect(mqtt);
+                continue;
+            }
+            mqtt->outLen   = 0;
+            mqtt->lastSend = NowMs();
+            pthread_mutex_lock(&mqtt->lock);
+            mqtt->stats.writes++;
+            pthread_mutex_unlock(&mqtt->lock);
+        }
+
+        now     = NowMs();
+        timeout = (int)(mqtt->lastSend + MQTT_KEEPALIVE*1000.0 - now);
+        pfd[0].fd     = mqtt->fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd     = mqtt->wake[0];
+        pfd[1].events = POLLIN;
+        if(poll(pfd, 2, (timeout > 0) ? timeout : 0) < 0) {
+            if(errno == EINTR) continue;
+            Disconnect(mqtt);
+            continue;
+        }
+        if(pfd[1].revents & POLLIN) DrainWake(mqtt);
+        if(pfd[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            ssize_t r = recv(mqtt->fd, mqtt->in + mqtt->inLen, MQTT_BUFFERSIZE - mqtt->inLen, 0);
+            if(r <= 0) {
+                Disconnect(mqtt);
+                continue;
+            }
+            mqtt->inLen   += r;
+            mqtt->lastRecv = NowMs();
+            Parse(mqtt);
+        }
+
+        now = NowMs();
+        if(now - mqtt->lastSend >= MQTT_KEEPALIVE*1000.0) {
+            uint8_t ping[2] = { MQTT_PINGREQ, 0 };
+            if(SendAll(mqtt->fd, ping, 2) != APIOK) {
+                Disconnect(mqtt);
+                continue;
+            }
+            mqtt->lastSend = now;
+        }
+        if(now - mqtt->lastRecv > MQTT_KEEPALIVE*1500.0) { //no PINGRESP
+            Log_Printf(LOGCAT_NET, LOGLVL_WARN, "MQTT: %s does not answer", mqtt->host);
+            Disconnect(mqtt);
+        }
+    }
+
+    if(mqtt->fd >= 0) {
+        uint8_t bye[2] = { MQTT_DISCONNECT, 0 };
+        SendAll(mqtt->fd, bye, 2);
+    }
+    Disconnect(mqtt);
+    return 0;
+}
+
+//broker is host[:port], readings go to spoolPath while it is away (NULL for memory only)
+int Mqtt_Open(pecwMBUSMqtt mqtt, const char *broker, const char *spoolPath, int window) {
+    const char *sep;
+    char        host[64];
+
+    if((NULL == mqtt) || (NULL == broker) || (0 == *broker)) return APIERROR;
+    memset(mqtt, 0, sizeof(ecwMBUSMqtt));
+    mqtt->fd = -1;
+    mqtt->wake[0] = mqtt->wake[1] = -1;
+    mqtt->window = ((window <= 0) || (window > MQTT_MAXWINDOW)) ? MQTT_WINDOW : window;
+
+    if((NULL != (sep = strrchr(broker, ':'))) && (NULL == strchr(sep, ']'))) {
+        snprintf(mqtt->host, sizeof(mqtt->host), "%.*s", (int)(sep-broker), broker);
+        snprintf(mqtt->port, sizeof(mqtt->port), "%s", sep+1);
+    }
+    else {
+        snprintf(mqtt->host, sizeof(mqtt->host), "%s", broker);
+        snprintf(mqtt->port, sizeof(mqtt->port), "%d", MQTT_DEFAULTPORT);
+    }
+    if((mqtt->host[0] == '[') && (mqtt->host[strlen(mqtt->host)-1] == ']')) { //[ipv6]
+        memmove(mqtt->host, mqtt->host+1, strlen(mqtt->host));
+        mqtt->host[strlen(mqtt->host)-1] = 0;
+    }
+    if(gethostname(host, sizeof(host)) != 0) strcpy(host, "pi");
+    host[sizeof(host)-1] = 0;
+    snprintf(mqtt->clientId, sizeof(mqtt->clientId), "eccwmbus-%.30s", host);
+    snprintf(mqtt->prefix, sizeof(mqtt->prefix), "%s", MQTT_TOPICPREFIX);
+
+    if((NULL != spoolPath) && (0 != *spoolPath)) {
+        if(Spool_Open(&mqtt->spool, spoolPath, SPOOL_DEFAULTMAX) != APIOK) return APIERROR;
+        mqtt->useSpool   = true;
+        mqtt->spoolCount = mqtt->spool.count;
+        if(mqtt->spool.count > 0)
+            Log_Printf(LOGCAT_NET, LOGLVL_INFO, "MQTT: %lu messages in the spool", mqtt->spool.count);
+    }
+
+    mqtt->queue = (ecwMBUSMqttMsg *) malloc(MQTT_QUEUESIZE*sizeof(ecwMBUSMqttMsg));
+    mqtt->out   = (uint8_t *) malloc(MQTT_BUFFERSIZE);
+    mqtt->in    = (uint8_t *) malloc(MQTT_BUFFERSIZE);
+    if((NULL == mqtt->queue) || (NULL == mqtt->out) || (NULL == mqtt->in) || (pipe(mqtt->wake) != 0)) {
+        Mqtt_Close(mqtt);
+        return APIERROR;
+    }
+    fcntl(mqtt->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(mqtt->wake[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&mqtt->lock, NULL);
+    pthread_mutex_init(&mqtt->spoolLock, NULL);
+    mqtt->running = (0 == pthread_create(&mqtt->thread, NULL, Mqtt_ThreadProc, mqtt));
+    if(!mqtt->running) {
+        pthread_mutex_destroy(&mqtt->lock);
+        pthread_mutex_destroy(&mqtt->spoolLock);
+        Mqtt_Close(mqtt);
+        return APIERROR;
+    }
+    return APIOK;
+}
+
+//queue a reading, called from the receiving thread
+void Mqtt_Publish(pecwMBUSMqtt mqtt, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    ecwMBUSMqttMsg msg;
+    bool           spool;
+    int            n, ret;
+
+    if((NULL == mqtt) || !mqtt->running) return;
+
+    n = snprintf(msg.data, MQTT_MAXTOPIC, "%s/%04x/%08x/value", mqtt->prefix, meter->manufacturerID, meter->ident);
+    if((n < 0) || (n >= MQTT_MAXTOPIC)) return;
+    msg.topicLen   = (uint8_t)n;
+    msg.payloadLen = (uint8_t)Fmt_Value(msg.data + n, data->value, data->exp);
+
+    //the spool lock is taken before the lock is released, so the spool gets the messages in order
+    pthread_mutex_lock(&mqtt->lock);
+    mqtt->stats.published++;
+    spool = mqtt->useSpool && (!mqtt->connected || (mqtt->spoolCount > 0) || (mqtt->qTail - mqtt->qHead >= MQTT_QUEUESIZE));
+    if(spool) {
+        mqtt->spoolCount++;
+        pthread_mutex_lock(&mqtt->spoolLock);
+    }
+    else if(mqtt->qTail - mqtt->qHead < MQTT_QUEUESIZE)
+        mqtt->queue[mqtt->qTail++ % MQTT_QUEUESIZE] = msg;
+    else
+        mqtt->stats.dropped++;
+    Wake(mqtt);
+    pthread_mutex_unlock(&mqtt->lock);
+    if(!spool) return;
+
+    ret = SpoolMsg(mqtt, &msg);
+    pthread_mutex_unlock(&mqtt->spoolLock);
+    pthread_mutex_lock(&mqtt->lock);
+    if(ret == APIOK) mqtt->stats.spooled++;
+    else {
+        mqtt->stats.dropped++;
+        mqtt->spoolCount--;
+    }
+    pthread_mutex_unlock(&mqtt->lock);
+}
+
+//messages in memory and in the spool, messages dropped so far
+void Mqtt_GetQueue(pecwMBUSMqtt mqtt, unsigned long *queued, unsigned long *spooled, unsigned long *dropped) {
+    *queued = *spooled = *dropped = 0;
+    if((NULL == mqtt) || !mqtt->running) return;
+    pthread_mutex_lock(&mqtt->lock);
+    *queued  = mqtt->qTail - mqtt->qHead;
+    *spooled = mqtt->spoolCount;
+    *dropped = mqtt->stats.dropped;
+    pthread_mutex_unlock(&mqtt->lock);
+}
+
+void Mqtt_PrintStats(pecwMBUSMqtt mqtt) {
+    ecwMBUSMqttStats stats;
+    unsigned long    queued, spool;
+    int              inflight;
+    bool             connected;
+
+    if((NULL == mqtt) || !mqtt->running) return;
+    pthread_mutex_lock(&mqtt->lock);
+    stats     = mqtt->stats;
+    queued    = mqtt->qTail - mqtt->qHead;
+    spool     = mqtt->spoolCount;
+    inflight  = mqtt->ifCount;
+    connected = mqtt->connected;
+    pthread_mutex_unlock(&mqtt->lock);
+
+    printf("MQTT %-16s: %s, %lu connects, window %d, %d in flight\n", mqtt->host,
+           connected ? "connected" : "disconnected", stats.connects, mqtt->window, inflight);
+    printf("MQTT messages        : %lu published, %lu acked, %lu queued, %lu spooled (%lu in spool), %lu dropped, %lu resent\n",
+           stats.published, stats.acked, queued, stats.spooled, spool, stats.dropped, stats.resent);
+    printf("MQTT writes          : %lu (%.1f messages/write)\n", stats.writes,
+           (stats.writes > 0) ? (double)stats.acked/stats.writes : 0.0);
+}
+
+//after the sender thread stopped: the rest of the memory queue is older than the spooled
+//messages and goes in front of them, it is sent first on the next start
+static void PrependQueue(pecwMBUSMqtt mqtt) {
+    unsigned long n = mqtt->qTail - mqtt->qHead, iX;
+    const void  **data;
+    size_t       *len;
+
+    if(n == 0) return;
+    data = (const void **) malloc(n*sizeof(const void *));
+    len  = (size_t *) malloc(n*sizeof(size_t));
+    if((NULL != data) && (NULL != len)) {
+        for(iX=0; iX<n; iX++) {
+            const ecwMBUSMqttMsg *msg = &mqtt->queue[(mqtt->qHead + iX) % MQTT_QUEUESIZE];
+            data[iX] = msg;
+            len[iX]  = 2 + msg->topicLen + msg->payloadLen;
+        }
+        if(Spool_Prepend(&mqtt->spool, data, len, n) == APIOK) {
+            mqtt->stats.spooled += n;
+            mqtt->qHead = mqtt->qTail;
+        }
+    }
+    free(data);
+    free(len);
+}
+
+void Mqtt_Close(pecwMBUSMqtt mqtt) {
+    if(NULL == mqtt) return;
+    if(mqtt->running) {
+        pthread_mutex_lock(&mqtt->lock);
+        mqtt->stop = true;
+        Wake(mqtt);
+        pthread_mutex_unlock(&mqtt->lock);
+        pthread_join(mqtt->thread, NULL);
+        mqtt->running = false;
+        pthread_mutex_destroy(&mqtt->lock);
+        pthread_mutex_destroy(&mqtt->spoolLock);
+        if(mqtt->useSpool) PrependQueue(mqtt);
+        if(mqtt->qTail != mqtt->qHead)
+            Log_Printf(LOGCAT_NET, LOGLVL_WARN, "MQTT: %lu messages not sent", mqtt->qTail - mqtt->qHead);
+    }
+    if(mqtt->useSpool) Spool_Close(&mqtt->spool);
+    if(mqtt->wake[0] >= 0) close(mqtt->wake[0]);
+    if(mqtt->wake[1] >= 0) close(mqtt->wake[1]);
+    mqtt->wake[0] = mqtt->wake[1] = -1;
+    free(mqtt->queue);
+    free(mqtt->out);
+    free(mqtt->in);
+    mqtt->queue = NULL;
+    mqtt->out   = mqtt->in = NULL;
+    mqtt->useSpool = false;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusfmt.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusndjson.h>
+
+static int WriteAll(int fd, const char *p, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        n = write(fd, p, len);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return APIERROR;
+        }
+        p   += n;
+        len -= n;
+    }
+    return APIOK;
+}
+
+int Ndj_Open(pecwMBUSNdjson ndj, int fd, int flags) {
+    if((NULL == ndj) || (fd < 0)) return APIERROR;
+    memset(ndj, 0, sizeof(ecwMBUSNdjson));
+    ndj->fd    = fd;
+    ndj->flags = flags & FMT_PAYLOAD;
+    if(NULL == (ndj->buf = (char *) malloc(NDJ_BUFFERSIZE))) return APIERROR;
+    signal(SIGPIPE, SIG_IGN); //a closed pipe shows up as write error
+    pthread_mutex_init(&ndj->lock, NULL);
+    ndj->open = true;
+    return APIOK;
+}
+
+//idle handler of the sink: everything collected since the last write goes out at once
+void Ndj_Flush(void *ctx, uint64_t tag) {
+    pecwMBUSNdjson ndj = (pecwMBUSNdjson) ctx;
+    bool           failed;
+
+    if((NULL == ndj) || !ndj->open || (0 == ndj->len)) return;
+    failed = ndj->failed || (WriteAll(ndj->fd, ndj->buf, ndj->len) != APIOK);
+    if(failed && !ndj->failed)
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "NDJSON output closed, readings are dropped");
+
+    pthread_mutex_lock(&ndj->lock);
+    if(failed) ndj->dropped += ndj->queued;
+    else {
+        ndj->written += ndj->queued;
+        ndj->writes++;
+        ndj->bytes   += ndj->len;
+    }
+    ndj->failed = failed;
+    ndj->queued = 0;
+    pthread_mutex_unlock(&ndj->lock);
+    ndj->len = 0;
+}
+
+//write handler of the sink, formats a reading into the buffer
+int Ndj_Write(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    pecwMBUSNdjson ndj = (pecwMBUSNdjson) ctx;
+
+    if((NULL == ndj) || !ndj->open) return APIERROR;
+    if(ndj->failed) {
+        pthread_mutex_lock(&ndj->lock);
+        ndj->dropped++;
+        pthread_mutex_unlock(&ndj->lock);
+        return APIERROR;
+    }
+    if(ndj->len + FMT_MAXJSON > NDJ_BUFFERSIZE)
+        Ndj_Flush(ndj, tag);
+    ndj->len += Fmt_ReadingJSON(ndj->buf + ndj->len, meter, data, ndj->flags | FMT_NEWLINE);
+    pthread_mutex_lock(&ndj->lock);
+    ndj->queued++;
+    pthread_mutex_unlock(&ndj->lock);
+    return APIOK;
+}
+
+//readings buffered, readings dropped so far
+void Ndj_GetQueue(pecwMBUSNdjson ndj, unsigned long *queued, unsigned long *dropped) {
+    *queued = *dropped = 0;
+    if((NULL == ndj) || !ndj->open) return;
+    pthread_mutex_lock(&ndj->lock);
+    *queued  = ndj->queued;
+    *dropped = ndj->dropped;
+    pthread_mutex_unlock(&ndj->lock);
+}
+
+void Ndj_PrintStats(pecwMBUSNdjson ndj) {
+    if((NULL == ndj) || !ndj->open) return;
+    pthread_mutex_lock(&ndj->lock);
+    printf("NDJSON readings      : %lu written, %lu dropped%s\n", ndj->written, ndj->dropped,
+            ndj->failed ? ", output closed" : "");
+    printf("NDJSON writes        : %lu (%.1f readings/write, %lu bytes)\n", ndj->writes,
+            (ndj->writes > 0) ? (double)ndj->written/ndj->writes : 0.0, ndj->bytes);
+    pthread_mutex_unlock(&ndj->lock);
+}
+
+//called after the sink is closed, writes what is buffered; the descriptor is closed by the caller
+void Ndj_Close(pecwMBUSNdjson ndj) {
+    if((NULL == ndj) || !ndj->open) return;
+    Ndj_Flush(ndj, 0);
+    ndj->open = false;
+    pthread_mutex_destroy(&ndj->lock);
+    free(ndj->buf);
+    ndj->buf = NULL;
+}
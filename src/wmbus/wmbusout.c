@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusout.h>
+
+static const char HexDigits[] = "0123456789abcdef";
+
+static bool PutHex(char **pp, char *end, uint32_t v, int digits) {
+    int iX;
+    if(end - *pp < digits) return false;
+    for(iX=digits-1; iX>=0; iX--) {
+        (*pp)[iX] = HexDigits[v & 0x0F];
+        v >>= 4;
+    }
+    *pp += digits;
+    return true;
+}
+
+static bool PutDec(char **pp, char *end, uint32_t v, int digits) {
+    int iX;
+    if(end - *pp < digits) return false;
+    for(iX=digits-1; iX>=0; iX--) {
+        (*pp)[iX] = (char)('0' + v%10);
+        v /= 10;
+    }
+    *pp += digits;
+    return true;
+}
+
+//expand a path template for a meter, returns APIERROR if the result does not fit
+int Out_ExpandPath(char *path, size_t size, const char *tmpl, const char *datapath, const ecwMBUSMeter *meter, const struct tm *tm) {
+    char *p   = path;
+    char *end = path + size - 1;
+    bool  ok  = true;
+
+    if((NULL == path) || (size == 0) || (NULL == tmpl) || (NULL == meter)) return APIERROR;
+    if((NULL == datapath) || (0 == *datapath)) datapath = OUT_DEFAULTDATAPATH;
+
+    while(*tmpl && ok) {
+        if(*tmpl != '%') {
+            if(p >= end) ok = false;
+            else         *p++ = *tmpl;
+            tmpl++;
+            continue;
+        }
+        tmpl++;
+        switch(*tmpl) {
+            case 'd': {
+                size_t len = strlen(datapath);
+                if((size_t)(end - p) < len) ok = false;
+                else {
+                    memcpy(p, datapath, len);
+                    p += len;
+                }
+                break;
+            }
+            case 'm': ok = PutHex(&p, end, meter->manufacturerID, 4); break;
+            case 'i': ok = PutHex(&p, end, meter->ident,          8); break;
+            case 't': ok = PutHex(&p, end, meter->type,           2); break;
+            case 'v': ok = PutHex(&p, end, meter->version,        2); break;
+            case 'Y': ok = (NULL != tm) && PutDec(&p, end, tm->tm_year+1900, 4); break;
+            case 'M': ok = (NULL != tm) && PutDec(&p, end, tm->tm_mon+1,     2); break;
+            case 'D': ok = (NULL != tm) && PutDec(&p, end, tm->tm_mday,      2); break;
+            case '%':
+                if(p >= end) ok = false;
+                else         *p++ = '%';
+                break;
+            default:
+                ok = false; //unknown token or % at the end
+                break;
+        }
+        if(*tmpl) tmpl++;
+    }
+    *p = 0;
+    return ok ? APIOK : APIERROR;
+}
+
+//create all parent directories of path
+int Out_MakeDirs(const char *path) {
+    char  dir[_MAX_PATH];
+    char *p;
+
+    if(strlen(path) >= sizeof(dir)) return APIERROR;
+    strcpy(dir, path);
+    for(p = dir+1; *p; p++) {
+        if(*p != '/') continue;
+        *p = 0;
+        if((mkdir(dir, 0777) != 0) && (errno != EEXIST)) return APIERROR;
+        *p = '/';
+    }
+    return APIOK;
+}
+
+static uint32_t HashPath(const char *path) {
+    uint32_t h = 2166136261u; //FNV-1a
+    while(*path) {
+        h ^= (uint8_t)*path++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int Out_InitCache(pecwMBUSFileCache cache, int maxOpen) {
+    if(NULL == cache) return APIERROR;
+    memset(cache, 0, sizeof(ecwMBUSFileCache));
+    cache->maxOpen = (maxOpen <= 0) ? OUT_DEFAULTMAXOPEN : min(maxOpen, OUT_MAXOPEN);
+    cache->files   = (ecwMBUSOutFile *) calloc(cache->maxOpen, sizeof(ecwMBUSOutFile));
+    return (NULL == cache->files) ? APIERROR : APIOK;
+}
+
+static void CloseEntry(pecwMBUSFileCache cache, int index) {
+    if(cache->syncOnClose)
+        fdatasync(cache->files[index].fd); //evicted rows must be on disk before a journal checkpoint
+    close(cache->files[index].fd);
+    cache->count--;
+    if(index != cache->count)
+        cache->files[index] = cache->files[cache->count];
+}
+
+//get an open descriptor for path, opening it (and its directories) on a miss
+//the least recently used file is closed when the cache is full
+//isNew is set when the file was empty on open, e.g. to write a header
+int Out_GetFile(pecwMBUSFileCache cache, const char *path, int flags, bool *isNew) {
+    uint32_t    hash = HashPath(path);
+    struct stat st;
+    int         iX, fd;
+
+    if(NULL != isNew) *isNew = false;
+    cache->tick++;
+
+    for(iX=0; iX<cache->count; iX++) {
+        if((cache->files[iX].hash == hash) && (cache->files[iX].flags == flags) && (0 == strcmp(cache->files[iX].path, path))) {
+            cache->files[iX].lastUse = cache->tick;
+            cache->hits++;
+            return cache->files[iX].fd;
+        }
+    }
+    cache->misses++;
+
+    if(strlen(path) >= _MAX_PATH) return -1;
+
+    if((fd = open(path, flags | O_CREAT, 0666)) < 0) {
+        if((errno != ENOENT) || (Out_MakeDirs(path) != APIOK) || ((fd = open(path, flags | O_CREAT, 0666)) < 0))
+            return -1;
+    }
+    if((NULL != isNew) && (fstat(fd, &st) == 0) && (st.st_size == 0))
+        *isNew = true;
+
+    if(cache->count == cache->maxOpen) { //evict LRU
+        int iLRU = 0;
+        for(iX=1; iX<cache->count; iX++) {
+            if((uint32_t)(cache->tick - cache->files[iX].lastUse) > (uint32_t)(cache->tick - cache->files[iLRU].lastUse))
+                iLRU = iX;
+        }
+        CloseEntry(cache, iLRU);
+    }
+
+    iX = cache->count++;
+    strcpy(cache->files[iX].path, path);
+    cache->files[iX].hash    = hash;
+    cache->files[iX].fd      = fd;
+    cache->files[iX].flags   = flags;
+    cache->files[iX].lastUse = cache->tick;
+    return fd;
+}
+
+void Out_CloseFile(pecwMBUSFileCache cache, const char *path) {
+    uint32_t hash = HashPath(path);
+    int      iX;
+
+    for(iX=cache->count-1; iX>=0; iX--) {
+        if((cache->files[iX].hash == hash) && (0 == strcmp(cache->files[iX].path, path)))
+            CloseEntry(cache, iX);
+    }
+}
+
+//flush all open files to disk
+void Out_SyncAll(pecwMBUSFileCache cache) {
+    int iX;
+    for(iX=0; iX<cache->count; iX++)
+        fdatasync(cache->files[iX].fd);
+}
+
+void Out_CloseAll(pecwMBUSFileCache cache) {
+    while(cache->count > 0)
+        CloseEntry(cache, cache->count-1);
+}
+
+void Out_FreeCache(pecwMBUSFileCache cache) {
+    if(NULL == cache) return;
+    if(NULL != cache->files) {
+        Out_CloseAll(cache);
+        free(cache->files);
+    }
+    memset(cache, 0, sizeof(ecwMBUSFileCache));
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbuspool.h>
+
+static pecwMBUSReading  Chunks[POOL_MAXCHUNKS];
+static int              ChunkCount = 0;
+static pecwMBUSReading  FreeList = NULL;
+static ecwMBUSPoolStats Stats;
+static pthread_mutex_t  lockPool = PTHREAD_MUTEX_INITIALIZER;
+
+//one chunk onto the free list, the caller holds the lock
+static bool Grow(void) {
+    pecwMBUSReading chunk;
+    int             iX;
+
+    if(ChunkCount >= POOL_MAXCHUNKS) return false;
+    if(NULL == (chunk = (pecwMBUSReading) malloc(POOL_CHUNK*sizeof(ecwMBUSReading)))) return false;
+    for(iX=0; iX<POOL_CHUNK; iX++) {
+        chunk[iX].refs = 0;
+        chunk[iX].next = FreeList;
+        FreeList = &chunk[iX];
+    }
+    Chunks[ChunkCount++] = chunk;
+    Stats.size += POOL_CHUNK;
+    Stats.allocations++;
+    return true;
+}
+
+pecwMBUSReading Pool_Get(const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    pecwMBUSReading reading;
+
+    pthread_mutex_lock(&lockPool);
+    if((NULL == FreeList) && !Grow()) {
+        Stats.failed++;
+        pthread_mutex_unlock(&lockPool);
+        return NULL;
+    }
+    reading  = FreeList;
+    FreeList = reading->next;
+    Stats.inUse++;
+    Stats.gets++;
+    pthread_mutex_unlock(&lockPool);
+
+    reading->meter = *meter;
+    reading->data  = *data;
+    reading->refs  = 1;
+    reading->next  = NULL;
+    return reading;
+}
+
+void Pool_Hold(pecwMBUSReading reading) {
+    __atomic_add_fetch(&reading->refs, 1, __ATOMIC_RELAXED);
+}
+
+void Pool_Release(pecwMBUSReading reading) {
+    if(NULL == reading) return;
+    if(__atomic_sub_fetch(&reading->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+    pthread_mutex_lock(&lockPool);
+    reading->next = FreeList;
+    FreeList = reading;
+    Stats.inUse--;
+    pthread_mutex_unlock(&lockPool);
+}
+
+void Pool_GetStats(ecwMBUSPoolStats *stats) {
+    pthread_mutex_lock(&lockPool);
+    *stats = Stats;
+    pthread_mutex_unlock(&lockPool);
+}
+
+void Pool_Free(void) {
+    int iX;
+
+    pthread_mutex_lock(&lockPool);
+    for(iX=0; iX<ChunkCount; iX++)
+        free(Chunks[iX]);
+    ChunkCount = 0;
+    FreeList   = NULL;
+    memset(&Stats, 0, sizeof(Stats));
+    pthread_mutex_unlock(&lockPool);
+}
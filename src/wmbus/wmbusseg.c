@@ -0,0 +1,564 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusjournal.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusseg.h>
+#include <wmbus/wmbusle.h>
+
+static int SegPath(char *path, const char *dir, uint64_t base) {
+    int n = snprintf(path, _MAX_PATH, "%s/%020llu" SEG_FILESUFFIX, dir, (unsigned long long)base);
+    return ((n < 0) || (n >= _MAX_PATH)) ? APIERROR : APIOK;
+}
+
+static int OffPath(char *path, const char *dir, const char *name, const char *suffix) {
+    int n = snprintf(path, _MAX_PATH, "%s/%s" SEG_OFFSUFFIX "%s", dir, name, suffix);
+    return ((n < 0) || (n >= _MAX_PATH)) ? APIERROR : APIOK;
+}
+
+static void SyncDir(const char *dir) {
+    int fd;
+    if((fd = open(dir, O_RDONLY | O_DIRECTORY)) >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static double NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+//consumer names become file names: letters, digits, '-', '_' and '.'
+int Seg_ValidName(const char *name) {
+    size_t len;
+
+    if((NULL == name) || (0 == (len = strlen(name))) || (len > SEG_MAXNAME) || (name[0] == '.'))
+        return APIERROR;
+    for(; *name; name++) {
+        if(!(((*name >= 'a') && (*name <= 'z')) || ((*name >= 'A') && (*name <= 'Z')) ||
+             ((*name >= '0') && (*name <= '9')) || (*name == '-') || (*name == '_') || (*name == '.')))
+            return APIERROR;
+    }
+    return APIOK;
+}
+
+static int CompareBase(const void *a, const void *b) {
+    uint64_t ba = *(const uint64_t *)a;
+    uint64_t bb = *(const uint64_t *)b;
+    return (ba < bb) ? -1 : (ba > bb);
+}
+
+//base offsets of all segments in dir, ascending, the caller frees *bases
+int Seg_ListSegments(const char *dir, uint64_t **bases, int *count) {
+    DIR           *d;
+    struct dirent *de;
+    uint64_t      *list = NULL;
+    int            n = 0, size = 0;
+
+    *bases = NULL;
+    *count = 0;
+    if(NULL == (d = opendir(dir))) return APIERROR;
+    while(NULL != (de = readdir(d))) {
+        const char *p = de->d_name;
+        uint64_t    base = 0;
+        int         iX;
+
+        if((strlen(p) != 20 + strlen(SEG_FILESUFFIX)) || (0 != strcmp(p+20, SEG_FILESUFFIX)))
+            continue;
+        for(iX=0; iX<20; iX++) {
+            if((p[iX] < '0') || (p[iX] > '9')) break;
+            base = base*10 + (uint64_t)(p[iX]-'0');
+        }
+        if(iX < 20) continue;
+        if(n == size) {
+            uint64_t *grow = (uint64_t *) realloc(list, (size ? 2*size : 32)*sizeof(uint64_t));
+            if(NULL == grow) {
+                free(list);
+                closedir(d);
+                return APIERROR;
+            }
+            list = grow;
+            size = size ? 2*size : 32;
+        }
+        list[n++] = base;
+    }
+    closedir(d);
+    if(n > 1) qsort(list, n, sizeof(uint64_t), CompareBase);
+    *bases = list;
+    *count = n;
+    return APIOK;
+}
+
+int Seg_GetOffset(const char *dir, const char *name, uint64_t *offset) {
+    char    path[_MAX_PATH];
+    uint8_t buf[SEG_OFFSIZE];
+    int     fd;
+    ssize_t n;
+
+    if((Seg_ValidName(name) != APIOK) || (OffPath(path, dir, name, "") != APIOK)) return APIERROR;
+    if((fd = open(path, O_RDONLY)) < 0) return APIERROR;
+    n = pread(fd, buf, SEG_OFFSIZE, 0);
+    close(fd);
+    if((n != SEG_OFFSIZE) || (GetU32(buf) != SEG_OFFMAGIC) || (Jnl_Crc32(buf+4, 8, 0) != GetU32(buf+12)))
+        return APIERROR;
+    *offset = GetU64(buf+4);
+    return APIOK;
+}
+
+//write the offset to a temporary file and rename it, a crash leaves the old or the new offset
+int Seg_SetOffset(const char *dir, const char *name, uint64_t offset) {
+    char    path[_MAX_PATH];
+    char    tmp[_MAX_PATH];
+    uint8_t buf[SEG_OFFSIZE];
+    int     fd, ret = APIOK;
+
+    if((Seg_ValidName(name) != APIOK) || (OffPath(path, dir, name, "") != APIOK) || (OffPath(tmp, dir, name, ".tmp") != APIOK))
+        return APIERROR;
+
+    PutU32(buf,    SEG_OFFMAGIC);
+    PutU64(buf+4,  offset);
+    PutU32(buf+12, Jnl_Crc32(buf+4, 8, 0));
+    if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) return APIERROR;
+    if((pwrite(fd, buf, SEG_OFFSIZE, 0) != SEG_OFFSIZE) || (fdatasync(fd) != 0)) ret = APIERROR;
+    close(fd);
+    if((APIOK != ret) || (rename(tmp, path) != 0)) {
+        unlink(tmp);
+        return APIERROR;
+    }
+    return APIOK;
+}
+
+//lowest committed offset of all consumers, APIERROR when there is no consumer
+static int MinConsumerOffset(const char *dir, uint64_t *minOffset) {
+    DIR           *d;
+    struct dirent *de;
+    char           name[SEG_MAXNAME+1];
+    size_t         sfx = strlen(SEG_OFFSUFFIX);
+    uint64_t       offset;
+    bool           found = false;
+
+    if(NULL == (d = opendir(dir))) return APIERROR;
+    while(NULL != (de = readdir(d))) {
+        size_t len = strlen(de->d_name);
+        if((len <= sfx) || (len-sfx > SEG_MAXNAME) || (0 != strcmp(de->d_name+len-sfx, SEG_OFFSUFFIX)))
+            continue;
+        memcpy(name, de->d_name, len-sfx);
+        name[len-sfx] = 0;
+        if(Seg_GetOffset(dir, name, &offset) != APIOK)
+            continue;
+        if(!found || (offset < *minOffset)) *minOffset = offset;
+        found = true;
+    }
+    closedir(d);
+    return found ? APIOK : APIERROR;
+}
+
+static int CreateSegment(pecwMBUSSegLog log, uint64_t base) {
+    char    path[_MAX_PATH];
+    uint8_t header[SEG_HEADERSIZE];
+
+    if(SegPath(path, log->dir, base) != APIOK) return APIERROR;
+    if((log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) return APIERROR;
+
+    memset(header, 0, sizeof(header));
+    PutU32(header,    SEG_MAGIC);
+    PutU16(header+4,  SEG_VERSION);
+    PutU16(header+6,  SEG_HEADERSIZE);
+    PutU64(header+8,  base);
+    PutU32(header+16, Jnl_Crc32(header+8, 8, 0));
+    if((pwrite(log->fd, header, SEG_HEADERSIZE, 0) != SEG_HEADERSIZE) || (fdatasync(log->fd) != 0)) {
+        close(log->fd);
+        log->fd = -1;
+        return APIERROR;
+    }
+    SyncDir(log->dir);
+    log->base       = base;
+    log->nextOffset = base;
+    log->size       = SEG_HEADERSIZE;
+    return APIOK;
+}
+
+static int CheckHeader(const uint8_t *header, uint64_t base) {
+    if((GetU32(header) != SEG_MAGIC) || (GetU16(header+4) != SEG_VERSION) || (GetU16(header+6) != SEG_HEADERSIZE) ||
+       (Jnl_Crc32(header+8, 8, 0) != GetU32(header+16)) || (GetU64(header+8) != base))
+        return APIERROR;
+    return APIOK;
+}
+
+//open the last segment for appending, a torn record at its end is cut off
+static int RecoverSegment(pecwMBUSSegLog log, uint64_t base) {
+    char          path[_MAX_PATH];
+    uint8_t       header[SEG_HEADERSIZE];
+    struct stat   st;
+    uint8_t      *file;
+    size_t        off;
+    ecwMBUSMeter  meter;
+    ecMBUSData    data;
+    uint64_t      seq;
+
+    if(SegPath(path, log->dir, base) != APIOK) return APIERROR;
+    if((log->fd = open(path, O_RDWR)) < 0) return APIERROR;
+    if(fstat(log->fd, &st) != 0) {
+        close(log->fd);
+        log->fd = -1;
+        return APIERROR;
+    }
+    //a crash while the segment was created leaves a torn header and no record, the segment starts again empty
+    if((st.st_size < SEG_HEADERSIZE) ||
+       ((st.st_size == SEG_HEADERSIZE) && ((pread(log->fd, header, SEG_HEADERSIZE, 0) != SEG_HEADERSIZE) || (CheckHeader(header, base) != APIOK)))) {
+        printf("Segment log: %s was not created completely, its header is written again\n", path);
+        close(log->fd);
+        return CreateSegment(log, base);
+    }
+    if(NULL == (file = (uint8_t *) malloc(st.st_size))) {
+        close(log->fd);
+        log->fd = -1;
+        return APIERROR;
+    }
+    if((pread(log->fd, file, st.st_size, 0) != st.st_size) || (CheckHeader(file, base) != APIOK)) {
+        printf("Segment log: %s is invalid\n", path);
+        free(file);
+        close(log->fd);
+        log->fd = -1;
+        return APIERROR;
+    }
+
+    log->base       = base;
+    log->nextOffset = base;
+    off = SEG_HEADERSIZE;
+    while(off + JNL_RECHEADERSIZE <= (size_t)st.st_size) {
+        size_t len = GetU16(file+off);
+        if((off + JNL_RECHEADERSIZE + len > (size_t)st.st_size) ||
+           (Jnl_Crc32(file+off+JNL_RECHEADERSIZE, len, 0) != GetU32(file+off+4)) ||
+           (Jnl_DecodeReading(file+off+JNL_RECHEADERSIZE, len, &seq, &meter, &data) != APIOK) ||
+           (seq != log->nextOffset))
+            break;
+        log->nextOffset++;
+        off += JNL_RECHEADERSIZE + len;
+    }
+    free(file);
+
+    if(off != (size_t)st.st_size) {
+        printf("Segment log: cut off %ld bytes of a torn record\n", (long)(st.st_size - off));
+        if((ftruncate(log->fd, off) != 0) || (fdatasync(log->fd) != 0)) {
+            close(log->fd);
+            log->fd = -1;
+            return APIERROR;
+        }
+    }
+    log->size = off;
+    return APIOK;
+}
+
+int Seg_Open(pecwMBUSSegLog log, const char *dir, off_t segSize) {
+    uint64_t *bases;
+    int       count, ret;
+
+    if((NULL == log) || (NULL == dir) || (strlen(dir) >= _MAX_PATH)) return APIERROR;
+
+    memset(log, 0, sizeof(ecwMBUSSegLog));
+    log->fd      = -1;
+    log->segSize = (segSize <= 0) ? SEG_DEFAULTSIZE : segSize;
+    strcpy(log->dir, dir);
+
+    if((mkdir(dir, 0777) != 0) && (errno != EEXIST)) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Cannot create segment log >%s<", dir);
+        return APIERROR;
+    }
+    if(Seg_ListSegments(dir, &bases, &count) != APIOK) return APIERROR;
+    ret = (count == 0) ? CreateSegment(log, 0) : RecoverSegment(log, bases[count-1]);
+    free(bases);
+    if(APIOK != ret) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Cannot open segment log >%s<", dir);
+        return APIERROR;
+    }
+    pthread_mutex_init(&log->lock, NULL);
+    return APIOK;
+}
+
+//remove segments that every consumer has read completely, nothing is removed without consumers
+static int RetainLocked(pecwMBUSSegLog log) {
+    uint64_t *bases;
+    uint64_t  minOffset;
+    char      path[_MAX_PATH];
+    int       count, iX;
+
+    if(MinConsumerOffset(log->dir, &minOffset) != APIOK) return APIOK;
+    if(Seg_ListSegments(log->dir, &bases, &count) != APIOK) return APIERROR;
+    for(iX=0; iX+1<count; iX++) {
+        if((bases[iX+1] > minOffset) || (bases[iX] == log->base))
+            break;
+        if((SegPath(path, log->dir, bases[iX]) == APIOK) && (unlink(path) == 0))
+            log->removed++;
+    }
+    free(bases);
+    return APIOK;
+}
+
+int Seg_Retain(pecwMBUSSegLog log) {
+    int ret;
+    if((NULL == log) || (log->fd < 0)) return APIERROR;
+    pthread_mutex_lock(&log->lock);
+    ret = RetainLocked(log);
+    pthread_mutex_unlock(&log->lock);
+    return ret;
+}
+
+//append a reading and sync it, readers never see a record that could be lost
+int Seg_Append(pecwMBUSSegLog log, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t *offset) {
+    uint8_t rec[JNL_MAXRECORD];
+    int     len;
+
+    if((NULL == log) || (NULL == meter) || (NULL == data)) return APIERROR;
+
+    pthread_mutex_lock(&log->lock);
+    if(log->fd < 0) {
+        pthread_mutex_unlock(&log->lock);
+        return APIERROR;
+    }
+    if(log->size >= log->segSize) { //roll over, the old segment is complete
+        fdatasync(log->fd);
+        close(log->fd);
+        if(CreateSegment(log, log->nextOffset) != APIOK) {
+            Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Segment log: cannot create segment %llu", (unsigned long long)log->nextOffset);
+            pthread_mutex_unlock(&log->lock);
+            return APIERROR;
+        }
+        RetainLocked(log);
+    }
+
+    len = Jnl_EncodeReading(rec+JNL_RECHEADERSIZE, log->nextOffset, meter, data);
+    PutU16(rec,   (uint16_t)len);
+    PutU16(rec+2, 0);
+    PutU32(rec+4, Jnl_Crc32(rec+JNL_RECHEADERSIZE, len, 0));
+    len += JNL_RECHEADERSIZE;
+    if((pwrite(log->fd, rec, len, log->size) != len) || (fdatasync(log->fd) != 0)) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Segment log: write failed (%s)", strerror(errno));
+        if(ftruncate(log->fd, log->size) != 0) {}
+        pthread_mutex_unlock(&log->lock);
+        return APIERROR;
+    }
+    log->size += len;
+    if(NULL != offset) *offset = log->nextOffset;
+    log->nextOffset++;
+    log->appended++;
+    pthread_mutex_unlock(&log->lock);
+    return APIOK;
+}
+
+void Seg_Close(pecwMBUSSegLog log) {
+    if((NULL == log) || (log->fd < 0)) return;
+    pthread_mutex_lock(&log->lock);
+    fdatasync(log->fd);
+    close(log->fd);
+    log->fd = -1;
+    pthread_mutex_unlock(&log->lock);
+    pthread_mutex_destroy(&log->lock);
+}
+
+static int OpenReaderSegment(pecwMBUSSegReader reader, uint64_t base) {
+    char    path[_MAX_PATH];
+    uint8_t header[SEG_HEADERSIZE];
+    int     fd;
+
+    if(SegPath(path, reader->dir, base) != APIOK) return APIERROR;
+    if((fd = open(path, O_RDONLY)) < 0) return APIERROR;
+    if((pread(fd, header, SEG_HEADERSIZE, 0) != SEG_HEADERSIZE) || (CheckHeader(header, base) != APIOK)) {
+        close(fd);
+        return APIERROR;
+    }
+    if(reader->fd >= 0) close(reader->fd);
+    reader->fd   = fd;
+    reader->base = base;
+    reader->pos  = SEG_HEADERSIZE;
+    return APIOK;
+}
+
+//open the segment holding reader->offset and skip to its record, offsets that
+//were already removed by retention continue with the oldest record on disk
+static int Locate(pecwMBUSSegReader reader) {
+    uint64_t *bases;
+    uint64_t  seq;
+    uint8_t   rec[JNL_RECHEADERSIZE];
+    int       count, iX;
+
+    if(Seg_ListSegments(reader->dir, &bases, &count) != APIOK) return APIERROR;
+    if(count == 0) {
+        free(bases);
+        return APIERROR;
+    }
+    for(iX=count-1; (iX > 0) && (bases[iX] > reader->offset); iX--)
+        ;
+    if(bases[iX] > reader->offset) reader->offset = bases[iX];
+    if(OpenReaderSegment(reader, bases[iX]) != APIOK) {
+        free(bases);
+        return APIERROR;
+    }
+    free(bases);
+
+    for(seq = reader->base; seq < reader->offset; seq++) {
+        if(pread(reader->fd, rec, JNL_RECHEADERSIZE, reader->pos) != JNL_RECHEADERSIZE)
+            break;
+        reader->pos += JNL_RECHEADERSIZE + GetU16(rec);
+    }
+    return APIOK;
+}
+
+int Seg_OpenReader(pecwMBUSSegReader reader, const char *dir, const char *name) {
+    uint64_t *bases;
+    uint64_t  offset = 0;
+    int       count;
+
+    if((NULL == reader) || (NULL == dir) || (strlen(dir) >= _MAX_PATH)) return APIERROR;
+    if((NULL != name) && (Seg_ValidName(name) != APIOK)) return APIERROR;
+
+    memset(reader, 0, sizeof(ecwMBUSSegReader));
+    reader->fd     = -1;
+    reader->notify = -1;
+    strcpy(reader->dir, dir);
+    if(NULL != name) strcpy(reader->name, name);
+
+    if((NULL == name) || (Seg_GetOffset(dir, name, &offset) != APIOK)) { //start with the oldest record
+        if(Seg_ListSegments(dir, &bases, &count) != APIOK) return APIERROR;
+        offset = (count > 0) ? bases[0] : 0;
+        free(bases);
+    }
+    reader->committed = offset;
+
+    //wake up blocking reads on appends, polling is the fallback
+    if((reader->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0) {
+        if(inotify_add_watch(reader->notify, dir, IN_MODIFY | IN_CREATE | IN_MOVED_TO) < 0) {
+            close(reader->notify);
+            reader->notify = -1;
+        }
+    }
+    return Seg_Seek(reader, offset);
+}
+
+//continue reading at offset, e.g. to replay older records
+int Seg_Seek(pecwMBUSSegReader reader, uint64_t offset) {
+    if(NULL == reader) return APIERROR;
+    if(reader->fd >= 0) close(reader->fd);
+    reader->fd     = -1;
+    reader->offset = offset;
+    Locate(reader); //retried by Seg_Read while there is no segment
+    return APIOK;
+}
+
+//base of the segment after the one being read, if any
+static bool NextSegment(pecwMBUSSegReader reader, uint64_t *next) {
+    uint64_t *bases;
+    int       count, iX;
+    bool      found = false;
+
+    if(Seg_ListSegments(reader->dir, &bases, &count) != APIOK) return false;
+    for(iX=0; iX<count; iX++) {
+        if(bases[iX] > reader->base) {
+            *next = bases[iX];
+            found = true;
+            break;
+        }
+    }
+    free(bases);
+    return found;
+}
+
+static int ReadRecord(pecwMBUSSegReader reader, pecwMBUSMeter meter, psecMBUSData data, uint64_t *seq) {
+    uint8_t rec[JNL_MAXRECORD];
+    size_t  len;
+
+    if(pread(reader->fd, rec, JNL_RECHEADERSIZE, reader->pos) != JNL_RECHEADERSIZE) return APIERROR;
+    len = GetU16(rec);
+    if((len > JNL_MAXRECORD - JNL_RECHEADERSIZE) ||
+       (pread(reader->fd, rec+JNL_RECHEADERSIZE, len, reader->pos+JNL_RECHEADERSIZE) != (ssize_t)len) ||
+       (Jnl_Crc32(rec+JNL_RECHEADERSIZE, len, 0) != GetU32(rec+4)) ||
+       (Jnl_DecodeReading(rec+JNL_RECHEADERSIZE, len, seq, meter, data) != APIOK))
+        return APIERROR; //not complete yet
+    reader->pos += JNL_RECHEADERSIZE + len;
+    return APIOK;
+}
+
+static void WaitForData(pecwMBUSSegReader reader, int waitMs) {
+    char buf[4096];
+
+    if(reader->notify >= 0) {
+        struct pollfd pfd;
+        pfd.fd     = reader->notify;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, waitMs) > 0) {
+            while(read(reader->notify, buf, sizeof(buf)) > 0)
+                ;
+        }
+    }
+    else
+        usleep(1000*(((waitMs < 0) || (waitMs > 200)) ? 200 : waitMs));
+}
+
+//read the next record, waits up to timeoutMs for new records (-1 forever, 0 no wait)
+//returns APIOK, SEG_NODATA on timeout or APIERROR
+int Seg_Read(pecwMBUSSegReader reader, pecwMBUSMeter meter, psecMBUSData data, uint64_t *offset, int timeoutMs) {
+    double   deadline = NowMs() + timeoutMs;
+    uint64_t seq, next;
+
+    if((NULL == reader) || (NULL == meter) || (NULL == data)) return APIERROR;
+
+    for(;;) {
+        if((reader->fd >= 0) || (Locate(reader) == APIOK)) {
+            int ret = ReadRecord(reader, meter, data, &seq);
+            //the writer creates the next segment after the last write to the old one,
+            //so the old one is read once more after the next one was seen
+            if((ret != APIOK) && NextSegment(reader, &next) && ((ret = ReadRecord(reader, meter, data, &seq)) != APIOK)) {
+                if(OpenReaderSegment(reader, next) == APIOK) {
+                    if(reader->offset < reader->base) reader->offset = reader->base;
+                    continue;
+                }
+            }
+            if(ret == APIOK) {
+                if(seq < reader->offset) continue;
+                reader->offset = seq+1;
+                if(NULL != offset) *offset = seq;
+                return APIOK;
+            }
+        }
+
+        if(timeoutMs == 0) return SEG_NODATA;
+        if(timeoutMs < 0) WaitForData(reader, -1);
+        else {
+            double left = deadline - NowMs();
+            if(left <= 0) return SEG_NODATA;
+            WaitForData(reader, (int)left + 1);
+        }
+    }
+}
+
+//persist the position, a restarted consumer continues with the next unread record
+int Seg_Commit(pecwMBUSSegReader reader) {
+    if((NULL == reader) || (0 == reader->name[0])) return APIERROR;
+    if(reader->offset == reader->committed) return APIOK;
+    if(Seg_SetOffset(reader->dir, reader->name, reader->offset) != APIOK) return APIERROR;
+    reader->committed = reader->offset;
+    return APIOK;
+}
+
+void Seg_CloseReader(pecwMBUSSegReader reader) {
+    if(NULL == reader) return;
+    if(reader->fd >= 0)     close(reader->fd);
+    if(reader->notify >= 0) close(reader->notify);
+    reader->fd     = -1;
+    reader->notify = -1;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusshm.h>
+
+static bool ValidHeader(const ecwMBUSShmHeader *h) {
+    return (h->magic == SHM_MAGIC) && (h->version == SHM_VERSION) &&
+           (h->slots == MAXMETER) && (h->slotSize == sizeof(ecwMBUSShmSlot));
+}
+
+static void InitHeader(ecwMBUSShmHeader *h) {
+    h->magic     = SHM_MAGIC;
+    h->version   = SHM_VERSION;
+    h->slots     = MAXMETER;
+    h->slotSize  = sizeof(ecwMBUSShmSlot);
+    h->writerPid = (uint32_t)getpid();
+    h->startTime = (uint32_t)time(NULL);
+}
+
+static void WriteSlot(pecwMBUSShm shm, int index, const ecwMBUSMeter *meter, const ecMBUSData *data);
+
+static void SetWriter(pecwMBUSShm shm, void *p) {
+    shm->table  = (ecwMBUSShmTable *) p;
+    shm->writer = true;
+    pthread_mutex_init(&shm->lock, NULL);
+}
+
+//map the table, without path it is an anonymous table of this process. A
+//table with another layout is replaced by a new file so readers still
+//mapping the old one never see it change under them
+int Shm_Create(pecwMBUSShm shm, const char *path) {
+    char        tmp[_MAX_PATH];
+    struct stat st;
+    int         fd;
+    void       *p;
+
+    if(NULL == shm) return APIERROR;
+    memset(shm, 0, sizeof(ecwMBUSShm));
+
+    if(NULL == path) { //private table, only for the writing process
+        p = mmap(NULL, sizeof(ecwMBUSShmTable), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if(MAP_FAILED == p) return APIERROR;
+        SetWriter(shm, p);
+        InitHeader(&shm->table->header);
+        return APIOK;
+    }
+
+    if(((fd = open(path, O_RDWR)) >= 0) && (fstat(fd, &st) == 0) && (st.st_size == sizeof(ecwMBUSShmTable)) &&
+       (MAP_FAILED != (p = mmap(NULL, sizeof(ecwMBUSShmTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)))) {
+        if(ValidHeader(&((ecwMBUSShmTable *)p)->header)) {
+            int iX;
+            close(fd);
+            SetWriter(shm, p);
+            //the slots of the previous run may hold meters that are gone, readers see them empty until the first reading
+            for(iX=0; iX<MAXMETER; iX++)
+                if(0 != shm->table->slot[iX].meter.manufacturerID) WriteSlot(shm, iX, NULL, NULL);
+            shm->table->header.writerPid = (uint32_t)getpid();
+            shm->table->header.startTime = (uint32_t)time(NULL);
+            return APIOK;
+        }
+        munmap(p, sizeof(ecwMBUSShmTable));
+    }
+    if(fd >= 0) close(fd);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "Cannot create >%s<\n", tmp);
+        return APIERROR;
+    }
+    if((ftruncate(fd, sizeof(ecwMBUSShmTable)) != 0) ||
+       (MAP_FAILED == (p = mmap(NULL, sizeof(ecwMBUSShmTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)))) {
+        close(fd);
+        unlink(tmp);
+        return APIERROR;
+    }
+    close(fd);
+    SetWriter(shm, p);
+    memset(shm->table, 0, sizeof(ecwMBUSShmTable)); //new file, nobody maps it yet
+    InitHeader(&shm->table->header);
+    if(rename(tmp, path) != 0) {
+        Shm_Close(shm);
+        unlink(tmp);
+        return APIERROR;
+    }
+    return APIOK;
+}
+
+//one writer per slot, the caller holds the writer lock
+static void WriteSlot(pecwMBUSShm shm, int index, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    pecwMBUSShmSlot slot = &shm->table->slot[index];
+    uint32_t        seq  = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, seq+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);  //odd sequence is visible before the data changes
+    if(NULL != meter) {
+        slot->meter = *meter;
+        memset(slot->meter.key, 0, sizeof(slot->meter.key));
+        slot->data  = *data;
+        slot->updates++;
+    }
+    else {
+        memset(&slot->meter, 0, sizeof(slot->meter));
+        memset(&slot->data,  0, sizeof(slot->data));
+    }
+    __atomic_store_n(&slot->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+void Shm_Update(pecwMBUSShm shm, int index, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    if((NULL == shm) || (NULL == shm->table) || !shm->writer || (index < 0) || (index >= MAXMETER)) return;
+    pthread_mutex_lock(&shm->lock);
+    WriteSlot(shm, index, meter, data);
+    __atomic_store_n(&shm->table->header.updates, shm->table->header.updates+1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&shm->lock);
+}
+
+//the meter of the slot was removed, eccwmbus calls it from the main thread
+void Shm_Clear(pecwMBUSShm shm, int index) {
+    if((NULL == shm) || (NULL == shm->table) || !shm->writer || (index < 0) || (index >= MAXMETER)) return;
+    pthread_mutex_lock(&shm->lock);
+    WriteSlot(shm, index, NULL, NULL);
+    pthread_mutex_unlock(&shm->lock);
+}
+
+int Shm_Attach(pecwMBUSShm shm, const char *path) {
+    struct stat st;
+    int         fd;
+    void       *p;
+
+    if((NULL == shm) || (NULL == path)) return APIERROR;
+    memset(shm, 0, sizeof(ecwMBUSShm));
+    if((fd = open(path, O_RDONLY)) < 0) return APIERROR;
+    if((fstat(fd, &st) != 0) || (st.st_size != sizeof(ecwMBUSShmTable)) ||
+       (MAP_FAILED == (p = mmap(NULL, sizeof(ecwMBUSShmTable), PROT_READ, MAP_SHARED, fd, 0)))) {
+        close(fd);
+        return APIERROR;
+    }
+    close(fd);
+    shm->table = (ecwMBUSShmTable *) p;
+    if(!ValidHeader(&shm->table->header)) {
+        Shm_Close(shm);
+        return APIERROR;
+    }
+    return APIOK;
+}
+
+//consistent copy of one slot, meter and data may be NULL
+int Shm_Read(pecwMBUSShm shm, int index, pecwMBUSMeter meter, psecMBUSData data, uint32_t *updates) {
+    const ecwMBUSShmSlot *slot;
+    ecwMBUSMeter          m;
+    uint32_t              seq, n;
+    int                   iTry;
+
+    if((NULL == shm) || (NULL == shm->table) || (index < 0) || (index >= MAXMETER)) return APIERROR;
+    slot = &shm->table->slot[index];
+    for(iTry=0; iTry<SHM_RETRIES; iTry++) {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) continue;
+        m = slot->meter;
+        n = slot->updates;
+        if(NULL != data) *data = slot->data;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);  //the copies are done before the sequence is read again
+        if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        if(NULL != meter)   *meter   = m;
+        if(NULL != updates) *updates = n;
+        return (0 == m.manufacturerID) ? SHM_EMPTY : APIOK;
+    }
+    return SHM_BUSY;
+}
+
+//slot of a meter, APIERROR when it is not in the table
+int Shm_Find(pecwMBUSShm shm, uint16_t manufacturerID, uint32_t ident) {
+    ecwMBUSMeter meter;
+    int          iX;
+
+    for(iX=0; iX<MAXMETER; iX++) {
+        if((Shm_Read(shm, iX, &meter, NULL, NULL) == APIOK) &&
+           (meter.manufacturerID == manufacturerID) && (meter.ident == ident))
+            return iX;
+    }
+    return APIERROR;
+}
+
+void Shm_Close(pecwMBUSShm shm) {
+    if((NULL == shm) || (NULL == shm->table)) return;
+    munmap(shm->table, sizeof(ecwMBUSShmTable));
+    if(shm->writer) pthread_mutex_destroy(&shm->lock);
+    shm->table  = NULL;
+    shm->writer = false;
+}
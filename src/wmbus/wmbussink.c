@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusjournal.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusmetrics.h>
+#include <wmbus/wmbuspool.h>
+#include <wmbus/wmbussink.h>
+
+#define SINK_SPOOLRECORD    (8 + JNL_READINGSIZE + 256)
+
+static const char *PolicyNames[] = { "block", "drop-oldest", "drop-newest", "spill" };
+
+const char *Sink_PolicyName(int policy) {
+    return ((policy >= SINK_BLOCK) && (policy <= SINK_SPILL)) ? PolicyNames[policy] : "?";
+}
+
+//looks for name=policy[:depth] in the comma separated spec, other entries are checked only
+int Sink_ParsePolicy(const char *spec, const char *name, pecwMBUSSinkPolicy policy) {
+    const char *p = spec, *eq, *end, *colon;
+    size_t      len;
+    int         iX, found;
+
+    if((NULL == spec) || (NULL == name) || (NULL == policy)) return APIERROR;
+    while(0 != *p) {
+        end = strchr(p, ',');
+        if(NULL == end) end = p + strlen(p);
+        eq = memchr(p, '=', end - p);
+        if((NULL == eq) || (eq == p)) return APIERROR;
+        colon = memchr(eq, ':', end - eq);
+        len   = ((NULL != colon) ? colon : end) - (eq + 1);
+        found = -1;
+        for(iX=SINK_BLOCK; iX<=SINK_SPILL; iX++)
+            if((strlen(PolicyNames[iX]) == len) && (0 == strncmp(eq + 1, PolicyNames[iX], len))) found = iX;
+        if(found < 0) return APIERROR;
+        if((NULL != colon) && ((atoi(colon + 1) < 1) || (atoi(colon + 1) > SINK_MAXDEPTH))) return APIERROR;
+        if(((size_t)(eq - p) == strlen(name)) && (0 == strncmp(p, name, eq - p))) {
+            policy->policy = found;
+            if(NULL != colon) policy->depth = atoi(colon + 1);
+        }
+        p = ('\0' != *end) ? end + 1 : end;
+    }
+    return APIOK;
+}
+
+static bool IsEmpty(pecwMBUSSink sink) {
+    return (sink->head == sink->tail) && (!sink->useSpool || (0 == sink->spool.count));
+}
+
+//a spooled reading is the queue time and the journal encoding with the tag as seq
+static int Spill(pecwMBUSSink sink, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag, uint64_t queuedUs) {
+    uint8_t rec[SINK_SPOOLRECORD];
+    int     len;
+
+    memcpy(rec, &queuedUs, 8);
+    len = Jnl_EncodeReading(rec + 8, tag, meter, data);
+    if(Spool_Push(&sink->spool, rec, 8 + len) != APIOK) {
+        sink->stats.dropped++;
+        return APIERROR;
+    }
+    sink->stats.spilled++;
+    return APIOK;
+}
+
+//false for a record that does not decode, the spool is given up when it cannot be read
+static bool Unspill(pecwMBUSSink sink, pecwMBUSSinkItem item, pecwMBUSReading reading, bool *readable) {
+    uint8_t rec[SINK_SPOOLRECORD];
+    size_t  len;
+
+    *readable = (Spool_Read(&sink->spool, rec, sizeof(rec), &len) == APIOK);
+    if(!*readable) return false;
+    memset(item, 0, sizeof(ecwMBUSSinkItem));
+    memset(reading, 0, sizeof(ecwMBUSReading));
+    memcpy(&item->queuedUs, rec, 8);
+    item->reading = reading;
+    return (len >= 8) && (Jnl_DecodeReading(rec + 8, len - 8, &item->tag, &reading->meter, &reading->data) == APIOK);
+}
+
+static void * Sink_ThreadProc(void *arg) {
+    pecwMBUSSink    sink = (pecwMBUSSink) arg;
+    ecwMBUSSinkItem item;
+    ecwMBUSReading  unspilled;          // a spooled reading is not pooled
+    bool            spooled, valid, readable;
+    uint64_t        t, tag;
+    int             ret;
+
+    pthread_mutex_lock(&sink->lock);
+    for(;;) {
+        while(IsEmpty(sink) && !sink->stop) {
+            if(sink->idlePending && (NULL != sink->idle)) {
+                sink->idlePending = false;
+                tag = sink->lastTag;
+                pthread_mutex_unlock(&sink->lock);
+                sink->idle(sink->ctx, tag);
+                pthread_mutex_lock(&sink->lock);
+                continue;
+            }
+            pthread_cond_wait(&sink->notEmpty, &sink->lock);
+        }
+        //on stop the queue is written, a spool stays for the next start
+        if(sink->head == sink->tail) {
+            if(sink->stop) break;
+            valid   = Unspill(sink, &item, &unspilled, &readable);
+            spooled = true;
+            if(!readable) {
+                Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Sink %s: spool not readable, %lu readings lost", sink->name, sink->spool.count);
+                sink->stats.dropped += sink->spool.count;
+                sink->useSpool = false; //a full queue drops the newest reading from now on
+                continue;
+            }
+        }
+        else {
+            memcpy(&item, &sink->items[sink->head % sink->depth], sizeof(ecwMBUSSinkItem));
+            sink->head++;
+            pthread_cond_signal(&sink->notFull);
+            valid   = true;
+            spooled = false;
+        }
+        pthread_mutex_unlock(&sink->lock);
+
+        ret = APIERROR;
+        if(valid) {
+            t   = Met_NowUs();
+            ret = sink->write(sink->ctx, &item.reading->meter, &item.reading->data, item.tag);
+            if(sink->metSink >= 0) Met_Observe(sink->metSink, t);
+        }
+        if(!spooled) Pool_Release(item.reading);
+
+        pthread_mutex_lock(&sink->lock);
+        if(spooled) Spool_Commit(&sink->spool, 1);
+        if(ret == APIOK) {
+            sink->stats.written++;
+            t = Met_NowUs(); //a reading spooled before a reboot has a queue time of the old clock
+            if((t > item.queuedUs) && (t - item.queuedUs > sink->stats.maxLagUs)) sink->stats.maxLagUs = t - item.queuedUs;
+        }
+        else
+            sink->stats.failed++;
+        if(valid) {
+            sink->lastTag     = item.tag;
+            sink->idlePending = true;
+        }
+    }
+    pthread_mutex_unlock(&sink->lock);
+    if(sink->idlePending && (NULL != sink->idle))
+        sink->idle(sink->ctx, sink->lastTag);
+    return NULL;
+}
+
+int Sink_Open(pecwMBUSSink sink, const char *name, int metSink, const ecwMBUSSinkPolicy *policy,
+              Sink_WriteHandler write, Sink_IdleHandler idle, void *ctx) {
+    if((NULL == sink) || (NULL == name) || (NULL == policy) || (NULL == write)) return APIERROR;
+    if((policy->depth < 1) || (policy->depth > SINK_MAXDEPTH)) return APIERROR;
+    if((policy->policy < SINK_BLOCK) || (policy->policy > SINK_SPILL)) return APIERROR;
+
+    memset(sink, 0, sizeof(ecwMBUSSink));
+    snprintf(sink->name, SINK_MAXNAME, "%s", name);
+    snprintf(sink->queueName, sizeof(sink->queueName), "%s_sink", sink->name);
+    sink->policy  = policy->policy;
+    sink->metSink = metSink;
+    sink->write   = write;
+    sink->idle    = idle;
+    sink->ctx     = ctx;
+    sink->depth   = policy->depth;
+    sink->items   = (pecwMBUSSinkItem) malloc(sink->depth * sizeof(ecwMBUSSinkItem));
+    if(NULL == sink->items) return APIERROR;
+
+    if(SINK_SPILL == sink->policy) {
+        if(Spool_Open(&sink->spool, policy->spoolPath, SINK_SPOOLMAX) != APIOK) {
+            Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Sink %s: cannot open spool >%s<", name, policy->spoolPath);
+            free(sink->items);
+            return APIERROR;
+        }
+        sink->useSpool = true;
+    }
+
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->notEmpty, NULL);
+    pthread_cond_init(&sink->notFull, NULL);
+    sink->running = (0 == pthread_create(&sink->thread, NULL, Sink_ThreadProc, sink));
+    if(!sink->running) {
+        pthread_cond_destroy(&sink->notFull);
+        pthread_cond_destroy(&sink->notEmpty);
+        pthread_mutex_destroy(&sink->lock);
+        if(sink->useSpool) Spool_Close(&sink->spool);
+        free(sink->items);
+        return APIERROR;
+    }
+    return APIOK;
+}
+
+//a reading the pool had no memory for
+static void Lost(pecwMBUSSink sink) {
+    pthread_mutex_lock(&sink->lock);
+    sink->stats.queued++;
+    sink->stats.dropped++;
+    pthread_mutex_unlock(&sink->lock);
+}
+
+//queues a reference to the pooled reading, waits only with the block policy;
+//the caller keeps its own reference, NULL counts the reading as dropped
+int Sink_PutReading(pecwMBUSSink sink, pecwMBUSReading reading, uint64_t tag) {
+    pecwMBUSSinkItem item;
+    uint64_t         now;
+    int              ret = APIOK;
+
+    if((NULL == sink) || !sink->running) return APIERROR;
+    if(NULL == reading) {
+        Lost(sink);
+        return APIERROR;
+    }
+    now = Met_NowUs();
+
+    pthread_mutex_lock(&sink->lock);
+    sink->stats.queued++;
+    if(sink->useSpool && ((sink->spool.count > 0) || (sink->tail - sink->head >= sink->depth))) {
+        //once spilling, newer readings follow the spool to keep the order
+        ret = Spill(sink, &reading->meter, &reading->data, tag, now);
+        pthread_cond_signal(&sink->notEmpty);
+        pthread_mutex_unlock(&sink->lock);
+        return ret;
+    }
+    if(sink->tail - sink->head >= sink->depth) {
+        switch(sink->policy) {
+            case SINK_BLOCK      : sink->stats.waits++;
+                                   while((sink->tail - sink->head >= sink->depth) && !sink->stop)
+                                       pthread_cond_wait(&sink->notFull, &sink->lock);
+                                   break;
+            case SINK_DROPOLDEST : Pool_Release(sink->items[sink->head % sink->depth].reading);
+                                   sink->head++;
+                                   sink->stats.dropped++;
+                                   break;
+            default              :
+            case SINK_DROPNEWEST : sink->stats.dropped++;
+                                   pthread_mutex_unlock(&sink->lock);
+                                   return APIERROR;
+        }
+    }
+    if(sink->tail - sink->head >= sink->depth) { //stopped while waiting
+        sink->stats.dropped++;
+        pthread_mutex_unlock(&sink->lock);
+        return APIERROR;
+    }
+    item = &sink->items[sink->tail % sink->depth];
+    item->tag      = tag;
+    item->queuedUs = now;
+    item->reading  = reading;
+    Pool_Hold(reading);
+    sink->tail++;
+    pthread_cond_signal(&sink->notEmpty);
+    pthread_mutex_unlock(&sink->lock);
+    return ret;
+}
+
+int Sink_Put(pecwMBUSSink sink, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    pecwMBUSReading reading;
+    int             ret;
+
+    if((NULL == sink) || !sink->running) return APIERROR;
+    reading = Pool_Get(meter, data);
+    ret = Sink_PutReading(sink, reading, tag);
+    if(NULL != reading) Pool_Release(reading);
+    return ret;
+}
+
+//the lag is the age of the oldest reading in memory
+void Sink_GetQueue(pecwMBUSSink sink, unsigned long *queued, unsigned long *spooled, unsigned long *dropped, uint64_t *lagUs) {
+    *queued = *spooled = *dropped = 0;
+    *lagUs  = 0;
+    if((NULL == sink) || !sink->running) return;
+    pthread_mutex_lock(&sink->lock);
+    *queued  = sink->tail - sink->head;
+    *spooled = sink->useSpool ? sink->spool.count : 0;
+    *dropped = sink->stats.dropped;
+    if(sink->tail != sink->head)
+        *lagUs = Met_NowUs() - sink->items[sink->head % sink->depth].queuedUs;
+    pthread_mutex_unlock(&sink->lock);
+}
+
+void Sink_PrintStats(pecwMBUSSink sink) {
+    if((NULL == sink) || !sink->running) return;
+    pthread_mutex_lock(&sink->lock);
+    printf("Sink %-15s : %lu written, %lu failed, %lu dropped, %lu spilled, queue %lu/%lu (%s), max lag %.1f ms\n",
+           sink->name, sink->stats.written, sink->stats.failed, sink->stats.dropped, sink->stats.spilled,
+           sink->tail - sink->head, sink->depth, Sink_PolicyName(sink->policy), sink->stats.maxLagUs/1000.0);
+    pthread_mutex_unlock(&sink->lock);
+}
+
+//writes what is queued, waiting callers return
+void Sink_Close(pecwMBUSSink sink) {
+    if((NULL == sink) || !sink->running) return;
+    pthread_mutex_lock(&sink->lock);
+    sink->stop = true;
+    pthread_cond_broadcast(&sink->notEmpty);
+    pthread_cond_broadcast(&sink->notFull);
+    pthread_mutex_unlock(&sink->lock);
+    pthread_join(sink->thread, NULL);
+    sink->running = false;
+    if(SINK_SPILL == sink->policy) {
+        Spool_Sync(&sink->spool);
+        Spool_Close(&sink->spool);
+    }
+    pthread_cond_destroy(&sink->notFull);
+    pthread_cond_destroy(&sink->notEmpty);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink->items);
+    sink->items = NULL;
+}
+
+int Sink_Add(pecwMBUSFanout fanout, pecwMBUSSink sink) {
+    if((NULL == fanout) || (NULL == sink) || (fanout->count >= SINK_MAXSINKS)) return APIERROR;
+    fanout->sinks[fanout->count++] = sink;
+    return APIOK;
+}
+
+//the pooled reading for all sinks, the caller keeps its own reference
+void Sink_DispatchReading(pecwMBUSFanout fanout, pecwMBUSReading reading, uint64_t tag) {
+    int iX;
+
+    for(iX=0; iX<fanout->count; iX++)
+        Sink_PutReading(fanout->sinks[iX], reading, tag);
+}
+
+//one pooled copy of the reading for all sinks
+void Sink_Dispatch(pecwMBUSFanout fanout, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    pecwMBUSReading reading;
+
+    if(0 == fanout->count) return;
+    reading = Pool_Get(meter, data);
+    Sink_DispatchReading(fanout, reading, tag);
+    if(NULL != reading) Pool_Release(reading);
+}
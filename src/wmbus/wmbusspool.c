@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusjournal.h>
+#include <wmbus/wmbuslog.h>
+#include <wmbus/wmbusspool.h>
+#include <wmbus/wmbusle.h>
+
+static int WriteHeader(pecwMBUSSpool spool) {
+    uint8_t header[SPOOL_HEADERSIZE];
+
+    memset(header, 0, sizeof(header));
+    PutU32(header,    SPOOL_MAGIC);
+    PutU16(header+4,  SPOOL_VERSION);
+    PutU16(header+6,  SPOOL_HEADERSIZE);
+    PutU64(header+8,  (uint64_t)spool->head);
+    PutU32(header+16, Jnl_Crc32(header+8, 8, 0));
+    return (pwrite(spool->fd, header, SPOOL_HEADERSIZE, 0) == SPOOL_HEADERSIZE) ? APIOK : APIERROR;
+}
+
+static int Reset(pecwMBUSSpool spool) {
+    spool->head = spool->cursor = spool->size = SPOOL_HEADERSIZE;
+    spool->count = spool->unread = 0;
+    if((ftruncate(spool->fd, SPOOL_HEADERSIZE) != 0) || (WriteHeader(spool) != APIOK))
+        return APIERROR;
+    return APIOK;
+}
+
+//length of the valid record at off, 0 at the end or for a torn record
+static size_t RecordAt(pecwMBUSSpool spool, off_t off, off_t end, uint8_t *buf) {
+    uint8_t hdr[SPOOL_RECHEADERSIZE];
+    size_t  len;
+
+    if((off + SPOOL_RECHEADERSIZE > end) || (pread(spool->fd, hdr, SPOOL_RECHEADERSIZE, off) != SPOOL_RECHEADERSIZE))
+        return 0;
+    len = GetU16(hdr);
+    if((len == 0) || (len > SPOOL_MAXRECORD) || (off + SPOOL_RECHEADERSIZE + (off_t)len > end) ||
+       (pread(spool->fd, buf, len, off + SPOOL_RECHEADERSIZE) != (ssize_t)len) ||
+       (Jnl_Crc32(buf, len, 0) != GetU32(hdr+4)))
+        return 0;
+    return len;
+}
+
+int Spool_Open(pecwMBUSSpool spool, const char *path, off_t maxSize) {
+    uint8_t     header[SPOOL_HEADERSIZE];
+    uint8_t     buf[SPOOL_MAXRECORD];
+    struct stat st;
+    size_t      len;
+    off_t       off;
+
+    if((NULL == spool) || (NULL == path)) return APIERROR;
+    memset(spool, 0, sizeof(ecwMBUSSpool));
+    spool->maxSize = (maxSize <= 0) ? SPOOL_DEFAULTMAX : maxSize;
+    if((spool->fd = open(path, O_RDWR | O_CREAT, 0666)) < 0) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_ERROR, "Cannot open spool >%s<", path);
+        return APIERROR;
+    }
+    if(fstat(spool->fd, &st) != 0) {
+        Spool_Close(spool);
+        return APIERROR;
+    }
+
+    if((st.st_size < SPOOL_HEADERSIZE) || (pread(spool->fd, header, SPOOL_HEADERSIZE, 0) != SPOOL_HEADERSIZE) ||
+       (GetU32(header) != SPOOL_MAGIC) || (GetU16(header+4) != SPOOL_VERSION) ||
+       (Jnl_Crc32(header+8, 8, 0) != GetU32(header+16)) || ((off_t)GetU64(header+8) > st.st_size)) {
+        if(st.st_size > 0) Log_Printf(LOGCAT_OUTPUT, LOGLVL_WARN, "Spool: %s is invalid, starting empty", path);
+        if(Reset(spool) != APIOK) {
+            Spool_Close(spool);
+            return APIERROR;
+        }
+        return APIOK;
+    }
+
+    //count the records after head and cut off a torn one
+    spool->head = (off_t)GetU64(header+8);
+    if(spool->head < SPOOL_HEADERSIZE) spool->head = SPOOL_HEADERSIZE;
+    off = spool->head;
+    while(0 != (len = RecordAt(spool, off, st.st_size, buf))) {
+        off += SPOOL_RECHEADERSIZE + len;
+        spool->count++;
+    }
+    if(off != st.st_size) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_WARN, "Spool: cut off %ld bytes of a torn record", (long)(st.st_size - off));
+        if(ftruncate(spool->fd, off) != 0) {
+            Spool_Close(spool);
+            return APIERROR;
+        }
+    }
+    spool->size   = off;
+    spool->cursor = spool->head;
+    spool->unread = spool->count;
+    if((spool->count == 0) && (spool->size > SPOOL_HEADERSIZE))
+        Reset(spool);
+    return APIOK;
+}
+
+//append a record, APIERROR when the spool is full
+int Spool_Push(pecwMBUSSpool spool, const void *data, size_t len) {
+    uint8_t rec[SPOOL_RECHEADERSIZE + SPOOL_MAXRECORD];
+
+    if((NULL == spool) || (spool->fd < 0) || (len == 0) || (len > SPOOL_MAXRECORD)) return APIERROR;
+    if(spool->size + SPOOL_RECHEADERSIZE + (off_t)len > spool->maxSize) {
+        spool->dropped++;
+        return APIERROR;
+    }
+    PutU16(rec,   (uint16_t)len);
+    PutU16(rec+2, 0);
+    PutU32(rec+4, Jnl_Crc32((const uint8_t *)data, len, 0));
+    memcpy(rec+SPOOL_RECHEADERSIZE, data, len);
+    if(pwrite(spool->fd, rec, SPOOL_RECHEADERSIZE + len, spool->size) != (ssize_t)(SPOOL_RECHEADERSIZE + len)) {
+        if(ftruncate(spool->fd, spool->size) != 0) {}
+        spool->dropped++;
+        return APIERROR;
+    }
+    spool->size += SPOOL_RECHEADERSIZE + len;
+    spool->count++;
+    spool->unread++;
+    return APIOK;
+}
+
+//next record after the cursor, it stays in the spool until committed
+int Spool_Read(pecwMBUSSpool spool, void *buf, size_t size, size_t *len) {
+    uint8_t data[SPOOL_MAXRECORD];
+    size_t  n;
+
+    if((NULL == spool) || (spool->fd < 0)) return APIERROR;
+    if(spool->unread == 0) return SPOOL_EMPTY;
+    if(0 == (n = RecordAt(spool, spool->cursor, spool->size, data))) return APIERROR;
+    if(n > size) return APIERROR;
+    memcpy(buf, data, n);
+    *len = n;
+    spool->cursor += SPOOL_RECHEADERSIZE + n;
+    spool->unread--;
+    return APIOK;
+}
+
+//copy len bytes from from to to, front to back, so to may be below from
+static int Copy(pecwMBUSSpool spool, off_t from, off_t to, off_t len) {
+    uint8_t buf[0x8000];
+    off_t   off;
+
+    for(off = 0; off < len; ) {
+        size_t n = (size_t)min((off_t)sizeof(buf), len - off);
+        if((pread(spool->fd, buf, n, from + off) != (ssize_t)n) || (pwrite(spool->fd, buf, n, to + off) != (ssize_t)n))
+            return APIERROR;
+        off += n;
+    }
+    return APIOK;
+}
+
+//move the records after head to the front of the file, only when they fit
+//below head so a crash leaves either the old or the new layout
+static int Compact(pecwMBUSSpool spool) {
+    uint8_t zero[SPOOL_RECHEADERSIZE];
+    off_t   shift = spool->head - SPOOL_HEADERSIZE;
+
+    if(Copy(spool, spool->head, SPOOL_HEADERSIZE, spool->size - spool->head) != APIOK)
+        return APIERROR;
+    memset(zero, 0, sizeof(zero)); //ends the record scan at the new end
+    if((pwrite(spool->fd, zero, sizeof(zero), spool->size - shift) != sizeof(zero)) || (fdatasync(spool->fd) != 0))
+        return APIERROR;
+
+    spool->head    = SPOOL_HEADERSIZE;
+    spool->cursor -= shift;
+    spool->size   -= shift;
+    if((WriteHeader(spool) != APIOK) || (fdatasync(spool->fd) != 0) || (ftruncate(spool->fd, spool->size) != 0))
+        return APIERROR;
+    return APIOK;
+}
+
+//remove the n oldest records, they were read and acknowledged
+int Spool_Commit(pecwMBUSSpool spool, unsigned long n) {
+    uint8_t hdr[SPOOL_RECHEADERSIZE];
+
+    if((NULL == spool) || (spool->fd < 0)) return APIERROR;
+    while((n > 0) && (spool->count > spool->unread)) {
+        if(pread(spool->fd, hdr, SPOOL_RECHEADERSIZE, spool->head) != SPOOL_RECHEADERSIZE) return APIERROR;
+        spool->head += SPOOL_RECHEADERSIZE + GetU16(hdr);
+        spool->count--;
+        n--;
+    }
+    if(spool->count == 0) return Reset(spool);
+    if((spool->head > SPOOL_COMPACTAT) && (spool->head - SPOOL_HEADERSIZE >= 2*(spool->size - spool->head) + SPOOL_RECHEADERSIZE))
+        return Compact(spool);
+    return WriteHeader(spool);
+}
+
+//put n records in front of the spooled ones, for records older than anything spooled; all
+//or none, the cursor goes back to the first record. They go into the committed part below
+//head if it has room, else behind the records together with a copy of them, so a crash
+//before the header moves leaves the old layout
+int Spool_Prepend(pecwMBUSSpool spool, const void * const *data, const size_t *len, unsigned long n) {
+    uint8_t       rec[SPOOL_RECHEADERSIZE + SPOOL_MAXRECORD];
+    off_t         need = 0, keep, at, off;
+    bool          behind;
+    unsigned long iX;
+
+    if((NULL == spool) || (spool->fd < 0)) return APIERROR;
+    for(iX=0; iX<n; iX++) {
+        if((len[iX] == 0) || (len[iX] > SPOOL_MAXRECORD)) return APIERROR;
+        need += SPOOL_RECHEADERSIZE + len[iX];
+    }
+    if(n == 0) return APIOK;
+    keep   = spool->size - spool->head;
+    behind = (spool->count > 0) && (spool->head - SPOOL_HEADERSIZE < need);
+    if(spool->count == 0)
+        at = spool->head;
+    else if(!behind)
+        at = spool->head - need;
+    else
+        at = spool->size + SPOOL_RECHEADERSIZE; //behind a zero header that ends the scan of the old layout
+    if(at + need + (behind ? keep : 0) > spool->maxSize) {
+        spool->dropped += n;
+        return APIERROR;
+    }
+
+    if(behind) {
+        memset(rec, 0, SPOOL_RECHEADERSIZE);
+        if((pwrite(spool->fd, rec, SPOOL_RECHEADERSIZE, spool->size) != SPOOL_RECHEADERSIZE) ||
+           (Copy(spool, spool->head, at + need, keep) != APIOK))
+            goto fail;
+    }
+    for(off = at, iX=0; iX<n; iX++) {
+        PutU16(rec,   (uint16_t)len[iX]);
+        PutU16(rec+2, 0);
+        PutU32(rec+4, Jnl_Crc32((const uint8_t *)data[iX], len[iX], 0));
+        memcpy(rec+SPOOL_RECHEADERSIZE, data[iX], len[iX]);
+        if(pwrite(spool->fd, rec, SPOOL_RECHEADERSIZE + len[iX], off) != (ssize_t)(SPOOL_RECHEADERSIZE + len[iX]))
+            goto fail;
+        off += SPOOL_RECHEADERSIZE + len[iX];
+    }
+    if(fdatasync(spool->fd) != 0) goto fail;
+
+    if(spool->count == 0)
+        spool->size = at + need;
+    else if(behind)
+        spool->size = at + need + keep;
+    spool->head   = at;
+    spool->count += n;
+    Spool_Rewind(spool);
+    return WriteHeader(spool);
+
+fail:
+    if(ftruncate(spool->fd, spool->size) != 0) {}
+    spool->dropped += n;
+    return APIERROR;
+}
+
+//read again from the first record not committed, e.g. after a reconnect
+void Spool_Rewind(pecwMBUSSpool spool) {
+    if((NULL == spool) || (spool->fd < 0)) return;
+    spool->cursor = spool->head;
+    spool->unread = spool->count;
+}
+
+void Spool_Sync(pecwMBUSSpool spool) {
+    if((NULL != spool) && (spool->fd >= 0))
+        fdatasync(spool->fd);
+}
+
+void Spool_Close(pecwMBUSSpool spool) {
+    if((NULL == spool) || (spool->fd < 0)) return;
+    fdatasync(spool->fd);
+    close(spool->fd);
+    spool->fd = -1;
+}
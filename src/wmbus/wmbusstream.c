@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusjournal.h>
+#include <wmbus/wmbusstream.h>
+#include <wmbus/wmbusle.h>
+
+static int SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) ? APIERROR : APIOK;
+}
+
+//the reading as Fmt_ReadingJSON writes it with the sequence number in front
+int Stream_EncodeJSON(char *p, size_t size, uint64_t seq, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    static const char head[] = "{\"seq\":";
+    int               len = sizeof(head) - 1, body;
+
+    if(size < sizeof(head) + 20 + FMT_MAXJSON) return APIERROR;
+    memcpy(p, head, len);
+    len += Fmt_U64(p+len, seq);
+    body = len;
+    len += Fmt_ReadingJSON(p+len, meter, data, FMT_PAYLOAD | FMT_NEWLINE);
+    p[body] = ',';  //instead of the opening brace of the reading
+    return len;
+}
+
+int Stream_Init(pecwMBUSStream srv) {
+    if(NULL == srv) return APIERROR;
+    memset(srv, 0, sizeof(ecwMBUSStream));
+    srv->wake[0] = srv->wake[1] = -1;
+    if((pipe(srv->wake) != 0) || (SetNonBlocking(srv->wake[0]) != APIOK) || (SetNonBlocking(srv->wake[1]) != APIOK))
+        return APIERROR;
+    pthread_mutex_init(&srv->lock, NULL);
+    return APIOK;
+}
+
+//add a listener, see wmbusstream.h for the spec
+int Stream_Listen(pecwMBUSStream srv, const char *spec) {
+    ecwMBUSStreamListener *l;
+    int                    fd = -1;
+    int                    one = 1;
+
+    if((NULL == srv) || (NULL == spec) || (srv->listenCount >= STREAM_MAXLISTEN) || srv->running) return APIERROR;
+    l = &srv->listen[srv->listenCount];
+    memset(l, 0, sizeof(ecwMBUSStreamListener));
+    l->format = STREAM_BINARY;
+    if(0 == strncmp(spec, "json:", 5)) {
+        l->format = STREAM_JSON;
+        spec += 5;
+    }
+
+    if(0 == strncmp(spec, "tcp:", 4)) {
+        struct sockaddr_in addr;
+        const char        *port = strrchr(spec+4, ':');
+        char               host[64];
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if(NULL == port) port = spec+4;
+        else {
+            size_t len = port - (spec+4);
+            if(len >= sizeof(host)) return APIERROR;
+            memcpy(host, spec+4, len);
+            host[len] = 0;
+            if(inet_pton(AF_INET, host, &addr.sin_addr) != 1) return APIERROR;
+            port++;
+        }
+        if((atoi(port) <= 0) || (atoi(port) > 65535)) return APIERROR;
+        addr.sin_port = htons((uint16_t)atoi(port));
+
+        if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return APIERROR;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            return APIERROR;
+        }
+    }
+    else if(0 == strncmp(spec, "unix:", 5)) {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if((strlen(spec+5) == 0) || (strlen(spec+5) >= sizeof(addr.sun_path))) return APIERROR;
+        strcpy(addr.sun_path, spec+5);
+
+        if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return APIERROR;
+        unlink(addr.sun_path); //left over from a crash
+        if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            return APIERROR;
+        }
+        chmod(addr.sun_path, 0666);
+        strcpy(l->path, addr.sun_path);
+    }
+    else
+        return APIERROR;
+
+    if((listen(fd, 16) != 0) || (SetNonBlocking(fd) != APIOK)) {
+        close(fd);
+        if(0 != l->path[0]) unlink(l->path);
+        return APIERROR;
+    }
+    l->fd = fd;
+    srv->listenCount++;
+    return APIOK;
+}
+
+static void Wake(pecwMBUSStream srv) {
+    if(!srv->wakePending) {
+        srv->wakePending = true;
+        if(write(srv->wake[1], "w", 1) < 0) {}
+    }
+}
+
+//called with the lock held
+static void CloseClient(pecwMBUSStream srv, int index) {
+    pecwMBUSStreamClient c = &srv->clients[index];
+
+    close(c->fd);
+    free(c->queue);
+    free(c->send);
+    srv->formats[c->format]--;
+    srv->clientCount--;
+    if(index != srv->clientCount)
+        srv->clients[index] = srv->clients[srv->clientCount];
+}
+
+static void AcceptClients(pecwMBUSStream srv, const ecwMBUSStreamListener *l) {
+    pecwMBUSStreamClient c;
+    int                  fd, one = 1;
+
+    while((fd = accept(l->fd, NULL, NULL)) >= 0) {
+        pthread_mutex_lock(&srv->lock);
+        if((srv->clientCount >= STREAM_MAXCLIENTS) || (SetNonBlocking(fd) != APIOK)) {
+            pthread_mutex_unlock(&srv->lock);
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); //batched already, fails on unix sockets
+        c = &srv->clients[srv->clientCount];
+        memset(c, 0, sizeof(ecwMBUSStreamClient));
+        c->fd     = fd;
+        c->format = l->format;
+        c->queue  = (uint8_t *) malloc(STREAM_QUEUESIZE);
+        c->send   = (uint8_t *) malloc(STREAM_QUEUESIZE);
+        if((NULL == c->queue) || (NULL == c->send)) {
+            free(c->queue);
+            free(c->send);
+            close(fd);
+        }
+        else {
+            srv->clientCount++;
+            srv->formats[c->format]++;
+            srv->accepted++;
+        }
+        pthread_mutex_unlock(&srv->lock);
+    }
+}
+
+void * Stream_ThreadProc(void *arg) {
+    pecwMBUSStream srv = (pecwMBUSStream) arg;
+    struct pollfd  pfd[1 + STREAM_MAXLISTEN + STREAM_MAXCLIENTS];
+    char           trash[256];
+    int            nClients, iX, n;
+
+    for(;;) {
+        pthread_mutex_lock(&srv->lock);
+        if(srv->stop) {
+            pthread_mutex_unlock(&srv->lock);
+            break;
+        }
+        n = 0;
+        pfd[n].fd = srv->wake[0];
+        pfd[n++].events = POLLIN;
+        for(iX=0; iX<srv->listenCount; iX++) {
+            pfd[n].fd = srv->listen[iX].fd;
+            pfd[n++].events = POLLIN;
+        }
+        //everything queued since the last write goes out with the next one
+        nClients = srv->clientCount;
+        for(iX=0; iX<nClients; iX++) {
+            pecwMBUSStreamClient c = &srv->clients[iX];
+            if((c->sendLen == 0) && (c->queueLen > 0)) {
+                uint8_t *p = c->send;
+                c->send     = c->queue;
+                c->sendLen  = c->queueLen;
+                c->sending  = c->queued;
+                c->queue    = p;
+                c->queueLen = 0;
+                c->queued   = 0;
+            }
+            pfd[n].fd = c->fd;
+            pfd[n++].events = POLLIN | ((c->sendLen > 0) ? POLLOUT : 0);
+        }
+        srv->wakePending = false;
+        pthread_mutex_unlock(&srv->lock);
+
+        if(poll(pfd, n, -1) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        if(pfd[0].revents & POLLIN) {
+            while(read(srv->wake[0], trash, sizeof(trash)) > 0)
+                ;
+        }
+
+        //clients are only added and removed by this thread, the indexes still match pfd
+        for(iX=nClients-1; iX>=0; iX--) {
+            pecwMBUSStreamClient c = &srv->clients[iX];
+            short    rev = pfd[1 + srv->listenCount + iX].revents;
+            bool     closeIt = false;
+            ssize_t  r;
+
+            if(rev & (POLLERR | POLLHUP | POLLNVAL)) closeIt = true;
+            if(!closeIt && (rev & POLLIN)) { //subscribers do not send, input is discarded
+                r = read(c->fd, trash, sizeof(trash));
+                if((r == 0) || ((r < 0) && (errno != EAGAIN) && (errno != EINTR))) closeIt = true;
+            }
+            if(!closeIt && (rev & POLLOUT)) {
+                r = send(c->fd, c->send + c->sendPos, c->sendLen - c->sendPos, MSG_NOSIGNAL);
+                if(r >= 0) {
+                    c->sendPos += r;
+                    if(c->sendPos == c->sendLen) {
+                        pthread_mutex_lock(&srv->lock);
+                        c->sent   += c->sending;
+                        srv->sent += c->sending;
+                        c->sendLen = c->sendPos = 0;
+                        c->sending = 0;
+                        srv->writes++;
+                        pthread_mutex_unlock(&srv->lock);
+                    }
+                }
+                else if((errno != EAGAIN) && (errno != EINTR))
+                    closeIt = true;
+            }
+            if(closeIt) {
+                pthread_mutex_lock(&srv->lock);
+                CloseClient(srv, iX);
+                pthread_mutex_unlock(&srv->lock);
+            }
+        }
+
+        for(iX=0; iX<srv->listenCount; iX++) {
+            if(pfd[1+iX].revents & POLLIN)
+                AcceptClients(srv, &srv->listen[iX]);
+        }
+    }
+    return 0;
+}
+
+int Stream_Start(pecwMBUSStream srv) {
+    if((NULL == srv) || (srv->listenCount == 0)) return APIERROR;
+    srv->running = (0 == pthread_create(&srv->thread, NULL, Stream_ThreadProc, srv));
+    return srv->running ? APIOK : APIERROR;
+}
+
+//queue a reading for every subscriber, called from the receiving thread
+void Stream_Publish(pecwMBUSStream srv, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    uint8_t bin[2 + JNL_MAXRECORD];
+    char    json[STREAM_MAXJSON];
+    int     binLen = 0, jsonLen = 0;
+    int     iX;
+
+    if((NULL == srv) || !srv->running) return;
+
+    pthread_mutex_lock(&srv->lock);
+    srv->seq++;
+    srv->published++;
+    if(srv->clientCount == 0) {
+        pthread_mutex_unlock(&srv->lock);
+        return;
+    }
+
+    //encoded once per format
+    if(srv->formats[STREAM_BINARY] > 0) {
+        binLen = Jnl_EncodeReading(bin+2, srv->seq, meter, data);
+        PutU16(bin, (uint16_t)binLen);
+        binLen += 2;
+    }
+    if(srv->formats[STREAM_JSON] > 0)
+        jsonLen = Stream_EncodeJSON(json, sizeof(json), srv->seq, meter, data);
+
+    for(iX=0; iX<srv->clientCount; iX++) {
+        pecwMBUSStreamClient c = &srv->clients[iX];
+        const void *p   = (c->format == STREAM_JSON) ? (const void *)json : (const void *)bin;
+        int         len = (c->format == STREAM_JSON) ? jsonLen : binLen;
+
+        if((len <= 0) || (c->queueLen + len > STREAM_QUEUESIZE)) {
+            c->dropped++;
+            srv->dropped++;
+            continue;
+        }
+        memcpy(c->queue + c->queueLen, p, len);
+        c->queueLen += len;
+        c->queued++;
+    }
+    Wake(srv);
+    pthread_mutex_unlock(&srv->lock);
+}
+
+//readings queued for all subscribers and readings dropped so far
+void Stream_GetQueue(pecwMBUSStream srv, unsigned long *queued, unsigned long *dropped) {
+    int iX;
+
+    *queued = *dropped = 0;
+    if((NULL == srv) || !srv->running) return;
+    pthread_mutex_lock(&srv->lock);
+    for(iX=0; iX<srv->clientCount; iX++)
+        *queued += srv->clients[iX].queued + srv->clients[iX].sending;
+    *dropped = srv->dropped;
+    pthread_mutex_unlock(&srv->lock);
+}
+
+void Stream_PrintStats(pecwMBUSStream srv) {
+    int iX;
+
+    if((NULL == srv) || !srv->running) return;
+    pthread_mutex_lock(&srv->lock);
+    printf("Stream readings      : %lu published, %lu dropped, %d subscribers (%lu accepted)\n",
+           srv->published, srv->dropped, srv->clientCount, srv->accepted);
+    printf("Stream writes        : %lu (%.1f readings/write)\n", srv->writes,
+           (srv->writes > 0) ? (double)srv->sent/srv->writes : 0.0);
+    for(iX=0; iX<srv->clientCount; iX++)
+        printf("  #%d %s: %lu sent, %lu dropped, %lu bytes queued\n", iX+1,
+               (srv->clients[iX].format == STREAM_JSON) ? "json  " : "binary", srv->clients[iX].sent,
+               srv->clients[iX].dropped, (unsigned long)(srv->clients[iX].queueLen + srv->clients[iX].sendLen - srv->clients[iX].sendPos));
+    pthread_mutex_unlock(&srv->lock);
+}
+
+void Stream_Close(pecwMBUSStream srv) {
+    int iX;
+
+    if(NULL == srv) return;
+    if(srv->running) {
+        pthread_mutex_lock(&srv->lock);
+        srv->stop = true;
+        srv->wakePending = false;
+        Wake(srv);
+        pthread_mutex_unlock(&srv->lock);
+        pthread_join(srv->thread, NULL);
+        srv->running = false;
+    }
+    while(srv->clientCount > 0)
+        CloseClient(srv, srv->clientCount-1);
+    for(iX=0; iX<srv->listenCount; iX++) {
+        close(srv->listen[iX].fd);
+        if(0 != srv->listen[iX].path[0]) unlink(srv->listen[iX].path);
+    }
+    srv->listenCount = 0;
+    if(srv->wake[0] >= 0) close(srv->wake[0]);
+    if(srv->wake[1] >= 0) close(srv->wake[1]);
+    srv->wake[0] = srv->wake[1] = -1;
+    pthread_mutex_destroy(&srv->lock);
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusfwd.h>
+#include <wmbus/wmbusagg.h>
+
+// testagg - the aggregator hands every telegram on once, the best copy wins
+//
+// The local stick and two forwarders report the same telegrams. gw2 hears
+// them best, but every fourth it has no key for and sends raw, with the
+// payload still encrypted, then the decoded copy of gw1 has to win. A few
+// telegrams only gw2 hears go on as its raw copy. After the window gw1
+// sends all of them again, as after a reconnect, and none may be handed on
+// twice. Telegrams still in their window when the aggregator is closed are
+// handed on by Agg_Close; their access numbers repeat those of the first
+// telegrams, 256 seconds later.
+
+#define TEST_TELEGRAMS  200
+#define TEST_RAWONLY    20          // heard by gw2 only
+#define TEST_LATE       50          // submitted right before Agg_Close
+#define TEST_ALL        (TEST_TELEGRAMS + TEST_RAWONLY + TEST_LATE)
+#define TEST_WINDOW     1000        // ms, long enough for both forwarders
+#define TEST_WAIT       10          // s, for the aggregator to read a resend
+
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static int             Handled[TEST_ALL];
+static unsigned long   Total, WrongCopy, Disorder;
+static long            Last = -1;
+
+static void Fail(const char *info) {
+    printf("testagg: %s\ntestagg: FAILED\n", info);
+    exit(1);
+}
+
+//n is the reception time, a raw copy has the payload as the stick of a gateway without the key got it
+static void Telegram(ecwMBUSMeter *meter, ecMBUSData *data, int n, int8_t rssi, bool raw) {
+    int iX;
+
+    memset(meter, 0, sizeof(ecwMBUSMeter));
+    memset(data,  0, sizeof(ecMBUSData));
+    meter->manufacturerID = 0x18c4;
+    meter->ident          = 0x12345678;
+    meter->type           = METER_WATER;
+    meter->version        = 1;
+    data->time            = 1700000000 + n;
+    data->value           = n;
+    data->exp             = -3;
+    data->accNo           = (uint8_t) n;
+    data->rssiDBm         = rssi;
+    data->status          = 0x10;
+    data->pktInfo         = raw ? PACKET_DECRYPTIONERROR : PACKET_WAS_ENCRYPTED;
+    data->payloadLength   = 32;
+    for(iX=0; iX<data->payloadLength; iX++)
+        data->payload[iX] = raw ? (uint8_t)(n*7 + iX*13 + 0x5a) : (uint8_t)(n + iX);
+    if(raw) data->value = 0;
+}
+
+static const char *Winner(int n, int *flags) {
+    *flags = 0;
+    if(n >= TEST_TELEGRAMS + TEST_RAWONLY) return AGG_LOCAL;
+    if(n >= TEST_TELEGRAMS) {
+        *flags = FWD_UNREGISTERED;
+        return "gw2";
+    }
+    return (0 == n % 4) ? "gw1" : "gw2";
+}
+
+static void Handler(void *ctx, const char *gateway, int flags, const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    int n = (int)(data->time - 1700000000), want;
+
+    pthread_mutex_lock(&Lock);
+    Total++;
+    if((n < 0) || (n >= TEST_ALL)) WrongCopy++;
+    else {
+        Handled[n]++;
+        if((0 != strcmp(gateway, Winner(n, &want))) || (flags != want)) WrongCopy++;
+        else if(!(flags & FWD_UNREGISTERED) && (data->value != (uint32_t)n)) WrongCopy++;
+    }
+    if(n <= Last) Disorder++;
+    Last = n;
+    pthread_mutex_unlock(&Lock);
+}
+
+//a port nobody listens on, the aggregator takes no port 0
+static int FreePort(void) {
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+    int                fd, port = -1;
+
+    if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if((0 == bind(fd, (struct sockaddr *)&addr, sizeof(addr))) && (0 == getsockname(fd, (struct sockaddr *)&addr, &len)))
+        port = ntohs(addr.sin_port);
+    close(fd);
+    return port;
+}
+
+//gw2 has no key for every fourth telegram and hears the raw-only ones
+static void Send(pecwMBUSFwd fwd, int8_t rssi, bool gw2) {
+    ecwMBUSMeter meter;
+    ecMBUSData   data;
+    int          iX;
+    bool         raw;
+
+    for(iX=0; iX<(gw2 ? TEST_TELEGRAMS + TEST_RAWONLY : TEST_TELEGRAMS); iX++) {
+        raw = gw2 && ((0 == iX % 4) || (iX >= TEST_TELEGRAMS));
+        Telegram(&meter, &data, iX, rssi, raw);
+        Fwd_Write(fwd, &meter, &data, raw ? FWD_UNREGISTERED : 0);
+    }
+    Fwd_Flush(fwd, 0);
+}
+
+//the readings the aggregator got from a gateway so far
+static unsigned long Readings(pecwMBUSAgg agg, const char *id) {
+    unsigned long n = 0;
+    int           iX;
+
+    pthread_mutex_lock(&agg->lock);
+    for(iX=0; iX<agg->gatewayCount; iX++)
+        if(0 == strcmp(agg->gateways[iX].id, id)) n = agg->gateways[iX].readings;
+    pthread_mutex_unlock(&agg->lock);
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    static ecwMBUSAgg agg;
+    ecwMBUSFwd        gw1, gw2;
+    ecwMBUSMeter      meter;
+    ecMBUSData        data;
+    char              spec[64];
+    unsigned long     once = 0, afterWindow, unique, duplicates = 0;
+    int               port, iX, failed = 0;
+
+    if((port = FreePort()) <= 0) Fail("no free port");
+    snprintf(spec, sizeof(spec), "127.0.0.1:%d", port);
+    if(APIOK != Agg_Open(&agg, spec, TEST_WINDOW, Handler, NULL)) Fail("Agg_Open failed");
+    snprintf(spec, sizeof(spec), "127.0.0.1:%d/gw1", port);
+    if(APIOK != Fwd_Open(&gw1, spec)) Fail("Fwd_Open gw1 failed");
+    snprintf(spec, sizeof(spec), "127.0.0.1:%d/gw2", port);
+    if(APIOK != Fwd_Open(&gw2, spec)) Fail("Fwd_Open gw2 failed");
+
+    for(iX=0; iX<TEST_TELEGRAMS; iX++) {
+        Telegram(&meter, &data, iX, -90, false);
+        Agg_Submit(&agg, &meter, &data);
+    }
+    Send(&gw1, -70, false);
+    Send(&gw2, -40, true);
+
+    //all windows closed, then the resend of gw1
+    usleep(2*TEST_WINDOW*1000);
+    pthread_mutex_lock(&Lock);
+    afterWindow = Total;
+    pthread_mutex_unlock(&Lock);
+    Send(&gw1, -30, false);
+    for(iX=0; (iX<TEST_WAIT*100) && (Readings(&agg, "gw1") < 2*TEST_TELEGRAMS); iX++)
+        usleep(10000);
+
+    for(iX=TEST_TELEGRAMS+TEST_RAWONLY; iX<TEST_ALL; iX++) {
+        Telegram(&meter, &data, iX, -90, false);
+        Agg_Submit(&agg, &meter, &data);
+    }
+    Fwd_Stop(&gw1);
+    Fwd_Stop(&gw2);
+    unique = agg.unique;
+    for(iX=0; iX<agg.gatewayCount; iX++)
+        duplicates += agg.gateways[iX].duplicates;
+    Agg_Close(&agg);
+    Fwd_Close(&gw1);
+    Fwd_Close(&gw2);
+
+    for(iX=0; iX<TEST_ALL; iX++)
+        if(1 == Handled[iX]) once++;
+    printf("testagg: %lu unique, %lu duplicates, %lu handed on (%lu after the window), %lu once, %lu wrong copy, %lu out of order\n",
+           unique, duplicates, Total, afterWindow, once, WrongCopy, Disorder);
+    if((unique != TEST_ALL) || (duplicates != 3*TEST_TELEGRAMS)) failed++;
+    if((afterWindow != TEST_TELEGRAMS + TEST_RAWONLY) || (Total != TEST_ALL) || (once != Total)) failed++;
+    if((0 != WrongCopy) || (0 != Disorder)) failed++;
+    printf("testagg: %s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <pty.h>
+#include <sys/ioctl.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusdash.h>
+
+// testdash - a redraw writes only the cells that changed
+//
+// The dashboard is shown on a pseudo terminal of 120x30. The first draw
+// paints the screen, drawing it again within the same second writes
+// nothing, one new reading rewrites a part of its row only and a flood of
+// readings between two draws costs less than painting the screen.
+
+#define TEST_METERS     8
+#define TEST_READINGS   100000
+#define TEST_ROWBYTES   120         // one changed row may not cost more than its width
+
+static int Master = -1;
+
+//the terminal side, ends when the last slave is closed
+static void *Drain(void *arg) {
+    char buf[4096];
+
+    while(read(Master, buf, sizeof(buf)) > 0)
+        ;
+    return NULL;
+}
+
+static void Meter(ecwMBUSMeter *meter, int iX) {
+    memset(meter, 0, sizeof(ecwMBUSMeter));
+    meter->manufacturerID = 0x18c4;
+    meter->ident          = 0x12345670 + iX;
+    meter->type           = METER_WATER;
+    meter->version        = 1;
+}
+
+static void Reading(ecMBUSData *data, uint32_t n) {
+    memset(data, 0, sizeof(ecMBUSData));
+    data->time    = (uint32_t) time(NULL);
+    data->value   = 1000 + n;
+    data->exp     = -3;
+    data->accNo   = (uint8_t) n;
+    data->rssiDBm = -60;
+    data->pktInfo = PACKET_WAS_NOT_ENCRYPTED;
+}
+
+//the bytes one draw wrote, started right after a full second so the clock stays the same
+static unsigned long Draw(pecwMBUSDash dash, const ecwMBUSMeter *meters, bool sync) {
+    unsigned long before = dash->bytes;
+    time_t        t = time(NULL);
+
+    while(sync && (time(NULL) == t))
+        usleep(1000);
+    Dash_Draw(dash, meters, TEST_METERS);
+    return dash->bytes - before;
+}
+
+int main(int argc, char *argv[]) {
+    static ecwMBUSDash dash;
+    ecwMBUSMeter   meters[TEST_METERS];
+    ecMBUSData     data;
+    struct winsize ws = { 30, 120, 0, 0 };
+    pthread_t      drain;
+    unsigned long  full, again, one, flood;
+    int            slave, out, iX, failed = 0;
+
+    if((0 != openpty(&Master, &slave, NULL, NULL, &ws)) || ((out = dup(STDOUT_FILENO)) < 0)) {
+        printf("testdash: no pseudo terminal\ntestdash: FAILED\n");
+        return 1;
+    }
+    pthread_create(&drain, NULL, Drain, NULL);
+    fflush(stdout);
+    dup2(slave, STDOUT_FILENO);
+
+    for(iX=0; iX<TEST_METERS; iX++)
+        Meter(&meters[iX], iX);
+    Dash_Init(&dash, "testdash");
+    if(APIOK != Dash_Show(&dash, true)) failed++;
+
+    //within one second nothing on the screen changes
+    Draw(&dash, meters, true);
+    full  = dash.bytes;
+    again = Draw(&dash, meters, false);
+
+    //one reading of a meter seen before, so the age and rate columns stay as they are
+    Reading(&data, 1);
+    Dash_Update(&dash, 3, &meters[3], &data);
+    Draw(&dash, meters, true);
+    Reading(&data, 2);
+    Dash_Update(&dash, 3, &meters[3], &data);
+    one = Draw(&dash, meters, false);
+
+    for(iX=0; iX<TEST_READINGS; iX++) {
+        Reading(&data, iX);
+        Dash_Update(&dash, iX % TEST_METERS, &meters[iX % TEST_METERS], &data);
+    }
+    flood = Draw(&dash, meters, false);
+
+    Dash_Free(&dash);
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+    close(slave);
+    pthread_join(drain, NULL);
+    close(Master);
+
+    printf("testdash: first draw %lu bytes, unchanged %lu, one reading %lu, %d readings %lu\n", full, again, one, TEST_READINGS, flood);
+    if((0 == full) || (0 != again)) failed++;
+    if((0 == one) || (one > TEST_ROWBYTES)) failed++;
+    if(flood >= full) failed++;
+    printf("testdash: %s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusfmt.h>
+
+// testfmt - the Fmt_ formatters against printf and known texts
+//
+// Fmt_Value must print every digit the meter sent, so a value is checked
+// against the exact decimal text and not against a rounded float.
+
+static int Failed = 0;
+
+static void Expect(const char *what, const char *buf, int len, const char *want) {
+    if((len != (int)strlen(want)) || (0 != memcmp(buf, want, len))) {
+        printf("testfmt: %s gave >%.*s<, want >%s<\n", what, len, buf, want);
+        Failed++;
+    }
+}
+
+static void TestValue(void) {
+    static const struct { uint32_t value; int8_t exp; const char *text; } cases[] = {
+        { 0,          0,  "0"            },
+        { 0,          2,  "0"            },
+        { 0,         -3,  "0.000"        },
+        { 125,       -1,  "12.5"         },
+        { 1234,      -3,  "1.234"        },
+        { 5,         -3,  "0.005"        },
+        { 12345,     -5,  "0.12345"      },
+        { 12345,      2,  "1234500"      },
+        { 4294967295u,-6, "4294.967295"  },
+        { 4294967295u, 0, "4294967295"   },
+        { 100,       -2,  "1.00"         },
+    };
+    char   buf[FMT_MAXVALUE];
+    size_t iX;
+
+    for(iX=0; iX<sizeof(cases)/sizeof(cases[0]); iX++)
+        Expect("Fmt_Value", buf, Fmt_Value(buf, cases[iX].value, cases[iX].exp), cases[iX].text);
+}
+
+static void TestDecimal(void) {
+    static const struct { int64_t value; int8_t exp; const char *text; } cases[] = {
+        { -1234,                -3, "-1.234"                  },
+        { -5,                   -3, "-0.005"                  },
+        { -7,                    1, "-70"                     },
+        { 4950,                 -5, "0.04950"                 },
+        { INT64_MAX,             0, "9223372036854775807"     },
+        { INT64_MIN,            -4, "-922337203685477.5808"   },
+        { 1,                   -16, "0.0000000000000001"      },
+    };
+    char   buf[FMT_MAXVALUE];
+    size_t iX;
+
+    for(iX=0; iX<sizeof(cases)/sizeof(cases[0]); iX++)
+        Expect("Fmt_Decimal", buf, Fmt_Decimal(buf, cases[iX].value, cases[iX].exp), cases[iX].text);
+}
+
+//the integer and hex helpers against printf over the edges and a spread of values
+static void TestIntegers(void) {
+    char     buf[32], want[32];
+    uint64_t v;
+    int      iX;
+
+    for(iX=0; iX<64; iX++) {
+        v = ((uint64_t)1 << iX) - 1;
+        snprintf(want, sizeof(want), "%llu", (unsigned long long)v);
+        Expect("Fmt_U64", buf, Fmt_U64(buf, v), want);
+        snprintf(want, sizeof(want), "%d", (int32_t)(uint32_t)v);
+        Expect("Fmt_I32", buf, Fmt_I32(buf, (int32_t)(uint32_t)v), want);
+        snprintf(want, sizeof(want), "%08x", (uint32_t)(v * 2654435761u));
+        Expect("Fmt_Hex", buf, Fmt_Hex(buf, (uint32_t)(v * 2654435761u), 8), want);
+    }
+    Expect("Fmt_I32", buf, Fmt_I32(buf, INT32_MIN), "-2147483648");
+    Expect("Fmt_Hex", buf, Fmt_Hex(buf, 0x18c4, 4), "18c4");
+    Expect("Fmt_Hex", buf, Fmt_Hex(buf, 0x7, 1), "7");
+}
+
+static void TestHexBytes(void) {
+    static const uint8_t data[] = { 0x00, 0x2c, 0x44, 0xa5, 0xff };
+    char buf[2*sizeof(data)];
+
+    Expect("Fmt_HexBytes", buf, Fmt_HexBytes(buf, data, sizeof(data)), "002c44a5ff");
+    Expect("Fmt_HexBytesUpper", buf, Fmt_HexBytesUpper(buf, data, sizeof(data)), "002C44A5FF");
+}
+
+static void TestDates(void) {
+    struct tm tm;
+    char      buf[FMT_MAXDATE+8];
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = 2015 - 1900;
+    tm.tm_mon  = 0;
+    tm.tm_mday = 2;
+    tm.tm_hour = 9;
+    tm.tm_min  = 5;
+    tm.tm_sec  = 7;
+    Expect("Fmt_Date ISO", buf, Fmt_Date(buf, &tm, FMT_DATE_ISO), "2015-01-02 09:05");
+    Expect("Fmt_Date DMY", buf, Fmt_Date(buf, &tm, FMT_DATE_DMY), "02.01.2015 09:05:07");
+    Expect("Fmt_IsoTime", buf, Fmt_IsoTime(buf, 1420106400), "2015-01-01T10:00:00Z");
+}
+
+int main(int argc, char *argv[]) {
+    TestValue();
+    TestDecimal();
+    TestIntegers();
+    TestHexBytes();
+    TestDates();
+    printf("testfmt: %s\n", Failed ? "FAILED" : "ok");
+    return Failed ? 1 : 0;
+}
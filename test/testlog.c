@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbuslog.h>
+
+// testlog - every message of the log ring is written or counted as dropped
+//
+// Several threads write numbered messages to a file target in bursts that
+// fill the ring. The file must have each thread's messages in
+// the order they were written, and the written messages and the drop notes
+// must add up to what the threads sent. Disabled levels write nothing and
+// the newlines at the end of a message do not add empty lines.
+
+#define TEST_THREADS    4
+#define TEST_MESSAGES   10000
+#define TEST_BURST      100
+
+static char Path[_MAX_PATH];
+
+static void *Writer(void *arg) {
+    int id = (int)(intptr_t)arg;
+    int iX;
+
+    for(iX=0; iX<TEST_MESSAGES; iX++) {
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_INFO, "writer %d message %d", id, iX);
+        Log_Printf(LOGCAT_OUTPUT, LOGLVL_DEBUG, "writer %d disabled %d", id, iX);
+        if(0 == iX % TEST_BURST) usleep(LOG_IDLEUS); //the ring drains between the bursts and runs full in them
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t     threads[TEST_THREADS];
+    char          line[LOG_MSGSIZE + 64];
+    long          next[TEST_THREADS];
+    unsigned long written = 0, notes = 0, dropped, disorder = 0, trimmed = 0, other = 0;
+    FILE         *f;
+    int           iX, id, n, failed = 0;
+
+    snprintf(Path, sizeof(Path), "/tmp/testlog.%d", (int)getpid());
+    unlink(Path);
+    Log_SetLevel(LOGCAT_OUTPUT, LOGLVL_INFO);
+    if(APIOK != Log_Start(Path)) {
+        printf("testlog: cannot open %s\ntestlog: FAILED\n", Path);
+        return 1;
+    }
+    Log_Printf(LOGCAT_MAIN, LOGLVL_ERROR, "trailing newlines\n\n");
+    for(iX=0; iX<TEST_THREADS; iX++)
+        pthread_create(&threads[iX], NULL, Writer, (void *)(intptr_t)iX);
+    for(iX=0; iX<TEST_THREADS; iX++)
+        pthread_join(threads[iX], NULL);
+    dropped = Log_GetDropped();
+    Log_Stop();
+
+    if(NULL == (f = fopen(Path, "r"))) {
+        printf("testlog: %s not written\ntestlog: FAILED\n", Path);
+        return 1;
+    }
+    for(iX=0; iX<TEST_THREADS; iX++)
+        next[iX] = -1;
+    while(NULL != fgets(line, sizeof(line), f)) {
+        const char *text = strstr(line, "writer ");
+        const char *note = strstr(line, " log messages dropped");
+
+        if((NULL != text) && (2 == sscanf(text, "writer %d message %d", &id, &n)) && (id >= 0) && (id < TEST_THREADS)) {
+            if(n <= next[id]) disorder++;
+            next[id] = n;
+            written++;
+        }
+        else if(NULL != note) {
+            while((note > line) && (' ' != note[-1])) note--;
+            notes += strtoul(note, NULL, 10);
+        }
+        else if(NULL != strstr(line, " trailing newlines\n"))
+            trimmed++;
+        else
+            other++;
+    }
+    fclose(f);
+    unlink(Path);
+
+    printf("testlog: %lu written, %lu dropped, %lu in the drop notes, %lu out of order, %lu unexpected lines\n",
+           written, dropped, notes, disorder, other);
+    if(written + dropped != (unsigned long)TEST_THREADS*TEST_MESSAGES) failed++;
+    if((notes != dropped) || (0 != disorder) || (1 != trimmed) || (0 != other)) failed++;
+    printf("testlog: %s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
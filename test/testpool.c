@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbuspool.h>
+#include <wmbus/wmbussink.h>
+
+// testpool - the reading pool stops allocating once it has seen the longest backlog
+//
+// Every thread takes readings like Sink_Dispatch does, one reference for
+// each of TEST_SINKS queues, keeps up to TEST_BACKLOG of them and lets the
+// queues release them in turns. After a warm-up to the full backlog the
+// allocation count of the pool must not move, every reading must come
+// back and none may be changed while it is still held.
+//
+// Then the readings go the way Deliver in eccwmbus.c sends them: one
+// pooled copy for the file sink and the fan-out of the outputs. Each
+// reading must cost one Pool_Get and, once the pool holds the full queues
+// of all sinks, no allocation.
+
+#define TEST_THREADS    4
+#define TEST_SINKS      3
+#define TEST_BACKLOG    500
+#define TEST_ROUNDS     400
+#define TEST_OUTPUTS    3
+#define TEST_DEPTH      256
+#define TEST_DELIVER    100000
+#define TEST_HELD       ((1 + TEST_OUTPUTS) * (TEST_DEPTH + 1))
+
+static unsigned long Corrupt[TEST_THREADS];
+
+static void Fill(ecwMBUSMeter *meter, ecMBUSData *data, uint32_t n) {
+    memset(meter, 0, sizeof(ecwMBUSMeter));
+    memset(data,  0, sizeof(ecMBUSData));
+    meter->manufacturerID = 0x18c4;
+    meter->ident          = n;
+    data->value           = n;
+    data->accNo           = (uint8_t) n;
+}
+
+//takes the whole backlog with a reference per sink, then the sinks release it
+static void Round(int id, uint32_t base) {
+    pecwMBUSReading held[TEST_BACKLOG];
+    ecwMBUSMeter    meter;
+    ecMBUSData      data;
+    int             iX, iS;
+
+    for(iX=0; iX<TEST_BACKLOG; iX++) {
+        Fill(&meter, &data, base + iX);
+        held[iX] = Pool_Get(&meter, &data);
+        for(iS=1; (NULL != held[iX]) && (iS<TEST_SINKS); iS++)
+            Pool_Hold(held[iX]);
+    }
+    for(iS=0; iS<TEST_SINKS; iS++) {
+        for(iX=0; iX<TEST_BACKLOG; iX++) {
+            if(NULL == held[iX]) {
+                Corrupt[id]++;
+                continue;
+            }
+            if((held[iX]->meter.ident != base + iX) || (held[iX]->data.value != base + iX))
+                Corrupt[id]++;
+            Pool_Release(held[iX]);
+        }
+    }
+}
+
+static void *Worker(void *arg) {
+    int id = (int)(intptr_t)arg;
+    int iR;
+
+    for(iR=0; iR<TEST_ROUNDS; iR++)
+        Round(id, ((uint32_t)id << 24) + iR*TEST_BACKLOG);
+    return NULL;
+}
+
+//the backlog of all threads at once, the largest pool the run can need
+static void WarmUp(void) {
+    static pecwMBUSReading held[TEST_THREADS*TEST_BACKLOG];
+    ecwMBUSMeter           meter;
+    ecMBUSData             data;
+    int                    iX;
+
+    for(iX=0; iX<TEST_THREADS*TEST_BACKLOG; iX++) {
+        Fill(&meter, &data, iX);
+        held[iX] = Pool_Get(&meter, &data);
+    }
+    for(iX=0; iX<TEST_THREADS*TEST_BACKLOG; iX++)
+        Pool_Release(held[iX]);
+}
+
+static int Write(void *ctx, const ecwMBUSMeter *meter, const ecMBUSData *data, uint64_t tag) {
+    unsigned long *corrupt = (unsigned long *) ctx;
+
+    if(meter->ident != data->value) (*corrupt)++;
+    return APIOK;
+}
+
+//the file sink and the outputs, as Deliver feeds them; false on a failure
+static bool DeliverPath(void) {
+    static ecwMBUSSink sinks[1 + TEST_OUTPUTS];
+    static unsigned long corrupt[1 + TEST_OUTPUTS];
+    static pecwMBUSReading held[TEST_HELD];
+    ecwMBUSSinkPolicy  policy;
+    ecwMBUSFanout      outputs;
+    ecwMBUSPoolStats   warm, done;
+    ecwMBUSMeter       meter;
+    ecMBUSData         data;
+    pecwMBUSReading    reading;
+    unsigned long      written = 0, bad = 0;
+    int                iX;
+
+    memset(&policy, 0, sizeof(policy));
+    memset(&outputs, 0, sizeof(outputs));
+    policy.policy = SINK_BLOCK;
+    policy.depth  = TEST_DEPTH;
+    for(iX=0; iX<1+TEST_OUTPUTS; iX++) {
+        if(APIOK != Sink_Open(&sinks[iX], (0 == iX) ? "file" : "output", -1, &policy, Write, NULL, &corrupt[iX])) {
+            printf("testpool: cannot open the sinks\n");
+            return false;
+        }
+        if(iX > 0) Sink_Add(&outputs, &sinks[iX]);
+    }
+
+    //as many readings as every queue full and one in each writer
+    for(iX=0; iX<TEST_HELD; iX++) {
+        Fill(&meter, &data, iX);
+        held[iX] = Pool_Get(&meter, &data);
+    }
+    for(iX=0; iX<TEST_HELD; iX++)
+        Pool_Release(held[iX]);
+    Pool_GetStats(&warm);
+    for(iX=0; iX<TEST_DELIVER; iX++) {
+        Fill(&meter, &data, iX);
+        reading = Pool_Get(&meter, &data);
+        Sink_PutReading(&sinks[0], reading, iX);
+        Sink_DispatchReading(&outputs, reading, 0);
+        if(NULL != reading) Pool_Release(reading);
+    }
+    for(iX=0; iX<1+TEST_OUTPUTS; iX++) {
+        Sink_Close(&sinks[iX]);
+        written += sinks[iX].stats.written;
+        bad     += corrupt[iX];
+    }
+    Pool_GetStats(&done);
+
+    printf("testpool: deliver %d readings to %d sinks, %lu gets, %lu allocations, %lu written, %lu in use, %lu corrupt\n",
+           TEST_DELIVER, 1+TEST_OUTPUTS, done.gets - warm.gets, done.allocations - warm.allocations, written, done.inUse, bad);
+    return (done.gets - warm.gets == TEST_DELIVER) && (done.allocations == warm.allocations) &&
+           (written == (unsigned long)(1+TEST_OUTPUTS)*TEST_DELIVER) && (0 == done.inUse) && (0 == bad);
+}
+
+int main(int argc, char *argv[]) {
+    ecwMBUSPoolStats warm, done;
+    unsigned long    corrupt = 0;
+    pthread_t        threads[TEST_THREADS];
+    int              iX, failed = 0;
+
+    WarmUp();
+    Pool_GetStats(&warm);
+    for(iX=0; iX<TEST_THREADS; iX++)
+        pthread_create(&threads[iX], NULL, Worker, (void *)(intptr_t)iX);
+    for(iX=0; iX<TEST_THREADS; iX++)
+        pthread_join(threads[iX], NULL);
+    Pool_GetStats(&done);
+    for(iX=0; iX<TEST_THREADS; iX++)
+        corrupt += Corrupt[iX];
+
+    printf("testpool: %lu readings after warm-up, %lu gets, %lu allocations after warm-up, %lu in use, %lu failed, %lu corrupt\n",
+           warm.size, done.gets - warm.gets, done.allocations - warm.allocations, done.inUse, done.failed, corrupt);
+    if(done.allocations != warm.allocations) failed++;
+    if((0 != done.inUse) || (0 != done.failed) || (0 != corrupt)) failed++;
+    if(done.gets - warm.gets != (unsigned long)TEST_THREADS*TEST_ROUNDS*TEST_BACKLOG) failed++;
+    if(!DeliverPath()) failed++;
+
+    Pool_Free();
+    printf("testpool: %s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusshm.h>
+
+// testshm - latest value table under concurrent writers and readers
+//
+// One thread updates the slots like the receiving thread, another clears
+// them like the main thread does for removed meters, the readers map the
+// file on their own and check every snapshot: a reading is the same number
+// in ident, value, time and payload, an empty slot is all zero.
+
+#define TEST_SLOTS      4
+#define TEST_READERS    4
+#define TEST_SECONDS    2
+
+static char              Path[_MAX_PATH];
+static ecwMBUSShm        Table;
+static volatile int      Stop = 0;
+static unsigned long     Reads[TEST_READERS], Empty[TEST_READERS], Busy[TEST_READERS], Torn[TEST_READERS];
+
+void ErrorAndExit(const char *info) {
+    fprintf(stderr, "%s", info);
+    exit(1);
+}
+
+static void Fill(ecwMBUSMeter *meter, ecMBUSData *data, uint32_t n) {
+    memset(meter, 0, sizeof(ecwMBUSMeter));
+    memset(data,  0, sizeof(ecMBUSData));
+    meter->manufacturerID = 0x18c4;
+    meter->ident          = n;
+    data->value           = n;
+    data->time            = n;
+    data->payloadLength   = sizeof(data->payload) - 1;
+    memset(data->payload, (uint8_t)n, sizeof(data->payload));
+}
+
+static bool Consistent(const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    size_t iX;
+
+    if((meter->ident != data->value) || (data->value != data->time)) return false;
+    for(iX=0; iX<sizeof(data->payload); iX++)
+        if(data->payload[iX] != (uint8_t)data->value) return false;
+    return true;
+}
+
+static bool Zero(const ecwMBUSMeter *meter, const ecMBUSData *data) {
+    static const ecMBUSData zero;
+    return (0 == meter->ident) && (0 == memcmp(data, &zero, sizeof(ecMBUSData)));
+}
+
+static void *Writer(void *arg) {
+    ecwMBUSMeter meter;
+    ecMBUSData   data;
+    uint32_t     n = 1;
+
+    while(!Stop) {
+        Fill(&meter, &data, n);
+        Shm_Update(&Table, n % TEST_SLOTS, &meter, &data);
+        n++;
+    }
+    return NULL;
+}
+
+static void *Clearer(void *arg) {
+    int n = 0;
+
+    while(!Stop)
+        Shm_Clear(&Table, n++ % TEST_SLOTS);
+    return NULL;
+}
+
+static void *Reader(void *arg) {
+    int          id = (int)(intptr_t)arg;
+    ecwMBUSShm   shm;
+    ecwMBUSMeter meter;
+    ecMBUSData   data;
+    int          n = 0, ret;
+
+    if(Shm_Attach(&shm, Path) != APIOK) {
+        Torn[id]++;
+        return NULL;
+    }
+    while(!Stop) {
+        ret = Shm_Read(&shm, n++ % TEST_SLOTS, &meter, &data, NULL);
+        Reads[id]++;
+        if(SHM_BUSY == ret)                              Busy[id]++;
+        else if(SHM_EMPTY == ret) {
+            Empty[id]++;
+            if(!Zero(&meter, &data))                     Torn[id]++;
+        }
+        else if((APIOK != ret) || !Consistent(&meter, &data)) Torn[id]++;
+    }
+    Shm_Close(&shm);
+    return NULL;
+}
+
+//a table left by a previous run is taken over with all slots empty
+static int TestStale(void) {
+    ecwMBUSMeter meter;
+    ecMBUSData   data;
+    int          iX, failed = 0;
+
+    if(Shm_Create(&Table, Path) != APIOK) return 1;
+    for(iX=0; iX<TEST_SLOTS; iX++) {
+        Fill(&meter, &data, iX+1);
+        Shm_Update(&Table, iX, &meter, &data);
+    }
+    Shm_Close(&Table);
+
+    if(Shm_Create(&Table, Path) != APIOK) return 1;
+    for(iX=0; iX<MAXMETER; iX++)
+        if(Shm_Read(&Table, iX, &meter, &data, NULL) != SHM_EMPTY) failed++;
+    Shm_Close(&Table);
+    printf("testshm: stale slots after restart: %d\n", failed);
+    return (failed > 0) ? 1 : 0;
+}
+
+static int TestConcurrent(void) {
+    pthread_t     writer, clearer, readers[TEST_READERS];
+    unsigned long reads = 0, empty = 0, busy = 0, torn = 0;
+    int           iX;
+
+    if(Shm_Create(&Table, Path) != APIOK) return 1;
+    pthread_create(&writer,  NULL, Writer,  NULL);
+    pthread_create(&clearer, NULL, Clearer, NULL);
+    for(iX=0; iX<TEST_READERS; iX++)
+        pthread_create(&readers[iX], NULL, Reader, (void *)(intptr_t)iX);
+    sleep(TEST_SECONDS);
+    Stop = 1;
+    pthread_join(writer,  NULL);
+    pthread_join(clearer, NULL);
+    for(iX=0; iX<TEST_READERS; iX++) {
+        pthread_join(readers[iX], NULL);
+        reads += Reads[iX];
+        empty += Empty[iX];
+        busy  += Busy[iX];
+        torn  += Torn[iX];
+    }
+    Shm_Close(&Table);
+    printf("testshm: %lu reads, %lu empty, %lu busy, %lu torn\n", reads, empty, busy, torn);
+    return ((torn > 0) || (reads == 0)) ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    int failed;
+
+    snprintf(Path, sizeof(Path), "/tmp/testshm.%d", (int)getpid());
+    failed = TestStale() + TestConcurrent();
+    unlink(Path);
+    printf("testshm: %s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <wmbus/eccwmbus.h>
+#include <wmbus/wmbusext.h>
+#include <wmbus/wmbusspool.h>
+
+// testspool - records prepended to the spool are read first, also after a restart
+//
+// The outputs put their memory queue in front of the spool when they stop,
+// it is older than the spooled records. This is checked for an empty
+// spool, for one whose records have to move and for one with room below
+// head after a commit, each time read back before and after reopening.
+
+#define TEST_NEW        100
+#define TEST_OLD        50
+#define TEST_OLDER      10
+
+typedef struct _PART {
+    const char *prefix;
+    int         from;
+    int         to;
+} Part;
+
+static char Path[_MAX_PATH];
+static int  Failed = 0;
+
+static int Prepend(pecwMBUSSpool spool, const char *prefix, int count) {
+    static char text[TEST_OLD][32];
+    const void *data[TEST_OLD];
+    size_t      len[TEST_OLD];
+    int         iX;
+
+    for(iX=0; iX<count; iX++) {
+        len[iX]  = snprintf(text[iX], sizeof(text[iX]), "%s %d", prefix, iX);
+        data[iX] = text[iX];
+    }
+    return Spool_Prepend(spool, data, len, count);
+}
+
+static void Push(pecwMBUSSpool spool, const char *prefix, int count) {
+    char text[32];
+    int  iX;
+
+    for(iX=0; iX<count; iX++)
+        Spool_Push(spool, text, snprintf(text, sizeof(text), "%s %d", prefix, iX));
+}
+
+static void Take(pecwMBUSSpool spool, int count) {
+    char   text[SPOOL_MAXRECORD];
+    size_t len;
+    int    iX;
+
+    Spool_Rewind(spool);
+    for(iX=0; iX<count; iX++)
+        Spool_Read(spool, text, sizeof(text), &len);
+    Spool_Commit(spool, count);
+}
+
+//every record of the spool, in the order of parts
+static void Expect(pecwMBUSSpool spool, const char *what, const Part *parts, int count) {
+    char   text[SPOOL_MAXRECORD], want[32];
+    size_t len;
+    int    iP, iX;
+
+    Spool_Rewind(spool);
+    for(iP=0; iP<count; iP++) {
+        for(iX=parts[iP].from; iX<parts[iP].to; iX++) {
+            snprintf(want, sizeof(want), "%s %d", parts[iP].prefix, iX);
+            if((APIOK != Spool_Read(spool, text, sizeof(text), &len)) || (len != strlen(want)) || (0 != memcmp(text, want, len))) {
+                printf("testspool: %s: >%s< missing or out of order\n", what, want);
+                Failed++;
+                return;
+            }
+        }
+    }
+    if(SPOOL_EMPTY != Spool_Read(spool, text, sizeof(text), &len)) {
+        printf("testspool: %s: more records than expected\n", what);
+        Failed++;
+    }
+}
+
+static void Reopen(pecwMBUSSpool spool) {
+    Spool_Close(spool);
+    if(APIOK != Spool_Open(spool, Path, SPOOL_DEFAULTMAX)) {
+        printf("testspool: cannot open %s again\ntestspool: FAILED\n", Path);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static const Part empty[] = { { "old", 0, TEST_OLD } };
+    static const Part moved[] = { { "old", 0, TEST_OLD }, { "new", 0, TEST_NEW } };
+    static const Part below[] = { { "older", 0, TEST_OLDER }, { "old", TEST_OLDER, TEST_OLD }, { "new", 0, TEST_NEW } };
+    ecwMBUSSpool spool;
+    off_t        size;
+
+    snprintf(Path, sizeof(Path), "/tmp/testspool.%d", (int)getpid());
+    unlink(Path);
+    if(APIOK != Spool_Open(&spool, Path, SPOOL_DEFAULTMAX)) {
+        printf("testspool: cannot open %s\ntestspool: FAILED\n", Path);
+        return 1;
+    }
+
+    if(APIOK != Prepend(&spool, "old", TEST_OLD)) Failed++;
+    Expect(&spool, "empty spool", empty, 1);
+    Take(&spool, TEST_OLD);
+
+    //no room below head, the records move behind the prepended ones
+    Push(&spool, "new", TEST_NEW);
+    size = spool.size;
+    spool.maxSize = size; //a spool that cannot take all of them takes none
+    if(APIOK == Prepend(&spool, "lost", TEST_OLD)) Failed++;
+    spool.maxSize = SPOOL_DEFAULTMAX;
+    if((APIOK != Prepend(&spool, "old", TEST_OLD)) || (spool.size <= size)) Failed++;
+    Expect(&spool, "records moved", moved, 2);
+    Reopen(&spool);
+    Expect(&spool, "records moved, reopened", moved, 2);
+
+    //room below head after a commit, the records stay where they are
+    Take(&spool, TEST_OLDER);
+    size = spool.size;
+    if((APIOK != Prepend(&spool, "older", TEST_OLDER)) || (spool.size != size)) Failed++;
+    Expect(&spool, "room below head", below, 3);
+    Reopen(&spool);
+    Expect(&spool, "room below head, reopened", below, 3);
+
+    Spool_Close(&spool);
+    unlink(Path);
+    printf("testspool: %s\n", Failed ? "FAILED" : "ok");
+    return Failed ? 1 : 0;
+}